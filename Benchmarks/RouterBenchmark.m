@@ -0,0 +1,120 @@
+//
+//  RouterBenchmark.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <mach/mach_time.h>
+#import <sysexits.h>
+
+#import "AQHTTPRouter.h"
+#import "AQHTTPResponseOperation.h"
+
+// how many times each request is routed per measurement
+#define RouterBenchmarkIterations   200000
+
+static NSUInteger _handled = 0;
+
+static AQHTTPRouter * _RouterWithRoutes(NSUInteger count, AQHTTPResponseOperation * op)
+{
+    AQHTTPRouteHandler handler = ^AQHTTPResponseOperation *(AQHTTPConnection * connection, CFHTTPMessageRef request, NSDictionary * parameters) {
+        _handled++;
+        return ( op );
+    };
+
+    // a third each of static paths, paths with parameters, and mounts, as a large API might have
+    AQHTTPRouter * router = [AQHTTPRouter new];
+    for ( NSUInteger i = 0; i < count; i++ )
+    {
+        switch ( i % 3 )
+        {
+            case 0:
+                [router addRouteForMethod: @"GET" pattern: [NSString stringWithFormat: @"/static/section%lu/page.html", (unsigned long)i] handler: handler];
+                break;
+            case 1:
+                [router addRouteForMethod: @"GET" pattern: [NSString stringWithFormat: @"/api/v1/resource%lu/:id/items/:item", (unsigned long)i] handler: handler];
+                break;
+            default:
+                [router mountHandler: handler atPrefix: [NSString stringWithFormat: @"/files/volume%lu", (unsigned long)i]];
+                break;
+        }
+    }
+
+#if USING_MRR
+    return ( [router autorelease] );
+#else
+    return ( router );
+#endif
+}
+
+static CFHTTPMessageRef _CreateRequest(NSString * path)
+{
+    NSURL * url = [NSURL URLWithString: [@"http://localhost" stringByAppendingString: path]];
+    return ( CFHTTPMessageCreateRequest(kCFAllocatorDefault, CFSTR("GET"), (__bridge CFURLRef)url, kCFHTTPVersion1_1) );
+}
+
+// returns the average time to route the request, in nanoseconds
+static double _TimeRouting(AQHTTPRouter * router, NSString * path)
+{
+    CFHTTPMessageRef request = _CreateRequest(path);
+    NSUInteger handled = _handled;
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    uint64_t start = mach_absolute_time();
+    for ( NSUInteger i = 0; i < RouterBenchmarkIterations; i += 1000 )
+    {
+        @autoreleasepool
+        {
+            for ( NSUInteger j = 0; j < 1000; j++ )
+                [router responseOperationForRequest: request connection: nil];
+        }
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    CFRelease(request);
+
+    if ( _handled - handled != RouterBenchmarkIterations )
+    {
+        fprintf(stderr, "%s was not routed to its handler\n", [path UTF8String]);
+        exit(EX_SOFTWARE);
+    }
+
+    return ( (double)elapsed * timebase.numer / timebase.denom / RouterBenchmarkIterations );
+}
+
+int main(int argc, const char * argv[])
+{
+    @autoreleasepool
+    {
+        CFHTTPMessageRef request = _CreateRequest(@"/");
+        AQHTTPResponseOperation * op = [[AQHTTPResponseOperation alloc] initWithRequest: request socket: nil ranges: nil forConnection: nil];
+        CFRelease(request);
+
+        NSUInteger counts[] = { 12, 1200, 12000 };
+        printf("%8s  %12s  %12s  %12s\n", "routes", "static", "parameters", "mount");
+        for ( size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++ )
+        {
+            @autoreleasepool
+            {
+                // the last route of each kind, so every lookup passes the most siblings
+                NSUInteger count = counts[i];
+                AQHTTPRouter * router = _RouterWithRoutes(count, op);
+                double staticTime = _TimeRouting(router, [NSString stringWithFormat: @"/static/section%lu/page.html", (unsigned long)(count - 3)]);
+                double parameterTime = _TimeRouting(router, [NSString stringWithFormat: @"/api/v1/resource%lu/12345/items/abcdef", (unsigned long)(count - 2)]);
+                double mountTime = _TimeRouting(router, [NSString stringWithFormat: @"/files/volume%lu/some/nested/file.txt", (unsigned long)(count - 1)]);
+                printf("%8lu  %10.0fns  %10.0fns  %10.0fns\n", (unsigned long)count, staticTime, parameterTime, mountTime);
+            }
+        }
+
+#if USING_MRR
+        [op release];
+#endif
+    }
+
+    return ( EX_OK );
+}
@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Fetches a page's worth of small assets over loopback, first with HTTP/2
+# (cleartext, by prior knowledge) and then with HTTP/1.1, using h2load. HTTP/2
+# multiplexes many streams on each connection, so it should complete the same
+# requests on far fewer connections without being held up behind any one of
+# them. Also checks that both prior knowledge and `Upgrade: h2c` negotiate
+# HTTP/2.
+#
+# Tunables: REQUESTS, CLIENTS, STREAMS (concurrent streams per connection).
+
+source "$(dirname "$0")/../Tests/common.sh"
+require h2load curl lsof
+
+REQUESTS=${REQUESTS:-50000}
+CLIENTS=${CLIENTS:-4}
+STREAMS=${STREAMS:-32}
+ASSETS=64
+
+for i in $(seq $ASSETS); do
+    make_file "$WORK_DIR/root/assets/$i.css" 4096
+done
+
+start_server --address localhost --webroot "$WORK_DIR/root"
+BASE="http://127.0.0.1:$SERVER_PORT"
+
+version=$(curl -s -o /dev/null -w '%{http_version}' --http2-prior-knowledge "$BASE/assets/1.css")
+[ "$version" = 2 ] || fail "prior-knowledge request used HTTP/$version"
+version=$(curl -s -o /dev/null -w '%{http_version}' --http2 "$BASE/assets/1.css")
+[ "$version" = 2 ] || fail "h2c upgrade request used HTTP/$version"
+
+urls=()
+for i in $(seq $ASSETS); do
+    urls+=("$BASE/assets/$i.css")
+done
+
+run()
+{
+    local label=$1
+    shift
+    h2load -n "$REQUESTS" -c "$CLIENTS" "$@" "${urls[@]}" >"$WORK_DIR/h2load.out"
+    grep -q "^requests: .* 0 failed, 0 errored" "$WORK_DIR/h2load.out" || fail "$label: $(grep '^requests:' "$WORK_DIR/h2load.out")"
+    echo "$label:"
+    grep -E '^(finished in|requests:|time for request:)' "$WORK_DIR/h2load.out" | sed 's/^/    /'
+}
+
+run "HTTP/2, $CLIENTS connections x $STREAMS streams" -m "$STREAMS"
+run "HTTP/1.1, $CLIENTS connections" --h1
+run "HTTP/1.1, $((CLIENTS * STREAMS)) connections" --h1 -c "$((CLIENTS * STREAMS))"
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Measures the latency of small requests while bulk downloads saturate the
+# server's outgoing bandwidth, limited with --rate-limit to stand in for the
+# uplink. The bandwidth scheduler serves small responses ahead of large ones
+# and shares the rest fairly, so small-request p99 under load should stay
+# close to its p99 on an idle server rather than queueing behind the
+# downloads. Both are reported.
+#
+# Tunables: RATE_LIMIT, BULK_CLIENTS, PROBES (small requests per measurement).
+
+source "$(dirname "$0")/../Tests/common.sh"
+require curl lsof
+
+RATE_LIMIT=${RATE_LIMIT:-20M}
+BULK_CLIENTS=${BULK_CLIENTS:-8}
+PROBES=${PROBES:-1000}
+
+make_file "$WORK_DIR/root/small.css" 16384
+make_file "$WORK_DIR/root/bulk.bin" $((256 * 1024 * 1024))
+
+start_server --address localhost --webroot "$WORK_DIR/root" --rate-limit "$RATE_LIMIT"
+URL="http://127.0.0.1:$SERVER_PORT"
+
+# the query makes each request distinct to curl, and is ignored by the server
+probe()
+{
+    curl -s --fail -o /dev/null -w '%{http_code} %{time_total}\n' "$URL/small.css?[1-$PROBES]" >"$WORK_DIR/probe.out" || fail "$1: small requests failed"
+    ! grep -qv '^200 ' "$WORK_DIR/probe.out" || fail "$1: small requests failed"
+    printf '%-32s p50 %7.1fms  p99 %7.1fms  max %7.1fms\n' "$1:" \
+        "$(cut -d' ' -f2 "$WORK_DIR/probe.out" | percentile 50 | awk '{ print $1 * 1000 }')" \
+        "$(cut -d' ' -f2 "$WORK_DIR/probe.out" | percentile 99 | awk '{ print $1 * 1000 }')" \
+        "$(cut -d' ' -f2 "$WORK_DIR/probe.out" | percentile 100 | awk '{ print $1 * 1000 }')"
+}
+
+probe "idle"
+
+bulk=()
+for i in $(seq "$BULK_CLIENTS"); do
+    curl -s -o /dev/null "$URL/bulk.bin" &
+    bulk+=($!)
+done
+sleep 2
+
+probe "$BULK_CLIENTS bulk downloads at $RATE_LIMIT/s"
+
+kill "${bulk[@]}" 2>/dev/null || true
+wait "${bulk[@]}" 2>/dev/null || true
@@ -0,0 +1,23 @@
+#!/bin/bash
+#
+# Builds RouterBenchmark.m against the server's sources and runs it. It times
+# routing static paths, paths with parameters, and mounted prefixes through
+# routers of increasingly many routes; a radix tree should take about as long
+# to route a path whatever the number of routes.
+
+source "$(dirname "$0")/../Tests/common.sh"
+require clang
+
+SRC_DIR="$ROOT_DIR/SimpleHTTPServer"
+sources=()
+for file in "$SRC_DIR"/*.m "$SRC_DIR"/AQSocket/*.m; do
+    [ "$(basename "$file")" = main.m ] || sources+=("$file")
+done
+
+clang -O2 -fobjc-arc -mmacosx-version-min=10.7 -include "$SRC_DIR/SimpleHTTPServer-Prefix.pch" \
+    -I "$SRC_DIR" -I "$SRC_DIR/AQSocket" \
+    "$ROOT_DIR/Benchmarks/RouterBenchmark.m" "${sources[@]}" \
+    -framework Foundation -framework CoreServices -framework Security -lz \
+    -o "$WORK_DIR/RouterBenchmark"
+
+"$WORK_DIR/RouterBenchmark"
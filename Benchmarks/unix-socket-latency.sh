@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Compares request latency over a Unix-domain socket with that over loopback
+# TCP, as a reverse proxy on the same host would see it. One server listens
+# on both, and the same small file is requested over each, first on a single
+# kept-alive connection and then with a new connection for every request,
+# where TCP's handshake and ephemeral ports cost the most.
+#
+# Tunables: REQUESTS (per measurement).
+
+source "$(dirname "$0")/../Tests/common.sh"
+require curl lsof
+
+REQUESTS=${REQUESTS:-2000}
+SOCKET="$WORK_DIR/server.sock"
+
+make_file "$WORK_DIR/root/small.css" 2048
+
+start_server --address localhost --unix-socket "$SOCKET" --webroot "$WORK_DIR/root"
+for i in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+[ -S "$SOCKET" ] || fail "the server did not create $SOCKET"
+
+# measure LABEL CURL-ARGS...: requests the file REQUESTS times, and reports the latencies in microseconds
+measure()
+{
+    local label=$1
+    shift
+    # the query makes each request distinct to curl, and is ignored by the server
+    curl -s --fail -o /dev/null -w '%{http_code} %{time_total}\n' "$@" "http://127.0.0.1:$SERVER_PORT/small.css?[1-$REQUESTS]" >"$WORK_DIR/measure.out" || fail "$label: requests failed"
+    ! grep -qv '^200 ' "$WORK_DIR/measure.out" || fail "$label: requests failed"
+    printf '%-36s p50 %7.0fus  p99 %7.0fus\n' "$label:" \
+        "$(cut -d' ' -f2 "$WORK_DIR/measure.out" | percentile 50 | awk '{ print $1 * 1000000 }')" \
+        "$(cut -d' ' -f2 "$WORK_DIR/measure.out" | percentile 99 | awk '{ print $1 * 1000000 }')"
+}
+
+measure "TCP, kept-alive connection"
+measure "Unix socket, kept-alive connection" --unix-socket "$SOCKET"
+measure "TCP, connection per request" -H 'Connection: close'
+measure "Unix socket, connection per request" --unix-socket "$SOCKET" -H 'Connection: close'
@@ -0,0 +1,60 @@
+//
+//  AQHTTPContentBundleWriter.h
+//  SimpleHTTPBundleBuilder
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Packs the contents of a folder into a single content bundle file, suitable
+ for serving with AQHTTPBundleConnection.
+
+ Every regular, non-hidden file below the source folder becomes one item in the
+ bundle, addressed by its path relative to that folder. The Etag, MIME type and
+ modification date of each item are computed once, here, and stored in the
+ bundle's index so that the server never needs to touch the file system.
+ */
+@interface AQHTTPContentBundleWriter : NSObject
+
+/**
+ Initializes a new bundle writer.
+
+ This is the designated initializer for AQHTTPContentBundleWriter.
+ @param sourceURL The URL of the folder whose contents will be packed.
+ @result A new AQHTTPContentBundleWriter instance.
+ */
+- (id) initWithSourceURL: (NSURL *) sourceURL;
+
+/// The folder whose contents will be packed.
+@property (nonatomic, readonly) NSURL * sourceURL;
+
+/**
+ If `YES` (the default), a gzip-compressed variant of each textual item is stored
+ alongside the original whenever doing so saves at least 10% of its size.
+ */
+@property (nonatomic, assign) BOOL storesCompressedVariants;
+
+/**
+ Items smaller than this are never compressed. The default is 256 bytes.
+ */
+@property (nonatomic, assign) UInt64 minimumCompressionSize;
+
+/// The number of items written by the last call to -writeToURL:error:.
+@property (nonatomic, readonly) NSUInteger itemCount;
+
+/**
+ Builds the bundle and writes it to the given location.
+
+ The bundle is written to a temporary file which is then moved into place, so
+ a running server will never observe a partially-written bundle.
+ @param url The location of the bundle file to create.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result Returns YES if the bundle was written, NO otherwise.
+ */
+- (BOOL) writeToURL: (NSURL *) url error: (NSError **) error;
+
+@end
@@ -0,0 +1,460 @@
+//
+//  AQHTTPContentBundleWriter.m
+//  SimpleHTTPBundleBuilder
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPContentBundleWriter.h"
+#import "AQHTTPContentBundleFormat.h"
+#import <CommonCrypto/CommonDigest.h>
+#import <zlib.h>
+#import <fcntl.h>
+
+// for UTTypes API
+#if TARGET_OS_IPHONE
+# import <MobileCoreServices/MobileCoreServices.h>
+#else
+# import <CoreServices/CoreServices.h>
+#endif
+
+@interface _AQBundleWriterItem : NSObject
+@property (nonatomic, strong) NSURL * sourceURL;
+@property (nonatomic, strong) NSData * pathBytes;
+@property (nonatomic, copy) NSString * contentType;
+@property (nonatomic, copy) NSString * etag;
+@property (nonatomic, strong) NSData * compressedData;
+@property (nonatomic, assign) UInt64 size;
+@property (nonatomic, assign) UInt64 modificationTime;
+@end
+
+@implementation _AQBundleWriterItem
+@synthesize sourceURL, pathBytes, contentType, etag, compressedData, size, modificationTime;
+#if USING_MRR
+- (void) dealloc
+{
+    [sourceURL release];
+    [pathBytes release];
+    [contentType release];
+    [etag release];
+    [compressedData release];
+    [super dealloc];
+}
+#endif
+@end
+
+#pragma mark -
+
+static NSString * _ContentTypeForExtension(NSString * extension)
+{
+    CFStringRef uti = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)extension, NULL);
+    NSString * contentType = nil;
+
+    if ( uti != NULL )
+    {
+        contentType = CFBridgingRelease(UTTypeCopyPreferredTagWithClass(uti, kUTTagClassMIMEType));
+        CFRelease(uti);
+    }
+
+    if ( contentType != nil )
+        return ( contentType );
+
+    // the same fallbacks used by AQHTTPResponseOperation
+    if ( [extension isEqualToString: @"svg"] )
+        return ( @"image/svg+xml" );
+    if ( [extension isEqualToString: @"xhtml"] )
+        return ( @"application/xhtml+xml" );
+    if ( [extension isEqualToString: @"html"] )
+        return ( @"text/html" );
+    if ( [extension isEqualToString: @"js"] )
+        return ( @"application/javascript" );
+    if ( [extension isEqualToString: @"css"] )
+        return ( @"text/css" );
+
+    return ( @"application/octet-stream" );
+}
+
+static BOOL _IsCompressibleContentType(NSString * contentType)
+{
+    if ( [contentType hasPrefix: @"text/"] )
+        return ( YES );
+
+    static NSSet * __types = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __types = [[NSSet alloc] initWithObjects: @"application/javascript", @"application/x-javascript", @"application/json",
+                   @"application/xml", @"application/xhtml+xml", @"image/svg+xml", @"application/rss+xml",
+                   @"application/atom+xml", @"application/x-font-ttf", @"application/vnd.ms-fontobject", nil];
+    });
+
+    return ( [__types containsObject: contentType] );
+}
+
+static NSString * _EtagForData(NSData * data)
+{
+    uint8_t md[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([data bytes], (CC_LONG)[data length], md);
+
+    char str[CC_SHA1_DIGEST_LENGTH*2+1];
+    str[CC_SHA1_DIGEST_LENGTH*2] = '\0';
+    for ( int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++ )
+    {
+        sprintf(&str[i*2], "%02x", md[i]);
+    }
+
+    return ( [NSString stringWithUTF8String: str] );
+}
+
+static NSData * _GzipData(NSData * data)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    // 16 added to the window bits selects a gzip wrapper rather than zlib's own
+    if ( deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK )
+        return ( nil );
+
+    NSMutableData * output = [NSMutableData dataWithLength: deflateBound(&zs, (uLong)[data length])];
+    zs.next_in = (Bytef *)[data bytes];
+    zs.avail_in = (uInt)[data length];
+    zs.next_out = [output mutableBytes];
+    zs.avail_out = (uInt)[output length];
+
+    int err = deflate(&zs, Z_FINISH);
+    [output setLength: zs.total_out];
+    deflateEnd(&zs);
+
+    if ( err != Z_STREAM_END )
+        return ( nil );
+
+    return ( output );
+}
+
+static uint64_t _Align(uint64_t value, uint64_t alignment)
+{
+    return ( (value + alignment - 1) & ~(alignment - 1) );
+}
+
+static BOOL _WriteFully(int fd, const void * bytes, size_t length, off_t offset, NSError ** error)
+{
+    const uint8_t * p = bytes;
+    while ( length != 0 )
+    {
+        ssize_t written = pwrite(fd, p, length, offset);
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( error != NULL )
+                *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+            return ( NO );
+        }
+
+        p += written;
+        offset += written;
+        length -= written;
+    }
+
+    return ( YES );
+}
+
+#pragma mark -
+
+@implementation AQHTTPContentBundleWriter
+{
+    NSURL * _sourceURL;
+    NSUInteger _itemCount;
+}
+
+@synthesize sourceURL=_sourceURL, storesCompressedVariants, minimumCompressionSize, itemCount=_itemCount;
+
+- (id) initWithSourceURL: (NSURL *) sourceURL
+{
+    NSParameterAssert([sourceURL isFileURL]);
+
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _sourceURL = [[sourceURL URLByResolvingSymlinksInPath] copy];
+    self.storesCompressedVariants = YES;
+    self.minimumCompressionSize = 256;
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_sourceURL release];
+    [super dealloc];
+}
+#endif
+
+- (NSArray *) _collectItems: (NSError **) error
+{
+    NSArray * keys = [NSArray arrayWithObjects: NSURLIsRegularFileKey, NSURLFileSizeKey, NSURLContentModificationDateKey, nil];
+    __block NSError * enumerationError = nil;
+    NSDirectoryEnumerator * dirEnum = [[NSFileManager defaultManager] enumeratorAtURL: _sourceURL
+                                                           includingPropertiesForKeys: keys
+                                                                              options: NSDirectoryEnumerationSkipsHiddenFiles
+                                                                         errorHandler: ^BOOL(NSURL *url, NSError *err) {
+#if USING_MRR
+                                                                             enumerationError = [err retain];
+#else
+                                                                             enumerationError = err;
+#endif
+                                                                             return ( NO );
+                                                                         }];
+
+    NSString * rootPath = [_sourceURL path];
+    NSMutableArray * items = [NSMutableArray array];
+
+    for ( NSURL * url in dirEnum )
+    {
+        @autoreleasepool
+        {
+            NSNumber * isRegular = nil;
+            [url getResourceValue: &isRegular forKey: NSURLIsRegularFileKey error: NULL];
+            if ( [isRegular boolValue] == NO )
+                continue;
+
+            NSString * fullPath = [[url URLByResolvingSymlinksInPath] path];
+            if ( [fullPath hasPrefix: rootPath] == NO )
+                continue;       // a symlink pointing outside the source folder
+
+            NSString * relativePath = [fullPath substringFromIndex: [rootPath length]];
+            if ( [relativePath hasPrefix: @"/"] == NO )
+                relativePath = [@"/" stringByAppendingString: relativePath];
+
+            NSNumber * size = nil;
+            NSDate * modDate = nil;
+            [url getResourceValue: &size forKey: NSURLFileSizeKey error: NULL];
+            [url getResourceValue: &modDate forKey: NSURLContentModificationDateKey error: NULL];
+
+            _AQBundleWriterItem * item = [_AQBundleWriterItem new];
+            item.sourceURL = url;
+            item.pathBytes = [relativePath dataUsingEncoding: NSUTF8StringEncoding];
+            item.contentType = _ContentTypeForExtension([relativePath pathExtension]);
+            item.size = [size unsignedLongLongValue];
+            item.modificationTime = (UInt64)[modDate timeIntervalSince1970];
+            [items addObject: item];
+#if USING_MRR
+            [item release];
+#endif
+        }
+    }
+
+    if ( enumerationError != nil )
+    {
+        if ( error != NULL )
+            *error = enumerationError;
+#if USING_MRR
+        [enumerationError autorelease];
+#endif
+        return ( nil );
+    }
+
+    // the server looks up paths by binary search using memcmp(), so we sort the same way
+    [items sortUsingComparator: ^NSComparisonResult(id obj1, id obj2) {
+        NSData * p1 = [obj1 pathBytes];
+        NSData * p2 = [obj2 pathBytes];
+        int cmp = memcmp([p1 bytes], [p2 bytes], MIN([p1 length], [p2 length]));
+        if ( cmp == 0 )
+            return ( [p1 length] < [p2 length] ? NSOrderedAscending : ([p1 length] > [p2 length] ? NSOrderedDescending : NSOrderedSame) );
+        return ( cmp < 0 ? NSOrderedAscending : NSOrderedDescending );
+    }];
+
+    return ( items );
+}
+
+- (BOOL) _computeDigestsForItem: (_AQBundleWriterItem *) item error: (NSError **) error
+{
+    NSData * contents = [NSData dataWithContentsOfURL: item.sourceURL options: NSDataReadingMappedIfSafe error: error];
+    if ( contents == nil )
+        return ( NO );
+
+    // the file may have changed since we enumerated it; believe what we actually read
+    item.size = [contents length];
+    item.etag = _EtagForData(contents);
+
+    if ( self.storesCompressedVariants && item.size >= self.minimumCompressionSize && _IsCompressibleContentType(item.contentType) )
+    {
+        NSData * compressed = _GzipData(contents);
+        if ( compressed != nil && [compressed length] < (item.size / 10) * 9 )
+            item.compressedData = compressed;
+    }
+
+    return ( YES );
+}
+
+- (BOOL) writeToURL: (NSURL *) url error: (NSError **) error
+{
+    NSArray * items = [self _collectItems: error];
+    if ( items == nil )
+        return ( NO );
+
+    for ( _AQBundleWriterItem * item in items )
+    {
+        @autoreleasepool
+        {
+            if ( [self _computeDigestsForItem: item error: error] == NO )
+                return ( NO );
+        }
+    }
+
+    if ( [items count] > UINT32_MAX )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: EFBIG userInfo: nil];
+        return ( NO );
+    }
+
+    // build the string table: MIME types are shared between entries, everything else is unique
+    NSMutableData * strings = [NSMutableData data];
+    NSMutableDictionary * typeOffsets = [NSMutableDictionary dictionary];
+    NSMutableData * index = [NSMutableData dataWithLength: [items count] * sizeof(AQHTTPContentBundleEntry)];
+    AQHTTPContentBundleEntry * entries = [index mutableBytes];
+
+    uint64_t indexOffset = _Align(sizeof(AQHTTPContentBundleHeader), sizeof(uint64_t));
+    uint64_t stringsOffset = indexOffset + [index length];
+
+    [items enumerateObjectsUsingBlock: ^(id obj, NSUInteger idx, BOOL *stop) {
+        _AQBundleWriterItem * item = obj;
+        AQHTTPContentBundleEntry * e = &entries[idx];
+
+        e->pathOffset = CFSwapInt32HostToLittle((uint32_t)[strings length]);
+        e->pathLength = CFSwapInt32HostToLittle((uint32_t)[item.pathBytes length]);
+        [strings appendData: item.pathBytes];
+
+        NSData * typeBytes = [item.contentType dataUsingEncoding: NSUTF8StringEncoding];
+        NSNumber * typeOffset = [typeOffsets objectForKey: item.contentType];
+        if ( typeOffset == nil )
+        {
+            typeOffset = [NSNumber numberWithUnsignedInteger: [strings length]];
+            [typeOffsets setObject: typeOffset forKey: item.contentType];
+            [strings appendData: typeBytes];
+        }
+        e->contentTypeOffset = CFSwapInt32HostToLittle((uint32_t)[typeOffset unsignedIntegerValue]);
+        e->contentTypeLength = CFSwapInt32HostToLittle((uint32_t)[typeBytes length]);
+
+        NSData * etagBytes = [item.etag dataUsingEncoding: NSUTF8StringEncoding];
+        e->etagOffset = CFSwapInt32HostToLittle((uint32_t)[strings length]);
+        e->etagLength = CFSwapInt32HostToLittle((uint32_t)[etagBytes length]);
+        [strings appendData: etagBytes];
+
+        e->modificationTime = CFSwapInt64HostToLittle(item.modificationTime);
+    }];
+
+    // now lay out the blobs, each on its own page boundary
+    uint64_t dataOffset = _Align(stringsOffset + [strings length], AQHTTPContentBundleBlobAlignment);
+    uint64_t offset = dataOffset;
+    for ( NSUInteger i = 0; i < [items count]; i++ )
+    {
+        _AQBundleWriterItem * item = [items objectAtIndex: i];
+        AQHTTPContentBundleEntry * e = &entries[i];
+
+        e->dataOffset = CFSwapInt64HostToLittle(offset);
+        e->dataLength = CFSwapInt64HostToLittle(item.size);
+        offset = _Align(offset + item.size, AQHTTPContentBundleBlobAlignment);
+
+        if ( item.compressedData != nil )
+        {
+            e->flags = CFSwapInt32HostToLittle(AQHTTPContentBundleEntryFlagCompressed);
+            e->gzipOffset = CFSwapInt64HostToLittle(offset);
+            e->gzipLength = CFSwapInt64HostToLittle([item.compressedData length]);
+            offset = _Align(offset + [item.compressedData length], AQHTTPContentBundleBlobAlignment);
+        }
+    }
+
+    AQHTTPContentBundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AQHTTPContentBundleMagic, sizeof(header.magic));
+    header.version = CFSwapInt32HostToLittle(AQHTTPContentBundleCurrentVersion);
+    header.entryCount = CFSwapInt32HostToLittle((uint32_t)[items count]);
+    header.indexOffset = CFSwapInt64HostToLittle(indexOffset);
+    header.stringsOffset = CFSwapInt64HostToLittle(stringsOffset);
+    header.stringsLength = CFSwapInt64HostToLittle([strings length]);
+    header.dataOffset = CFSwapInt64HostToLittle(dataOffset);
+    header.fileLength = CFSwapInt64HostToLittle(offset);
+
+    // write everything into a temporary file alongside the destination, then swap it into place
+    NSString * destPath = [[url URLByStandardizingPath] path];
+    NSString * tempPath = [destPath stringByAppendingFormat: @".%d.tmp", getpid()];
+    int fd = open([tempPath fileSystemRepresentation], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if ( fd < 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+        return ( NO );
+    }
+
+    BOOL ok = (_WriteFully(fd, &header, sizeof(header), 0, error) &&
+               _WriteFully(fd, [index bytes], [index length], indexOffset, error) &&
+               _WriteFully(fd, [strings bytes], [strings length], stringsOffset, error));
+
+    for ( NSUInteger i = 0; ok && i < [items count]; i++ )
+    {
+        @autoreleasepool
+        {
+            _AQBundleWriterItem * item = [items objectAtIndex: i];
+            AQHTTPContentBundleEntry * e = &entries[i];
+
+            NSData * contents = [NSData dataWithContentsOfURL: item.sourceURL options: NSDataReadingMappedIfSafe error: error];
+            if ( contents == nil )
+            {
+                ok = NO;
+                break;
+            }
+
+            // the file must not have changed size between the two passes
+            if ( (UInt64)[contents length] != item.size )
+            {
+                if ( error != NULL )
+                    *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: EAGAIN userInfo: nil];
+                ok = NO;
+                break;
+            }
+
+            ok = _WriteFully(fd, [contents bytes], [contents length], (off_t)CFSwapInt64LittleToHost(e->dataOffset), error);
+            if ( ok && item.compressedData != nil )
+                ok = _WriteFully(fd, [item.compressedData bytes], [item.compressedData length], (off_t)CFSwapInt64LittleToHost(e->gzipOffset), error);
+        }
+    }
+
+    // the last blob is padded out to its alignment too
+    if ( ok && ftruncate(fd, (off_t)offset) != 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+        ok = NO;
+    }
+
+    if ( ok && fsync(fd) != 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+        ok = NO;
+    }
+
+    close(fd);
+
+    if ( ok && rename([tempPath fileSystemRepresentation], [destPath fileSystemRepresentation]) != 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+        ok = NO;
+    }
+
+    if ( !ok )
+    {
+        unlink([tempPath fileSystemRepresentation]);
+        return ( NO );
+    }
+
+    _itemCount = [items count];
+    return ( YES );
+}
+
+@end
@@ -0,0 +1,143 @@
+//
+//  main.m
+//  SimpleHTTPBundleBuilder
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <getopt.h>
+#import <sysexits.h>
+
+#import "AQHTTPContentBundleWriter.h"
+
+static const char *gVersionNumber = "1.0";
+
+static const char *		_shortCommandLineArgs = "hvo:nm:";
+static struct option	_longCommandLineArgs[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "version", no_argument, NULL, 'v' },
+    { "output", required_argument, NULL, 'o' },
+    { "no-compress", no_argument, NULL, 'n' },
+    { "min-compress", required_argument, NULL, 'm' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(FILE *fp)
+{
+    NSString * usageStr = [[NSString alloc] initWithFormat: @"Usage: %@ [OPTIONS] -o BUNDLE FOLDER\n"
+                           @"\n"
+                           @"Packs the contents of FOLDER into a content bundle for use with SimpleHTTPServer --bundle.\n"
+                           @"\n"
+                           @"Options:\n"
+                           @"  -h, --help          Display this information.\n"
+                           @"  -v, --version       Display the version number.\n"
+                           @"  -n, --no-compress   Do not store gzip-compressed variants of textual items.\n"
+                           @"  -m, --min-compress  The minimum size of an item to compress, in bytes. Default is 256.\n"
+                           @"\n"
+                           @"Arguments:\n"
+                           @"  -o, --output        The path of the bundle file to create.\n"
+                           @"\n", [[NSProcessInfo processInfo] processName]];
+    fprintf(fp, "%s", [usageStr UTF8String]);
+#if USING_MRR
+    [usageStr release];
+#endif
+    fflush(fp);
+}
+
+static void version(FILE *fp)
+{
+    fprintf(fp, "%s: version %s\n", [[[NSProcessInfo processInfo] processName] UTF8String], gVersionNumber);
+    fflush(fp);
+}
+
+int main(int argc, char * const argv[])
+{
+    @autoreleasepool
+    {
+        int ch = 0;
+        NSString * output = nil;
+        BOOL compress = YES;
+        UInt64 minCompress = 256;
+
+        while ((ch = getopt_long(argc, argv, _shortCommandLineArgs, _longCommandLineArgs, NULL)) != -1)
+        {
+            switch ( ch )
+            {
+                case 'h':
+                    usage(stdout);
+                    exit(EX_OK);
+                    break;
+
+                case 'v':
+                    version(stdout);
+                    exit(EX_OK);
+                    break;
+
+                case 'o':
+                    if (optarg == NULL)
+                    {
+                        usage(stderr);
+                        exit(EX_USAGE);
+                    }
+
+                    output = [NSString stringWithUTF8String: optarg];
+                    break;
+
+                case 'n':
+                    compress = NO;
+                    break;
+
+                case 'm':
+                    if (optarg == NULL)
+                    {
+                        usage(stderr);
+                        exit(EX_USAGE);
+                    }
+
+                    minCompress = strtoull(optarg, NULL, 10);
+                    break;
+
+                default:
+                    usage(stderr);
+                    exit(EX_USAGE);
+                    break;
+            }
+        }
+
+        if ( output == nil || optind != argc - 1 )
+        {
+            fprintf(stderr, "You must specify an output path and a single source folder.\n");
+            usage(stderr);
+            exit(EX_USAGE);
+        }
+
+        NSString * source = [NSString stringWithUTF8String: argv[optind]];
+        BOOL isDir = NO;
+        if ( [[NSFileManager defaultManager] fileExistsAtPath: source isDirectory: &isDir] == NO || isDir == NO )
+        {
+            fprintf(stderr, "%s is not a folder.\n", [source UTF8String]);
+            exit(EX_NOINPUT);
+        }
+
+        AQHTTPContentBundleWriter * writer = [[AQHTTPContentBundleWriter alloc] initWithSourceURL: [NSURL fileURLWithPath: source isDirectory: YES]];
+        writer.storesCompressedVariants = compress;
+        writer.minimumCompressionSize = minCompress;
+
+        NSError * error = nil;
+        if ( [writer writeToURL: [NSURL fileURLWithPath: output] error: &error] == NO )
+        {
+            fprintf(stderr, "Failed to write bundle: %s\n", [[error description] UTF8String]);
+            exit(EX_CANTCREAT);
+        }
+
+        fprintf(stdout, "Wrote %lu items to %s\n", (unsigned long)writer.itemCount, [output UTF8String]);
+
+#if USING_MRR
+        [writer release];
+#endif
+    }
+
+    return ( EX_OK );
+}
@@ -0,0 +1,83 @@
+//
+//  AQHPACK.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ HPACK header compression (RFC 7541), as used by HTTP/2.
+
+ Each direction of an HTTP/2 connection has its own compression context, so a
+ connection keeps one decoder for incoming header blocks and one encoder for
+ outgoing ones. Neither class is thread-safe: header blocks must be processed
+ in the order in which they appear on the connection, which in practice means
+ on the connection's serial queue.
+
+ Headers are represented as an array of two-element arrays, each containing a
+ lowercase header name and its value, in the order they appear in the block.
+ */
+
+/// The default (and initial) size of a dynamic table, as defined by HTTP/2.
+#define AQHPACKDefaultTableSize     4096
+
+@interface AQHPACKDecoder : NSObject
+
+/**
+ Initializes a new decoder.
+
+ This is the designated initializer for AQHPACKDecoder.
+ @param maximumTableSize The largest dynamic table size the remote encoder
+ is permitted to use. This should be the value we advertise in our
+ SETTINGS_HEADER_TABLE_SIZE setting.
+ @result A new AQHPACKDecoder instance.
+ */
+- (id) initWithMaximumTableSize: (NSUInteger) maximumTableSize;
+
+/// The largest dynamic table size the remote encoder is permitted to select.
+@property (nonatomic, readonly) NSUInteger maximumTableSize;
+
+/**
+ The largest decoded header list we will accept, calculated as described for
+ SETTINGS_MAX_HEADER_LIST_SIZE. Defaults to 64KB.
+ */
+@property (nonatomic, assign) NSUInteger maximumHeaderListSize;
+
+/**
+ Decodes a complete header block.
+
+ Any failure here is a COMPRESSION_ERROR: the decoding context is now out of
+ sync with the peer's and the connection must be torn down.
+ @param block A complete header block, i.e. the concatenated fragments from a
+ HEADERS frame and any following CONTINUATION frames.
+ @result An array of name/value pairs, or `nil` if the block could not be decoded.
+ */
+- (NSArray *) decodeHeaderBlock: (NSData *) block;
+
+@end
+
+@interface AQHPACKEncoder : NSObject
+
+/**
+ The dynamic table size used by the encoder. This should be set from the peer's
+ SETTINGS_HEADER_TABLE_SIZE; the encoder will never use more than
+ AQHPACKDefaultTableSize regardless. Any change is signalled to the peer at
+ the start of the next encoded header block.
+ */
+@property (nonatomic, assign) NSUInteger maximumTableSize;
+
+/**
+ Encodes a list of headers into a single header block.
+
+ Header names must already be lowercase. Frequently-repeated headers are
+ added to the dynamic table; headers whose values change on each response
+ (such as Date or Content-Length) are sent without indexing.
+ @param headers An array of name/value pairs.
+ @result A header block ready to be split into HEADERS and CONTINUATION frames.
+ */
+- (NSData *) encodeHeaders: (NSArray *) headers;
+
+@end
@@ -0,0 +1,854 @@
+//
+//  AQHPACK.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHPACK.h"
+
+// RFC 7541, Appendix A
+typedef struct
+{
+    const char * name;
+    const char * value;
+} _AQHPACKStaticEntry;
+
+static const _AQHPACKStaticEntry _AQHPACKStaticTable[] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+#define AQHPACKStaticTableCount     (sizeof(_AQHPACKStaticTable) / sizeof(_AQHPACKStaticTable[0]))
+
+// every dynamic table entry costs 32 octets on top of its name and value
+#define AQHPACKEntryOverhead        32
+
+// RFC 7541, Appendix B: symbols 0-255, plus EOS (256)
+typedef struct
+{
+    uint32_t    code;
+    uint8_t     length;
+} _AQHuffmanCode;
+
+static const _AQHuffmanCode _AQHuffmanCodes[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 }
+};
+
+#pragma mark - Huffman Coding
+
+// A decoding tree for the code above. A full binary tree with 257 leaves has 256 interior nodes.
+// Node zero is the root, so a zero child means 'no such branch'; a negative child is a leaf
+// holding ~symbol.
+static int16_t _AQHuffmanTree[256][2];
+
+static void _AQBuildHuffmanTree(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        int16_t nodeCount = 1;
+        for ( int16_t sym = 0; sym < 257; sym++ )
+        {
+            uint32_t code = _AQHuffmanCodes[sym].code;
+            int16_t node = 0;
+            for ( int i = _AQHuffmanCodes[sym].length - 1; i > 0; i-- )
+            {
+                int bit = (code >> i) & 1;
+                if ( _AQHuffmanTree[node][bit] == 0 )
+                    _AQHuffmanTree[node][bit] = nodeCount++;
+                node = _AQHuffmanTree[node][bit];
+            }
+            
+            _AQHuffmanTree[node][code & 1] = ~sym;
+        }
+    });
+}
+
+static BOOL _AQHuffmanDecode(const uint8_t * p, size_t len, NSMutableData * output)
+{
+    _AQBuildHuffmanTree();
+    
+    int16_t node = 0;
+    NSUInteger pendingBits = 0;
+    BOOL pendingAllOnes = YES;
+    
+    for ( size_t i = 0; i < len; i++ )
+    {
+        for ( int shift = 7; shift >= 0; shift-- )
+        {
+            int bit = (p[i] >> shift) & 1;
+            int16_t next = _AQHuffmanTree[node][bit];
+            if ( next < 0 )
+            {
+                int16_t sym = ~next;
+                if ( sym == 256 )
+                    return ( NO );      // an explicit EOS is a decoding error
+                
+                uint8_t ch = (uint8_t)sym;
+                [output appendBytes: &ch length: 1];
+                node = 0;
+                pendingBits = 0;
+                pendingAllOnes = YES;
+            }
+            else if ( next == 0 )
+            {
+                return ( NO );
+            }
+            else
+            {
+                node = next;
+                pendingBits++;
+                pendingAllOnes = (pendingAllOnes && bit == 1);
+            }
+        }
+    }
+    
+    // any padding must be shorter than a byte, and must be the most-significant bits of EOS (i.e. all ones)
+    return ( pendingBits < 8 && pendingAllOnes );
+}
+
+static NSUInteger _AQHuffmanEncodedLength(const uint8_t * p, size_t len)
+{
+    NSUInteger bits = 0;
+    for ( size_t i = 0; i < len; i++ )
+        bits += _AQHuffmanCodes[p[i]].length;
+    return ( (bits + 7) / 8 );
+}
+
+static void _AQHuffmanEncode(const uint8_t * p, size_t len, NSMutableData * output)
+{
+    uint64_t accumulator = 0;
+    unsigned int numBits = 0;
+    
+    for ( size_t i = 0; i < len; i++ )
+    {
+        const _AQHuffmanCode * code = &_AQHuffmanCodes[p[i]];
+        accumulator = (accumulator << code->length) | code->code;
+        numBits += code->length;
+        
+        while ( numBits >= 8 )
+        {
+            numBits -= 8;
+            uint8_t byte = (uint8_t)(accumulator >> numBits);
+            [output appendBytes: &byte length: 1];
+        }
+    }
+    
+    if ( numBits > 0 )
+    {
+        // pad with the high bits of EOS, which are all ones
+        uint8_t byte = (uint8_t)((accumulator << (8 - numBits)) | (0xff >> numBits));
+        [output appendBytes: &byte length: 1];
+    }
+}
+
+#pragma mark - Primitive Types
+
+static void _AQHPACKAppendInteger(NSMutableData * output, uint8_t flags, unsigned int prefixBits, NSUInteger value)
+{
+    NSUInteger prefixMax = (1u << prefixBits) - 1;
+    if ( value < prefixMax )
+    {
+        uint8_t byte = flags | (uint8_t)value;
+        [output appendBytes: &byte length: 1];
+        return;
+    }
+    
+    uint8_t byte = flags | (uint8_t)prefixMax;
+    [output appendBytes: &byte length: 1];
+    
+    value -= prefixMax;
+    while ( value >= 128 )
+    {
+        byte = (uint8_t)((value % 128) + 128);
+        [output appendBytes: &byte length: 1];
+        value /= 128;
+    }
+    
+    byte = (uint8_t)value;
+    [output appendBytes: &byte length: 1];
+}
+
+static BOOL _AQHPACKDecodeInteger(const uint8_t ** pp, const uint8_t * end, unsigned int prefixBits, NSUInteger * outValue)
+{
+    const uint8_t * p = *pp;
+    if ( p >= end )
+        return ( NO );
+    
+    NSUInteger prefixMax = (1u << prefixBits) - 1;
+    NSUInteger value = *p++ & prefixMax;
+    if ( value == prefixMax )
+    {
+        unsigned int shift = 0;
+        uint8_t byte = 0;
+        do
+        {
+            // nothing we deal with comes anywhere near 2^28, so anything longer is an attack
+            if ( p >= end || shift > 21 )
+                return ( NO );
+            
+            byte = *p++;
+            value += (NSUInteger)(byte & 0x7f) << shift;
+            shift += 7;
+            
+        } while ( (byte & 0x80) != 0 );
+    }
+    
+    *pp = p;
+    *outValue = value;
+    return ( YES );
+}
+
+static NSString * _AQHPACKStringFromOctets(const void * bytes, NSUInteger length)
+{
+    NSString * str = [[NSString alloc] initWithBytes: bytes length: length encoding: NSUTF8StringEncoding];
+    if ( str == nil )
+    {
+        // header values are octets; anything not valid UTF-8 we take as Latin-1, which always succeeds
+        str = [[NSString alloc] initWithBytes: bytes length: length encoding: NSISOLatin1StringEncoding];
+    }
+#if USING_MRR
+    [str autorelease];
+#endif
+    return ( str );
+}
+
+static NSString * _AQHPACKDecodeString(const uint8_t ** pp, const uint8_t * end, NSUInteger * outOctets)
+{
+    const uint8_t * p = *pp;
+    if ( p >= end )
+        return ( nil );
+    
+    BOOL huffman = ((*p & 0x80) != 0);
+    NSUInteger length = 0;
+    if ( _AQHPACKDecodeInteger(&p, end, 7, &length) == NO )
+        return ( nil );
+    if ( length > (NSUInteger)(end - p) )
+        return ( nil );
+    
+    NSString * result = nil;
+    if ( huffman )
+    {
+        NSMutableData * decoded = [[NSMutableData alloc] initWithCapacity: length * 2];
+        if ( _AQHuffmanDecode(p, length, decoded) )
+        {
+            result = _AQHPACKStringFromOctets([decoded bytes], [decoded length]);
+            *outOctets = [decoded length];
+        }
+#if USING_MRR
+        [decoded release];
+#endif
+    }
+    else
+    {
+        result = _AQHPACKStringFromOctets(p, length);
+        *outOctets = length;
+    }
+    
+    *pp = p + length;
+    return ( result );
+}
+
+static void _AQHPACKAppendString(NSMutableData * output, NSString * str)
+{
+    NSData * octets = [str dataUsingEncoding: NSUTF8StringEncoding];
+    NSUInteger huffmanLength = _AQHuffmanEncodedLength([octets bytes], [octets length]);
+    
+    if ( huffmanLength < [octets length] )
+    {
+        _AQHPACKAppendInteger(output, 0x80, 7, huffmanLength);
+        _AQHuffmanEncode([octets bytes], [octets length], output);
+    }
+    else
+    {
+        _AQHPACKAppendInteger(output, 0x00, 7, [octets length]);
+        [output appendData: octets];
+    }
+}
+
+#pragma mark - Header Tables
+
+@interface _AQHPACKTableEntry : NSObject
+{
+@public
+    NSString *  _name;
+    NSString *  _value;
+    NSUInteger  _nameSize;          // octets
+    NSUInteger  _size;              // octets of name and value, plus overhead
+}
+- (id) initWithName: (NSString *) name value: (NSString *) value nameSize: (NSUInteger) nameSize valueSize: (NSUInteger) valueSize;
+@end
+
+@implementation _AQHPACKTableEntry
+
+- (id) initWithName: (NSString *) name value: (NSString *) value nameSize: (NSUInteger) nameSize valueSize: (NSUInteger) valueSize
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+    
+    _name = [name copy];
+    _value = [value copy];
+    _nameSize = nameSize;
+    _size = nameSize + valueSize + AQHPACKEntryOverhead;
+    
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_name release];
+    [_value release];
+    [super dealloc];
+}
+#endif
+
+@end
+
+static NSArray * _AQHPACKStaticEntries(void)
+{
+    static NSArray * __entries = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray * entries = [[NSMutableArray alloc] initWithCapacity: AQHPACKStaticTableCount];
+        for ( NSUInteger i = 0; i < AQHPACKStaticTableCount; i++ )
+        {
+            const _AQHPACKStaticEntry * e = &_AQHPACKStaticTable[i];
+            _AQHPACKTableEntry * entry = [[_AQHPACKTableEntry alloc] initWithName: [NSString stringWithUTF8String: e->name]
+                                                                            value: [NSString stringWithUTF8String: e->value]
+                                                                         nameSize: strlen(e->name)
+                                                                        valueSize: strlen(e->value)];
+            [entries addObject: entry];
+#if USING_MRR
+            [entry release];
+#endif
+        }
+        
+        __entries = [entries copy];
+#if USING_MRR
+        [entries release];
+#endif
+    });
+    
+    return ( __entries );
+}
+
+// maps a header name to the (one-based) index of its first appearance in the static table
+static NSDictionary * _AQHPACKStaticNameIndices(void)
+{
+    static NSDictionary * __indices = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableDictionary * indices = [[NSMutableDictionary alloc] initWithCapacity: AQHPACKStaticTableCount];
+        for ( NSUInteger i = AQHPACKStaticTableCount; i > 0; i-- )
+        {
+            [indices setObject: [NSNumber numberWithUnsignedInteger: i] forKey: [NSString stringWithUTF8String: _AQHPACKStaticTable[i-1].name]];
+        }
+        
+        __indices = [indices copy];
+#if USING_MRR
+        [indices release];
+#endif
+    });
+    
+    return ( __indices );
+}
+
+@interface _AQHPACKDynamicTable : NSObject
+{
+@public
+    NSMutableArray *    _entries;       // newest first
+    NSUInteger          _size;
+    NSUInteger          _maximumSize;
+}
+- (void) setMaximumSize: (NSUInteger) maximumSize;
+- (void) addEntry: (_AQHPACKTableEntry *) entry;
+- (_AQHPACKTableEntry *) entryAtIndex: (NSUInteger) index;     // one-based, across static & dynamic
+@end
+
+@implementation _AQHPACKDynamicTable
+
+- (id) init
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+    
+    _entries = [NSMutableArray new];
+    _maximumSize = AQHPACKDefaultTableSize;
+    
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_entries release];
+    [super dealloc];
+}
+#endif
+
+- (void) _evictToSize: (NSUInteger) size
+{
+    while ( _size > size && [_entries count] != 0 )
+    {
+        _AQHPACKTableEntry * oldest = [_entries lastObject];
+        _size -= oldest->_size;
+        [_entries removeLastObject];
+    }
+}
+
+- (void) setMaximumSize: (NSUInteger) maximumSize
+{
+    _maximumSize = maximumSize;
+    [self _evictToSize: maximumSize];
+}
+
+- (void) addEntry: (_AQHPACKTableEntry *) entry
+{
+    // an entry larger than the table simply empties it
+    if ( entry->_size > _maximumSize )
+    {
+        [_entries removeAllObjects];
+        _size = 0;
+        return;
+    }
+    
+    [self _evictToSize: _maximumSize - entry->_size];
+    [_entries insertObject: entry atIndex: 0];
+    _size += entry->_size;
+}
+
+- (_AQHPACKTableEntry *) entryAtIndex: (NSUInteger) index
+{
+    if ( index == 0 )
+        return ( nil );
+    if ( index <= AQHPACKStaticTableCount )
+        return ( [_AQHPACKStaticEntries() objectAtIndex: index - 1] );
+    
+    index -= AQHPACKStaticTableCount + 1;
+    if ( index >= [_entries count] )
+        return ( nil );
+    
+    return ( [_entries objectAtIndex: index] );
+}
+
+@end
+
+#pragma mark - Decoder
+
+@implementation AQHPACKDecoder
+{
+    _AQHPACKDynamicTable * _table;
+}
+
+@synthesize maximumTableSize=_maximumTableSize, maximumHeaderListSize=_maximumHeaderListSize;
+
+- (id) initWithMaximumTableSize: (NSUInteger) maximumTableSize
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+    
+    _table = [_AQHPACKDynamicTable new];
+    [_table setMaximumSize: maximumTableSize];
+    _maximumTableSize = maximumTableSize;
+    _maximumHeaderListSize = 64 * 1024;
+    
+    return ( self );
+}
+
+- (id) init
+{
+    return ( [self initWithMaximumTableSize: AQHPACKDefaultTableSize] );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_table release];
+    [super dealloc];
+}
+#endif
+
+- (NSArray *) decodeHeaderBlock: (NSData *) block
+{
+    const uint8_t * p = [block bytes];
+    const uint8_t * end = p + [block length];
+    
+    NSMutableArray * headers = [NSMutableArray array];
+    NSUInteger listSize = 0;
+    
+    while ( p < end )
+    {
+        uint8_t first = *p;
+        NSString * name = nil, * value = nil;
+        NSUInteger nameOctets = 0, valueOctets = 0;
+        NSUInteger index = 0;
+        
+        if ( (first & 0x80) != 0 )
+        {
+            // Indexed Header Field
+            if ( _AQHPACKDecodeInteger(&p, end, 7, &index) == NO )
+                return ( nil );
+            
+            _AQHPACKTableEntry * entry = [_table entryAtIndex: index];
+            if ( entry == nil )
+                return ( nil );
+            
+            [headers addObject: [NSArray arrayWithObjects: entry->_name, entry->_value, nil]];
+            listSize += entry->_size;
+        }
+        else if ( (first & 0xe0) == 0x20 )
+        {
+            // Dynamic Table Size Update: only valid before the first header field
+            if ( [headers count] != 0 )
+                return ( nil );
+            
+            NSUInteger newSize = 0;
+            if ( _AQHPACKDecodeInteger(&p, end, 5, &newSize) == NO || newSize > _maximumTableSize )
+                return ( nil );
+            
+            [_table setMaximumSize: newSize];
+            continue;
+        }
+        else
+        {
+            // Literal Header Field, with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            BOOL addToTable = ((first & 0xc0) == 0x40);
+            if ( _AQHPACKDecodeInteger(&p, end, (addToTable ? 6 : 4), &index) == NO )
+                return ( nil );
+            
+            if ( index != 0 )
+            {
+                _AQHPACKTableEntry * entry = [_table entryAtIndex: index];
+                if ( entry == nil )
+                    return ( nil );
+                
+                name = entry->_name;
+                nameOctets = entry->_nameSize;
+            }
+            else
+            {
+                name = _AQHPACKDecodeString(&p, end, &nameOctets);
+                if ( name == nil )
+                    return ( nil );
+            }
+            
+            value = _AQHPACKDecodeString(&p, end, &valueOctets);
+            if ( value == nil )
+                return ( nil );
+            
+            if ( addToTable )
+            {
+                _AQHPACKTableEntry * entry = [[_AQHPACKTableEntry alloc] initWithName: name value: value nameSize: nameOctets valueSize: valueOctets];
+                [_table addEntry: entry];
+#if USING_MRR
+                [entry release];
+#endif
+            }
+            
+            [headers addObject: [NSArray arrayWithObjects: name, value, nil]];
+            listSize += nameOctets + valueOctets + AQHPACKEntryOverhead;
+        }
+        
+        if ( listSize > _maximumHeaderListSize )
+            return ( nil );
+    }
+    
+    return ( headers );
+}
+
+@end
+
+#pragma mark - Encoder
+
+typedef enum
+{
+    AQHPACKIndexIncrementally,
+    AQHPACKDoNotIndex,
+    AQHPACKNeverIndex
+    
+} AQHPACKIndexing;
+
+static AQHPACKIndexing _AQHPACKIndexingForHeader(NSString * name)
+{
+    static NSSet * __volatileHeaders = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // these change with nearly every response, so they'd only push useful entries out of the table
+        __volatileHeaders = [[NSSet alloc] initWithObjects: @"date", @"content-length", @"content-range", @"etag", @"last-modified", @"location", nil];
+    });
+    
+    if ( [name isEqualToString: @"set-cookie"] )
+        return ( AQHPACKNeverIndex );
+    if ( [__volatileHeaders containsObject: name] )
+        return ( AQHPACKDoNotIndex );
+    return ( AQHPACKIndexIncrementally );
+}
+
+@implementation AQHPACKEncoder
+{
+    _AQHPACKDynamicTable * _table;
+    BOOL _sizeUpdatePending;
+}
+
+- (id) init
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+    
+    _table = [_AQHPACKDynamicTable new];
+    
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_table release];
+    [super dealloc];
+}
+#endif
+
+- (NSUInteger) maximumTableSize
+{
+    return ( _table->_maximumSize );
+}
+
+- (void) setMaximumTableSize: (NSUInteger) maximumTableSize
+{
+    maximumTableSize = MIN(maximumTableSize, (NSUInteger)AQHPACKDefaultTableSize);
+    if ( maximumTableSize == _table->_maximumSize )
+        return;
+    
+    [_table setMaximumSize: maximumTableSize];
+    _sizeUpdatePending = YES;
+}
+
+// returns a one-based index for an exact match, or for a name-only match if *exact is set to NO on return
+- (NSUInteger) _indexOfName: (NSString *) name value: (NSString *) value exact: (BOOL *) exact
+{
+    NSUInteger nameIndex = 0;
+    *exact = NO;
+    
+    NSNumber * staticIndex = [_AQHPACKStaticNameIndices() objectForKey: name];
+    if ( staticIndex != nil )
+    {
+        // entries sharing a name are contiguous in the static table
+        nameIndex = [staticIndex unsignedIntegerValue];
+        for ( NSUInteger i = nameIndex; i <= AQHPACKStaticTableCount && strcmp(_AQHPACKStaticTable[i-1].name, _AQHPACKStaticTable[nameIndex-1].name) == 0; i++ )
+        {
+            _AQHPACKTableEntry * entry = [_AQHPACKStaticEntries() objectAtIndex: i-1];
+            if ( [entry->_value isEqualToString: value] )
+            {
+                *exact = YES;
+                return ( i );
+            }
+        }
+    }
+    
+    NSUInteger i = AQHPACKStaticTableCount + 1;
+    for ( _AQHPACKTableEntry * entry in _table->_entries )
+    {
+        if ( [entry->_name isEqualToString: name] )
+        {
+            if ( [entry->_value isEqualToString: value] )
+            {
+                *exact = YES;
+                return ( i );
+            }
+            
+            if ( nameIndex == 0 )
+                nameIndex = i;
+        }
+        
+        i++;
+    }
+    
+    return ( nameIndex );
+}
+
+- (NSData *) encodeHeaders: (NSArray *) headers
+{
+    NSMutableData * output = [NSMutableData dataWithCapacity: [headers count] * 16];
+    
+    if ( _sizeUpdatePending )
+    {
+        _AQHPACKAppendInteger(output, 0x20, 5, _table->_maximumSize);
+        _sizeUpdatePending = NO;
+    }
+    
+    for ( NSArray * pair in headers )
+    {
+        NSString * name = [pair objectAtIndex: 0];
+        NSString * value = [pair objectAtIndex: 1];
+        
+        BOOL exact = NO;
+        NSUInteger index = [self _indexOfName: name value: value exact: &exact];
+        if ( exact )
+        {
+            _AQHPACKAppendInteger(output, 0x80, 7, index);
+            continue;
+        }
+        
+        AQHPACKIndexing indexing = _AQHPACKIndexingForHeader(name);
+        switch ( indexing )
+        {
+            case AQHPACKIndexIncrementally:
+                _AQHPACKAppendInteger(output, 0x40, 6, index);
+                break;
+            case AQHPACKDoNotIndex:
+                _AQHPACKAppendInteger(output, 0x00, 4, index);
+                break;
+            case AQHPACKNeverIndex:
+                _AQHPACKAppendInteger(output, 0x10, 4, index);
+                break;
+        }
+        
+        if ( index == 0 )
+            _AQHPACKAppendString(output, name);
+        _AQHPACKAppendString(output, value);
+        
+        if ( indexing == AQHPACKIndexIncrementally )
+        {
+            _AQHPACKTableEntry * entry = [[_AQHPACKTableEntry alloc] initWithName: name value: value
+                                                                         nameSize: [name lengthOfBytesUsingEncoding: NSUTF8StringEncoding]
+                                                                        valueSize: [value lengthOfBytesUsingEncoding: NSUTF8StringEncoding]];
+            [_table addEntry: entry];
+#if USING_MRR
+            [entry release];
+#endif
+        }
+    }
+    
+    return ( output );
+}
+
+@end
@@ -0,0 +1,101 @@
+//
+//  AQHTTP2Session.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AQHTTPConnection, AQSocket;
+
+/// The HTTP version given to requests which arrived on an HTTP/2 stream.
+#define AQHTTPVersion2_0    CFSTR("HTTP/2.0")
+
+/**
+ An AQHTTP2Session runs the HTTP/2 framing layer on behalf of a single
+ AQHTTPConnection, once that connection has switched to HTTP/2 either by
+ prior knowledge (the client opened with the HTTP/2 connection preface) or
+ by way of an `Upgrade: h2c` request.
+
+ Each incoming stream is turned into an ordinary CFHTTPMessageRef request and
+ handed to the connection's -responseOperationForRequest: method, so existing
+ AQHTTPResponseOperation subclasses work unchanged. The operation is given a
+ per-stream socket: the serialized response header it writes is re-encoded as
+ a HEADERS frame, and everything after that is sent as DATA frames, subject to
+ the peer's flow-control windows. Ready streams share the connection in
+ round-robin order, one frame at a time, so a large response can't starve
+ the others.
+
+ Operations for different streams run concurrently, on a queue private to
+ the session. All framing state is confined to the session's own serial
+ dispatch queue.
+ */
+@interface AQHTTP2Session : NSObject
+
+/// The 24-octet client connection preface.
++ (NSData *) connectionPreface;
+
+/**
+ Determines whether an HTTP/1.1 request is asking to upgrade to cleartext HTTP/2.
+ @param request A complete HTTP/1.1 request header.
+ @result `YES` if the request carries `Upgrade: h2c` and a single
+ HTTP2-Settings header, both nominated by its Connection header.
+ */
++ (BOOL) isUpgradeRequest: (CFHTTPMessageRef) request;
+
+/**
+ Initializes a new session.
+
+ This is the designated initializer for AQHTTP2Session.
+ @param connection The connection on whose behalf the session will run. This
+ is not retained.
+ @param socket The connection's socket.
+ @result A new AQHTTP2Session instance. It will buffer any incoming data until
+ it is sent -start.
+ */
+- (id) initWithConnection: (AQHTTPConnection *) connection socket: (AQSocket *) socket;
+
+/**
+ Prepares the session to take over from an HTTP/1.1 `Upgrade: h2c` request.
+
+ The request's HTTP2-Settings are applied as though they had arrived in a
+ SETTINGS frame, and the request itself becomes stream 1, whose response will
+ be sent once the session is started.
+ @param request The upgrade request.
+ @result `NO` if the request's HTTP2-Settings header could not be decoded, in
+ which case the upgrade should be ignored and the request answered over HTTP/1.1.
+ */
+- (BOOL) takeUpgradeRequest: (CFHTTPMessageRef) request;
+
+/**
+ Sends the server connection preface and begins processing incoming frames.
+
+ For an upgraded connection, this must only be called once the
+ `101 Switching Protocols` response has been written.
+ */
+- (void) start;
+
+/**
+ Passes newly-arrived bytes from the socket to the session. May be called
+ from any thread.
+ @param data The incoming bytes.
+ */
+- (void) processIncomingData: (NSData *) data;
+
+/**
+ Sends a GOAWAY frame, if possible, and cancels all active streams.
+ */
+- (void) close;
+
+/**
+ Sends a GOAWAY frame so the client opens no new streams, then closes the
+ connection once the active streams have finished.
+ */
+- (void) drain;
+
+/// Returns `YES` if the session currently has no active streams.
+@property (nonatomic, readonly, getter=isIdle) BOOL idle;
+
+@end
@@ -0,0 +1,1623 @@
+//
+//  AQHTTP2Session.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTP2Session.h"
+#import "AQHPACK.h"
+#import "AQHTTPConnection.h"
+#import "AQHTTPConnection_PrivateInternal.h"
+#import "AQHTTPResponseOperation.h"
+#import "AQHTTPRequestBody.h"
+#import "AQHTTPRequestBody_PrivateInternal.h"
+#import "AQSocket.h"
+
+// RFC 7540, section 6
+enum
+{
+    AQHTTP2FrameData            = 0x0,
+    AQHTTP2FrameHeaders         = 0x1,
+    AQHTTP2FramePriority        = 0x2,
+    AQHTTP2FrameRstStream       = 0x3,
+    AQHTTP2FrameSettings        = 0x4,
+    AQHTTP2FramePushPromise     = 0x5,
+    AQHTTP2FramePing            = 0x6,
+    AQHTTP2FrameGoAway          = 0x7,
+    AQHTTP2FrameWindowUpdate    = 0x8,
+    AQHTTP2FrameContinuation    = 0x9
+};
+
+enum
+{
+    AQHTTP2FlagEndStream        = 0x1,
+    AQHTTP2FlagAck              = 0x1,
+    AQHTTP2FlagEndHeaders       = 0x4,
+    AQHTTP2FlagPadded           = 0x8,
+    AQHTTP2FlagPriority         = 0x20
+};
+
+// RFC 7540, section 7
+enum
+{
+    AQHTTP2NoError              = 0x0,
+    AQHTTP2ProtocolError        = 0x1,
+    AQHTTP2InternalError        = 0x2,
+    AQHTTP2FlowControlError     = 0x3,
+    AQHTTP2StreamClosed         = 0x5,
+    AQHTTP2FrameSizeError       = 0x6,
+    AQHTTP2RefusedStream        = 0x7,
+    AQHTTP2Cancel               = 0x8,
+    AQHTTP2CompressionError     = 0x9,
+    AQHTTP2EnhanceYourCalm      = 0xb
+};
+
+// RFC 7540, section 6.5.2
+enum
+{
+    AQHTTP2SettingHeaderTableSize       = 0x1,
+    AQHTTP2SettingEnablePush            = 0x2,
+    AQHTTP2SettingMaxConcurrentStreams  = 0x3,
+    AQHTTP2SettingInitialWindowSize     = 0x4,
+    AQHTTP2SettingMaxFrameSize          = 0x5,
+    AQHTTP2SettingMaxHeaderListSize     = 0x6
+};
+
+#define AQHTTP2FrameHeaderLength        9
+#define AQHTTP2DefaultWindowSize        65535
+#define AQHTTP2DefaultMaxFrameSize      16384
+#define AQHTTP2MaxFrameSizeLimit        16777215
+#define AQHTTP2MaxWindowSize            0x7fffffff
+
+// the number of streams a client may have open at once, and how many of their responses are produced in parallel
+#define AQHTTP2MaxConcurrentStreams     100
+#define AQHTTP2MaxConcurrentResponses   8
+#define AQHTTP2MaxHeaderListSize        (64 * 1024)
+
+static const char _AQHTTP2ConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define AQHTTP2ConnectionPrefaceLength  (sizeof(_AQHTTP2ConnectionPreface) - 1)
+
+static char _AQHTTP2SessionQueueKey;
+
+#pragma mark - Helpers
+
+static inline uint32_t _AQReadUInt32(const uint8_t * p)
+{
+    return ( ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3] );
+}
+
+static inline uint16_t _AQReadUInt16(const uint8_t * p)
+{
+    return ( (uint16_t)(((uint16_t)p[0] << 8) | (uint16_t)p[1]) );
+}
+
+static void _AQAppendUInt32(NSMutableData * data, uint32_t value)
+{
+    uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    [data appendBytes: bytes length: 4];
+}
+
+static void _AQAppendSetting(NSMutableData * data, uint16_t identifier, uint32_t value)
+{
+    uint8_t bytes[2] = { (uint8_t)(identifier >> 8), (uint8_t)identifier };
+    [data appendBytes: bytes length: 2];
+    _AQAppendUInt32(data, value);
+}
+
+// creates a frame holding only the header; the caller appends the payload
+static NSMutableData * _AQHTTP2NewFrame(uint8_t type, uint8_t flags, uint32_t streamID, NSUInteger payloadLength)
+{
+    NSMutableData * frame = [[NSMutableData alloc] initWithCapacity: AQHTTP2FrameHeaderLength + payloadLength];
+    uint8_t header[AQHTTP2FrameHeaderLength] = {
+        (uint8_t)(payloadLength >> 16), (uint8_t)(payloadLength >> 8), (uint8_t)payloadLength,
+        type, flags,
+        (uint8_t)((streamID >> 24) & 0x7f), (uint8_t)(streamID >> 16), (uint8_t)(streamID >> 8), (uint8_t)streamID
+    };
+    [frame appendBytes: header length: AQHTTP2FrameHeaderLength];
+    return ( frame );
+}
+
+static NSError * _AQHTTP2CancelledError(void)
+{
+    return ( [NSError errorWithDomain: NSPOSIXErrorDomain code: ECANCELED userInfo: nil] );
+}
+
+static BOOL _AQHeaderContainsToken(NSString * header, NSString * token)
+{
+    for ( NSString * item in [header componentsSeparatedByString: @","] )
+    {
+        NSString * trimmed = [item stringByTrimmingCharactersInSet: [NSCharacterSet whitespaceCharacterSet]];
+        if ( [trimmed caseInsensitiveCompare: token] == NSOrderedSame )
+            return ( YES );
+    }
+
+    return ( NO );
+}
+
+// hop-by-hop headers, which have no meaning in HTTP/2
+static NSSet * _AQHTTP2ConnectionSpecificHeaders(void)
+{
+    static NSSet * __headers = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __headers = [[NSSet alloc] initWithObjects: @"connection", @"keep-alive", @"proxy-connection", @"transfer-encoding", @"upgrade", nil];
+    });
+
+    return ( __headers );
+}
+
+// the HTTP2-Settings header is base64url, without padding
+static NSData * _AQDecodeBase64URL(NSString * str)
+{
+    NSData * input = [str dataUsingEncoding: NSASCIIStringEncoding];
+    if ( input == nil )
+        return ( nil );
+
+    NSMutableData * output = [NSMutableData dataWithCapacity: ([input length] * 3) / 4];
+    const uint8_t * p = [input bytes];
+    uint32_t accumulator = 0;
+    int numBits = 0;
+
+    for ( NSUInteger i = 0; i < [input length]; i++ )
+    {
+        uint8_t c = p[i];
+        uint32_t value = 0;
+        if ( c >= 'A' && c <= 'Z' )
+            value = c - 'A';
+        else if ( c >= 'a' && c <= 'z' )
+            value = c - 'a' + 26;
+        else if ( c >= '0' && c <= '9' )
+            value = c - '0' + 52;
+        else if ( c == '-' || c == '+' )
+            value = 62;
+        else if ( c == '_' || c == '/' )
+            value = 63;
+        else if ( c == '=' )
+            break;
+        else
+            return ( nil );
+
+        accumulator = (accumulator << 6) | value;
+        numBits += 6;
+        if ( numBits >= 8 )
+        {
+            numBits -= 8;
+            uint8_t byte = (uint8_t)(accumulator >> numBits);
+            [output appendBytes: &byte length: 1];
+        }
+    }
+
+    return ( output );
+}
+
+#pragma mark -
+
+@interface AQHTTP2Session ()
+- (void) _writeData: (NSData *) data forStreamID: (uint32_t) streamID completion: (void (^)(NSData *, NSError *)) completion;
+- (void) _cancelStreamWithID: (uint32_t) streamID;
+@end
+
+// The socket handed to a stream's response operation. Everything written to it is
+// passed to the session to be framed.
+@interface _AQHTTP2StreamSocket : AQSocket
+{
+    AQHTTP2Session * __maybe_weak _session;
+    AQSocket *          _parent;
+    uint32_t            _streamID;
+    volatile BOOL       _invalid;
+}
+- (id) initWithSession: (AQHTTP2Session *) session streamID: (uint32_t) streamID parent: (AQSocket *) parent;
+- (void) invalidate;
+@end
+
+@implementation _AQHTTP2StreamSocket
+
+- (id) initWithSession: (AQHTTP2Session *) session streamID: (uint32_t) streamID parent: (AQSocket *) parent
+{
+    self = [super initWithSocketType: SOCK_STREAM];
+    if ( self == nil )
+        return ( nil );
+
+    _session = session;
+    _streamID = streamID;
+#if USING_MRR
+    _parent = [parent retain];
+#else
+    _parent = parent;
+#endif
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_parent release];
+    [super dealloc];
+}
+#endif
+
+- (void) invalidate
+{
+    _invalid = YES;
+    _session = nil;
+}
+
+- (AQSocketStatus) status
+{
+    return ( _invalid ? AQSocketDisconnected : AQSocketConnected );
+}
+
+- (struct sockaddr_storage) socketAddress
+{
+    return ( _parent.socketAddress );
+}
+
+- (struct sockaddr_storage) peerSocketAddress
+{
+    return ( _parent.peerSocketAddress );
+}
+
+- (uint16_t) port
+{
+    return ( _parent.port );
+}
+
+- (BOOL) isSecure
+{
+    return ( _parent.secure );
+}
+
+- (NSString *) negotiatedApplicationProtocol
+{
+    return ( _parent.negotiatedApplicationProtocol );
+}
+
+- (void) close
+{
+    AQHTTP2Session * session = _session;
+    [self invalidate];
+    [session _cancelStreamWithID: _streamID];
+}
+
+// request bodies on a stream are paced using its flow-control window, never by pausing the shared socket
+- (void) suspendReading
+{
+}
+
+- (void) resumeReading
+{
+}
+
+- (void) writeBytes: (NSData *) bytes completion: (void (^)(NSData *, NSError *)) completionHandler
+{
+    NSParameterAssert([bytes length] != 0);
+
+    AQHTTP2Session * session = _session;
+    if ( _invalid || session == nil )
+    {
+        if ( completionHandler != nil )
+            completionHandler(bytes, _AQHTTP2CancelledError());
+        return;
+    }
+
+    [session _writeData: bytes forStreamID: _streamID completion: completionHandler];
+}
+
+- (NSString *) description
+{
+    return ( [NSString stringWithFormat: @"%@: {stream=%u, parent=%@}", [super description], _streamID, _parent] );
+}
+
+@end
+
+#pragma mark -
+
+@interface _AQHTTP2PendingWrite : NSObject
+{
+@public
+    NSData *        _data;
+    NSUInteger      _offset;
+    void (^_completion)(NSData *, NSError *);
+}
+@end
+
+@implementation _AQHTTP2PendingWrite
+#if USING_MRR
+- (void) dealloc
+{
+    [_data release];
+    [_completion release];
+    [super dealloc];
+}
+#endif
+@end
+
+@interface _AQHTTP2Stream : NSObject
+{
+@public
+    uint32_t                    _streamID;
+    int64_t                     _sendWindow;
+    int64_t                     _receiveWindow;     // credit we've extended to the client for request body data
+    NSMutableArray *            _pendingWrites;
+    CFHTTPMessageRef            _responseHeader;    // assembled from the operation's first write(s)
+    _AQHTTP2StreamSocket *      _socket;
+    AQHTTPResponseOperation *   _operation;
+    AQHTTPRequestBody *         _requestBody;
+    BOOL                        _headersSent;
+    BOOL                        _responseFinished;  // the operation has completed
+    BOOL                        _endStreamSent;
+    BOOL                        _remoteClosed;
+    BOOL                        _scheduled;         // in the session's send queue
+}
+- (id) initWithStreamID: (uint32_t) streamID sendWindow: (int64_t) sendWindow;
+@end
+
+@implementation _AQHTTP2Stream
+
+- (id) initWithStreamID: (uint32_t) streamID sendWindow: (int64_t) sendWindow
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _streamID = streamID;
+    _sendWindow = sendWindow;
+    _receiveWindow = AQHTTP2DefaultWindowSize;
+    _pendingWrites = [NSMutableArray new];
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _responseHeader != NULL )
+        CFRelease(_responseHeader);
+#if USING_MRR
+    [_pendingWrites release];
+    [_socket release];
+    [_operation release];
+    [_requestBody release];
+    [super dealloc];
+#endif
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTP2Session
+{
+    AQHTTPConnection * __maybe_weak _connection;
+    AQSocket *              _socket;
+    dispatch_queue_t        _q;
+    NSOperationQueue *      _streamQ;
+
+    NSMutableData *         _inputBuffer;
+    BOOL                    _started;
+    BOOL                    _sawPreface;
+    BOOL                    _sawSettings;
+    BOOL                    _goingAway;
+    BOOL                    _closed;
+
+    AQHPACKDecoder *        _decoder;
+    AQHPACKEncoder *        _encoder;
+
+    NSMutableDictionary *   _streams;           // NSNumber stream ID -> _AQHTTP2Stream
+    NSMutableArray *        _sendQueue;         // streams with output ready, in round-robin order
+    BOOL                    _waitingForSocket;  // the socket has as much output queued as it will take for now
+    uint32_t                _lastStreamID;
+    CFHTTPMessageRef        _upgradeRequest;
+
+    // a header block being assembled from HEADERS & CONTINUATION frames
+    NSMutableData *         _headerBlock;
+    uint32_t                _headerStreamID;
+    uint8_t                 _headerFlags;
+
+    // flow control & framing limits imposed by the peer
+    int64_t                 _sendWindow;
+    uint32_t                _peerInitialWindowSize;
+    uint32_t                _peerMaxFrameSize;
+}
+
++ (NSData *) connectionPreface
+{
+    return ( [NSData dataWithBytesNoCopy: (void *)_AQHTTP2ConnectionPreface length: AQHTTP2ConnectionPrefaceLength freeWhenDone: NO] );
+}
+
++ (BOOL) isUpgradeRequest: (CFHTTPMessageRef) request
+{
+    NSString * upgrade = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Upgrade")));
+    NSString * connection = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Connection")));
+    NSString * settings = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("HTTP2-Settings")));
+
+    if ( upgrade == nil || connection == nil || settings == nil )
+        return ( NO );
+
+    // there must be exactly one HTTP2-Settings header
+    if ( [settings rangeOfString: @","].location != NSNotFound )
+        return ( NO );
+
+    if ( _AQHeaderContainsToken(upgrade, @"h2c") == NO )
+        return ( NO );
+    if ( _AQHeaderContainsToken(connection, @"Upgrade") == NO || _AQHeaderContainsToken(connection, @"HTTP2-Settings") == NO )
+        return ( NO );
+
+    // we can't carry a request body across the switch
+    NSString * contentLength = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Content-Length")));
+    NSString * transferEncoding = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Transfer-Encoding")));
+    if ( [contentLength longLongValue] != 0 || transferEncoding != nil )
+        return ( NO );
+
+    return ( YES );
+}
+
+- (id) initWithConnection: (AQHTTPConnection *) connection socket: (AQSocket *) socket
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _connection = connection;
+#if USING_MRR
+    _socket = [socket retain];
+#else
+    _socket = socket;
+#endif
+
+    _q = dispatch_queue_create("me.alanquatermain.AQHTTP2Session", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(_q, &_AQHTTP2SessionQueueKey, (__bridge void *)self, NULL);
+
+    _streamQ = [NSOperationQueue new];
+    _streamQ.maxConcurrentOperationCount = AQHTTP2MaxConcurrentResponses;
+
+    _inputBuffer = [NSMutableData new];
+    _decoder = [[AQHPACKDecoder alloc] initWithMaximumTableSize: AQHPACKDefaultTableSize];
+    _decoder.maximumHeaderListSize = AQHTTP2MaxHeaderListSize;
+    _encoder = [AQHPACKEncoder new];
+
+    _streams = [NSMutableDictionary new];
+    _sendQueue = [NSMutableArray new];
+
+    _sendWindow = AQHTTP2DefaultWindowSize;
+    _peerInitialWindowSize = AQHTTP2DefaultWindowSize;
+    _peerMaxFrameSize = AQHTTP2DefaultMaxFrameSize;
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _upgradeRequest != NULL )
+        CFRelease(_upgradeRequest);
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(_q);
+#endif
+#if USING_MRR
+    [_socket release];
+    [_streamQ release];
+    [_inputBuffer release];
+    [_decoder release];
+    [_encoder release];
+    [_streams release];
+    [_sendQueue release];
+    [_headerBlock release];
+    [super dealloc];
+#endif
+}
+
+- (void) _performSync: (dispatch_block_t) block
+{
+    if ( dispatch_get_specific(&_AQHTTP2SessionQueueKey) == (__bridge void *)self )
+        block();
+    else
+        dispatch_sync(_q, block);
+}
+
+#pragma mark - Public API
+
+- (BOOL) takeUpgradeRequest: (CFHTTPMessageRef) request
+{
+    NSString * settingsStr = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("HTTP2-Settings")));
+    NSData * settings = _AQDecodeBase64URL([settingsStr stringByTrimmingCharactersInSet: [NSCharacterSet whitespaceCharacterSet]]);
+    if ( settings == nil || [settings length] % 6 != 0 )
+        return ( NO );
+
+    __block uint32_t err = AQHTTP2NoError;
+    [self _performSync: ^{
+        err = [self _applySettings: [settings bytes] length: [settings length]];
+    }];
+    if ( err != AQHTTP2NoError )
+        return ( NO );
+
+    // the request becomes stream 1, half-closed from the client's side
+    NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
+    NSURL * url = CFBridgingRelease(CFHTTPMessageCopyRequestURL(request));
+    CFHTTPMessageRef streamRequest = CFHTTPMessageCreateRequest(kCFAllocatorDefault, (__bridge CFStringRef)method, (__bridge CFURLRef)url, AQHTTPVersion2_0);
+
+    NSDictionary * fields = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(request));
+    [fields enumerateKeysAndObjectsUsingBlock: ^(id key, id obj, BOOL *stop) {
+        NSString * name = [key lowercaseString];
+        if ( [_AQHTTP2ConnectionSpecificHeaders() containsObject: name] || [name isEqualToString: @"http2-settings"] )
+            return;
+        CFHTTPMessageSetHeaderFieldValue(streamRequest, (__bridge CFStringRef)key, (__bridge CFStringRef)obj);
+    }];
+
+    [self _performSync: ^{
+        if ( _upgradeRequest != NULL )
+            CFRelease(_upgradeRequest);
+        _upgradeRequest = streamRequest;
+    }];
+
+    return ( YES );
+}
+
+- (void) start
+{
+    dispatch_async(_q, ^{
+        if ( _started || _closed )
+            return;
+
+        _started = YES;
+
+        // the server connection preface is simply our SETTINGS frame
+        NSMutableData * payload = [NSMutableData dataWithCapacity: 12];
+        _AQAppendSetting(payload, AQHTTP2SettingMaxConcurrentStreams, AQHTTP2MaxConcurrentStreams);
+        _AQAppendSetting(payload, AQHTTP2SettingMaxHeaderListSize, AQHTTP2MaxHeaderListSize);
+        [self _sendFrameType: AQHTTP2FrameSettings flags: 0 streamID: 0 payload: payload];
+
+        if ( _upgradeRequest != NULL )
+        {
+            _lastStreamID = 1;
+            [self _startStreamWithID: 1 request: _upgradeRequest remoteClosed: YES];
+            CFRelease(_upgradeRequest);
+            _upgradeRequest = NULL;
+        }
+
+        [self _processInput];
+    });
+}
+
+- (void) processIncomingData: (NSData *) data
+{
+    if ( [data length] == 0 )
+        return;
+
+    dispatch_async(_q, ^{
+        if ( _closed )
+            return;
+
+        [_inputBuffer appendData: data];
+        [self _processInput];
+    });
+}
+
+- (void) close
+{
+    [self _performSync: ^{
+        if ( _closed )
+            return;
+
+        // best effort: the socket is likely to be closed before this goes out
+        [self _sendGoAwayWithError: AQHTTP2NoError completion: nil];
+        [self _shutdown];
+    }];
+}
+
+- (void) drain
+{
+    dispatch_async(_q, ^{
+        if ( _closed || _goingAway )
+            return;
+
+        // streams the client opens after this are refused, so it knows it may retry them elsewhere
+        _goingAway = YES;
+        if ( [_streams count] == 0 )
+            [self _closeConnectionWithError: AQHTTP2NoError];
+        else
+            [self _sendGoAwayWithError: AQHTTP2NoError completion: nil];
+    });
+}
+
+- (BOOL) isIdle
+{
+    __block BOOL idle = YES;
+    [self _performSync: ^{
+        idle = ([_streams count] == 0);
+    }];
+    return ( idle );
+}
+
+#pragma mark - Output
+
+- (void) _writeFrame: (NSData *) frame completion: (void (^)(NSData *, NSError *)) completion
+{
+    void (^completionCopy)(NSData *, NSError *) = [completion copy];
+
+    if ( _socket.status != AQSocketConnected )
+    {
+        if ( completionCopy != nil )
+            completionCopy(nil, [NSError errorWithDomain: NSPOSIXErrorDomain code: EPIPE userInfo: nil]);
+    }
+    else
+    {
+        [_socket writeBytes: frame completion: ^(NSData *unwritten, NSError *error) {
+            if ( completionCopy != nil )
+                completionCopy(nil, error);
+        }];
+    }
+
+#if USING_MRR
+    [completionCopy release];
+#endif
+}
+
+- (void) _sendFrameType: (uint8_t) type flags: (uint8_t) flags streamID: (uint32_t) streamID payload: (NSData *) payload
+{
+    NSMutableData * frame = _AQHTTP2NewFrame(type, flags, streamID, [payload length]);
+    if ( payload != nil )
+        [frame appendData: payload];
+    [self _writeFrame: frame completion: nil];
+#if USING_MRR
+    [frame release];
+#endif
+}
+
+- (void) _sendResetForStreamID: (uint32_t) streamID errorCode: (uint32_t) errorCode
+{
+    NSMutableData * payload = [NSMutableData dataWithCapacity: 4];
+    _AQAppendUInt32(payload, errorCode);
+    [self _sendFrameType: AQHTTP2FrameRstStream flags: 0 streamID: streamID payload: payload];
+}
+
+- (void) _sendWindowUpdate: (uint32_t) increment forStreamID: (uint32_t) streamID
+{
+    NSMutableData * payload = [NSMutableData dataWithCapacity: 4];
+    _AQAppendUInt32(payload, increment);
+    [self _sendFrameType: AQHTTP2FrameWindowUpdate flags: 0 streamID: streamID payload: payload];
+}
+
+- (void) _sendGoAwayWithError: (uint32_t) errorCode completion: (void (^)(NSData *, NSError *)) completion
+{
+    NSMutableData * frame = _AQHTTP2NewFrame(AQHTTP2FrameGoAway, 0, 0, 8);
+    _AQAppendUInt32(frame, _lastStreamID);
+    _AQAppendUInt32(frame, errorCode);
+    [self _writeFrame: frame completion: completion];
+#if USING_MRR
+    [frame release];
+#endif
+}
+
+- (void) _sendHeaderBlock: (NSData *) block forStreamID: (uint32_t) streamID
+{
+    // anything larger than the peer's maximum frame size continues in CONTINUATION frames
+    const uint8_t * p = [block bytes];
+    NSUInteger remaining = [block length];
+    uint8_t type = AQHTTP2FrameHeaders;
+
+    do
+    {
+        NSUInteger length = MIN(remaining, (NSUInteger)_peerMaxFrameSize);
+        uint8_t flags = (length == remaining ? AQHTTP2FlagEndHeaders : 0);
+
+        NSMutableData * frame = _AQHTTP2NewFrame(type, flags, streamID, length);
+        [frame appendBytes: p length: length];
+        [self _writeFrame: frame completion: nil];
+#if USING_MRR
+        [frame release];
+#endif
+
+        p += length;
+        remaining -= length;
+        type = AQHTTP2FrameContinuation;
+
+    } while ( remaining != 0 );
+}
+
+- (void) _sendHeadersForStream: (_AQHTTP2Stream *) stream
+{
+    CFHTTPMessageRef response = stream->_responseHeader;
+
+    NSMutableArray * headers = [NSMutableArray array];
+    NSString * status = [NSString stringWithFormat: @"%ld", (long)CFHTTPMessageGetResponseStatusCode(response)];
+    [headers addObject: [NSArray arrayWithObjects: @":status", status, nil]];
+
+    NSDictionary * fields = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(response));
+    [fields enumerateKeysAndObjectsUsingBlock: ^(id key, id obj, BOOL *stop) {
+        NSString * name = [key lowercaseString];
+        if ( [_AQHTTP2ConnectionSpecificHeaders() containsObject: name] )
+            return;
+        [headers addObject: [NSArray arrayWithObjects: name, obj, nil]];
+    }];
+
+    [self _sendHeaderBlock: [_encoder encodeHeaders: headers] forStreamID: stream->_streamID];
+    stream->_headersSent = YES;
+}
+
+- (void) _scheduleStream: (_AQHTTP2Stream *) stream
+{
+    if ( stream->_scheduled )
+        return;
+
+    stream->_scheduled = YES;
+    [_sendQueue addObject: stream];
+}
+
+- (void) _endStream: (_AQHTTP2Stream *) stream
+{
+    stream->_endStreamSent = YES;
+    [self _sendFrameType: AQHTTP2FrameData flags: AQHTTP2FlagEndStream streamID: stream->_streamID payload: nil];
+
+    // the response is complete: we've no interest in whatever else the client might have to say
+    if ( stream->_remoteClosed == NO )
+        [self _sendResetForStreamID: stream->_streamID errorCode: AQHTTP2NoError];
+
+    [self _removeStream: stream];
+}
+
+// Sends DATA frames for ready streams, one frame per stream in turn, until either
+// everything is sent or the flow-control windows are exhausted.
+- (void) _pumpOutput
+{
+    while ( [_sendQueue count] != 0 && _closed == NO )
+    {
+        if ( _waitingForSocket )
+            break;
+
+        if ( _socket.writable == NO )
+        {
+            // a peer's flow-control window can be far larger than we'd want to hold in memory, so the socket's water marks apply too
+            _waitingForSocket = YES;
+            [_socket notifyWhenWritable: ^(BOOL writable) {
+                dispatch_async(_q, ^{
+                    _waitingForSocket = NO;
+                    if ( writable )
+                        [self _pumpOutput];
+                });
+            }];
+            break;
+        }
+
+        _AQHTTP2Stream * stream = [_sendQueue objectAtIndex: 0];
+#if USING_MRR
+        [[stream retain] autorelease];
+#endif
+        [_sendQueue removeObjectAtIndex: 0];
+        stream->_scheduled = NO;
+
+        _AQHTTP2PendingWrite * write = ([stream->_pendingWrites count] != 0 ? [stream->_pendingWrites objectAtIndex: 0] : nil);
+        if ( write == nil )
+        {
+            if ( stream->_responseFinished && stream->_endStreamSent == NO )
+                [self _endStream: stream];
+            continue;
+        }
+
+        if ( _sendWindow <= 0 )
+        {
+            // the whole connection is blocked: keep our place and wait for a WINDOW_UPDATE
+            stream->_scheduled = YES;
+            [_sendQueue insertObject: stream atIndex: 0];
+            break;
+        }
+
+        if ( stream->_sendWindow <= 0 )
+            continue;       // rescheduled when the stream's window is next updated
+
+        NSUInteger length = [write->_data length] - write->_offset;
+        length = MIN(length, (NSUInteger)_peerMaxFrameSize);
+        length = MIN(length, (NSUInteger)_sendWindow);
+        length = MIN(length, (NSUInteger)stream->_sendWindow);
+
+        NSMutableData * frame = _AQHTTP2NewFrame(AQHTTP2FrameData, 0, stream->_streamID, length);
+        [frame appendBytes: (const uint8_t *)[write->_data bytes] + write->_offset length: length];
+        write->_offset += length;
+        _sendWindow -= length;
+        stream->_sendWindow -= length;
+
+        // the writer hears back once the last of its data has gone out on the socket
+        void (^completion)(NSData *, NSError *) = nil;
+        if ( write->_offset == [write->_data length] )
+        {
+#if USING_MRR
+            completion = [[write->_completion retain] autorelease];
+#else
+            completion = write->_completion;
+#endif
+            [stream->_pendingWrites removeObjectAtIndex: 0];
+        }
+
+        [self _writeFrame: frame completion: completion];
+#if USING_MRR
+        [frame release];
+#endif
+
+        if ( [stream->_pendingWrites count] != 0 || stream->_responseFinished )
+            [self _scheduleStream: stream];
+    }
+}
+
+- (void) _writeData: (NSData *) data forStreamID: (uint32_t) streamID completion: (void (^)(NSData *, NSError *)) completion
+{
+    void (^completionCopy)(NSData *, NSError *) = [completion copy];
+
+    dispatch_async(_q, ^{
+        _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+        if ( _closed || stream == nil || stream->_endStreamSent )
+        {
+            if ( completionCopy != nil )
+                completionCopy(data, _AQHTTP2CancelledError());
+            return;
+        }
+
+        NSData * body = data;
+        if ( stream->_headersSent == NO )
+        {
+            // the operation begins by writing a serialized HTTP/1.1 response header
+            if ( stream->_responseHeader == NULL )
+                stream->_responseHeader = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, FALSE);
+            CFHTTPMessageAppendBytes(stream->_responseHeader, [data bytes], [data length]);
+            if ( CFHTTPMessageIsHeaderComplete(stream->_responseHeader) == FALSE )
+            {
+                if ( completionCopy != nil )
+                    completionCopy(nil, nil);
+                return;
+            }
+
+            [self _sendHeadersForStream: stream];
+
+            // anything following the header is the start of the body
+            body = CFBridgingRelease(CFHTTPMessageCopyBody(stream->_responseHeader));
+            CFRelease(stream->_responseHeader);
+            stream->_responseHeader = NULL;
+
+            if ( [body length] == 0 )
+            {
+                if ( completionCopy != nil )
+                    completionCopy(nil, nil);
+                return;
+            }
+        }
+
+        _AQHTTP2PendingWrite * write = [_AQHTTP2PendingWrite new];
+#if USING_MRR
+        write->_data = [body retain];
+        write->_completion = [completionCopy retain];
+#else
+        write->_data = body;
+        write->_completion = completionCopy;
+#endif
+        [stream->_pendingWrites addObject: write];
+#if USING_MRR
+        [write release];
+#endif
+
+        [self _scheduleStream: stream];
+        [self _pumpOutput];
+    });
+
+#if USING_MRR
+    [completionCopy release];
+#endif
+}
+
+#pragma mark - Streams
+
+- (void) _startStreamWithID: (uint32_t) streamID request: (CFHTTPMessageRef) request remoteClosed: (BOOL) remoteClosed
+{
+    AQHTTPConnection * connection = _connection;
+    if ( connection == nil )
+        return;
+
+    _AQHTTP2Stream * stream = [[_AQHTTP2Stream alloc] initWithStreamID: streamID sendWindow: _peerInitialWindowSize];
+    stream->_remoteClosed = remoteClosed;
+    stream->_socket = [[_AQHTTP2StreamSocket alloc] initWithSession: self streamID: streamID parent: _socket];
+    [_streams setObject: stream forKey: [NSNumber numberWithUnsignedInt: streamID]];
+#if USING_MRR
+    [stream release];
+#endif
+
+    if ( remoteClosed == NO )
+    {
+        // DATA frames will follow; the content-length, if any, is checked against what actually arrives
+        long long expectedLength = -1;
+        NSString * contentLength = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Content-Length")));
+        if ( [contentLength length] != 0 && [contentLength rangeOfCharacterFromSet: [[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location == NSNotFound )
+            expectedLength = [contentLength longLongValue];
+
+        stream->_requestBody = [[AQHTTPRequestBody alloc] initWithExpectedLength: expectedLength maximumLength: connection.maximumRequestBodyLength];
+
+        // the client's window is only extended as the operation reads what it has already sent
+        stream->_requestBody.consumptionHandler = ^(NSUInteger length){
+            dispatch_async(_q, ^{
+                _AQHTTP2Stream * current = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+                if ( _closed || current == nil || current->_remoteClosed )
+                    return;
+
+                current->_receiveWindow += length;
+                [self _sendWindowUpdate: (uint32_t)length forStreamID: streamID];
+            });
+        };
+    }
+
+    [connection _cancelIdleTimer];
+
+    AQHTTPResponseOperation * op = [connection _responseOperationForRequest: request socket: stream->_socket];
+    if ( op == nil )
+    {
+        [self _resetStream: stream errorCode: AQHTTP2RefusedStream];
+        return;
+    }
+
+#if USING_MRR
+    stream->_operation = [op retain];
+#else
+    stream->_operation = op;
+#endif
+    op.requestBody = stream->_requestBody;
+
+    [op setCompletionBlock: ^{
+        dispatch_async(_q, ^{
+            [self _operationFinishedForStream: stream];
+        });
+    }];
+
+    [_streamQ addOperation: op];
+}
+
+- (void) _operationFinishedForStream: (_AQHTTP2Stream *) stream
+{
+#if USING_MRR
+    [stream->_operation release];
+#endif
+    stream->_operation = nil;
+    stream->_responseFinished = YES;
+
+    // has it already been reset?
+    if ( [_streams objectForKey: [NSNumber numberWithUnsignedInt: stream->_streamID]] != stream )
+        return;
+
+    if ( stream->_headersSent == NO )
+    {
+        // the operation gave up without producing a response
+        [self _resetStream: stream errorCode: AQHTTP2InternalError];
+        return;
+    }
+
+    [self _scheduleStream: stream];
+    [self _pumpOutput];
+}
+
+- (void) _discardStream: (_AQHTTP2Stream *) stream
+{
+#if USING_MRR
+    [[stream retain] autorelease];
+#endif
+
+    [stream->_socket invalidate];
+    [stream->_operation cancel];
+
+    // an operation still reading the body learns that no more is coming; this also breaks the handler's reference to us
+    stream->_requestBody.consumptionHandler = nil;
+    [stream->_requestBody failWithError: nil];
+
+    for ( _AQHTTP2PendingWrite * write in stream->_pendingWrites )
+    {
+        if ( write->_completion != nil )
+            write->_completion(nil, _AQHTTP2CancelledError());
+    }
+    [stream->_pendingWrites removeAllObjects];
+
+    if ( stream->_scheduled )
+    {
+        [_sendQueue removeObjectIdenticalTo: stream];
+        stream->_scheduled = NO;
+    }
+
+    [_streams removeObjectForKey: [NSNumber numberWithUnsignedInt: stream->_streamID]];
+}
+
+- (void) _removeStream: (_AQHTTP2Stream *) stream
+{
+    [self _discardStream: stream];
+
+    if ( [_streams count] != 0 || _closed )
+        return;
+
+    if ( _goingAway )
+        [self _closeConnectionWithError: AQHTTP2NoError];
+    else
+        [_connection _maybeInstallIdleTimer];
+}
+
+- (void) _resetStream: (_AQHTTP2Stream *) stream errorCode: (uint32_t) errorCode
+{
+    [self _sendResetForStreamID: stream->_streamID errorCode: errorCode];
+    [self _removeStream: stream];
+}
+
+- (void) _cancelStreamWithID: (uint32_t) streamID
+{
+    dispatch_async(_q, ^{
+        _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+        if ( stream != nil && stream->_endStreamSent == NO )
+            [self _resetStream: stream errorCode: AQHTTP2Cancel];
+    });
+}
+
+- (void) _shutdown
+{
+    _closed = YES;
+
+    for ( _AQHTTP2Stream * stream in [_streams allValues] )
+    {
+        [self _discardStream: stream];
+    }
+
+    [_streamQ cancelAllOperations];
+    [_inputBuffer setLength: 0];
+}
+
+- (void) _closeConnectionWithError: (uint32_t) errorCode
+{
+    if ( _closed )
+        return;
+
+    // let the GOAWAY go out before we close the socket underneath it
+    AQHTTPConnection * connection = _connection;
+    [self _sendGoAwayWithError: errorCode completion: ^(NSData *unwritten, NSError *error) {
+        [connection close];
+    }];
+    [self _shutdown];
+}
+
+#pragma mark - Input
+
+- (uint32_t) _applySettings: (const uint8_t *) p length: (NSUInteger) length
+{
+    for ( NSUInteger i = 0; i + 6 <= length; i += 6 )
+    {
+        uint16_t identifier = _AQReadUInt16(p + i);
+        uint32_t value = _AQReadUInt32(p + i + 2);
+
+        switch ( identifier )
+        {
+            case AQHTTP2SettingHeaderTableSize:
+                _encoder.maximumTableSize = value;
+                break;
+
+            case AQHTTP2SettingEnablePush:
+                if ( value > 1 )
+                    return ( AQHTTP2ProtocolError );
+                break;
+
+            case AQHTTP2SettingInitialWindowSize:
+            {
+                if ( value > AQHTTP2MaxWindowSize )
+                    return ( AQHTTP2FlowControlError );
+
+                // this applies retroactively to every open stream
+                int64_t delta = (int64_t)value - (int64_t)_peerInitialWindowSize;
+                _peerInitialWindowSize = value;
+                for ( _AQHTTP2Stream * stream in [_streams objectEnumerator] )
+                {
+                    stream->_sendWindow += delta;
+                    if ( stream->_sendWindow > AQHTTP2MaxWindowSize )
+                        return ( AQHTTP2FlowControlError );
+                    if ( delta > 0 && [stream->_pendingWrites count] != 0 )
+                        [self _scheduleStream: stream];
+                }
+                break;
+            }
+
+            case AQHTTP2SettingMaxFrameSize:
+                if ( value < AQHTTP2DefaultMaxFrameSize || value > AQHTTP2MaxFrameSizeLimit )
+                    return ( AQHTTP2ProtocolError );
+                _peerMaxFrameSize = value;
+                break;
+
+            default:
+                // MAX_CONCURRENT_STREAMS and MAX_HEADER_LIST_SIZE don't constrain a server which never pushes; unknown settings are ignored
+                break;
+        }
+    }
+
+    return ( AQHTTP2NoError );
+}
+
+- (CFHTTPMessageRef) _newRequestFromHeaders: (NSArray *) headers
+{
+    static NSSet * __pseudoHeaders = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __pseudoHeaders = [[NSSet alloc] initWithObjects: @":method", @":scheme", @":authority", @":path", nil];
+    });
+
+    NSMutableDictionary * pseudo = [NSMutableDictionary dictionaryWithCapacity: 4];
+    NSMutableArray * fields = [NSMutableArray arrayWithCapacity: [headers count]];
+
+    for ( NSArray * pair in headers )
+    {
+        NSString * name = [pair objectAtIndex: 0];
+        NSString * value = [pair objectAtIndex: 1];
+
+        if ( [name length] == 0 || [name rangeOfCharacterFromSet: [NSCharacterSet uppercaseLetterCharacterSet]].location != NSNotFound )
+            return ( NULL );
+
+        if ( [name characterAtIndex: 0] == ':' )
+        {
+            // pseudo-headers come first, once each
+            if ( [fields count] != 0 || [__pseudoHeaders containsObject: name] == NO || [pseudo objectForKey: name] != nil )
+                return ( NULL );
+
+            [pseudo setObject: value forKey: name];
+            continue;
+        }
+
+        if ( [_AQHTTP2ConnectionSpecificHeaders() containsObject: name] )
+            return ( NULL );
+        if ( [name isEqualToString: @"te"] && [value isEqualToString: @"trailers"] == NO )
+            return ( NULL );
+
+        [fields addObject: pair];
+    }
+
+    NSString * method = [pseudo objectForKey: @":method"];
+    NSString * path = [pseudo objectForKey: @":path"];
+    NSString * authority = [pseudo objectForKey: @":authority"];
+    if ( method == nil || [pseudo objectForKey: @":scheme"] == nil || [path length] == 0 )
+        return ( NULL );
+
+    NSURL * url = [NSURL URLWithString: path];
+    if ( url == nil )
+        return ( NULL );
+
+    CFHTTPMessageRef request = CFHTTPMessageCreateRequest(kCFAllocatorDefault, (__bridge CFStringRef)method, (__bridge CFURLRef)url, AQHTTPVersion2_0);
+    if ( authority != nil )
+        CFHTTPMessageSetHeaderFieldValue(request, CFSTR("Host"), (__bridge CFStringRef)authority);
+
+    for ( NSArray * pair in fields )
+    {
+        NSString * name = [pair objectAtIndex: 0];
+        NSString * value = [pair objectAtIndex: 1];
+
+        if ( authority != nil && [name isEqualToString: @"host"] )
+            continue;
+
+        // repeated fields are folded together, as they would be in HTTP/1.1; cookies use their own separator
+        NSString * existing = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, (__bridge CFStringRef)name));
+        if ( existing != nil )
+            value = [NSString stringWithFormat: @"%@%@%@", existing, ([name isEqualToString: @"cookie"] ? @"; " : @", "), value];
+
+        CFHTTPMessageSetHeaderFieldValue(request, (__bridge CFStringRef)name, (__bridge CFStringRef)value);
+    }
+
+    return ( request );
+}
+
+- (void) _headerBlockComplete
+{
+    NSData * block = _headerBlock;
+#if USING_MRR
+    [block autorelease];
+#endif
+    _headerBlock = nil;
+
+    uint32_t streamID = _headerStreamID;
+    BOOL endStream = ((_headerFlags & AQHTTP2FlagEndStream) != 0);
+    _headerStreamID = 0;
+
+    // this must happen whatever becomes of the stream, to keep the compression context in step
+    NSArray * headers = [_decoder decodeHeaderBlock: block];
+    if ( headers == nil )
+    {
+        [self _closeConnectionWithError: AQHTTP2CompressionError];
+        return;
+    }
+
+    _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+    if ( stream != nil )
+    {
+        // trailers, which must end the stream; we have no use for them
+        if ( stream->_remoteClosed )
+            [self _resetStream: stream errorCode: AQHTTP2StreamClosed];
+        else if ( endStream == NO )
+            [self _resetStream: stream errorCode: AQHTTP2ProtocolError];
+        else
+        {
+            stream->_remoteClosed = YES;
+            [stream->_requestBody finish];
+        }
+        return;
+    }
+
+    // client streams are odd-numbered, and each new one must be numbered above all its predecessors
+    if ( (streamID & 1) == 0 || streamID <= _lastStreamID )
+    {
+        [self _closeConnectionWithError: AQHTTP2ProtocolError];
+        return;
+    }
+
+    _lastStreamID = streamID;
+
+    if ( _goingAway || [_streams count] >= AQHTTP2MaxConcurrentStreams )
+    {
+        [self _sendResetForStreamID: streamID errorCode: AQHTTP2RefusedStream];
+        return;
+    }
+
+    CFHTTPMessageRef request = [self _newRequestFromHeaders: headers];
+    if ( request == NULL )
+    {
+        [self _sendResetForStreamID: streamID errorCode: AQHTTP2ProtocolError];
+        return;
+    }
+
+    [self _startStreamWithID: streamID request: request remoteClosed: endStream];
+    CFRelease(request);
+}
+
+- (void) _handleFrameType: (uint8_t) type flags: (uint8_t) flags streamID: (uint32_t) streamID payload: (const uint8_t *) payload length: (NSUInteger) length
+{
+    // a header block may not be interleaved with any other frame
+    if ( _headerBlock != nil && (type != AQHTTP2FrameContinuation || streamID != _headerStreamID) )
+    {
+        [self _closeConnectionWithError: AQHTTP2ProtocolError];
+        return;
+    }
+
+    // the client's connection preface ends with a SETTINGS frame
+    if ( _sawSettings == NO && type != AQHTTP2FrameSettings )
+    {
+        [self _closeConnectionWithError: AQHTTP2ProtocolError];
+        return;
+    }
+
+    switch ( type )
+    {
+        case AQHTTP2FrameData:
+        {
+            if ( streamID == 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+
+            // padding counts against flow control too; at the connection level we hand all the credit straight back
+            if ( length != 0 )
+                [self _sendWindowUpdate: (uint32_t)length forStreamID: 0];
+
+            _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+            if ( stream == nil || stream->_remoteClosed )
+            {
+                if ( streamID > _lastStreamID )
+                    [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                else if ( stream != nil )
+                    [self _resetStream: stream errorCode: AQHTTP2StreamClosed];
+                else
+                    [self _sendResetForStreamID: streamID errorCode: AQHTTP2StreamClosed];
+                return;
+            }
+
+            const uint8_t * p = payload;
+            NSUInteger dataLength = length;
+            if ( (flags & AQHTTP2FlagPadded) != 0 )
+            {
+                if ( length == 0 || payload[0] >= length )
+                {
+                    [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                    return;
+                }
+
+                dataLength -= 1 + p[0];
+                p++;
+            }
+
+            stream->_receiveWindow -= length;
+            if ( stream->_receiveWindow < 0 )
+            {
+                [self _resetStream: stream errorCode: AQHTTP2FlowControlError];
+                return;
+            }
+
+            // the stream's window is reopened as the operation consumes the body (if the body has failed, it stays shut)
+            if ( dataLength != 0 )
+                [stream->_requestBody appendData: [NSData dataWithBytes: p length: dataLength]];
+
+            if ( (flags & AQHTTP2FlagEndStream) != 0 )
+            {
+                stream->_remoteClosed = YES;
+                [stream->_requestBody finish];
+            }
+            else if ( length > dataLength )
+            {
+                // padding is never seen by the operation, so its credit is returned immediately
+                stream->_receiveWindow += length - dataLength;
+                [self _sendWindowUpdate: (uint32_t)(length - dataLength) forStreamID: streamID];
+            }
+            break;
+        }
+
+        case AQHTTP2FrameHeaders:
+        {
+            if ( streamID == 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+
+            const uint8_t * p = payload;
+            NSUInteger fragmentLength = length;
+            if ( (flags & AQHTTP2FlagPadded) != 0 )
+            {
+                if ( fragmentLength < 1 || p[0] >= fragmentLength )
+                {
+                    [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                    return;
+                }
+
+                fragmentLength -= 1 + p[0];
+                p++;
+            }
+            if ( (flags & AQHTTP2FlagPriority) != 0 )
+            {
+                // we don't prioritize, so the stream dependency & weight are skipped
+                if ( fragmentLength < 5 )
+                {
+                    [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                    return;
+                }
+
+                p += 5;
+                fragmentLength -= 5;
+            }
+
+            _headerBlock = [[NSMutableData alloc] initWithBytes: p length: fragmentLength];
+            _headerStreamID = streamID;
+            _headerFlags = flags;
+
+            if ( (flags & AQHTTP2FlagEndHeaders) != 0 )
+                [self _headerBlockComplete];
+            break;
+        }
+
+        case AQHTTP2FrameContinuation:
+        {
+            if ( _headerBlock == nil )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+
+            [_headerBlock appendBytes: payload length: length];
+            if ( [_headerBlock length] > AQHTTP2MaxHeaderListSize )
+            {
+                [self _closeConnectionWithError: AQHTTP2EnhanceYourCalm];
+                return;
+            }
+
+            if ( (flags & AQHTTP2FlagEndHeaders) != 0 )
+                [self _headerBlockComplete];
+            break;
+        }
+
+        case AQHTTP2FramePriority:
+            if ( streamID == 0 )
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+            else if ( length != 5 )
+                [self _sendResetForStreamID: streamID errorCode: AQHTTP2FrameSizeError];
+            break;
+
+        case AQHTTP2FrameRstStream:
+        {
+            if ( streamID == 0 || streamID > _lastStreamID )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+            if ( length != 4 )
+            {
+                [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+            if ( stream != nil )
+                [self _removeStream: stream];
+            break;
+        }
+
+        case AQHTTP2FrameSettings:
+        {
+            if ( streamID != 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+
+            if ( (flags & AQHTTP2FlagAck) != 0 )
+            {
+                if ( length != 0 )
+                    [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            if ( length % 6 != 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            uint32_t err = [self _applySettings: payload length: length];
+            if ( err != AQHTTP2NoError )
+            {
+                [self _closeConnectionWithError: err];
+                return;
+            }
+
+            _sawSettings = YES;
+            [self _sendFrameType: AQHTTP2FrameSettings flags: AQHTTP2FlagAck streamID: 0 payload: nil];
+
+            // a larger initial window may have unblocked some streams
+            [self _pumpOutput];
+            break;
+        }
+
+        case AQHTTP2FramePushPromise:
+            // clients can't push
+            [self _closeConnectionWithError: AQHTTP2ProtocolError];
+            return;
+
+        case AQHTTP2FramePing:
+        {
+            if ( streamID != 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+            if ( length != 8 )
+            {
+                [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            if ( (flags & AQHTTP2FlagAck) == 0 )
+                [self _sendFrameType: AQHTTP2FramePing flags: AQHTTP2FlagAck streamID: 0 payload: [NSData dataWithBytes: payload length: length]];
+            break;
+        }
+
+        case AQHTTP2FrameGoAway:
+        {
+            if ( streamID != 0 )
+            {
+                [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                return;
+            }
+            if ( length < 8 )
+            {
+                [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            // finish what we've started, then close
+            _goingAway = YES;
+            if ( [_streams count] == 0 )
+                [self _closeConnectionWithError: AQHTTP2NoError];
+            break;
+        }
+
+        case AQHTTP2FrameWindowUpdate:
+        {
+            if ( length != 4 )
+            {
+                [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+                return;
+            }
+
+            uint32_t increment = _AQReadUInt32(payload) & 0x7fffffff;
+            if ( streamID == 0 )
+            {
+                if ( increment == 0 )
+                {
+                    [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                    return;
+                }
+
+                _sendWindow += increment;
+                if ( _sendWindow > AQHTTP2MaxWindowSize )
+                {
+                    [self _closeConnectionWithError: AQHTTP2FlowControlError];
+                    return;
+                }
+            }
+            else
+            {
+                _AQHTTP2Stream * stream = [_streams objectForKey: [NSNumber numberWithUnsignedInt: streamID]];
+                if ( stream == nil )
+                {
+                    if ( streamID > _lastStreamID )
+                        [self _closeConnectionWithError: AQHTTP2ProtocolError];
+                    return;     // otherwise it's for a stream we've already closed
+                }
+
+                if ( increment == 0 )
+                {
+                    [self _resetStream: stream errorCode: AQHTTP2ProtocolError];
+                    return;
+                }
+
+                stream->_sendWindow += increment;
+                if ( stream->_sendWindow > AQHTTP2MaxWindowSize )
+                {
+                    [self _resetStream: stream errorCode: AQHTTP2FlowControlError];
+                    return;
+                }
+
+                if ( [stream->_pendingWrites count] != 0 )
+                    [self _scheduleStream: stream];
+            }
+
+            [self _pumpOutput];
+            break;
+        }
+
+        default:
+            // unknown frame types must be ignored
+            break;
+    }
+}
+
+- (void) _processInput
+{
+    if ( _started == NO || _closed )
+        return;
+
+    const uint8_t * bytes = [_inputBuffer bytes];
+    NSUInteger available = [_inputBuffer length];
+    NSUInteger offset = 0;
+
+    if ( _sawPreface == NO )
+    {
+        NSUInteger checkLength = MIN(available, AQHTTP2ConnectionPrefaceLength);
+        if ( memcmp(bytes, _AQHTTP2ConnectionPreface, checkLength) != 0 )
+        {
+            [self _closeConnectionWithError: AQHTTP2ProtocolError];
+            return;
+        }
+
+        if ( available < AQHTTP2ConnectionPrefaceLength )
+            return;
+
+        offset = AQHTTP2ConnectionPrefaceLength;
+        _sawPreface = YES;
+    }
+
+    while ( _closed == NO && available - offset >= AQHTTP2FrameHeaderLength )
+    {
+        const uint8_t * header = bytes + offset;
+        NSUInteger length = ((NSUInteger)header[0] << 16) | ((NSUInteger)header[1] << 8) | (NSUInteger)header[2];
+        uint8_t type = header[3];
+        uint8_t flags = header[4];
+        uint32_t streamID = _AQReadUInt32(header + 5) & 0x7fffffff;
+
+        // we never advertise a larger SETTINGS_MAX_FRAME_SIZE than the default
+        if ( length > AQHTTP2DefaultMaxFrameSize )
+        {
+            [self _closeConnectionWithError: AQHTTP2FrameSizeError];
+            return;
+        }
+
+        if ( available - offset - AQHTTP2FrameHeaderLength < length )
+            break;      // wait for the rest of the frame
+
+        [self _handleFrameType: type flags: flags streamID: streamID payload: header + AQHTTP2FrameHeaderLength length: length];
+        offset += AQHTTP2FrameHeaderLength + length;
+    }
+
+    if ( _closed == NO && offset != 0 )
+        [_inputBuffer replaceBytesInRange: NSMakeRange(0, offset) withBytes: NULL length: 0];
+}
+
+@end
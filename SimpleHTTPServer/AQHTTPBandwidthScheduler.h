@@ -0,0 +1,85 @@
+//
+//  AQHTTPBandwidthScheduler.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AQHTTPConnection;
+
+/// The number of bytes a response sends before it drops from the first priority class to the second.
+#define AQHTTPBandwidthInteractiveLimit     (64 * 1024)
+
+/// The number of bytes a response sends before it drops from the second priority class to the last.
+#define AQHTTPBandwidthBulkThreshold        (1024 * 1024)
+
+/**
+ An AQHTTPBandwidthScheduler shares a server's outgoing bandwidth between
+ the responses it is sending.
+
+ Responses ask the scheduler before each write. When the server's output is
+ limited by a rate, waiting responses are served using deficit round-robin,
+ so each receives an equal share of the rate in bytes regardless of how
+ large its individual writes are.
+
+ Responses are divided into three priority classes by how much they have
+ sent so far: up to AQHTTPBandwidthInteractiveLimit bytes, up to
+ AQHTTPBandwidthBulkThreshold bytes, and beyond. A waiting response in a
+ higher class is always served before one in a lower class, so small
+ responses, and the start of every response, aren't held up behind bulk
+ downloads.
+
+ Connections may also be limited individually, in which case each
+ connection's responses share its rate between them.
+ */
+@interface AQHTTPBandwidthScheduler : NSObject
+
+/**
+ Initializes a bandwidth scheduler.
+ @param rate The most bytes per second to send across all connections, or
+ zero for no limit.
+ @param connectionRate The most bytes per second to send on any one
+ connection, or zero for no limit.
+ @result A new bandwidth scheduler.
+ */
+- (id) initWithRate: (NSUInteger) rate connectionRate: (NSUInteger) connectionRate;
+
+/// The most bytes per second sent across all connections, or zero if unlimited.
+@property (nonatomic, readonly) NSUInteger rate;
+
+/// The most bytes per second sent on any one connection, or zero if unlimited.
+@property (nonatomic, readonly) NSUInteger connectionRate;
+
+/**
+ The number of bytes by which a waiting response's credit grows each time
+ its turn comes around. The default is 16KB.
+ */
+@property (nonatomic, assign) NSUInteger quantum;
+
+/**
+ Creates an object representing the output of a single response.
+ @param connection The connection on which the response is being sent.
+ @result An opaque object to pass to -waitToSend:onFlow:.
+ */
+- (id) flowForConnection: (AQHTTPConnection *) connection;
+
+/**
+ Blocks until a response may send some data.
+ @param length The number of bytes the response is about to send.
+ @param flow The response's flow, as returned by -flowForConnection:.
+ @result Returns `YES` when the response may send, or `NO` if its connection
+ has closed, in which case it should give up.
+ */
+- (BOOL) waitToSend: (NSUInteger) length onFlow: (id) flow;
+
+/**
+ Discards the state kept for a connection, and releases any of its responses
+ waiting in -waitToSend:onFlow:. Called by the server as its connections close.
+ @param connection The connection which has closed.
+ */
+- (void) connectionDidClose: (AQHTTPConnection *) connection;
+
+@end
@@ -0,0 +1,361 @@
+//
+//  AQHTTPBandwidthScheduler.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPBandwidthScheduler.h"
+
+#define AQHTTPBandwidthClassCount           3
+#define AQHTTPBandwidthDefaultQuantum       (16 * 1024)
+
+// while responses are waiting for their rate to refill, they're looked at this often
+#define AQHTTPBandwidthServiceInterval      (10 * NSEC_PER_MSEC)
+
+// a rate limit allows bursts of this many seconds' worth of data
+#define AQHTTPBandwidthBurstDuration        0.1
+
+@interface _AQTokenBucket : NSObject
+{
+@public
+    double          _rate;          // bytes per second; zero means unlimited
+    double          _capacity;
+    double          _tokens;        // may go negative: a large write borrows against future refills
+    NSTimeInterval  _lastRefill;
+}
+- (id) initWithRate: (NSUInteger) rate;
+- (BOOL) hasTokensAtTime: (NSTimeInterval) now;
+- (void) spend: (NSUInteger) length;
+@end
+
+@implementation _AQTokenBucket
+
+- (id) initWithRate: (NSUInteger) rate
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _rate = (double)rate;
+    _capacity = MAX(_rate * AQHTTPBandwidthBurstDuration, (double)AQHTTPBandwidthDefaultQuantum);
+    _tokens = _capacity;
+    _lastRefill = [NSDate timeIntervalSinceReferenceDate];
+
+    return ( self );
+}
+
+- (BOOL) hasTokensAtTime: (NSTimeInterval) now
+{
+    if ( _rate == 0.0 )
+        return ( YES );
+
+    _tokens = MIN(_capacity, _tokens + (now - _lastRefill) * _rate);
+    _lastRefill = now;
+    return ( _tokens > 0.0 );
+}
+
+- (void) spend: (NSUInteger) length
+{
+    if ( _rate != 0.0 )
+        _tokens -= (double)length;
+}
+
+@end
+
+@interface _AQHTTPBandwidthFlow : NSObject
+{
+@public
+    _AQTokenBucket *        _connectionBucket;  // shared by all flows on the same connection
+    UInt64                  _bytesSent;
+    NSUInteger              _deficit;
+    NSUInteger              _pendingLength;
+    dispatch_semaphore_t    _grant;
+    void *                  _connection;        // identifies the connection; never dereferenced
+    BOOL                    _cancelled;         // set once the connection has closed
+}
+- (NSUInteger) priorityClass;
+@end
+
+@implementation _AQHTTPBandwidthFlow
+
+- (id) init
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _grant = dispatch_semaphore_create(0);
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+#if USING_MRR || DISPATCH_USES_ARC == 0
+    dispatch_release(_grant);
+#endif
+#if USING_MRR
+    [_connectionBucket release];
+    [super dealloc];
+#endif
+}
+
+- (NSUInteger) priorityClass
+{
+    if ( _bytesSent < AQHTTPBandwidthInteractiveLimit )
+        return ( 0 );
+    if ( _bytesSent < AQHTTPBandwidthBulkThreshold )
+        return ( 1 );
+    return ( 2 );
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTPBandwidthScheduler
+{
+    dispatch_queue_t        _q;
+    _AQTokenBucket *        _bucket;
+    NSUInteger              _connectionRate;
+    NSUInteger              _quantum;
+
+    NSMutableDictionary *   _connectionBuckets;     // non-retained connection -> _AQTokenBucket
+    NSArray *               _waiting;               // one round-robin list of waiting flows per priority class
+    NSUInteger              _waitingCount;
+    BOOL                    _serviceScheduled;
+}
+
+@synthesize connectionRate=_connectionRate, quantum=_quantum;
+
+- (id) initWithRate: (NSUInteger) rate connectionRate: (NSUInteger) connectionRate
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _q = dispatch_queue_create("me.alanquatermain.AQHTTPBandwidthScheduler", DISPATCH_QUEUE_SERIAL);
+    _bucket = [[_AQTokenBucket alloc] initWithRate: rate];
+    _connectionRate = connectionRate;
+    _quantum = AQHTTPBandwidthDefaultQuantum;
+    _connectionBuckets = [NSMutableDictionary new];
+
+    NSMutableArray * waiting = [NSMutableArray new];
+    for ( NSUInteger i = 0; i < AQHTTPBandwidthClassCount; i++ )
+    {
+        NSMutableArray * list = [NSMutableArray new];
+        [waiting addObject: list];
+#if USING_MRR
+        [list release];
+#endif
+    }
+    _waiting = waiting;
+
+    return ( self );
+}
+
+#if USING_MRR || DISPATCH_USES_ARC == 0
+- (void) dealloc
+{
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(_q);
+#endif
+#if USING_MRR
+    [_bucket release];
+    [_connectionBuckets release];
+    [_waiting release];
+    [super dealloc];
+#endif
+}
+#endif
+
+- (NSUInteger) rate
+{
+    return ( (NSUInteger)_bucket->_rate );
+}
+
+- (id) flowForConnection: (AQHTTPConnection *) connection
+{
+    _AQHTTPBandwidthFlow * flow = [_AQHTTPBandwidthFlow new];
+    flow->_connection = (__bridge void *)connection;
+    if ( _connectionRate != 0 )
+    {
+        dispatch_sync(_q, ^{
+            NSValue * key = [NSValue valueWithNonretainedObject: connection];
+            _AQTokenBucket * bucket = [_connectionBuckets objectForKey: key];
+            if ( bucket == nil )
+            {
+                bucket = [[_AQTokenBucket alloc] initWithRate: _connectionRate];
+                [_connectionBuckets setObject: bucket forKey: key];
+#if USING_MRR
+                [bucket autorelease];
+#endif
+            }
+#if USING_MRR
+            flow->_connectionBucket = [bucket retain];
+#else
+            flow->_connectionBucket = bucket;
+#endif
+        });
+    }
+
+#if USING_MRR
+    return ( [flow autorelease] );
+#else
+    return ( flow );
+#endif
+}
+
+- (void) connectionDidClose: (AQHTTPConnection *) connection
+{
+    void * key = (__bridge void *)connection;
+    dispatch_async(_q, ^{
+        [_connectionBuckets removeObjectForKey: [NSValue valueWithNonretainedObject: connection]];
+
+        // nothing more will be sent for the connection's responses, so any still waiting are sent on their way
+        for ( NSMutableArray * list in _waiting )
+        {
+            for ( NSUInteger i = [list count]; i > 0; i-- )
+            {
+                _AQHTTPBandwidthFlow * flow = [list objectAtIndex: i - 1];
+                if ( flow->_connection != key )
+                    continue;
+
+                flow->_cancelled = YES;
+                flow->_pendingLength = 0;
+                dispatch_semaphore_signal(flow->_grant);
+                [list removeObjectAtIndex: i - 1];
+                _waitingCount--;
+            }
+        }
+    });
+}
+
+// must be called on _q
+- (BOOL) _isLimitedAtTime: (NSTimeInterval) now flow: (_AQHTTPBandwidthFlow *) flow
+{
+    if ( [_bucket hasTokensAtTime: now] == NO )
+        return ( YES );
+    if ( flow->_connectionBucket != nil && [flow->_connectionBucket hasTokensAtTime: now] == NO )
+        return ( YES );
+    return ( NO );
+}
+
+// must be called on _q
+- (void) _flow: (_AQHTTPBandwidthFlow *) flow sends: (NSUInteger) length
+{
+    [_bucket spend: length];
+    [flow->_connectionBucket spend: length];
+    flow->_bytesSent += length;
+
+    // a flow keeps at most one quantum of unspent credit between its writes
+    flow->_deficit = (flow->_deficit > length ? flow->_deficit - length : 0);
+    flow->_deficit = MIN(flow->_deficit, _quantum);
+}
+
+- (BOOL) waitToSend: (NSUInteger) length onFlow: (id) flowObject
+{
+    _AQHTTPBandwidthFlow * flow = flowObject;
+    __block BOOL granted = NO;
+    __block BOOL queued = NO;
+
+    dispatch_sync(_q, ^{
+        if ( flow->_cancelled )
+            return;
+
+        NSUInteger priorityClass = [flow priorityClass];
+
+        // a flow may go straight ahead if nobody of its class or higher is waiting, or if it has the credit to do so
+        BOOL contended = NO;
+        for ( NSUInteger i = 0; i <= priorityClass; i++ )
+        {
+            if ( [[_waiting objectAtIndex: i] count] != 0 )
+                contended = YES;
+        }
+
+        if ( (contended == NO || flow->_deficit >= length) && [self _isLimitedAtTime: [NSDate timeIntervalSinceReferenceDate] flow: flow] == NO )
+        {
+            [self _flow: flow sends: length];
+            granted = YES;
+            return;
+        }
+
+        flow->_pendingLength = length;
+        [[_waiting objectAtIndex: priorityClass] addObject: flow];
+        _waitingCount++;
+        queued = YES;
+        [self _scheduleService];
+    });
+
+    if ( queued == NO )
+        return ( granted );
+
+    // signalled when the flow's turn comes, or when its connection closes
+    dispatch_semaphore_wait(flow->_grant, DISPATCH_TIME_FOREVER);
+
+    __block BOOL cancelled = NO;
+    dispatch_sync(_q, ^{ cancelled = flow->_cancelled; });
+    return ( cancelled == NO );
+}
+
+// must be called on _q
+- (void) _scheduleService
+{
+    if ( _serviceScheduled || _waitingCount == 0 )
+        return;
+
+    _serviceScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, AQHTTPBandwidthServiceInterval), _q, ^{
+        _serviceScheduled = NO;
+        [self _service];
+        [self _scheduleService];
+    });
+}
+
+// must be called on _q
+- (void) _service
+{
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    for ( NSMutableArray * list in _waiting )
+    {
+        // flows held back by their connection's rate step aside for the rest of the list
+        NSUInteger limited = 0;
+        while ( [list count] > limited )
+        {
+            if ( [_bucket hasTokensAtTime: now] == NO )
+                return;     // nobody can send until the next refill
+
+            _AQHTTPBandwidthFlow * flow = [list objectAtIndex: 0];
+#if USING_MRR
+            [[flow retain] autorelease];
+#endif
+            [list removeObjectAtIndex: 0];
+
+            if ( [self _isLimitedAtTime: now flow: flow] )
+            {
+                [list addObject: flow];
+                limited++;
+                continue;
+            }
+
+            // each turn earns the flow another quantum of credit; it sends once it has enough
+            flow->_deficit += _quantum;
+            if ( flow->_deficit < flow->_pendingLength )
+            {
+                [list addObject: flow];
+                continue;
+            }
+
+            [self _flow: flow sends: flow->_pendingLength];
+            flow->_pendingLength = 0;
+            _waitingCount--;
+            limited = 0;
+            dispatch_semaphore_signal(flow->_grant);
+        }
+    }
+}
+
+@end
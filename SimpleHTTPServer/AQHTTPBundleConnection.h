@@ -0,0 +1,33 @@
+//
+//  AQHTTPBundleConnection.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPConnection.h"
+
+@class AQHTTPContentBundle;
+
+/**
+ An AQHTTPConnection subclass which serves content from a packed content bundle
+ rather than from a folder.
+
+ The connection's documentRoot is expected to be the file URL of a bundle built
+ by the SimpleHTTPBundleBuilder tool. All connections serving the same bundle
+ share a single memory mapping of that file, so serving a request involves no
+ file-system calls at all; see AQHTTPContentBundle for details.
+
+ Install this class using -[AQHTTPServer setConnectionClass:].
+ */
+@interface AQHTTPBundleConnection : AQHTTPConnection
+
+/**
+ The bundle from which content is being served, or `nil` if the document root
+ could not be opened as a content bundle. In the latter case, all requests will
+ receive a `404 Not Found` response.
+ */
+@property (nonatomic, readonly) AQHTTPContentBundle * contentBundle;
+
+@end
@@ -0,0 +1,94 @@
+//
+//  AQHTTPBundleConnection.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPBundleConnection.h"
+#import "AQHTTPBundleResponseOperation.h"
+#import "AQHTTPContentBundle.h"
+
+@implementation AQHTTPBundleConnection
+{
+    AQHTTPContentBundle * _contentBundle;
+}
+
+- (id) initWithSocket: (AQSocket *) aSocket documentRoot: (NSURL *) documentRoot forServer: (AQHTTPServer *) server
+{
+    self = [super initWithSocket: aSocket documentRoot: documentRoot forServer: server];
+    if ( self == nil )
+        return ( nil );
+
+    [self _loadContentBundle];
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_contentBundle release];
+    [super dealloc];
+}
+#endif
+
+- (void) _loadContentBundle
+{
+    NSError * error = nil;
+    AQHTTPContentBundle * bundle = [AQHTTPContentBundle contentBundleWithURL: self.documentRoot error: &error];
+    if ( bundle == nil )
+        NSLog(@"Unable to open content bundle at %@: %@", self.documentRoot, error);
+
+    @synchronized(self)
+    {
+#if USING_MRR
+        [_contentBundle release];
+        _contentBundle = [bundle retain];
+#else
+        _contentBundle = bundle;
+#endif
+    }
+}
+
+- (AQHTTPContentBundle *) contentBundle
+{
+    @synchronized(self)
+    {
+#if USING_MRR
+        return ( [[_contentBundle retain] autorelease] );
+#else
+        return ( _contentBundle );
+#endif
+    }
+}
+
+- (void) documentRootDidChange
+{
+    // the old bundle's no longer being served, so it needn't stay mapped once the requests still using it are done
+    NSURL * oldURL = self.contentBundle.URL;
+    [self _loadContentBundle];
+    if ( oldURL != nil && [oldURL isEqual: self.contentBundle.URL] == NO )
+        [AQHTTPContentBundle removeSharedContentBundleWithURL: oldURL];
+}
+
+- (AQHTTPResponseOperation *) fileResponseOperationForRequest: (CFHTTPMessageRef) request
+{
+    NSArray * ranges = nil;
+    NSString * rangeHeader = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Range")));
+    if ( rangeHeader != nil )
+    {
+        const AQHTTPContentBundleEntry * entry = [self.contentBundle entryForRequestPath: AQHTTPRequestPath(request)];
+        if ( entry != NULL )
+            ranges = [self parseRangeRequest: rangeHeader withContentLength: AQHTTPContentBundleEntryLength(entry, NO)];
+    }
+
+    AQHTTPBundleResponseOperation * op = [[AQHTTPBundleResponseOperation alloc] initWithRequest: request socket: self.socket ranges: ranges forConnection: self];
+#if USING_MRR
+    [op autorelease];
+#endif
+    return ( op );
+}
+
+@end
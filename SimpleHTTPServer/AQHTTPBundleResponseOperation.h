@@ -0,0 +1,23 @@
+//
+//  AQHTTPBundleResponseOperation.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AQHTTPResponseOperation.h"
+
+/**
+ A response operation which serves items from the content bundle of an
+ AQHTTPBundleConnection.
+
+ Metadata (size, Etag, MIME type, modification date) comes straight from the
+ bundle index, and item contents are sent directly from the mapped bundle
+ file without being copied. Where the bundle contains a precompressed variant
+ of an item and the client accepts gzip encoding, the compressed variant is
+ sent instead.
+ */
+@interface AQHTTPBundleResponseOperation : AQHTTPResponseOperation
+@end
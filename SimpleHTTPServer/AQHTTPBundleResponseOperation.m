@@ -0,0 +1,239 @@
+//
+//  AQHTTPBundleResponseOperation.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPBundleResponseOperation.h"
+#import "AQHTTPBundleConnection.h"
+#import "AQHTTPContentBundle.h"
+#import "NSDateFormatter+AQHTTPDateFormatter.h"
+
+// Random access to a single bundle item, handing out no-copy subranges of the mapped file.
+@interface _AQContentBundleItem : NSObject <AQRandomAccessFile>
+{
+    AQHTTPContentBundle * _bundle;
+    const AQHTTPContentBundleEntry * _entry;
+    BOOL _compressed;
+}
+- (id) initWithBundle: (AQHTTPContentBundle *) bundle entry: (const AQHTTPContentBundleEntry *) entry compressed: (BOOL) compressed;
+@end
+
+@implementation _AQContentBundleItem
+
+- (id) initWithBundle: (AQHTTPContentBundle *) bundle entry: (const AQHTTPContentBundleEntry *) entry compressed: (BOOL) compressed
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+#if USING_MRR
+    _bundle = [bundle retain];
+#else
+    _bundle = bundle;
+#endif
+    _entry = entry;
+    _compressed = compressed;
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_bundle release];
+    [super dealloc];
+}
+#endif
+
+- (UInt64) length
+{
+    return ( AQHTTPContentBundleEntryLength(_entry, _compressed) );
+}
+
+- (NSData *) readDataFromByteRange: (DDRange) range
+{
+    return ( [_bundle dataForEntry: _entry range: NSRangeFromDDRange(range) compressed: _compressed] );
+}
+
+@end
+
+#pragma mark -
+
+static BOOL _AcceptsGzipEncoding(CFHTTPMessageRef request)
+{
+    NSString * accept = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Accept-Encoding")));
+    if ( accept == nil )
+        return ( NO );
+
+    for ( NSString * item in [accept componentsSeparatedByString: @","] )
+    {
+        NSArray * params = [item componentsSeparatedByString: @";"];
+        NSString * coding = [[params objectAtIndex: 0] stringByTrimmingCharactersInSet: [NSCharacterSet whitespaceCharacterSet]];
+        if ( [coding caseInsensitiveCompare: @"gzip"] != NSOrderedSame )
+            continue;
+
+        // "gzip;q=0" means the client explicitly does NOT want it
+        for ( NSUInteger i = 1; i < [params count]; i++ )
+        {
+            NSString * param = [[params objectAtIndex: i] stringByTrimmingCharactersInSet: [NSCharacterSet whitespaceCharacterSet]];
+            if ( [param hasPrefix: @"q="] && [[param substringFromIndex: 2] doubleValue] == 0.0 )
+                return ( NO );
+        }
+
+        return ( YES );
+    }
+
+    return ( NO );
+}
+
+@implementation AQHTTPBundleResponseOperation
+{
+    AQHTTPContentBundle * _bundle;
+    const AQHTTPContentBundleEntry * _entry;
+    BOOL _lookedUp;
+    BOOL _sendCompressed;
+}
+
+- (id) initWithRequest: (CFHTTPMessageRef) request
+                socket: (AQSocket *) aSocket
+                ranges: (NSArray *) ranges
+         forConnection: (AQHTTPConnection *) connection
+{
+    self = [super initWithRequest: request socket: aSocket ranges: ranges forConnection: connection];
+    if ( self == nil )
+        return ( nil );
+
+    // take our own reference, in case the connection switches bundles while we're in flight
+    if ( [connection isKindOfClass: [AQHTTPBundleConnection class]] )
+    {
+#if USING_MRR
+        _bundle = [[(AQHTTPBundleConnection *)connection contentBundle] retain];
+#else
+        _bundle = [(AQHTTPBundleConnection *)connection contentBundle];
+#endif
+    }
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_bundle release];
+    [super dealloc];
+}
+#endif
+
+- (const AQHTTPContentBundleEntry *) _entryForPath: (NSString *) rootRelativePath
+{
+    if ( _lookedUp )
+        return ( _entry );
+
+    _lookedUp = YES;
+    _entry = [_bundle entryForRequestPath: rootRelativePath];
+
+    // only whole-item responses can be sent compressed: ranges refer to the uncompressed bytes
+    if ( _entry != NULL && _ranges == nil && AQHTTPContentBundleEntryHasCompressedVariant(_entry) )
+        _sendCompressed = _AcceptsGzipEncoding(_request);
+
+    return ( _entry );
+}
+
+- (NSUInteger) statusCodeForItemAtPath: (NSString *) rootRelativePath
+{
+    if ( [self _entryForPath: rootRelativePath] == NULL )
+        return ( 404 );
+
+    NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(_request));
+    if ( [method caseInsensitiveCompare: @"GET"] != NSOrderedSame && [method caseInsensitiveCompare: @"HEAD"] != NSOrderedSame )
+        return ( 405 );
+
+    if ( _ranges != nil )
+        return ( 206 );
+
+    return ( 200 );
+}
+
+- (UInt64) sizeOfItemAtPath: (NSString *) rootRelativePath
+{
+    const AQHTTPContentBundleEntry * entry = [self _entryForPath: rootRelativePath];
+    if ( entry == NULL )
+        return ( (UInt64)-1 );
+
+    return ( AQHTTPContentBundleEntryLength(entry, _sendCompressed) );
+}
+
+- (NSString *) etagForItemAtPath: (NSString *) rootRelativePath
+{
+    const AQHTTPContentBundleEntry * entry = [self _entryForPath: rootRelativePath];
+    if ( entry == NULL )
+        return ( nil );
+
+    NSString * etag = [_bundle etagForEntry: entry];
+
+    // the compressed representation is a different entity, so it needs a distinct tag
+    if ( etag != nil && _sendCompressed )
+        etag = [etag stringByAppendingString: @"-gzip"];
+
+    return ( etag );
+}
+
+- (NSString *) contentTypeForItemAtPath: (NSString *) rootRelativePath
+{
+    const AQHTTPContentBundleEntry * entry = [self _entryForPath: rootRelativePath];
+    NSString * contentType = (entry != NULL ? [_bundle contentTypeForEntry: entry] : nil);
+    if ( [contentType length] == 0 )
+        contentType = [super contentTypeForItemAtPath: rootRelativePath];
+
+    return ( contentType );
+}
+
+- (id<AQRandomAccessFile>) randomAccessFileForItemAtPath: (NSString *) rootRelativePath
+{
+    const AQHTTPContentBundleEntry * entry = [self _entryForPath: rootRelativePath];
+    if ( entry == NULL )
+        return ( nil );
+
+    _AQContentBundleItem * item = [[_AQContentBundleItem alloc] initWithBundle: _bundle entry: entry compressed: _sendCompressed];
+#if USING_MRR
+    [item autorelease];
+#endif
+    return ( item );
+}
+
+- (CFHTTPMessageRef) newResponseForItemAtPath: (NSString *) path
+                               withHTTPStatus: (NSUInteger) status
+{
+    CFHTTPMessageRef response = [super newResponseForItemAtPath: path withHTTPStatus: status];
+    if ( response == NULL )
+        return ( NULL );
+
+    CFIndex actualStatus = CFHTTPMessageGetResponseStatusCode(response);
+    if ( actualStatus == 405 )
+    {
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Allow"), CFSTR("GET, HEAD"));
+    }
+
+    const AQHTTPContentBundleEntry * entry = [self _entryForPath: path];
+    if ( entry == NULL || actualStatus >= 400 )
+        return ( response );
+
+    NSDate * modDate = [NSDate dateWithTimeIntervalSince1970: AQHTTPContentBundleEntryModificationTime(entry)];
+    NSString * lastModified = [[NSDateFormatter AQHTTPDateFormatter] stringFromDate: modDate];
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Last-Modified"), (__bridge CFStringRef)lastModified);
+
+    if ( AQHTTPContentBundleEntryHasCompressedVariant(entry) )
+    {
+        // caches need to know that the representation depends on the request's Accept-Encoding header
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Vary"), CFSTR("Accept-Encoding"));
+        if ( _sendCompressed && actualStatus == 200 )
+            CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Encoding"), CFSTR("gzip"));
+    }
+
+    return ( response );
+}
+
+@end
@@ -8,7 +8,7 @@
 
 #import <Foundation/Foundation.h>
 
-@class AQHTTPServer, AQSocket, AQHTTPConnection, AQHTTPResponseOperation;
+@class AQHTTPServer, AQSocket, AQHTTPConnection, AQHTTPResponseOperation, AQHTTPServerConfiguration;
 
 @protocol AQHTTPConnectionDelegate <NSObject>
 - (void) connectionDidClose: (AQHTTPConnection *) connection;
@@ -60,6 +60,14 @@
  */
 @property (nonatomic, readonly, copy) NSURL *documentRoot;
 
+/**
+ The server settings used by the request currently being handled. Response
+ operations take a reference to this when they are created, and use it
+ throughout.
+ @see AQHTTPServerConfiguration
+ */
+@property (nonatomic, readonly) AQHTTPServerConfiguration * configuration;
+
 /**
  Returns the socket used for receiving & sending data.
  */
@@ -83,6 +91,19 @@
  */
 @property (nonatomic, readonly) BOOL supportsPipelinedRequests;
 
+/**
+ The largest request body the connection will accept, in bytes. Zero means
+ there is no limit. Until this is set, the server's maximumRequestBodyLength
+ applies.
+ 
+ A request whose Content-Length exceeds this is refused with a
+ `413 Request Entity Too Large` response and the connection is closed. A
+ chunked body which grows beyond it is cut off: the response operation's
+ next read from its requestBody fails, and the connection is closed once the
+ operation has finished.
+ */
+@property (nonatomic, assign) unsigned long long maximumRequestBodyLength;
+
 /**
  This method will parse a request's Range header into an array of ranges.
  
@@ -106,11 +127,23 @@
  Returns a response operation suitable for handling the request
  provided.
  
+ If the server has a router, the request is passed to it; otherwise the
+ request is handled by -fileResponseOperationForRequest:.
+ 
  Subclasses can override this to provide responses which deal with their
  particular data storage/transmission setups.
  */
 - (AQHTTPResponseOperation *) responseOperationForRequest: (CFHTTPMessageRef) request;
 
+/**
+ Returns a response operation which serves the requested item from the
+ document root, honouring any Range header.
+ 
+ Subclasses which store their content differently can override this; it is
+ also used by +[AQHTTPRouter fileHandler].
+ */
+- (AQHTTPResponseOperation *) fileResponseOperationForRequest: (CFHTTPMessageRef) request;
+
 @end
 
 /**
@@ -121,9 +154,10 @@
 /**
  This method is called when the documentRoot property actually changes.
  
- The setter for the documentRoot property will wait until the currently-enqueued
- operations have finished before changing its value. Once it has done so, it will
- call this method to inform any subclasses of the change.
+ A connection picks up the server's new document root as the next request
+ arrives, and calls this method before asking for that request's response
+ operation. Operations created earlier keep the configuration they started
+ with, so they are unaffected.
  */
 - (void) documentRootDidChange;
 
@@ -7,19 +7,52 @@
 //
 
 #import "AQHTTPConnection.h"
+#import <libkern/OSAtomic.h>
 #import "AQHTTPConnection_PrivateInternal.h"
 #import "AQHTTPServer.h"
+#import "AQHTTPServer_PrivateInternal.h"
 #import "AQSocket.h"
 #import "AQSocketReader.h"
 #import "AQHTTPFileResponseOperation.h"
+#import "AQHTTP2Session.h"
+#import "AQHTTPRouter.h"
+#import "AQHTTPRequestBody.h"
+#import "AQHTTPRequestBody_PrivateInternal.h"
+#import "AQHTTPTrace.h"
+#import "NSDateFormatter+AQHTTPDateFormatter.h"
 #import "DDRange.h"
 #import "DDNumber.h"
 
+// a request header larger than this is refused with '431 Request Header Fields Too Large'
+#define AQHTTPMaximumRequestHeaderLength        (64 * 1024)
+
+static void _AQWriteAndWait(AQSocket * socket, NSData * data)
+{
+    if ( socket.status != AQSocketConnected )
+        return;
+    
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [socket writeBytes: data completion: ^(NSData *unwritten, NSError *error) {
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(sem);
+#endif
+}
+
 @interface AQHTTPConnection ()
 - (void) _setEventHandlerOnSocket;
 - (void) _handleIncomingData: (AQSocketReader *) reader;
 - (void) _socketDisconnected;
 - (void) _socketErrorOccurred: (NSError *) error;
+- (BOOL) _maybeStartHTTP2WithReader: (AQSocketReader *) reader;
+- (BOOL) _upgradeToHTTP2ForRequest: (CFHTTPMessageRef) request;
+- (CFHTTPMessageRef) _newRequestFromReader: (AQSocketReader *) reader;
+- (BOOL) _readBodyFromReader: (AQSocketReader *) reader;
+- (void) _dispatchRequest: (CFHTTPMessageRef) request trace: (AQHTTPTraceID) trace;
+- (BOOL) _answerRequestFromCache: (CFHTTPMessageRef) request configuration: (AQHTTPServerConfiguration *) configuration trace: (AQHTTPTraceID) trace;
+- (void) _refuseRequestWithStatus: (CFIndex) status;
 @end
 
 @implementation AQHTTPConnection
@@ -28,15 +61,40 @@
     NSOperationQueue *_requestQ;
     
     AQSocket * _socket;
-    NSURL * _documentRoot;
-    CFHTTPMessageRef _incomingMessage;
+    
+    // replaced by the server's latest snapshot as each request arrives, only ever by the thread dispatching requests;
+    // other threads take their own reference under the lock, so an old snapshot goes once the last operation using it does
+    AQHTTPServerConfiguration * _configuration;
+    AQHTTPServerConfiguration * _serverConfiguration;  // the server's snapshot from which _configuration was taken
+    OSSpinLock _configurationLock;
+    
+    // a request header which has only partly arrived, and the body currently being received (if any)
+    NSMutableData * _incomingHeader;
+    AQHTTPRequestBody * _incomingBody;
+    unsigned long long _maximumRequestBodyLength;
+    BOOL _hasMaximumRequestBodyLength;
+    
+    // set once we've given up on making sense of the client's input, or answered the last request we'll read from it
+    BOOL _refusingInput;
+    
+    // set when the server wants the connection closed as soon as it's idle
+    BOOL _draining;
+    
+    // cleared for subclasses which choose their own response operations, so they always see every request
+    BOOL _canAnswerFromCache;
     
     NSTimer *   _idleDisconnectionTimer;
     
+    // once the connection has switched to HTTP/2, all incoming data goes here
+    AQHTTP2Session * _http2Session;
+    
+    // the socket returned by -socket while a response operation is being created for an HTTP/2 stream
+    AQSocket * _responseSocket;
+    
     AQHTTPServer * __maybe_weak _server;
 }
 
-@synthesize delegate, documentRoot=_documentRoot, socket=_socket, server=_server;
+@synthesize delegate, socket=_socket, server=_server, draining=_draining;
 
 - (id) initWithSocket: (AQSocket *) aSocket documentRoot: (NSURL *) documentRoot forServer: (AQHTTPServer *) server
 {
@@ -44,12 +102,34 @@
     if ( self == nil )
         return ( nil );
     
-    _documentRoot = [documentRoot copy];
     _server = server;       // weak/unsafe reference
     
+    // the server's settings apply, but with whatever document root we were given
+    AQHTTPServerConfiguration * configuration = server.configuration;
+    AQHTTPServerConfiguration * adopted = configuration;
+    if ( configuration == nil )
+        adopted = [[AQHTTPServerConfiguration alloc] initWithDocumentRoot: documentRoot];
+    else if ( [configuration.documentRoot isEqual: documentRoot] == NO )
+        adopted = [configuration configurationWithDocumentRoot: documentRoot];
+    
+#if USING_MRR
+    _serverConfiguration = [configuration retain];
+    _configuration = (configuration == nil ? adopted : [adopted retain]);
+#else
+    _serverConfiguration = configuration;
+    _configuration = adopted;
+#endif
+    _configurationLock = OS_SPINLOCK_INIT;
+    
     _requestQ = [NSOperationQueue new];
     _requestQ.maxConcurrentOperationCount = 1;
     
+    _incomingHeader = [NSMutableData new];
+    
+    Class cls = [self class];
+    _canAnswerFromCache = ([cls instanceMethodForSelector: @selector(responseOperationForRequest:)] == [AQHTTPConnection instanceMethodForSelector: @selector(responseOperationForRequest:)] &&
+                           [cls instanceMethodForSelector: @selector(fileResponseOperationForRequest:)] == [AQHTTPConnection instanceMethodForSelector: @selector(fileResponseOperationForRequest:)]);
+    
     // don't install the event handler until we've got the queue ready: the event handler might be called immediately if data has already arrived.
     _socket = aSocket;
 #if USING_MRR
@@ -66,19 +146,23 @@
 
 - (void) dealloc
 {
-    if ( _incomingMessage != NULL )
-        CFRelease(_incomingMessage);
     _socket.eventHandler = nil;
 #if USING_MRR
-    [_documentRoot release];
+    [_configuration release];
+    [_serverConfiguration release];
     [_socket release];
     [_requestQ release];
+    [_http2Session release];
+    [_incomingHeader release];
+    [_incomingBody release];
     [super dealloc];
 #endif
 }
 
 - (void) close
 {
+    [_http2Session close];
+    [_incomingBody failWithError: nil];
     [_requestQ cancelAllOperations];
     [_socket close];
     _socket.eventHandler = nil;
@@ -90,29 +174,82 @@
     [self.delegate connectionDidClose: self];
 }
 
-- (void) setDocumentRoot: (NSURL *) documentRoot
+- (AQSocket *) socket
+{
+    if ( _responseSocket != nil )
+        return ( _responseSocket );
+    return ( _socket );
+}
+
+- (AQHTTPServerConfiguration *) configuration
 {
-    dispatch_block_t setterBody = ^{
+    // the reference is taken under the lock, so the snapshot can't be released between reading the pointer and retaining it
+    OSSpinLockLock(&_configurationLock);
+    AQHTTPServerConfiguration * configuration = _configuration;
 #if USING_MRR
-        NSURL * newValue = [documentRoot copy];
-        NSURL * oldValue = _documentRoot;
-        _documentRoot = newValue;
-        [oldValue release];
+    [configuration retain];
+#endif
+    OSSpinLockUnlock(&_configurationLock);
+    
+#if USING_MRR
+    return ( [configuration autorelease] );
 #else
-        _documentRoot = [documentRoot copy];
+    return ( configuration );
 #endif
-        [self documentRootDidChange];
-    };
+}
+
+- (NSURL *) documentRoot
+{
+    return ( self.configuration.documentRoot );
+}
+
+- (AQHTTPServerConfiguration *) _currentConfiguration
+{
+    // called only while dispatching a request, which happens for one request at a time, so nothing else writes these ivars
+    AQHTTPServerConfiguration * latest = _server.configuration;
+    AQHTTPServerConfiguration * current = _configuration;
+    if ( latest == nil || latest == _serverConfiguration )
+        return ( current );
     
-    if ( [_requestQ operationCount] != 0 )
-    {
-        // wait until the in-flight operations have completed before updating the value
-        [[[_requestQ operations] lastObject] setCompletionBlock: setterBody];
-        return;
-    }
+    // operations already queued hold on to the snapshot they were created with, so we can switch straight away
+    AQHTTPServerConfiguration * adopted = latest;
+    if ( latest.documentRoot == nil )
+        adopted = [latest configurationWithDocumentRoot: current.documentRoot];     // never propagate nil URLs
+    BOOL rootChanged = ([adopted.documentRoot isEqual: current.documentRoot] == NO);
+    
+    // the old snapshots are released outside the lock (by `current` and `previous`, under ARC), since that may close a document root
+    AQHTTPServerConfiguration * previous = _serverConfiguration;
+    OSSpinLockLock(&_configurationLock);
+#if USING_MRR
+    _serverConfiguration = [latest retain];
+    _configuration = [adopted retain];
+#else
+    _serverConfiguration = latest;
+    _configuration = adopted;
+#endif
+    OSSpinLockUnlock(&_configurationLock);
+#if USING_MRR
+    [previous release];
+    [current release];
+#endif
+    
+    if ( rootChanged )
+        [self documentRootDidChange];
     
-    // otherwise, we can go ahead and do it now
-    setterBody();
+    return ( adopted );
+}
+
+- (unsigned long long) maximumRequestBodyLength
+{
+    if ( _hasMaximumRequestBodyLength )
+        return ( _maximumRequestBodyLength );
+    return ( self.configuration.maximumRequestBodyLength );
+}
+
+- (void) setMaximumRequestBodyLength: (unsigned long long) maximumRequestBodyLength
+{
+    _maximumRequestBodyLength = maximumRequestBodyLength;
+    _hasMaximumRequestBodyLength = YES;
 }
 
 - (void) _setEventHandlerOnSocket
@@ -285,8 +422,9 @@
     if ( _idleDisconnectionTimer != nil )
         return;
     
-    _idleDisconnectionTimer = [[NSTimer alloc] initWithFireDate: [NSDate dateWithTimeIntervalSinceNow: 2.0]
-                                                       interval: 2.0
+    NSTimeInterval idleTimeout = self.configuration.idleTimeout;
+    _idleDisconnectionTimer = [[NSTimer alloc] initWithFireDate: [NSDate dateWithTimeIntervalSinceNow: idleTimeout]
+                                                       interval: idleTimeout
                                                          target: self
                                                        selector: @selector(_checkIdleTimer:)
                                                        userInfo: nil
@@ -294,103 +432,581 @@
     [[NSRunLoop mainRunLoop] addTimer: _idleDisconnectionTimer forMode: NSRunLoopCommonModes];
 }
 
+- (void) _cancelIdleTimer
+{
+    if ( [_idleDisconnectionTimer isValid] )
+    {
+        [_idleDisconnectionTimer invalidate];
+#if USING_MRR
+        [_idleDisconnectionTimer release];
+#endif
+        _idleDisconnectionTimer = nil;
+    }
+}
+
+- (void) _drain
+{
+    _draining = YES;
+    
+    // an HTTP/2 client is told to stop opening streams, and the session closes the connection after the last one
+    if ( _http2Session != nil )
+    {
+        [_http2Session drain];
+        return;
+    }
+    
+    // otherwise, responses now carry 'Connection: close', so only an idle connection needs closing here
+    if ( [_requestQ operationCount] == 0 && [_incomingHeader length] == 0 && _incomingBody == nil )
+        [self close];
+}
+
 - (void) _checkIdleTimer: (NSTimer *) timer
 {
     if ( [_requestQ operationCount] != 0 )
         return;
+    if ( _socket.queuedWriteByteCount != 0 )
+        return;     // a response written directly from the cache is still going out
+    if ( _http2Session != nil && _http2Session.idle == NO )
+        return;
     
     // disconnect due to under-utilization
     [self close];
 }
 
 - (AQHTTPResponseOperation *) responseOperationForRequest: (CFHTTPMessageRef) request
+{
+    AQHTTPRouter * router = _server.router;
+    if ( router != nil )
+        return ( [router responseOperationForRequest: request connection: self] );
+    
+    return ( [self fileResponseOperationForRequest: request] );
+}
+
+- (AQHTTPResponseOperation *) fileResponseOperationForRequest: (CFHTTPMessageRef) request
 {
     NSString * rangeHeader = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Range")));
     NSArray * ranges = nil;
     if ( rangeHeader != nil )
     {
-        NSString * path = [(NSURL *)CFBridgingRelease(CFHTTPMessageCopyRequestURL(request)) path];
-        path = [[_documentRoot path] stringByAppendingPathComponent: path];
-        ranges = [self parseRangeRequest: rangeHeader withContentLength: [[[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL] fileSize]];
+        struct stat st;
+        if ( [self.configuration getStatus: &st ofItemAtPath: AQHTTPRequestPath(request)] == NO )
+            st.st_size = 0;
+        ranges = [self parseRangeRequest: rangeHeader withContentLength: (UInt64)st.st_size];
     }
     
     // the best thing about this approach? It works with pipelining!
-    AQHTTPFileResponseOperation * op = [[AQHTTPFileResponseOperation alloc] initWithRequest: request socket: _socket ranges: ranges forConnection: self];
+    AQHTTPFileResponseOperation * op = [[AQHTTPFileResponseOperation alloc] initWithRequest: request socket: self.socket ranges: ranges forConnection: self];
 #if USING_MRR
     [op autorelease];
 #endif
     return ( op );
 }
 
-- (void) _handleIncomingData: (AQSocketReader *) reader
+- (AQHTTPResponseOperation *) _responseOperationForRequest: (CFHTTPMessageRef) request socket: (AQSocket *) socket
 {
-#if DEBUGLOG
-    NSLog(@"Data arriving on %p; length=%lu", self, (unsigned long)reader.length);
+    [_server _noteRequestReceived];
+    [self _currentConfiguration];
+    
+    // subclasses create their operations using self.socket, so we substitute the stream's socket while they do so
+    // the session asks for its streams' operations one at a time, on its own queue, so this needs no lock
+    _responseSocket = socket;
+    AQHTTPResponseOperation * op = [self responseOperationForRequest: request];
+    _responseSocket = nil;
+    
+    return ( op );
+}
+
+- (BOOL) _maybeStartHTTP2WithReader: (AQSocketReader *) reader
+{
+    // a client with prior knowledge of HTTP/2 support opens with the connection preface
+    NSData * preface = [AQHTTP2Session connectionPreface];
+    NSUInteger length = MIN(reader.length, [preface length]);
+    if ( length == 0 )
+        return ( NO );
+    
+    NSData * peeked = [reader peekBytes: length];
+    if ( memcmp([peeked bytes], [preface bytes], length) != 0 )
+        return ( NO );
+    
+    if ( length < [preface length] )
+        return ( YES );     // wait for the rest before deciding
+    
+    _http2Session = [[AQHTTP2Session alloc] initWithConnection: self socket: _socket];
+    [_http2Session processIncomingData: [reader readBytes: reader.length]];
+    [_http2Session start];
+    return ( YES );
+}
+
+- (BOOL) _upgradeToHTTP2ForRequest: (CFHTTPMessageRef) request
+{
+    AQHTTP2Session * session = [[AQHTTP2Session alloc] initWithConnection: self socket: _socket];
+    if ( [session takeUpgradeRequest: request] == NO )
+    {
+#if USING_MRR
+        [session release];
 #endif
+        return ( NO );
+    }
     
-    CFHTTPMessageRef msg = NULL;
-    if ( _incomingMessage != NULL )
-        msg = (CFHTTPMessageRef)CFRetain(_incomingMessage);
-    else
-        msg = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, TRUE);
+    _http2Session = session;
     
-    NSData * data = [reader readBytes: reader.length];
-    CFHTTPMessageAppendBytes(msg, [data bytes], [data length]);
+    // anything the client sends after the request (such as its preface) is passed to the session by -_handleIncomingData:
     
-    if ( CFHTTPMessageIsHeaderComplete(msg) )
+    // any pipelined HTTP/1.1 responses go out first, then the switch, and only then can the session write
+    AQSocket * socket = _socket;
+    NSBlockOperation * op = [NSBlockOperation blockOperationWithBlock: ^{
+        static const char switchingProtocols[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        _AQWriteAndWait(socket, [NSData dataWithBytes: switchingProtocols length: sizeof(switchingProtocols) - 1]);
+        [session start];
+    }];
+    [self _cancelIdleTimer];
+    [_requestQ addOperation: op];
+    
+    return ( YES );
+}
+
+- (CFHTTPMessageRef) _newRequestFromReader: (AQSocketReader *) reader
+{
+    NSData * available = [reader peekBytes: reader.length];
+    const uint8_t * bytes = [available bytes];
+    NSUInteger length = [available length];
+    
+    // clients may send empty lines between requests
+    NSUInteger start = 0;
+    if ( [_incomingHeader length] == 0 )
+    {
+        while ( start < length && (bytes[start] == '\r' || bytes[start] == '\n') )
+            start++;
+    }
+    
+    NSUInteger oldLength = [_incomingHeader length];
+    [_incomingHeader appendBytes: bytes + start length: length - start];
+    
+    // find the blank line which ends the header, picking up where the last search left off
+    const uint8_t * header = [_incomingHeader bytes];
+    NSUInteger headerLength = [_incomingHeader length];
+    NSUInteger end = NSNotFound;
+    for ( NSUInteger i = (oldLength > 3 ? oldLength - 3 : 0); i + 4 <= headerLength; i++ )
     {
-        if ( _incomingMessage == msg && _incomingMessage != NULL )
+        if ( header[i] == '\r' && header[i+1] == '\n' && header[i+2] == '\r' && header[i+3] == '\n' )
         {
-            CFRelease(_incomingMessage);
-            _incomingMessage = NULL;
+            end = i + 4;
+            break;
         }
-        
+    }
+    
+    if ( end == NSNotFound )
+    {
+        [reader readBytes: length];
+        if ( headerLength > AQHTTPMaximumRequestHeaderLength )
+            [self _refuseRequestWithStatus: 431];
+        return ( NULL );
+    }
+    
+    // only the header is consumed: whatever follows is the body, or the next request
+    [reader readBytes: start + (end - oldLength)];
+    if ( end > AQHTTPMaximumRequestHeaderLength )
+    {
+        [self _refuseRequestWithStatus: 431];
+        return ( NULL );
+    }
+    
+    CFHTTPMessageRef request = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, TRUE);
+    BOOL parsed = CFHTTPMessageAppendBytes(request, header, end) && CFHTTPMessageIsHeaderComplete(request);
+    [_incomingHeader setLength: 0];
+    
+    if ( parsed == NO )
+    {
+        CFRelease(request);
+        [self _refuseRequestWithStatus: 400];
+        return ( NULL );
+    }
+    
+    return ( request );
+}
+
+- (BOOL) _readBodyFromReader: (AQSocketReader *) reader
+{
+    NSData * available = [reader peekBytes: reader.length];
+    NSUInteger used = [_incomingBody appendEncodedBytes: [available bytes] length: [available length]];
+    [reader readBytes: used];
+    
+    if ( _incomingBody.complete )
+    {
+#if USING_MRR
+        [_incomingBody release];
+#endif
+        _incomingBody = nil;
+        return ( YES );
+    }
+    
+    if ( _incomingBody.error != nil )
+    {
+        // the operation will see the error when it reads; once it's done, the connection is closed
+        _refusingInput = YES;
+        [_socket suspendReading];
+#if USING_MRR
+        [_incomingBody release];
+#endif
+        _incomingBody = nil;
+    }
+    
+    // either way, there's nothing more we can do with the input right now
+    return ( NO );
+}
+
+- (void) _refuseRequestWithStatus: (CFIndex) status
+{
+    // we can't make sense of anything else the client sends, so stop reading; the connection is closed once the response is out
+    _refusingInput = YES;
+    [_socket suspendReading];
+    [_incomingHeader setLength: 0];
+    
+    CFHTTPMessageRef response = CFHTTPMessageCreateResponse(kCFAllocatorDefault, status, NULL, kCFHTTPVersion1_1);
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Server"), CFSTR("AQHTTPServer/1.0"));
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Date"), (__bridge CFStringRef)[[NSDateFormatter AQHTTPDateFormatter] stringFromDate: [NSDate date]]);
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Length"), CFSTR("0"));
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), CFSTR("close"));
+    NSData * data = CFBridgingRelease(CFHTTPMessageCopySerializedMessage(response));
+    CFRelease(response);
+    
+    // any responses to earlier requests go out first
+    AQSocket * socket = _socket;
+    NSBlockOperation * op = [NSBlockOperation blockOperationWithBlock: ^{
+        _AQWriteAndWait(socket, data);
+    }];
+    [op setCompletionBlock: ^{ [self close]; }];
+    [self _cancelIdleTimer];
+    [_requestQ addOperation: op];
+}
+
+- (void) _dispatchRequest: (CFHTTPMessageRef) request trace: (AQHTTPTraceID) trace
+{
+    uint64_t dispatchStart = AQHTTPTraceTimestamp();
+    
 #if DEBUGLOG
-        NSString * httpVersion = CFBridgingRelease(CFHTTPMessageCopyVersion(msg));
-        NSString * httpMethod  = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(msg));
-        NSURL * url = CFBridgingRelease(CFHTTPMessageCopyRequestURL(msg));
-        NSDictionary * headers = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(msg));
-        NSData * body = CFBridgingRelease(CFHTTPMessageCopyBody(msg));
+    NSString * httpVersion = CFBridgingRelease(CFHTTPMessageCopyVersion(request));
+    NSString * httpMethod  = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
+    NSURL * url = CFBridgingRelease(CFHTTPMessageCopyRequestURL(request));
+    NSDictionary * headers = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(request));
+    
+    NSMutableString * debugStr = [NSMutableString string];
+    [debugStr appendFormat: @"%@ %@ \"%@\"\n", httpVersion, httpMethod, [url absoluteString]];
+    [headers enumerateKeysAndObjectsUsingBlock: ^(id key, id obj, BOOL *stop) {
+        [debugStr appendFormat: @"%@: %@\n", key, obj];
+    }];
+    
+    NSLog(@"Incoming request:\n%@", debugStr);
+#endif
+    
+    // the request sees the server's settings as they are now, however they change while it's handled
+    AQHTTPServerConfiguration * configuration = [self _currentConfiguration];
+    
+    // work out how the body, if any, is delimited
+    long long bodyLength = 0;
+    NSCharacterSet * whitespace = [NSCharacterSet whitespaceCharacterSet];
+    NSString * transferEncoding = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Transfer-Encoding")));
+    NSString * contentLength = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Content-Length")));
+    if ( transferEncoding != nil )
+    {
+        // chunked must be the last coding applied, or we can't tell where the body ends; Content-Length is ignored
+        NSString * lastCoding = [[[transferEncoding componentsSeparatedByString: @","] lastObject] stringByTrimmingCharactersInSet: whitespace];
+        if ( [lastCoding caseInsensitiveCompare: @"chunked"] != NSOrderedSame )
+        {
+            [self _refuseRequestWithStatus: 400];
+            return;
+        }
         
-        NSMutableString * debugStr = [NSMutableString string];
-        [debugStr appendFormat: @"%@ %@ \"%@\"\n", httpVersion, httpMethod, [url absoluteString]];
-        [headers enumerateKeysAndObjectsUsingBlock: ^(id key, id obj, BOOL *stop) {
-            [debugStr appendFormat: @"%@: %@\n", key, obj];
-        }];
-        if ( [body length] != 0 )
+        bodyLength = -1;
+    }
+    else if ( contentLength != nil )
+    {
+        contentLength = [contentLength stringByTrimmingCharactersInSet: whitespace];
+        if ( [contentLength length] == 0 || [contentLength length] > 18 || [contentLength rangeOfCharacterFromSet: [[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location != NSNotFound )
         {
-            NSString * bodyStr = [[NSString alloc] initWithData: body encoding: NSUTF8StringEncoding];
-            [debugStr appendFormat: @"\n%@\n", bodyStr];
+            [self _refuseRequestWithStatus: 400];
+            return;
+        }
+        
+        bodyLength = [contentLength longLongValue];
+    }
+    
+    unsigned long long maximumBodyLength = self.maximumRequestBodyLength;
+    if ( maximumBodyLength != 0 && bodyLength > 0 && (unsigned long long)bodyLength > maximumBodyLength )
+    {
+        [self _refuseRequestWithStatus: 413];
+        return;
+    }
+    
+    AQHTTPRequestBody * body = nil;
+    __block BOOL continueSent = YES;
+    if ( bodyLength != 0 )
+    {
+        body = [[AQHTTPRequestBody alloc] initWithExpectedLength: bodyLength maximumLength: maximumBodyLength];
 #if USING_MRR
-            [bodyStr release];
+        [body autorelease];
 #endif
+        
+        // when the operation falls behind, the client is made to wait
+        AQSocket * socket = _socket;
+        body.suspendHandler = ^{ [socket suspendReading]; };
+        body.resumeHandler = ^{ [socket resumeReading]; };
+        
+        NSString * expect = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Expect")));
+        NSString * version = CFBridgingRelease(CFHTTPMessageCopyVersion(request));
+        if ( [expect caseInsensitiveCompare: @"100-continue"] == NSOrderedSame && [version isEqualToString: (__bridge NSString *)kCFHTTPVersion1_1] )
+        {
+            // the client waits for the go-ahead before sending its body; it gets it only if the operation wants the body
+            continueSent = NO;
+            body.firstReadHandler = ^{
+                static const char continueResponse[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                continueSent = YES;
+                [socket writeBytes: [NSData dataWithBytes: continueResponse length: sizeof(continueResponse) - 1] completion: ^(NSData *unwritten, NSError *error) {}];
+            };
         }
         
-        NSLog(@"Incoming request:\n%@", debugStr);
+#if USING_MRR
+        _incomingBody = [body retain];
+#else
+        _incomingBody = body;
 #endif
-        AQHTTPResponseOperation * op = [self responseOperationForRequest: msg];
-        if ( op != nil )
+    }
+    
+    // an upgraded request is answered on HTTP/2 stream 1; over TLS, HTTP/2 is negotiated using ALPN instead
+    AQHTTPResponseOperation * op = nil;
+    if ( _socket.secure || [AQHTTP2Session isUpgradeRequest: request] == NO || [self _upgradeToHTTP2ForRequest: request] == NO )
+    {
+        [_server _noteRequestReceived];
+        if ( body == nil && [self _answerRequestFromCache: request configuration: configuration trace: trace] )
+            return;
+        op = [self responseOperationForRequest: request];
+    }
+    
+    if ( op == nil )
+    {
+        // we still have to read past the body to find the next request
+        [body discard];
+        return;
+    }
+    
+    op.requestBody = body;
+    [op setCompletionBlock: ^{
+        // whatever the operation didn't read is thrown away as it arrives
+        [body discard];
+        if ( body.error != nil || (body.complete == NO && continueSent == NO) )
+        {
+            // the rest of the body can't, or won't, be sent, so we've lost our place in the input
+            [self close];
+            return;
+        }
+        
+        if ( _draining )
+        {
+            // whether or not the operation closed the connection itself, it's done with now
+            [self close];
+            return;
+        }
+        
+        [self _maybeInstallIdleTimer];
+    }];
+    [self _cancelIdleTimer];
+    AQHTTPTraceRecordSpan(trace, "dispatch", dispatchStart, AQHTTPTraceTimestamp());
+    op.trace = trace;
+    [_requestQ addOperation: op];
+}
+
+- (BOOL) _answerRequestFromCache: (CFHTTPMessageRef) request configuration: (AQHTTPServerConfiguration *) configuration trace: (AQHTTPTraceID) trace
+{
+    if ( _canAnswerFromCache == NO )
+        return ( NO );
+    
+    // routed or rate-limited responses must go through an operation
+    AQHTTPServer * server = _server;
+    AQHTTPFileCache * cache = configuration.fileCache;
+    if ( cache == nil || server.router != nil || server.bandwidthScheduler != nil )
+        return ( NO );
+    
+    // method names are case-sensitive; anything unusual is left to the operation
+    NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
+    BOOL isHead = [method isEqualToString: @"HEAD"];
+    if ( isHead == NO && [method isEqualToString: @"GET"] == NO )
+        return ( NO );
+    
+    CFStringRef rangeHeader = CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Range"));
+    if ( rangeHeader != NULL )
+    {
+        CFRelease(rangeHeader);
+        return ( NO );
+    }
+    
+    // the file is found just as the operation would find it, relative to this request's document root
+    NSString * path = AQHTTPRequestPath(request);
+    if ( path == nil )
+        return ( NO );
+    
+    AQHTTPCachedFile * file = [cache cachedFileForItemAtPath: path configuration: configuration];
+    if ( file == nil )
+    {
+        // the operation answers this one, and the cache will be ready for the next
+        [cache loadItemAtPath: path configuration: configuration];
+        return ( NO );
+    }
+    
+    NSDate * modificationDate = file.modificationDate;
+    BOOL notModified = AQHTTPRequestIsNotModified(request, file.etag, modificationDate);
+    
+    NSData * contents = nil;
+    if ( notModified == NO && isHead == NO )
+    {
+        contents = file.contents;
+        if ( contents == nil )
+            return ( NO );      // too large to keep in memory, so it's streamed from disk
+    }
+    
+    [file noteRequestWithBytes: [contents length]];
+    
+    // the same headers as -[AQHTTPResponseOperation newResponseForItemAtPath:withHTTPStatus:] would send
+    CFHTTPMessageRef response = CFHTTPMessageCreateResponse(kCFAllocatorDefault, (notModified ? 304 : 200), NULL, kCFHTTPVersion1_1);
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Server"), CFSTR("AQHTTPServer/1.0"));
+    NSString * date = [[NSDateFormatter AQHTTPDateFormatter] stringFromDate: [NSDate date]];
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Date"), (__bridge CFStringRef)date);
+    NSString * contentType = file.contentType;
+    if ( contentType == nil )
+        contentType = @"application/octet-stream";
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Type"), (__bridge CFStringRef)contentType);
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Etag"), (__bridge CFStringRef)file.etag);
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Last-Modified"), (__bridge CFStringRef)[[NSDateFormatter AQHTTPDateFormatter] stringFromDate: modificationDate]);
+    if ( notModified == NO )
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Length"), (__bridge CFStringRef)[NSString stringWithFormat: @"%llu", file.size]);
+    
+    BOOL closeAfterResponse = NO;
+    if ( self.supportsPipelinedRequests == NO || _draining )
+    {
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), CFSTR("close"));
+        closeAfterResponse = YES;
+    }
+    else
+    {
+        NSString * connStatus = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("Connection")));
+        if ( connStatus != nil )
         {
-            [op setCompletionBlock: ^{ [self _maybeInstallIdleTimer]; }];
-            if ( [_idleDisconnectionTimer isValid] )
-            {
-                [_idleDisconnectionTimer invalidate];
+            CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), (__bridge CFStringRef)connStatus);
+            closeAfterResponse = ([connStatus caseInsensitiveCompare: @"close"] == NSOrderedSame);
+        }
+    }
+    
+    NSMutableData * data = [CFBridgingRelease(CFHTTPMessageCopySerializedMessage(response)) mutableCopy];
+    CFRelease(response);
+    if ( contents != nil )
+        [data appendData: contents];
 #if USING_MRR
-                [_idleDisconnectionTimer release];
+    [data autorelease];
 #endif
-                _idleDisconnectionTimer = nil;
-            }
+    
+    [self _cancelIdleTimer];
+    
+    // nothing more is read from a client whose connection is about to be closed
+    if ( closeAfterResponse )
+        _refusingInput = YES;
+    
+    uint64_t queuedAt = AQHTTPTraceTimestamp();
+    if ( [_requestQ operationCount] == 0 && _socket.writable )
+    {
+        // nothing ahead of it, and room on the socket, so the response can be queued there right away
+        [_socket writeBytes: data completion: ^(NSData *unwritten, NSError *error) {
+            AQHTTPTraceRecordSpan(trace, "write", queuedAt, AQHTTPTraceTimestamp());
             
-            [_requestQ addOperation: op];
-        }
+            // the socket may still be busy with the write when this is called, so it's closed from elsewhere
+            if ( closeAfterResponse )
+                dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ [self close]; });
+        }];
+        
+        if ( closeAfterResponse == NO )
+            [self _maybeInstallIdleTimer];
+        return ( YES );
     }
-    else
+    
+    // responses to earlier requests are still being sent, or the client is slow to read them, so this one waits its turn
+    // while it does, the queue holds up any requests behind it, just as a response operation would
+    AQSocket * socket = _socket;
+    
+    // A client which isn't reading its responses isn't allowed to keep sending requests. Suspensions are
+    // counted, so this one belongs to the operation alone: its completion releases it whichever way it ends,
+    // and never lifts one held by the request body or a refused request.
+    BOOL suspendedReading = NO;
+    if ( socket.writable == NO )
+    {
+        [socket suspendReading];
+        suspendedReading = YES;
+    }
+    
+    NSBlockOperation * op = [NSBlockOperation blockOperationWithBlock: ^{
+        uint64_t writeStart = AQHTTPTraceTimestamp();
+        AQHTTPTraceRecordSpan(trace, "queue", queuedAt, writeStart);
+        if ( [socket waitUntilWritable] )
+            _AQWriteAndWait(socket, data);
+        AQHTTPTraceRecordSpan(trace, "write", writeStart, AQHTTPTraceTimestamp());
+    }];
+    [op setCompletionBlock: ^{
+        if ( suspendedReading )
+            [socket resumeReading];
+        
+        if ( closeAfterResponse || _draining )
+        {
+            [self close];
+            return;
+        }
+        
+        [self _maybeInstallIdleTimer];
+    }];
+    [_requestQ addOperation: op];
+    return ( YES );
+}
+
+- (void) _handleIncomingData: (AQSocketReader *) reader
+{
+#if DEBUGLOG
+    NSLog(@"Data arriving on %p; length=%lu", self, (unsigned long)reader.length);
+#endif
+    
+    // handling the whole read is traced as part of the first sampled request it carries
+    uint64_t readStart = AQHTTPTraceTimestamp();
+    AQHTTPTraceID readTrace = 0;
+    
+    // a single read may carry the end of one request, several complete ones, and the start of another
+    while ( reader.length != 0 && _refusingInput == NO )
     {
-        _incomingMessage = (CFHTTPMessageRef)CFRetain(msg);
+        if ( _http2Session != nil )
+        {
+            [_http2Session processIncomingData: [reader readBytes: reader.length]];
+            break;
+        }
+        
+        if ( _incomingBody != nil )
+        {
+            if ( [self _readBodyFromReader: reader] == NO )
+                break;
+            continue;
+        }
+        
+        if ( [_incomingHeader length] == 0 && [self _maybeStartHTTP2WithReader: reader] )
+            break;
+        
+        uint64_t parseStart = AQHTTPTraceTimestamp();
+        CFHTTPMessageRef request = [self _newRequestFromReader: reader];
+        if ( request == NULL )
+            break;
+        
+        AQHTTPTraceID trace = AQHTTPTraceBeginRequest();
+        AQHTTPTraceRecordSpan(trace, "parse", parseStart, AQHTTPTraceTimestamp());
+        if ( readTrace == 0 )
+            readTrace = trace;
+        
+        [self _dispatchRequest: request trace: trace];
+        CFRelease(request);
     }
     
-    if (msg != NULL)
-        CFRelease(msg);
+    AQHTTPTraceRecordSpan(readTrace, "read", readStart, AQHTTPTraceTimestamp());
 }
 
 - (void) _socketDisconnected
@@ -419,3 +1035,12 @@
 }
 
 @end
+
+@implementation AQHTTPConnection (ForSubclasses)
+
+- (void) documentRootDidChange
+{
+    // nothing to do by default
+}
+
+@end
@@ -9,5 +9,16 @@
 #import "AQHTTPConnection.h"
 
 @interface AQHTTPConnection ()
-@property (nonatomic, readwrite, copy) NSURL * documentRoot;
+// adopts the server's latest configuration snapshot, if it has changed, calling -documentRootDidChange as needed
+- (AQHTTPServerConfiguration *) _currentConfiguration;
+
+// used by AQHTTP2Session to create response operations which write to a stream rather than the socket itself
+- (AQHTTPResponseOperation *) _responseOperationForRequest: (CFHTTPMessageRef) request socket: (AQSocket *) socket;
+- (void) _cancelIdleTimer;
+- (void) _maybeInstallIdleTimer;
+
+// Used by AQHTTPServer during a graceful restart. Idle connections close immediately; busy ones
+// answer their outstanding requests with 'Connection: close' and close once they're done.
+- (void) _drain;
+@property (nonatomic, readonly, getter=isDraining) BOOL draining;
 @end
@@ -0,0 +1,137 @@
+//
+//  AQHTTPContentBundle.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AQHTTPContentBundleFormat.h"
+
+/// The error domain for errors describing malformed content bundles.
+extern NSString * const AQHTTPContentBundleErrorDomain;
+
+/**
+ The AQHTTPContentBundle class provides read-only access to a packed content
+ bundle, as created by the SimpleHTTPBundleBuilder tool.
+
+ The entire bundle file is mapped into memory once, when the bundle is opened.
+ Looking up an item is a binary search of the bundle's path index and requires
+ no file-system access of any kind, and item contents are returned as NSData
+ objects which reference the mapped pages directly rather than copying them.
+ */
+@interface AQHTTPContentBundle : NSObject
+
+/**
+ Returns a shared bundle instance for the file at the given URL.
+
+ All callers asking for the same file share a single mapping. If the file has
+ been replaced since it was last opened, a new instance is created; existing
+ users of the old instance keep the old mapping alive until they release it.
+ The shared instance is kept until the file disappears or is replaced, or
+ until +removeSharedContentBundleWithURL: is called.
+ @param url A file URL referencing a content bundle.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result A bundle instance, or `nil` if the file could not be opened or is not
+ a valid content bundle.
+ */
++ (AQHTTPContentBundle *) contentBundleWithURL: (NSURL *) url error: (NSError **) error;
+
+/**
+ Forgets the shared instance for the file at the given URL, so its mapping is
+ released once its current users have finished with it. Call this when a file
+ is no longer being served, such as when the document root moves elsewhere; a
+ later call to +contentBundleWithURL:error: maps the file afresh.
+ @param url A file URL referencing a content bundle.
+ */
++ (void) removeSharedContentBundleWithURL: (NSURL *) url;
+
+/**
+ Opens and maps a content bundle.
+
+ This is the designated initializer for AQHTTPContentBundle. Most callers should
+ use +contentBundleWithURL:error: instead, to share a single mapping.
+ @param url A file URL referencing a content bundle.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result A new bundle instance, or `nil` on failure.
+ */
+- (id) initWithURL: (NSURL *) url error: (NSError **) error;
+
+/// The URL from which the bundle was loaded.
+@property (nonatomic, readonly) NSURL * URL;
+
+/// The number of items in the bundle.
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ Looks up the index entry for an item.
+
+ The returned pointer refers into the mapped bundle, and remains valid for as
+ long as the receiver is alive.
+ @param path The UTF-8 bytes of a root-relative path with a leading slash,
+ e.g. `/images/logo.png`.
+ @param length The number of bytes in `path`.
+ @result The entry for the item, or `NULL` if no such item exists.
+ */
+- (const AQHTTPContentBundleEntry *) entryForPath: (const char *) path length: (size_t) length;
+
+/**
+ Looks up the index entry for a decoded request path.
+
+ Paths ending in a slash are resolved to the `index.html` item within that
+ folder.
+ @param path The root-relative path of a request, with percent escapes removed.
+ @result The entry for the item, or `NULL` if no such item exists.
+ */
+- (const AQHTTPContentBundleEntry *) entryForRequestPath: (NSString *) path;
+
+/**
+ Returns the contents of an item.
+
+ The returned data object references the mapped file directly, and keeps the
+ receiver alive for as long as it exists.
+ @param entry An entry returned from -entryForPath:length:.
+ @param compressed If `YES`, return the precompressed (gzip) variant. The entry
+ must have the AQHTTPContentBundleEntryFlagCompressed flag set.
+ @result An NSData object.
+ */
+- (NSData *) dataForEntry: (const AQHTTPContentBundleEntry *) entry compressed: (BOOL) compressed;
+
+/**
+ Returns a subrange of an item's contents without copying.
+ @param entry An entry returned from -entryForPath:length:.
+ @param range The byte range within the item to return.
+ @param compressed If `YES`, the range refers to the precompressed variant.
+ @result An NSData object.
+ @exception NSInvalidArgumentException if the range is outside the item.
+ */
+- (NSData *) dataForEntry: (const AQHTTPContentBundleEntry *) entry range: (NSRange) range compressed: (BOOL) compressed;
+
+/// Returns the MIME type recorded for an item when the bundle was built.
+- (NSString *) contentTypeForEntry: (const AQHTTPContentBundleEntry *) entry;
+
+/// Returns the Etag recorded for an item when the bundle was built.
+- (NSString *) etagForEntry: (const AQHTTPContentBundleEntry *) entry;
+
+@end
+
+/**
+ Inline accessors for the little-endian fields of a bundle index entry.
+ */
+NS_INLINE UInt64 AQHTTPContentBundleEntryLength(const AQHTTPContentBundleEntry * entry, BOOL compressed)
+{
+    return ( CFSwapInt64LittleToHost(compressed ? entry->gzipLength : entry->dataLength) );
+}
+
+NS_INLINE BOOL AQHTTPContentBundleEntryHasCompressedVariant(const AQHTTPContentBundleEntry * entry)
+{
+    return ( (CFSwapInt32LittleToHost(entry->flags) & AQHTTPContentBundleEntryFlagCompressed) != 0 );
+}
+
+NS_INLINE NSTimeInterval AQHTTPContentBundleEntryModificationTime(const AQHTTPContentBundleEntry * entry)
+{
+    return ( (NSTimeInterval)CFSwapInt64LittleToHost(entry->modificationTime) );
+}
@@ -0,0 +1,403 @@
+//
+//  AQHTTPContentBundle.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPContentBundle.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+
+NSString * const AQHTTPContentBundleErrorDomain = @"AQHTTPContentBundleErrorDomain";
+
+// A no-copy NSData referencing bytes within a mapped bundle, keeping the bundle alive while in use.
+@interface _AQContentBundleData : NSData
+{
+    AQHTTPContentBundle * _bundle;
+    const void *    _buf;
+    NSUInteger      _len;
+}
+- (id) initWithBundle: (AQHTTPContentBundle *) bundle bytes: (const void *) bytes length: (NSUInteger) length;
+@end
+
+@implementation _AQContentBundleData
+
+- (id) initWithBundle: (AQHTTPContentBundle *) bundle bytes: (const void *) bytes length: (NSUInteger) length
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+#if USING_MRR
+    _bundle = [bundle retain];
+#else
+    _bundle = bundle;
+#endif
+    _buf = bytes;
+    _len = length;
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_bundle release];
+    [super dealloc];
+}
+#endif
+
+- (const void *) bytes
+{
+    return ( _buf );
+}
+
+- (NSUInteger) length
+{
+    return ( _len );
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTPContentBundle
+{
+    NSURL *         _url;
+    const uint8_t * _map;
+    size_t          _mapLength;
+
+    const AQHTTPContentBundleEntry * _entries;
+    const uint8_t * _strings;
+    NSUInteger      _count;
+
+    // used to detect a bundle being replaced on disk
+    dev_t           _device;
+    ino_t           _inode;
+    struct timespec _mtime;
+}
+
+@synthesize URL=_url, count=_count;
+
+// YES if `length` bytes at `offset` lie within `size` bytes; written so that no sum can wrap around
+static inline BOOL _RangeFits(uint64_t offset, uint64_t length, uint64_t size)
+{
+    return ( offset <= size && length <= size - offset );
+}
+
+static NSError * _BundleError(NSInteger code, NSString * reason)
+{
+    NSDictionary * userInfo = [[NSDictionary alloc] initWithObjectsAndKeys: reason, NSLocalizedFailureReasonErrorKey, nil];
+    NSError * error = [NSError errorWithDomain: AQHTTPContentBundleErrorDomain code: code userInfo: userInfo];
+#if USING_MRR
+    [userInfo release];
+#endif
+    return ( error );
+}
+
+// standardized URL -> the shared AQHTTPContentBundle for that file
+static NSMutableDictionary * _SharedBundles(void)
+{
+    static NSMutableDictionary * __bundles = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __bundles = [NSMutableDictionary new];
+    });
+    return ( __bundles );
+}
+
++ (AQHTTPContentBundle *) contentBundleWithURL: (NSURL *) url error: (NSError **) error
+{
+    NSMutableDictionary * __bundles = _SharedBundles();
+    NSURL * key = [url URLByStandardizingPath];
+    struct stat sb;
+    if ( stat([[key path] fileSystemRepresentation], &sb) != 0 )
+    {
+        int err = errno;
+        
+        // the file's gone, so there's no point keeping its mapping for later callers
+        @synchronized(__bundles)
+        {
+            [__bundles removeObjectForKey: key];
+        }
+        
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: err userInfo: nil];
+        return ( nil );
+    }
+
+    @synchronized(__bundles)
+    {
+        AQHTTPContentBundle * bundle = [__bundles objectForKey: key];
+        if ( bundle != nil && bundle->_device == sb.st_dev && bundle->_inode == sb.st_ino &&
+             bundle->_mtime.tv_sec == sb.st_mtimespec.tv_sec && bundle->_mtime.tv_nsec == sb.st_mtimespec.tv_nsec )
+        {
+#if USING_MRR
+            return ( [[bundle retain] autorelease] );
+#else
+            return ( bundle );
+#endif
+        }
+
+        bundle = [[self alloc] initWithURL: key error: error];
+        if ( bundle == nil )
+        {
+            [__bundles removeObjectForKey: key];
+            return ( nil );
+        }
+
+        [__bundles setObject: bundle forKey: key];
+#if USING_MRR
+        [bundle autorelease];
+#endif
+        return ( bundle );
+    }
+}
+
++ (void) removeSharedContentBundleWithURL: (NSURL *) url
+{
+    NSMutableDictionary * __bundles = _SharedBundles();
+    @synchronized(__bundles)
+    {
+        [__bundles removeObjectForKey: [url URLByStandardizingPath]];
+    }
+}
+
+- (id) initWithURL: (NSURL *) url error: (NSError **) error
+{
+    NSParameterAssert([url isFileURL]);
+
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _url = [url copy];
+
+    int fd = open([[url path] fileSystemRepresentation], O_RDONLY);
+    if ( fd < 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    struct stat sb;
+    if ( fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(AQHTTPContentBundleHeader) )
+    {
+        if ( error != NULL )
+            *error = _BundleError(1, @"The file is too small to be a content bundle.");
+        close(fd);
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    _device = sb.st_dev;
+    _inode = sb.st_ino;
+    _mtime = sb.st_mtimespec;
+    _mapLength = (size_t)sb.st_size;
+
+    void * map = mmap(NULL, _mapLength, PROT_READ, MAP_SHARED, fd, 0);
+    int mapErr = errno;
+
+    // the mapping holds its own reference to the file, so we don't need the descriptor any more
+    close(fd);
+
+    if ( map == MAP_FAILED )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: mapErr userInfo: nil];
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    _map = map;
+
+    NSError * validationError = nil;
+    if ( [self _validate: &validationError] == NO )
+    {
+        if ( error != NULL )
+            *error = validationError;
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    // the index and string table are touched on every lookup, so ask for them to be paged in now
+    const AQHTTPContentBundleHeader * header = (const AQHTTPContentBundleHeader *)_map;
+    madvise((void *)_map, (size_t)CFSwapInt64LittleToHost(header->dataOffset), MADV_WILLNEED);
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _map != NULL )
+        munmap((void *)_map, _mapLength);
+#if USING_MRR
+    [_url release];
+    [super dealloc];
+#endif
+}
+
+- (BOOL) _validate: (NSError **) error
+{
+    const AQHTTPContentBundleHeader * header = (const AQHTTPContentBundleHeader *)_map;
+    if ( memcmp(header->magic, AQHTTPContentBundleMagic, sizeof(header->magic)) != 0 )
+    {
+        *error = _BundleError(2, @"The file is not a content bundle.");
+        return ( NO );
+    }
+    if ( CFSwapInt32LittleToHost(header->version) != AQHTTPContentBundleCurrentVersion )
+    {
+        *error = _BundleError(3, @"The content bundle was created by an unsupported version of the bundle builder.");
+        return ( NO );
+    }
+
+    uint64_t count = CFSwapInt32LittleToHost(header->entryCount);
+    uint64_t indexOffset = CFSwapInt64LittleToHost(header->indexOffset);
+    uint64_t stringsOffset = CFSwapInt64LittleToHost(header->stringsOffset);
+    uint64_t stringsLength = CFSwapInt64LittleToHost(header->stringsLength);
+
+    // count is at most UINT32_MAX, so the index's length can't overflow
+    if ( CFSwapInt64LittleToHost(header->fileLength) != _mapLength ||
+         indexOffset % sizeof(uint64_t) != 0 ||
+         _RangeFits(indexOffset, count * sizeof(AQHTTPContentBundleEntry), _mapLength) == NO ||
+         _RangeFits(stringsOffset, stringsLength, _mapLength) == NO ||
+         stringsLength > UINT32_MAX )
+    {
+        *error = _BundleError(4, @"The content bundle is truncated or corrupt.");
+        return ( NO );
+    }
+
+    _entries = (const AQHTTPContentBundleEntry *)(_map + indexOffset);
+    _strings = _map + stringsOffset;
+    _count = (NSUInteger)count;
+
+    // check every entry once up front, so that lookups don't need to
+    for ( NSUInteger i = 0; i < _count; i++ )
+    {
+        const AQHTTPContentBundleEntry * e = &_entries[i];
+        if ( _RangeFits(CFSwapInt32LittleToHost(e->pathOffset), CFSwapInt32LittleToHost(e->pathLength), stringsLength) == NO ||
+             _RangeFits(CFSwapInt32LittleToHost(e->contentTypeOffset), CFSwapInt32LittleToHost(e->contentTypeLength), stringsLength) == NO ||
+             _RangeFits(CFSwapInt32LittleToHost(e->etagOffset), CFSwapInt32LittleToHost(e->etagLength), stringsLength) == NO ||
+             _RangeFits(CFSwapInt64LittleToHost(e->dataOffset), CFSwapInt64LittleToHost(e->dataLength), _mapLength) == NO ||
+             _RangeFits(CFSwapInt64LittleToHost(e->gzipOffset), CFSwapInt64LittleToHost(e->gzipLength), _mapLength) == NO )
+        {
+            *error = _BundleError(4, @"The content bundle is truncated or corrupt.");
+            return ( NO );
+        }
+    }
+
+    return ( YES );
+}
+
+- (const AQHTTPContentBundleEntry *) entryForPath: (const char *) path length: (size_t) length
+{
+    NSUInteger lo = 0, hi = _count;
+    while ( lo < hi )
+    {
+        NSUInteger mid = lo + ((hi - lo) >> 1);
+        const AQHTTPContentBundleEntry * e = &_entries[mid];
+        const uint8_t * entryPath = _strings + CFSwapInt32LittleToHost(e->pathOffset);
+        size_t entryLength = CFSwapInt32LittleToHost(e->pathLength);
+
+        int cmp = memcmp(entryPath, path, MIN(entryLength, length));
+        if ( cmp == 0 )
+        {
+            if ( entryLength == length )
+                return ( e );
+            cmp = (entryLength < length ? -1 : 1);
+        }
+
+        if ( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return ( NULL );
+}
+
+- (const AQHTTPContentBundleEntry *) entryForRequestPath: (NSString *) path
+{
+    static const char indexName[] = "index.html";
+
+    // decode into a stack buffer rather than going through -UTF8String
+    char buf[PATH_MAX];
+    CFIndex used = 0;
+    CFIndex len = CFStringGetLength((__bridge CFStringRef)path);
+    if ( CFStringGetBytes((__bridge CFStringRef)path, CFRangeMake(0, len), kCFStringEncodingUTF8, 0, false,
+                          (UInt8 *)buf, sizeof(buf) - sizeof(indexName), &used) != len )
+    {
+        return ( NULL );
+    }
+
+    if ( used == 0 || buf[used-1] == '/' )
+    {
+        if ( used == 0 )
+            buf[used++] = '/';
+        memcpy(buf + used, indexName, sizeof(indexName) - 1);
+        used += sizeof(indexName) - 1;
+    }
+
+    return ( [self entryForPath: buf length: (size_t)used] );
+}
+
+- (NSData *) dataForEntry: (const AQHTTPContentBundleEntry *) entry compressed: (BOOL) compressed
+{
+    UInt64 length = AQHTTPContentBundleEntryLength(entry, compressed);
+    return ( [self dataForEntry: entry range: NSMakeRange(0, (NSUInteger)length) compressed: compressed] );
+}
+
+- (NSData *) dataForEntry: (const AQHTTPContentBundleEntry *) entry range: (NSRange) range compressed: (BOOL) compressed
+{
+    UInt64 offset = CFSwapInt64LittleToHost(compressed ? entry->gzipOffset : entry->dataOffset);
+    UInt64 length = AQHTTPContentBundleEntryLength(entry, compressed);
+
+    if ( (UInt64)NSMaxRange(range) > length )
+    {
+        [NSException raise: NSInvalidArgumentException format: @"Range %@ is outside the bounds of an item of length %llu", NSStringFromRange(range), length];
+    }
+
+    NSData * data = [[_AQContentBundleData alloc] initWithBundle: self bytes: _map + offset + range.location length: range.length];
+#if USING_MRR
+    [data autorelease];
+#endif
+    return ( data );
+}
+
+- (NSString *) _stringAtOffset: (uint32_t) offset length: (uint32_t) length
+{
+    NSString * str = [[NSString alloc] initWithBytes: _strings + CFSwapInt32LittleToHost(offset)
+                                              length: CFSwapInt32LittleToHost(length)
+                                            encoding: NSUTF8StringEncoding];
+#if USING_MRR
+    [str autorelease];
+#endif
+    return ( str );
+}
+
+- (NSString *) contentTypeForEntry: (const AQHTTPContentBundleEntry *) entry
+{
+    return ( [self _stringAtOffset: entry->contentTypeOffset length: entry->contentTypeLength] );
+}
+
+- (NSString *) etagForEntry: (const AQHTTPContentBundleEntry *) entry
+{
+    if ( entry->etagLength == 0 )
+        return ( nil );
+    return ( [self _stringAtOffset: entry->etagOffset length: entry->etagLength] );
+}
+
+@end
@@ -0,0 +1,75 @@
+//
+//  AQHTTPContentBundleFormat.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#ifndef SimpleHTTPServer_AQHTTPContentBundleFormat_h
+#define SimpleHTTPServer_AQHTTPContentBundleFormat_h
+
+#include <stdint.h>
+
+/*
+ On-disk layout of a packed content bundle. All integers are little-endian.
+
+    +--------------------------------+  0
+    | AQHTTPContentBundleHeader      |
+    +--------------------------------+  header.indexOffset
+    | AQHTTPContentBundleEntry[n]    |  sorted by path, bytewise (memcmp) order
+    +--------------------------------+  header.stringsOffset
+    | string table                   |  paths, MIME types & etags, not NUL-terminated
+    +--------------------------------+  header.dataOffset (page-aligned)
+    | blobs                          |  each blob starts on a page boundary
+    +--------------------------------+  header.fileLength
+
+ Lookups are a binary search of the entry index, comparing the requested path
+ against the path bytes in the string table, so a lookup never allocates and
+ never touches the blob pages.
+ */
+
+#define AQHTTPContentBundleMagic            "AQHB"
+#define AQHTTPContentBundleCurrentVersion   1
+
+// blobs are aligned to 16KB so that the same bundle is page-aligned for both 4KB and 16KB VM pages
+#define AQHTTPContentBundleBlobAlignment    16384
+
+enum
+{
+    AQHTTPContentBundleEntryFlagCompressed  = 1 << 0,   /// gzipOffset/gzipLength are valid
+};
+
+typedef struct AQHTTPContentBundleHeader
+{
+    uint8_t     magic[4];
+    uint32_t    version;
+    uint32_t    entryCount;
+    uint32_t    flags;
+    uint64_t    indexOffset;
+    uint64_t    stringsOffset;
+    uint64_t    stringsLength;
+    uint64_t    dataOffset;
+    uint64_t    fileLength;
+
+} AQHTTPContentBundleHeader;
+
+typedef struct AQHTTPContentBundleEntry
+{
+    uint32_t    pathOffset;             /// relative to header.stringsOffset
+    uint32_t    pathLength;
+    uint32_t    contentTypeOffset;
+    uint32_t    contentTypeLength;
+    uint32_t    etagOffset;
+    uint32_t    etagLength;
+    uint32_t    flags;
+    uint32_t    reserved;
+    uint64_t    modificationTime;       /// seconds since 1970-01-01 00:00:00 UTC
+    uint64_t    dataOffset;             /// absolute file offset
+    uint64_t    dataLength;
+    uint64_t    gzipOffset;             /// absolute file offset
+    uint64_t    gzipLength;
+
+} AQHTTPContentBundleEntry;
+
+#endif
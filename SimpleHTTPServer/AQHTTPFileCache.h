@@ -0,0 +1,150 @@
+//
+//  AQHTTPFileCache.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AQHTTPServerConfiguration;
+
+/**
+ The cached metadata, and possibly contents, of a single file.
+ */
+@interface AQHTTPCachedFile : NSObject
+
+/// The absolute path of the file.
+@property (nonatomic, readonly) NSString * path;
+
+/// The file's size in bytes.
+@property (nonatomic, readonly) UInt64 size;
+
+/// The file's entity tag, as returned by AQHTTPEtagForFileAtPath().
+@property (nonatomic, readonly) NSString * etag;
+
+/// The file's MIME type, as returned by AQHTTPContentTypeForPath().
+@property (nonatomic, readonly) NSString * contentType;
+
+/// The time the file was last modified.
+@property (nonatomic, readonly) NSDate * modificationDate;
+
+/// The file's contents, or `nil` if the file is too large for them to be cached.
+@property (nonatomic, readonly) NSData * contents;
+
+/**
+ Counts a request answered with the file, towards the set of frequently-requested
+ files returned by -[AQHTTPFileCache hotFilesWithLimit:]. This takes no locks,
+ so it may be called from any thread for every request.
+ @param bytes The number of bytes of the file sent in the response.
+ */
+- (void) noteRequestWithBytes: (UInt64) bytes;
+
+@end
+
+/// Keys for the dictionaries returned by -[AQHTTPFileCache hotFilesWithLimit:].
+extern NSString * const AQHTTPHotFilePathKey;          // NSString: the file's absolute path
+extern NSString * const AQHTTPHotFileRequestsKey;      // NSNumber: requests answered with the file
+extern NSString * const AQHTTPHotFileBytesKey;         // NSNumber: bytes of the file sent
+
+/**
+ An AQHTTPFileCache holds the metadata of recently-requested files, along
+ with the contents of small ones, so that requests for them can be answered
+ without reading the disk.
+
+ Entries are checked against the file system each time they're used, and
+ discarded if the file has changed. Loading happens in the background, and
+ the least-recently-used contents are evicted once the cache grows beyond
+ its limit. A cache may be used from any thread.
+ */
+@interface AQHTTPFileCache : NSObject
+
+/**
+ Initializes a file cache.
+ @param maximumFileSize The largest file whose contents will be cached.
+ @param totalSize The most bytes of file contents to hold at once.
+ @result A new, empty file cache.
+ */
+- (id) initWithMaximumFileSize: (NSUInteger) maximumFileSize totalSize: (NSUInteger) totalSize;
+
+/// The largest file whose contents will be cached.
+@property (nonatomic, readonly) NSUInteger maximumFileSize;
+
+/// The most bytes of file contents held at once.
+@property (nonatomic, readonly) NSUInteger totalSize;
+
+/**
+ Looks up a file. This checks that the file hasn't changed since it was
+ cached, but otherwise doesn't touch the disk.
+ 
+ The file is found the same way a response operation finds it: relative to
+ the document root descriptor held by `configuration`.
+ @param path A request path, relative to the document root.
+ @param configuration The configuration of the request being answered.
+ @result The cached file, or `nil` if it isn't in the cache or has changed.
+ */
+- (AQHTTPCachedFile *) cachedFileForItemAtPath: (NSString *) path configuration: (AQHTTPServerConfiguration *) configuration;
+
+/**
+ Adds a file to the cache in the background, unless it's already there or
+ being loaded. Directories and other special files are ignored.
+ @param path A request path, relative to the document root.
+ @param configuration The configuration of the request being answered.
+ */
+- (void) loadItemAtPath: (NSString *) path configuration: (AQHTTPServerConfiguration *) configuration;
+
+/**
+ Empties the cache. The record of frequently-requested files is kept.
+ */
+- (void) removeAllFiles;
+
+/** @name Frequently-Requested Files */
+
+/**
+ Whether requests noted with -noteRequestForFileAtPath:bytes: are counted.
+ Nothing but a warm-up manifest uses the counts, so this is `NO` by default;
+ AQHTTPServer turns it on when it has a warmupManifestURL to keep up to date.
+ */
+@property (nonatomic, assign) BOOL recordsHotFiles;
+
+/**
+ Counts a request answered with a file, towards the set of frequently-requested
+ files returned by -hotFilesWithLimit:. May be called from any thread. Requests
+ answered from the cache are counted with -[AQHTTPCachedFile noteRequestWithBytes:]
+ instead. Does nothing unless recordsHotFiles is set.
+ @param path The absolute path of the file.
+ @param bytes The number of bytes of the file sent in the response.
+ */
+- (void) noteRequestForFileAtPath: (NSString *) path bytes: (UInt64) bytes;
+
+/**
+ Returns the most frequently-requested files, with the most requests first.
+ Files with the same number of requests are ordered by the bytes sent.
+ @param limit The most files to return.
+ @result An array of dictionaries, using the AQHTTPHotFile keys.
+ */
+- (NSArray *) hotFilesWithLimit: (NSUInteger) limit;
+
+/**
+ Halves the counts of every file, forgetting those which reach zero, so
+ that the set of frequently-requested files follows changes in demand.
+ */
+- (void) ageHotFiles;
+
+/**
+ Loads files into the cache in the background, in the order given, until the
+ cache is full. The contents of small files are read; for larger ones, only
+ the metadata is cached, and the kernel is advised to read ahead the start of
+ the file. The work runs at background priority, so its I/O gives way to the
+ server's own.
+ 
+ Files are opened the same way a response operation opens them: relative to
+ the document root descriptor held by `configuration`.
+ @param paths Request paths, relative to the document root, most important first.
+ @param configuration The configuration whose document root holds the files.
+ @param maximumConcurrency The most files to load at once.
+ */
+- (void) prefetchItemsAtPaths: (NSArray *) paths configuration: (AQHTTPServerConfiguration *) configuration maximumConcurrency: (NSUInteger) maximumConcurrency;
+
+@end
@@ -0,0 +1,467 @@
+//
+//  AQHTTPFileCache.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPFileCache.h"
+#import "AQHTTPServerConfiguration.h"
+#import "AQHTTPResponseOperation.h"
+#import "AQHTTPFileResponseOperation.h"
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <libkern/OSAtomic.h>
+
+// the cost charged for an entry without contents, so metadata alone can't fill the cache indefinitely
+#define AQHTTPCachedFileMetadataCost    256
+
+// how much of a file too large to cache the kernel is asked to read ahead when prefetching
+#define AQHTTPFileCacheReadAheadLength  (4 * 1024 * 1024)
+
+NSString * const AQHTTPHotFilePathKey = @"path";
+NSString * const AQHTTPHotFileRequestsKey = @"requests";
+NSString * const AQHTTPHotFileBytesKey = @"bytes";
+
+// the request counts for one file, updated atomically from any thread
+@interface _AQHotFile : NSObject
+{
+@public
+    volatile int64_t    _requests;
+    volatile int64_t    _bytes;
+    volatile int32_t    _entries;       // cached entries counting into this; it's not forgotten while there are any
+}
+@end
+
+@implementation _AQHotFile
+@end
+
+@interface AQHTTPCachedFile ()
+- (id) initWithPath: (NSString *) path status: (const struct stat *) st contents: (NSData *) contents hotFile: (_AQHotFile *) hotFile;
+- (BOOL) matchesStatus: (const struct stat *) st;
+@end
+
+@implementation AQHTTPCachedFile
+{
+    NSString *          _path;
+    NSString *          _etag;
+    NSString *          _contentType;
+    NSData *            _contents;
+    _AQHotFile *        _hotFile;
+
+    // a file with a different identity, size, or modification or change time has changed
+    dev_t               _device;
+    ino_t               _inode;
+    off_t               _size;
+    struct timespec     _modified;
+    struct timespec     _changed;
+}
+
+@synthesize path=_path, etag=_etag, contentType=_contentType, contents=_contents;
+
+- (id) initWithPath: (NSString *) path status: (const struct stat *) st contents: (NSData *) contents hotFile: (_AQHotFile *) hotFile
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _etag = [AQHTTPEtagForFileAtPath(path) copy];
+    if ( _etag == nil )
+    {
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    _path = [path copy];
+    _contentType = [AQHTTPContentTypeForPath(path) copy];
+#if USING_MRR
+    _contents = [contents retain];
+    _hotFile = [hotFile retain];
+#else
+    _contents = contents;
+    _hotFile = hotFile;
+#endif
+    OSAtomicIncrement32Barrier(&_hotFile->_entries);
+
+    _device = st->st_dev;
+    _inode = st->st_ino;
+    _size = st->st_size;
+    _modified = st->st_mtimespec;
+    _changed = st->st_ctimespec;
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _hotFile != nil )
+        OSAtomicDecrement32Barrier(&_hotFile->_entries);
+#if USING_MRR
+    [_path release];
+    [_etag release];
+    [_contentType release];
+    [_contents release];
+    [_hotFile release];
+    [super dealloc];
+#endif
+}
+
+- (UInt64) size
+{
+    return ( (UInt64)_size );
+}
+
+- (NSDate *) modificationDate
+{
+    return ( [NSDate dateWithTimeIntervalSince1970: (NSTimeInterval)_modified.tv_sec + ((NSTimeInterval)_modified.tv_nsec / NSEC_PER_SEC)] );
+}
+
+- (BOOL) matchesStatus: (const struct stat *) st
+{
+    if ( st->st_dev != _device || st->st_ino != _inode || st->st_size != _size )
+        return ( NO );
+    if ( st->st_mtimespec.tv_sec != _modified.tv_sec || st->st_mtimespec.tv_nsec != _modified.tv_nsec )
+        return ( NO );
+    if ( st->st_ctimespec.tv_sec != _changed.tv_sec || st->st_ctimespec.tv_nsec != _changed.tv_nsec )
+        return ( NO );
+    return ( YES );
+}
+
+- (void) noteRequestWithBytes: (UInt64) bytes
+{
+    OSAtomicIncrement64(&_hotFile->_requests);
+    OSAtomicAdd64((int64_t)bytes, &_hotFile->_bytes);
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTPFileCache
+{
+    NSCache *           _files;         // absolute path -> AQHTTPCachedFile
+    dispatch_queue_t    _q;             // guards _loading and _hotFiles
+    NSMutableSet *      _loading;
+    NSMutableDictionary * _hotFiles;    // absolute path -> _AQHotFile
+    NSUInteger          _maximumFileSize;
+    NSUInteger          _totalSize;
+    BOOL                _recordsHotFiles;
+}
+
+@synthesize maximumFileSize=_maximumFileSize, totalSize=_totalSize, recordsHotFiles=_recordsHotFiles;
+
+- (id) initWithMaximumFileSize: (NSUInteger) maximumFileSize totalSize: (NSUInteger) totalSize
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _maximumFileSize = maximumFileSize;
+    _totalSize = totalSize;
+
+    _files = [NSCache new];
+    _files.name = @"me.alanquatermain.AQHTTPFileCache";
+    _files.totalCostLimit = totalSize;
+
+    _q = dispatch_queue_create("me.alanquatermain.AQHTTPFileCache", DISPATCH_QUEUE_SERIAL);
+    _loading = [NSMutableSet new];
+    _hotFiles = [NSMutableDictionary new];
+
+    return ( self );
+}
+
+#if USING_MRR || DISPATCH_USES_ARC == 0
+- (void) dealloc
+{
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(_q);
+#endif
+#if USING_MRR
+    [_files release];
+    [_loading release];
+    [_hotFiles release];
+    [super dealloc];
+#endif
+}
+#endif
+
+// returns the entry for a file with the given status, discarding any which is out of date; `st` is NULL if the file is gone
+- (AQHTTPCachedFile *) _cachedFileForKey: (NSString *) key status: (const struct stat *) st
+{
+    AQHTTPCachedFile * file = [_files objectForKey: key];
+    if ( file == nil )
+        return ( nil );
+
+    if ( st == NULL || [file matchesStatus: st] == NO )
+    {
+        [_files removeObjectForKey: key];
+        return ( nil );
+    }
+
+    return ( file );
+}
+
+- (AQHTTPCachedFile *) cachedFileForItemAtPath: (NSString *) path configuration: (AQHTTPServerConfiguration *) configuration
+{
+    NSString * key = [configuration absolutePathForItemAtPath: path];
+    if ( key == nil )
+        return ( nil );
+
+    struct stat st;
+    BOOL exists = [configuration getStatus: &st ofItemAtPath: path];
+    return ( [self _cachedFileForKey: key status: (exists ? &st : NULL)] );
+}
+
+// marks a file as being loaded, returning NO if it already was; each YES must be balanced by -_endLoadingFileAtPath:
+- (BOOL) _beginLoadingFileAtPath: (NSString *) key
+{
+    __block BOOL alreadyLoading = NO;
+    dispatch_sync(_q, ^{
+        alreadyLoading = [_loading containsObject: key];
+        if ( alreadyLoading == NO )
+            [_loading addObject: key];
+    });
+    return ( alreadyLoading == NO );
+}
+
+- (void) _endLoadingFileAtPath: (NSString *) key
+{
+    dispatch_async(_q, ^{
+        [_loading removeObject: key];
+    });
+}
+
+- (void) loadItemAtPath: (NSString *) path configuration: (AQHTTPServerConfiguration *) configuration
+{
+    NSString * key = [configuration absolutePathForItemAtPath: path];
+    if ( key == nil || [self _beginLoadingFileAtPath: key] == NO )
+        return;
+
+    NSString * pathCopy = [path copy];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        @autoreleasepool {
+            int fd = [configuration openItemAtPath: pathCopy];
+            if ( fd >= 0 )
+            {
+                [self _loadFileAtPath: key descriptor: fd];
+                close(fd);
+            }
+        }
+        [self _endLoadingFileAtPath: key];
+    });
+#if USING_MRR
+    [pathCopy release];
+#endif
+}
+
+- (_AQHotFile *) _hotFileForPath: (NSString *) key
+{
+    __block _AQHotFile * file = nil;
+    dispatch_sync(_q, ^{
+        file = [_hotFiles objectForKey: key];
+        if ( file == nil )
+        {
+            file = [_AQHotFile new];
+            [_hotFiles setObject: file forKey: key];
+#if USING_MRR
+            [file release];
+#endif
+        }
+    });
+    return ( file );
+}
+
+// caches the file open on `fd`, under its absolute path `key`
+- (void) _loadFileAtPath: (NSString *) key descriptor: (int) fd
+{
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || S_ISREG(st.st_mode) == 0 )
+        return;
+    if ( [self _cachedFileForKey: key status: &st] != nil )
+        return;
+
+    NSData * contents = nil;
+    if ( (UInt64)st.st_size <= _maximumFileSize )
+    {
+        NSMutableData * data = [NSMutableData dataWithLength: (NSUInteger)st.st_size];
+        size_t total = 0;
+        while ( total < (size_t)st.st_size )
+        {
+            ssize_t numRead = pread(fd, (uint8_t *)[data mutableBytes] + total, (size_t)st.st_size - total, (off_t)total);
+            if ( numRead <= 0 )
+                return;
+            total += (size_t)numRead;
+        }
+
+        // make sure we didn't read the file while it was being changed
+        struct stat after;
+        if ( fstat(fd, &after) != 0 || after.st_size != st.st_size ||
+             after.st_mtimespec.tv_sec != st.st_mtimespec.tv_sec || after.st_mtimespec.tv_nsec != st.st_mtimespec.tv_nsec )
+        {
+            return;
+        }
+
+        contents = data;
+    }
+
+    AQHTTPCachedFile * file = [[AQHTTPCachedFile alloc] initWithPath: key status: &st contents: contents hotFile: [self _hotFileForPath: key]];
+    if ( file == nil )
+        return;
+
+    [_files setObject: file forKey: key cost: MAX([contents length], (NSUInteger)AQHTTPCachedFileMetadataCost)];
+#if USING_MRR
+    [file release];
+#endif
+}
+
+- (void) removeAllFiles
+{
+    [_files removeAllObjects];
+}
+
+- (void) noteRequestForFileAtPath: (NSString *) path bytes: (UInt64) bytes
+{
+    // without a manifest to write, the table would only ever grow
+    if ( _recordsHotFiles == NO )
+        return;
+
+    NSString * pathCopy = [path copy];
+    dispatch_async(_q, ^{
+        _AQHotFile * file = [_hotFiles objectForKey: pathCopy];
+        if ( file == nil )
+        {
+            file = [_AQHotFile new];
+            [_hotFiles setObject: file forKey: pathCopy];
+#if USING_MRR
+            [file release];
+#endif
+        }
+
+        OSAtomicIncrement64(&file->_requests);
+        OSAtomicAdd64((int64_t)bytes, &file->_bytes);
+    });
+#if USING_MRR
+    [pathCopy release];
+#endif
+}
+
+- (NSArray *) hotFilesWithLimit: (NSUInteger) limit
+{
+    // the counts can change while we look at them, so sort a copy
+    NSMutableArray * counts = [NSMutableArray array];
+    dispatch_sync(_q, ^{
+        [_hotFiles enumerateKeysAndObjectsUsingBlock: ^(id key, id obj, BOOL *stop) {
+            _AQHotFile * file = obj;
+            if ( file->_requests == 0 )
+                return;
+            [counts addObject: [NSDictionary dictionaryWithObjectsAndKeys: key, AQHTTPHotFilePathKey,
+                                [NSNumber numberWithLongLong: file->_requests], AQHTTPHotFileRequestsKey,
+                                [NSNumber numberWithLongLong: file->_bytes], AQHTTPHotFileBytesKey, nil]];
+        }];
+    });
+
+    [counts sortUsingComparator: ^NSComparisonResult(id obj1, id obj2) {
+        NSComparisonResult result = [[obj2 objectForKey: AQHTTPHotFileRequestsKey] compare: [obj1 objectForKey: AQHTTPHotFileRequestsKey]];
+        if ( result == NSOrderedSame )
+            result = [[obj2 objectForKey: AQHTTPHotFileBytesKey] compare: [obj1 objectForKey: AQHTTPHotFileBytesKey]];
+        return ( result );
+    }];
+
+    if ( [counts count] > limit )
+        [counts removeObjectsInRange: NSMakeRange(limit, [counts count] - limit)];
+    return ( counts );
+}
+
+- (void) ageHotFiles
+{
+    dispatch_async(_q, ^{
+        for ( NSString * path in [_hotFiles allKeys] )
+        {
+            // requests may be counted while we do this, so take away half of what we saw rather than storing a new value
+            _AQHotFile * file = [_hotFiles objectForKey: path];
+            int64_t requests = file->_requests, bytes = file->_bytes;
+            OSAtomicAdd64Barrier(-(requests - requests / 2), &file->_requests);
+            OSAtomicAdd64Barrier(-(bytes - bytes / 2), &file->_bytes);
+
+            // a file still in the cache keeps counting into this record, so it's kept
+            if ( file->_requests == 0 && file->_entries == 0 )
+                [_hotFiles removeObjectForKey: path];
+        }
+    });
+}
+
+// returns the number of bytes of contents cached
+- (UInt64) _prefetchItemAtPath: (NSString *) path configuration: (AQHTTPServerConfiguration *) configuration
+{
+    // a request may already have started loading it
+    NSString * key = [configuration absolutePathForItemAtPath: path];
+    if ( key == nil || [self _beginLoadingFileAtPath: key] == NO )
+        return ( 0 );
+
+    // opened below the document root descriptor, just as a request for it would be
+    int fd = [configuration openItemAtPath: path];
+    if ( fd < 0 )
+    {
+        [self _endLoadingFileAtPath: key];
+        return ( 0 );
+    }
+
+    struct stat st;
+    if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (UInt64)st.st_size > _maximumFileSize )
+    {
+        // warm the page cache for the start of the response, which is all the client waits for
+        struct radvisory advice = { .ra_offset = 0, .ra_count = (int)MIN(st.st_size, (off_t)AQHTTPFileCacheReadAheadLength) };
+        fcntl(fd, F_RDADVISE, &advice);
+    }
+
+    [self _loadFileAtPath: key descriptor: fd];
+    close(fd);
+    [self _endLoadingFileAtPath: key];
+    return ( [[_files objectForKey: key].contents length] );
+}
+
+- (void) prefetchItemsAtPaths: (NSArray *) paths configuration: (AQHTTPServerConfiguration *) configuration maximumConcurrency: (NSUInteger) maximumConcurrency
+{
+    NSArray * pathsCopy = [paths copy];
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0);
+    NSUInteger concurrency = MAX(maximumConcurrency, (NSUInteger)1);
+    dispatch_async(queue, ^{
+        dispatch_semaphore_t slots = dispatch_semaphore_create(concurrency);
+        __block volatile int64_t loaded = 0;
+
+        for ( NSString * path in pathsCopy )
+        {
+            // stop once the cache is full: any more would only push out the files we've just loaded
+            dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+            if ( (UInt64)loaded >= _totalSize )
+            {
+                dispatch_semaphore_signal(slots);
+                break;
+            }
+
+            dispatch_async(queue, ^{
+                @autoreleasepool {
+                    OSAtomicAdd64Barrier((int64_t)[self _prefetchItemAtPath: path configuration: configuration], &loaded);
+                }
+                dispatch_semaphore_signal(slots);
+            });
+        }
+
+        // wait for the stragglers, then hand the slots back: a semaphore can't be released while it's short
+        for ( NSUInteger i = 0; i < concurrency; i++ )
+            dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+        for ( NSUInteger i = 0; i < concurrency; i++ )
+            dispatch_semaphore_signal(slots);
+#if DISPATCH_USES_ARC == 0
+        dispatch_release(slots);
+#endif
+    });
+#if USING_MRR
+    [pathsCopy release];
+#endif
+}
+
+@end
@@ -9,5 +9,13 @@
 #import <Foundation/Foundation.h>
 #import "AQHTTPResponseOperation.h"
 
+/**
+ Calculates the entity tag used for a file, which changes whenever any of
+ its attributes do.
+ @param path The absolute path of the file.
+ @result A hexadecimal entity tag, or `nil` if the file's attributes can't be read.
+ */
+extern NSString * AQHTTPEtagForFileAtPath(NSString * path);
+
 @interface AQHTTPFileResponseOperation : AQHTTPResponseOperation
 @end
@@ -14,28 +14,63 @@
 # import <CoreServices/CoreServices.h>
 #endif
 #import <CommonCrypto/CommonDigest.h>
+#import <sys/stat.h>
 
 static NSString * htmlErrorFormat = @"<!DOCTYPE html><html><head><title>%@</title></head><body><p>%@</p></body></html>";
 
+NSString * AQHTTPEtagForFileAtPath(NSString * path)
+{
+    NSDictionary * dict = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL];
+    if ( dict == nil )
+        return ( nil );
+    
+    NSData * plist = [NSPropertyListSerialization dataWithPropertyList: dict format: NSPropertyListBinaryFormat_v1_0 options: 0 error: NULL];
+    if ( plist == nil )
+        return ( nil );
+    
+    // SHA-1 hash it
+    uint8_t md[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([plist bytes], (CC_LONG)[plist length], md);
+    
+    // convert to a string
+    char str[CC_SHA1_DIGEST_LENGTH*2+1];
+    str[CC_SHA1_DIGEST_LENGTH*2] = '\0';
+    for ( int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++ )
+    {
+        sprintf(&str[i*2], "%02x", md[i]);
+    }
+    
+    return ( [NSString stringWithUTF8String: str] );
+}
+
 @implementation AQHTTPFileResponseOperation
 
 - (NSUInteger) statusCodeForItemAtPath: (NSString *) rootRelativePath
 {
-    NSString * path = [[[_connection.documentRoot URLByAppendingPathComponent: rootRelativePath] absoluteURL] path];
     NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(_request));
-    BOOL isDir = NO;
+    struct stat st;
     
-    if ( [[NSFileManager defaultManager] fileExistsAtPath: path isDirectory: &isDir] == NO )
+    if ( [_configuration getStatus: &st ofItemAtPath: rootRelativePath] == NO )
     {
         // Resource Not Found
         return ( 404 );
     }
-    else if ( isDir || [method caseInsensitiveCompare: @"DELETE"] == NSOrderedSame )
+    else if ( S_ISDIR(st.st_mode) || [method caseInsensitiveCompare: @"DELETE"] == NSOrderedSame )
     {
         // Not Permitted
         return ( 403 );
     }
-    else if ( _ranges != nil )
+    
+    // the file has been looked up anyway, so count it towards the cache's record of frequently-requested files
+    AQHTTPFileCache * cache = _configuration.fileCache;
+    if ( cache != nil && S_ISREG(st.st_mode) )
+    {
+        NSString * absolutePath = [_configuration absolutePathForItemAtPath: rootRelativePath];
+        if ( absolutePath != nil )
+            [cache noteRequestForFileAtPath: absolutePath bytes: ([method caseInsensitiveCompare: @"HEAD"] == NSOrderedSame ? 0 : (UInt64)st.st_size)];
+    }
+    
+    if ( _ranges != nil )
     {
         return ( 206 );
     }
@@ -45,49 +80,48 @@ static NSString * htmlErrorFormat = @"<!DOCTYPE html><html><head><title>%@</titl
 
 - (UInt64) sizeOfItemAtPath: (NSString *) rootRelativePath
 {
-    NSString * path = [[[_connection.documentRoot URLByAppendingPathComponent: rootRelativePath] absoluteURL] path];
-    
-    NSDictionary * attrs = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL];
-    if ( attrs == nil )
+    struct stat st;
+    if ( [_configuration getStatus: &st ofItemAtPath: rootRelativePath] == NO )
         return ( (UInt64)-1 );
     
-    return ( [attrs fileSize] );
+    return ( (UInt64)st.st_size );
 }
 
 - (NSString *) etagForItemAtPath: (NSString *) path
 {
-    path = [[[_connection.documentRoot URLByAppendingPathComponent: path] absoluteURL] path];
-    NSDictionary * dict = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL];
-    if ( dict == nil )
+    NSString * absolutePath = [_configuration absolutePathForItemAtPath: path];
+    if ( absolutePath == nil )
         return ( nil );
     
-    NSData * plist = [NSPropertyListSerialization dataWithPropertyList: dict format: NSPropertyListBinaryFormat_v1_0 options: 0 error: NULL];
-    if ( plist == nil )
+    return ( AQHTTPEtagForFileAtPath(absolutePath) );
+}
+
+- (NSDate *) modificationDateForItemAtPath: (NSString *) rootRelativePath
+{
+    struct stat st;
+    if ( [_configuration getStatus: &st ofItemAtPath: rootRelativePath] == NO )
         return ( nil );
     
-    // SHA-1 hash it
-    uint8_t md[CC_SHA1_DIGEST_LENGTH];
-    CC_SHA1([plist bytes], (CC_LONG)[plist length], md);
-    
-    // convert to a string
-    char str[CC_SHA1_DIGEST_LENGTH*2+1];
-    str[CC_SHA1_DIGEST_LENGTH*2] = '\0';
-    for ( int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++ )
-    {
-        sprintf(&str[i*2], "%02x", md[i]);
-    }
-    
-    return ( [NSString stringWithUTF8String: str] );
+    return ( [NSDate dateWithTimeIntervalSince1970: (NSTimeInterval)st.st_mtimespec.tv_sec + ((NSTimeInterval)st.st_mtimespec.tv_nsec / NSEC_PER_SEC)] );
 }
 
 - (NSInputStream *) inputStreamForItemAtPath: (NSString *) rootRelativePath
 {
-    return ( [NSInputStream inputStreamWithURL: [_connection.documentRoot URLByAppendingPathComponent: rootRelativePath]] );
+    // files are read through a descriptor opened relative to the document root; see below
+    return ( nil );
 }
 
 - (id<AQRandomAccessFile>) randomAccessFileForItemAtPath: (NSString *) rootRelativePath
 {
-    return ( [NSFileHandle fileHandleForReadingFromURL: [_connection.documentRoot URLByAppendingPathComponent: rootRelativePath] error: NULL] );
+    int fd = [_configuration openItemAtPath: rootRelativePath];
+    if ( fd < 0 )
+        return ( nil );
+    
+    NSFileHandle * handle = [[NSFileHandle alloc] initWithFileDescriptor: fd closeOnDealloc: YES];
+#if USING_MRR
+    [handle autorelease];
+#endif
+    return ( handle );
 }
 
 @end
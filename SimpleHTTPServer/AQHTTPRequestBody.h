@@ -0,0 +1,75 @@
+//
+//  AQHTTPRequestBody.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/// The error domain for errors reported by AQHTTPRequestBody.
+extern NSString * const AQHTTPRequestBodyErrorDomain;
+
+enum
+{
+    AQHTTPRequestBodyTooLargeError          = 1,    /// The body exceeded the connection's maximumRequestBodyLength.
+    AQHTTPRequestBodyMalformedError         = 2,    /// The body's chunked encoding (or HTTP/2 framing) was invalid.
+    AQHTTPRequestBodyConnectionLostError    = 3,    /// The connection or stream went away before the body was complete.
+};
+
+/**
+ An AQHTTPRequestBody provides streaming access to the body of an incoming
+ request.
+
+ Bodies are never accumulated in full: the connection decodes any
+ Content-Length or chunked framing and passes the payload to the body as it
+ arrives, and a response operation reads it from the body at its own pace.
+ When too much unread data builds up, the connection stops reading from its
+ socket (or, for HTTP/2, stops extending the stream's flow-control window)
+ until the operation catches up.
+
+ A response operation which has no interest in the body needn't do anything:
+ any unread data is discarded once the operation finishes.
+ */
+@interface AQHTTPRequestBody : NSObject
+
+/// The length given by the request's Content-Length header, or `-1` if the length isn't known in advance (e.g. a chunked body).
+@property (nonatomic, readonly) long long expectedLength;
+
+/// The number of payload bytes which have arrived so far, whether or not they've been read.
+@property (nonatomic, readonly) unsigned long long receivedLength;
+
+/**
+ Reads the next available portion of the body, waiting for more to arrive if
+ necessary.
+
+ This method blocks, so it should only be called from a response operation's
+ own thread.
+ @param maxLength The largest amount of data to return.
+ @param error If this method returns `nil`, then on return this value contains
+ an NSError object detailing the error.
+ @result Between 1 and `maxLength` bytes of the body, an empty data object
+ once the whole body has been read, or `nil` if the body could not be
+ received in full.
+ */
+- (NSData *) readDataOfMaximumLength: (NSUInteger) maxLength error: (NSError **) error;
+
+/**
+ Reads the remainder of the body into memory.
+
+ This is a convenience for small bodies such as form submissions. Callers
+ should check the expectedLength before relying on it.
+ @param error If this method returns `nil`, then on return this value contains
+ an NSError object detailing the error.
+ @result The rest of the body, or `nil` if it could not be received in full.
+ */
+- (NSData *) readDataToEndOfBodyWithError: (NSError **) error;
+
+/**
+ Throws away any buffered data, along with the rest of the body as it
+ arrives. Subsequent reads return an empty data object.
+ */
+- (void) discard;
+
+@end
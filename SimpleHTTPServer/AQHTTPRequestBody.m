@@ -0,0 +1,518 @@
+//
+//  AQHTTPRequestBody.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPRequestBody.h"
+#import "AQHTTPRequestBody_PrivateInternal.h"
+
+NSString * const AQHTTPRequestBodyErrorDomain = @"AQHTTPRequestBodyErrorDomain";
+
+// reading from the socket is suspended when this much data is waiting to be read, and resumed when it drops back below the low mark
+#define AQHTTPRequestBodyHighWaterMark  (256 * 1024)
+#define AQHTTPRequestBodyLowWaterMark   (64 * 1024)
+
+// chunk-size lines (including any extensions) and trailers aren't stored, but we don't let them go on forever
+#define AQHTTPRequestBodyMaxChunkLine   4096
+#define AQHTTPRequestBodyMaxTrailer     (16 * 1024)
+
+typedef enum
+{
+    AQHTTPBodyStateFixedLength,
+    AQHTTPBodyStateChunkSize,
+    AQHTTPBodyStateChunkData,
+    AQHTTPBodyStateChunkDataEnd,
+    AQHTTPBodyStateTrailer,
+    AQHTTPBodyStateDone
+
+} AQHTTPBodyState;
+
+static NSError * _AQHTTPRequestBodyError(NSInteger code)
+{
+    NSString * description = nil;
+    switch ( code )
+    {
+        case AQHTTPRequestBodyTooLargeError:
+            description = NSLocalizedString(@"The request body is too large.", @"HTTP request body error");
+            break;
+        case AQHTTPRequestBodyMalformedError:
+            description = NSLocalizedString(@"The request body is not correctly encoded.", @"HTTP request body error");
+            break;
+        default:
+            description = NSLocalizedString(@"The connection was lost before the request body was received.", @"HTTP request body error");
+            break;
+    }
+
+    return ( [NSError errorWithDomain: AQHTTPRequestBodyErrorDomain code: code userInfo: [NSDictionary dictionaryWithObject: description forKey: NSLocalizedDescriptionKey]] );
+}
+
+static inline int _HexDigitValue(uint8_t c)
+{
+    if ( c >= '0' && c <= '9' )
+        return ( c - '0' );
+    if ( c >= 'a' && c <= 'f' )
+        return ( c - 'a' + 10 );
+    if ( c >= 'A' && c <= 'F' )
+        return ( c - 'A' + 10 );
+    return ( -1 );
+}
+
+@implementation AQHTTPRequestBody
+{
+    long long               _expectedLength;
+    unsigned long long      _maximumLength;
+    unsigned long long      _receivedLength;
+
+    // everything below is protected by _lock
+    NSCondition *           _lock;
+    NSMutableArray *        _chunks;
+    NSUInteger              _bufferedLength;
+    BOOL                    _complete;
+    BOOL                    _discarded;
+    BOOL                    _suspended;
+    NSError *               _error;
+
+    // decoder state; only ever touched by the producer
+    AQHTTPBodyState         _state;
+    unsigned long long      _remaining;
+    NSUInteger              _lineLength;
+    NSUInteger              _trailerLength;
+    NSUInteger              _sizeDigits;
+    BOOL                    _inExtension;
+
+    void (^_suspendHandler)(void);
+    void (^_resumeHandler)(void);
+    void (^_consumptionHandler)(NSUInteger);
+    void (^_firstReadHandler)(void);
+}
+
+@synthesize expectedLength=_expectedLength, receivedLength=_receivedLength;
+@synthesize suspendHandler=_suspendHandler, resumeHandler=_resumeHandler, consumptionHandler=_consumptionHandler, firstReadHandler=_firstReadHandler;
+
+- (id) initWithExpectedLength: (long long) expectedLength maximumLength: (unsigned long long) maximumLength
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _expectedLength = expectedLength;
+    _maximumLength = maximumLength;
+    _lock = [NSCondition new];
+    _chunks = [NSMutableArray new];
+
+    if ( expectedLength < 0 )
+    {
+        _state = AQHTTPBodyStateChunkSize;
+    }
+    else
+    {
+        _state = AQHTTPBodyStateFixedLength;
+        _remaining = (unsigned long long)expectedLength;
+        if ( _remaining == 0 )
+        {
+            _state = AQHTTPBodyStateDone;
+            _complete = YES;
+        }
+    }
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+#if USING_MRR
+    [_lock release];
+    [_chunks release];
+    [_error release];
+    [_suspendHandler release];
+    [_resumeHandler release];
+    [_consumptionHandler release];
+    [_firstReadHandler release];
+    [super dealloc];
+#endif
+}
+
+- (BOOL) isComplete
+{
+    [_lock lock];
+    BOOL result = _complete;
+    [_lock unlock];
+    return ( result );
+}
+
+- (NSError *) error
+{
+    [_lock lock];
+    NSError * result = _error;
+#if USING_MRR
+    [[result retain] autorelease];
+#endif
+    [_lock unlock];
+    return ( result );
+}
+
+// must be called with the lock held
+- (void) _resumeIfSuspended
+{
+    if ( _suspended == NO )
+        return;
+
+    _suspended = NO;
+    if ( _resumeHandler != nil )
+        _resumeHandler();
+}
+
+// must be called with the lock held
+- (void) _setError: (NSError *) error
+{
+    if ( _complete || _error != nil )
+        return;
+
+#if USING_MRR
+    _error = [error retain];
+#else
+    _error = error;
+#endif
+    _state = AQHTTPBodyStateDone;
+    [self _resumeIfSuspended];
+    [_lock broadcast];
+}
+
+- (BOOL) _appendPayloadBytes: (const uint8_t *) bytes length: (NSUInteger) length
+{
+    if ( length == 0 )
+        return ( YES );
+
+    _receivedLength += length;
+
+    BOOL result = YES;
+    NSUInteger consumed = 0;
+
+    [_lock lock];
+    if ( _error != nil )
+    {
+        result = NO;
+    }
+    else if ( _maximumLength != 0 && _receivedLength > _maximumLength )
+    {
+        [self _setError: _AQHTTPRequestBodyError(AQHTTPRequestBodyTooLargeError)];
+        result = NO;
+    }
+    else if ( _discarded )
+    {
+        // nobody's going to read it, so it counts as consumed straight away
+        consumed = length;
+    }
+    else
+    {
+        [_chunks addObject: [NSData dataWithBytes: bytes length: length]];
+        _bufferedLength += length;
+
+        if ( _bufferedLength >= AQHTTPRequestBodyHighWaterMark && _suspended == NO )
+        {
+            _suspended = YES;
+            if ( _suspendHandler != nil )
+                _suspendHandler();
+        }
+
+        [_lock signal];
+    }
+    [_lock unlock];
+
+    if ( consumed != 0 && _consumptionHandler != nil )
+        _consumptionHandler(consumed);
+
+    return ( result );
+}
+
+- (NSUInteger) appendEncodedBytes: (const uint8_t *) bytes length: (NSUInteger) length
+{
+    NSUInteger used = 0;
+
+    while ( used < length && _state != AQHTTPBodyStateDone )
+    {
+        switch ( _state )
+        {
+            case AQHTTPBodyStateFixedLength:
+            case AQHTTPBodyStateChunkData:
+            {
+                NSUInteger count = (NSUInteger)MIN((unsigned long long)(length - used), _remaining);
+                if ( [self _appendPayloadBytes: bytes + used length: count] == NO )
+                    return ( used );
+
+                used += count;
+                _remaining -= count;
+                if ( _remaining == 0 )
+                {
+                    if ( _state == AQHTTPBodyStateFixedLength )
+                        [self finish];
+                    else
+                        _state = AQHTTPBodyStateChunkDataEnd;
+                }
+                break;
+            }
+
+            case AQHTTPBodyStateChunkSize:
+            {
+                uint8_t c = bytes[used++];
+                if ( ++_lineLength > AQHTTPRequestBodyMaxChunkLine )
+                {
+                    [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                    return ( used );
+                }
+
+                if ( c == '\n' )
+                {
+                    if ( _sizeDigits == 0 )
+                    {
+                        [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                        return ( used );
+                    }
+
+                    _state = (_remaining == 0 ? AQHTTPBodyStateTrailer : AQHTTPBodyStateChunkData);
+                    _lineLength = 0;
+                    _sizeDigits = 0;
+                    _inExtension = NO;
+                }
+                else if ( _inExtension == NO && c != '\r' )
+                {
+                    int value = _HexDigitValue(c);
+                    if ( value >= 0 )
+                    {
+                        // fifteen digits keeps us well clear of overflow
+                        if ( ++_sizeDigits > 15 )
+                        {
+                            [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                            return ( used );
+                        }
+                        _remaining = (_remaining << 4) | (unsigned long long)value;
+                    }
+                    else if ( c == ';' || c == ' ' || c == '\t' )
+                    {
+                        // chunk extensions are ignored
+                        _inExtension = YES;
+                    }
+                    else
+                    {
+                        [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                        return ( used );
+                    }
+                }
+                break;
+            }
+
+            case AQHTTPBodyStateChunkDataEnd:
+            {
+                uint8_t c = bytes[used++];
+                if ( c == '\n' )
+                {
+                    _state = AQHTTPBodyStateChunkSize;
+                }
+                else if ( c != '\r' )
+                {
+                    [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                    return ( used );
+                }
+                break;
+            }
+
+            case AQHTTPBodyStateTrailer:
+            {
+                // trailer fields are read and ignored; an empty line ends the body
+                uint8_t c = bytes[used++];
+                if ( ++_trailerLength > AQHTTPRequestBodyMaxTrailer )
+                {
+                    [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+                    return ( used );
+                }
+
+                if ( c == '\n' )
+                {
+                    if ( _lineLength == 0 )
+                        [self finish];
+                    _lineLength = 0;
+                }
+                else if ( c != '\r' )
+                {
+                    _lineLength++;
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return ( used );
+}
+
+- (BOOL) appendData: (NSData *) data
+{
+    if ( _state == AQHTTPBodyStateDone )
+        return ( NO );
+
+    if ( _expectedLength >= 0 && _receivedLength + [data length] > (unsigned long long)_expectedLength )
+    {
+        // more data than the content-length promised
+        [self failWithError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+        return ( NO );
+    }
+
+    return ( [self _appendPayloadBytes: [data bytes] length: [data length]] );
+}
+
+- (void) finish
+{
+    [_lock lock];
+    if ( _error == nil && _complete == NO )
+    {
+        if ( _expectedLength >= 0 && _receivedLength != (unsigned long long)_expectedLength )
+        {
+            // an HTTP/2 stream ended early
+            [self _setError: _AQHTTPRequestBodyError(AQHTTPRequestBodyMalformedError)];
+        }
+        else
+        {
+            _complete = YES;
+            _state = AQHTTPBodyStateDone;
+            [self _resumeIfSuspended];
+            [_lock broadcast];
+        }
+    }
+    [_lock unlock];
+}
+
+- (void) failWithError: (NSError *) error
+{
+    if ( error == nil )
+        error = _AQHTTPRequestBodyError(AQHTTPRequestBodyConnectionLostError);
+
+    [_lock lock];
+    [self _setError: error];
+    [_lock unlock];
+}
+
+- (NSData *) readDataOfMaximumLength: (NSUInteger) maxLength error: (NSError **) error
+{
+    NSParameterAssert(maxLength != 0);
+
+    NSData * result = nil;
+    NSError * failure = nil;
+    NSUInteger consumed = 0;
+    void (^firstRead)(void) = nil;
+
+    [_lock lock];
+
+    // the first read is what tells a client waiting on '100 Continue' to go ahead, so it has to happen before we wait
+    if ( _firstReadHandler != nil )
+    {
+        firstRead = _firstReadHandler;
+        _firstReadHandler = nil;
+        [_lock unlock];
+        firstRead();
+#if USING_MRR
+        [firstRead release];
+#endif
+        [_lock lock];
+    }
+
+    while ( [_chunks count] == 0 && _complete == NO && _error == nil && _discarded == NO )
+        [_lock wait];
+
+    if ( [_chunks count] != 0 )
+    {
+        NSData * chunk = [_chunks objectAtIndex: 0];
+        if ( [chunk length] <= maxLength )
+        {
+#if USING_MRR
+            result = [[chunk retain] autorelease];
+#else
+            result = chunk;
+#endif
+            [_chunks removeObjectAtIndex: 0];
+        }
+        else
+        {
+            result = [chunk subdataWithRange: NSMakeRange(0, maxLength)];
+            [_chunks replaceObjectAtIndex: 0 withObject: [chunk subdataWithRange: NSMakeRange(maxLength, [chunk length] - maxLength)]];
+        }
+
+        consumed = [result length];
+        _bufferedLength -= consumed;
+        if ( _bufferedLength <= AQHTTPRequestBodyLowWaterMark )
+            [self _resumeIfSuspended];
+    }
+    else if ( _error != nil )
+    {
+#if USING_MRR
+        failure = [[_error retain] autorelease];
+#else
+        failure = _error;
+#endif
+    }
+    else
+    {
+        // complete or discarded
+        result = [NSData data];
+    }
+
+    [_lock unlock];
+
+    if ( consumed != 0 && _consumptionHandler != nil )
+        _consumptionHandler(consumed);
+
+    if ( result == nil && error != NULL )
+        *error = failure;
+
+    return ( result );
+}
+
+- (NSData *) readDataToEndOfBodyWithError: (NSError **) error
+{
+    NSMutableData * result = [NSMutableData data];
+
+    for ( ;; )
+    {
+        NSData * data = [self readDataOfMaximumLength: AQHTTPRequestBodyHighWaterMark error: error];
+        if ( data == nil )
+            return ( nil );
+        if ( [data length] == 0 )
+            break;
+        [result appendData: data];
+    }
+
+    return ( result );
+}
+
+- (void) discard
+{
+    NSUInteger consumed = 0;
+
+    [_lock lock];
+    if ( _discarded == NO )
+    {
+        _discarded = YES;
+        consumed = _bufferedLength;
+        [_chunks removeAllObjects];
+        _bufferedLength = 0;
+
+        // nobody is going to read, so there's no need to ask the client for anything
+#if USING_MRR
+        [_firstReadHandler release];
+#endif
+        _firstReadHandler = nil;
+
+        [self _resumeIfSuspended];
+        [_lock broadcast];
+    }
+    [_lock unlock];
+
+    if ( consumed != 0 && _consumptionHandler != nil )
+        _consumptionHandler(consumed);
+}
+
+@end
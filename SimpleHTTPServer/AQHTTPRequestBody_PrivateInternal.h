@@ -0,0 +1,42 @@
+//
+//  AQHTTPRequestBody_PrivateInternal.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPRequestBody.h"
+
+// the producer side of AQHTTPRequestBody, used by AQHTTPConnection and AQHTTP2Session
+@interface AQHTTPRequestBody ()
+
+// expectedLength is -1 for a chunked body; a maximumLength of zero means no limit
+- (id) initWithExpectedLength: (long long) expectedLength maximumLength: (unsigned long long) maximumLength;
+
+// Decodes HTTP/1.1 body framing (Content-Length or chunked), returning the number of bytes consumed.
+// Stops at the end of the body, so anything left over belongs to the next request.
+// Returns zero once the body is complete or has failed.
+- (NSUInteger) appendEncodedBytes: (const uint8_t *) bytes length: (NSUInteger) length;
+
+// appends already-decoded payload, as carried by HTTP/2 DATA frames
+- (BOOL) appendData: (NSData *) data;
+
+- (void) finish;
+- (void) failWithError: (NSError *) error;
+
+@property (nonatomic, readonly, getter=isComplete) BOOL complete;
+@property (nonatomic, readonly) NSError * error;
+
+// Called with the body's lock held when the amount of unread data crosses its high (suspend) and low (resume) water marks.
+// The resume handler is also called if reading is suspended when the body completes or is discarded.
+@property (nonatomic, copy) void (^suspendHandler)(void);
+@property (nonatomic, copy) void (^resumeHandler)(void);
+
+// called, outside the lock, as payload is read or discarded
+@property (nonatomic, copy) void (^consumptionHandler)(NSUInteger length);
+
+// called, outside the lock, the first time the consumer asks for data; used to send '100 Continue'
+@property (nonatomic, copy) void (^firstReadHandler)(void);
+
+@end
@@ -10,9 +10,35 @@
 #import "DDRange.h"
 #import "AQHTTPConnection.h"
 #import "AQSocket.h"
+#import "AQHTTPRequestBody.h"
+#import "AQHTTPTrace.h"
 
 @protocol AQRandomAccessFile, AQHTTPConnection;
 
+/**
+ Calculates a MIME type from the filename extension of a path.
+ @see -[AQHTTPResponseOperation contentTypeForItemAtPath:]
+ */
+extern NSString * AQHTTPContentTypeForPath(NSString * path);
+
+/**
+ Returns the path a request asks for, relative to the document root. Percent
+ escapes in the request URL are decoded exactly once.
+ */
+extern NSString * AQHTTPRequestPath(CFHTTPMessageRef request);
+
+/**
+ Decides whether a request's preconditions allow it to be answered with
+ `304 Not Modified`. If the request has an If-None-Match header it's compared
+ with `etag`; otherwise any If-Modified-Since header is compared with
+ `modificationDate`.
+ @param request The request.
+ @param etag The current entity tag of the item requested, or `nil`.
+ @param modificationDate The time the item was last modified, or `nil`.
+ @result Returns `YES` if the client's copy of the item is up to date.
+ */
+extern BOOL AQHTTPRequestIsNotModified(CFHTTPMessageRef request, NSString * etag, NSDate * modificationDate);
+
 /**
  All requests are handled by their own instance of AQHTTPResponseOperation
  or one of its subclasses. Once the HTTP request has been parsed properly,
@@ -31,13 +57,28 @@
  
  For ranged requests, any object implementing the AQRandomAccessFile
  protocol can be used to obtain data for the requested range(s).
+ 
+ Subclasses which generate their content incrementally, and so can't know
+ its length in advance, can send it using the chunked response methods
+ instead.
  */
 @interface AQHTTPResponseOperation : NSOperation <NSStreamDelegate>
 {
     CFHTTPMessageRef _request;
     AQSocket *_socketRef;
     AQHTTPConnection *_connection;
+    AQHTTPServerConfiguration *_configuration;     // the connection's settings when the request arrived
+    AQHTTPRequestBody *_requestBody;
     BOOL _responseComplete;
+    id _bandwidthFlow;
+    
+    // tracing; zero unless the request was sampled
+    AQHTTPTraceID _trace;
+    uint64_t _traceQueuedAt;
+    
+    // chunked responses
+    BOOL _chunkedEncoding;
+    BOOL _closeAfterBody;
     
     // ranged requests
     NSArray *_ranges;
@@ -70,6 +111,26 @@
                 ranges: (NSArray *) ranges
          forConnection: (AQHTTPConnection *) connection;
 
+/**
+ The body of the request, or `nil` if it doesn't have one.
+ 
+ This is set by the connection before the operation is enqueued. The body
+ arrives while the operation runs: it should be read from the operation's
+ own thread, and anything left unread is discarded once the operation
+ completes.
+ */
+@property (nonatomic, strong) AQHTTPRequestBody * requestBody;
+
+/**
+ The trace of the request, or zero if it isn't being traced.
+ 
+ This is set by the connection as the operation is enqueued, and the time
+ from then until the operation starts is recorded as the request's queueing
+ time. The operation traces the phases of its response itself; subclasses
+ can add their own spans using AQHTTPTraceRecordSpan().
+ */
+@property (nonatomic, assign) AQHTTPTraceID trace;
+
 @end
 
 /**
@@ -85,6 +146,9 @@
  method implements a *synthetic synchronous* wrapper around those 
  asynchronous routines to aid in correctly-ordered responses when data
  is being read in discrete chunks (such as from an asynchronous stream).
+ If the socket already has more output queued than its high water mark,
+ this first waits for it to drain, so large responses should be written a
+ piece at a time rather than being read into memory in one go.
  
  If this method returns NO, the caller should assume that it is no longer
  possible to send any data as part of this response.
@@ -95,6 +159,42 @@
  */
 - (BOOL) writeAll: (NSData *) data;
 
+/**
+ Sends a response header for a body of unknown length.
+ 
+ Any Content-Length header is removed from the response. For HTTP/1.1
+ clients, the body will be sent using the chunked transfer-coding; HTTP/1.0
+ clients don't support this, so for them the connection is closed to mark
+ the end of the body. Over HTTP/2, the body's framing is handled by the
+ stream.
+ 
+ The body is then sent using -writeChunk:, and must be terminated by
+ calling -finishChunkedResponse.
+ @param response The response header to send. The caller retains ownership.
+ @result Returns YES if the header was written, or NO if the communications
+ channel is no longer available.
+ */
+- (BOOL) beginChunkedResponse: (CFHTTPMessageRef) response;
+
+/**
+ Sends the next portion of a body begun with -beginChunkedResponse:.
+ 
+ Like -writeAll:, this blocks until the data has been written, so a subclass
+ producing content faster than the client can receive it will be paced by
+ the connection.
+ @param data The data to send. Empty data is ignored.
+ @result Returns YES if the data was written, or NO if the communications
+ channel encountered an error.
+ */
+- (BOOL) writeChunk: (NSData *) data;
+
+/**
+ Ends a body begun with -beginChunkedResponse:.
+ @result Returns YES if the end of the body was sent, or NO if the
+ communications channel encountered an error.
+ */
+- (BOOL) finishChunkedResponse;
+
 /**
  Calculates a MIME type based on the name of the item at the given
  path.
@@ -122,9 +222,10 @@
  this case, and the response can be sent in one pass.
  
  If the request has an If-None-Match header and the receiver also returns a
- non-nil value from the -etagForItemAtPath: method, this method may choose
- to return a 304 Not Modified response instead of a requested 200-series
- response. The caller should check for this by calling
+ non-nil value from the -etagForItemAtPath: method, or it has an
+ If-Modified-Since header and the receiver returns a date from the
+ -modificationDateForItemAtPath: method, this method may choose to return a
+ 304 Not Modified response instead of a requested 200-series response. The caller should check for this by calling
  CFHTTPMessageGetResponseStatusCode() against the returned response.
  @param path The sub-path from the document root to the item requested.
  @param status The HTTP status code for this response.
@@ -183,6 +284,18 @@
  */
 - (NSString *) etagForItemAtPath: (NSString *) rootRelativePath;
 
+/**
+ Returns the time the given item was last modified.
+ 
+ Any date returned from this method will be sent in the response's
+ Last-Modified header, and compared with any If-Modified-Since header in the
+ request. The base class returns nil.
+ @param rootRelativePath The sub-path below the document root at which the
+ requested item resides.
+ @result The item's modification date, or `nil` if it isn't known.
+ */
+- (NSDate *) modificationDateForItemAtPath: (NSString *) rootRelativePath;
+
 /**
  Returns an input stream from which the contents of an item can be read.
  
@@ -8,6 +8,9 @@
 
 #import "AQHTTPResponseOperation.h"
 #import "NSDateFormatter+AQHTTPDateFormatter.h"
+#import "AQHTTP2Session.h"
+#import "AQHTTPConnection_PrivateInternal.h"
+#import "AQHTTPServer.h"
 #import <sys/stat.h>
 
 // for UTTypes API
@@ -20,8 +23,89 @@
 static NSString * const htmlErrorFormat = @"<!DOCTYPE html><html><head><title>%@</title></head><body><p>%@</p></body></html>";
 static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode";
 
+// file content is read & sent this much at a time, so a response's memory use doesn't depend on the file's size
+#define AQHTTPResponseFileChunkSize     (64 * 1024)
+
+@interface AQHTTPResponseOperation ()
+- (BOOL) _writeRange: (DDRange) range ofFile: (id<AQRandomAccessFile>) file;
+@end
+
+NSString * AQHTTPContentTypeForPath(NSString * path)
+{
+    // determine the type
+    CFStringRef uti = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)[path pathExtension], NULL);
+    NSString * contentType = nil;
+    
+    if ( uti != NULL )
+    {
+        contentType = CFBridgingRelease(UTTypeCopyPreferredTagWithClass(uti, kUTTagClassMIMEType));
+        //TODO : figure out the text encoding, if this is a text file, and include that using "; charset=[encoding]"
+        
+        CFRelease(uti);
+    }
+    
+    if ( contentType == nil )
+    {
+        NSString * extension = [path pathExtension];
+        if ( [extension isEqualToString: @"svg"] )
+        {
+            contentType = @"image/svg+xml";
+        }
+        else if ( [extension isEqualToString: @"xhtml"] )
+        {
+            contentType = @"application/xhtml+xml";
+        }
+        else if ( [extension isEqualToString: @"html"] )
+        {
+            contentType = @"text/html";
+        }
+        else if ( [extension isEqualToString: @"js"] )
+        {
+            contentType = @"application/javascript";
+        }
+        else if ( [extension isEqualToString: @"css"] )
+        {
+            contentType = @"text/css";
+        }
+        else
+        {
+            contentType = @"application/octet-stream";
+        }
+    }
+    
+    return ( contentType );
+}
+
+NSString * AQHTTPRequestPath(CFHTTPMessageRef request)
+{
+    // -[NSURL path] has already decoded the escapes: decoding again would turn "%2541" into "A" instead of "%41"
+    NSURL * requestURL = CFBridgingRelease(CFHTTPMessageCopyRequestURL(request));
+    return ( [requestURL path] );
+}
+
+BOOL AQHTTPRequestIsNotModified(CFHTTPMessageRef request, NSString * etag, NSDate * modificationDate)
+{
+    // If-None-Match takes precedence over If-Modified-Since
+    NSString * clientEtag = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("If-None-Match")));
+    if ( clientEtag != nil )
+        return ( [etag length] != 0 && [clientEtag isEqualToString: etag] );
+    
+    NSString * since = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(request, CFSTR("If-Modified-Since")));
+    if ( since == nil || modificationDate == nil )
+        return ( NO );
+    
+    NSDate * sinceDate = [[NSDateFormatter AQHTTPDateFormatter] dateFromString: since];
+    if ( sinceDate == nil )
+        return ( NO );
+    
+    // HTTP dates only go down to the second
+    return ( floor([modificationDate timeIntervalSince1970]) <= [sinceDate timeIntervalSince1970] );
+}
+
 @implementation AQHTTPResponseOperation
 
+@synthesize requestBody=_requestBody, trace=_trace;
+
 - (id) initWithRequest: (CFHTTPMessageRef) request
                 socket: (AQSocket *) aSocket
                 ranges: (NSArray *) ranges
@@ -37,9 +121,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
 #if USING_MRR
     _socketRef = [aSocket retain];
     _connection = [connection retain];
+    _configuration = [connection.configuration retain];
 #else
     _socketRef = aSocket;
     _connection = connection;
+    _configuration = connection.configuration;
 #endif
     
     _ranges = [ranges copy];
@@ -69,14 +155,33 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
 #if USING_MRR
     [_socketRef release];
     [_connection release];
+    [_configuration release];
+    [_requestBody release];
     [_ranges release];
     [_orderedRanges release];
     [_rangeBoundary release];
     [_contentType release];
+    [_bandwidthFlow release];
     [super dealloc];
 #endif
 }
 
+- (void) setTrace: (AQHTTPTraceID) trace
+{
+    _trace = trace;
+    _traceQueuedAt = AQHTTPTraceTimestamp();
+}
+
+- (void) start
+{
+    uint64_t runStart = AQHTTPTraceTimestamp();
+    AQHTTPTraceRecordSpan(_trace, "queue", _traceQueuedAt, runStart);
+    
+    [super start];
+    
+    AQHTTPTraceRecordSpan(_trace, "response", runStart, AQHTTPTraceTimestamp());
+}
+
 - (NSString *) rangeHeaderForRange: (DDRange) range fileSize: (UInt64) fileSize
                        contentType: (NSString *) contentType boundary: (NSString *) boundary
 {
@@ -98,12 +203,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     NSInputStream * stream = nil;
     id<AQRandomAccessFile> file = nil;
     
-    BOOL forceCloseConnection = !_connection.supportsPipelinedRequests;
+    BOOL forceCloseConnection = (!_connection.supportsPipelinedRequests || _connection.draining);
     
     @try
     {
-        NSURL * requestURL = CFBridgingRelease(CFHTTPMessageCopyRequestURL(_request));
-        NSString * path = [[requestURL path] stringByReplacingPercentEscapesUsingEncoding: NSUTF8StringEncoding];
+        NSString * path = AQHTTPRequestPath(_request);
         NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(_request));
         
         if ( [[path pathExtension] isEqualToString: @"ttf"] )
@@ -120,7 +224,9 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
         
         // determine if the item is accessible
         // also build a response early, so we can check for Not Modified status before creating streams etc.
+        uint64_t headerStart = AQHTTPTraceTimestamp();
         response = [self newResponseForItemAtPath: path withHTTPStatus: [self statusCodeForItemAtPath: path]];
+        AQHTTPTraceRecordSpan(_trace, "build response", headerStart, AQHTTPTraceTimestamp());
         if ( response == NULL )
         {
             NSLog(@"Error: no response returned from -newResponseForItemAtPath:withHTTPStatus:!");
@@ -266,17 +372,12 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
             if ( responseRange.location != NSNotFound )
             {
                 // single range, one way or another
-                NSData * data = [file readDataFromByteRange: responseRange];
-                if ( data == nil )
+                if ( [self _writeRange: responseRange ofFile: file] == NO )
                 {
-                    NSLog(@"Error reading data!");
                     // ensure the connection is closed, to stop the other end from just timing out
                     forceCloseConnection = YES;
-                    return;
                 }
                 
-                [self writeAll: data];
-                
                 // whether that worked or not, we're done!
                 return;
             }
@@ -295,8 +396,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
                     return;     // socket closed, can't write any more
                 
                 // now fetch & send the associated data
-                if ( [self writeAll: [file readDataFromByteRange: r]] == NO )
-                    return;     // socket closed, can't write any more
+                if ( [self _writeRange: r ofFile: file] == NO )
+                {
+                    forceCloseConnection = YES;
+                    return;     // socket closed or file unreadable, can't write any more
+                }
             }
             
             // now the trailer
@@ -318,7 +422,12 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
         
         // NB: stream and file are autoreleased variables
         
-        if ( forceCloseConnection )
+        NSString * requestVersion = CFBridgingRelease(CFHTTPMessageCopyVersion(_request));
+        if ( [requestVersion isEqualToString: (__bridge NSString *)AQHTTPVersion2_0] )
+        {
+            // the connection is shared with other streams: the session decides when it closes
+        }
+        else if ( forceCloseConnection )
         {
             [_connection close];
         }
@@ -336,6 +445,30 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     }
 }
 
+- (BOOL) _writeRange: (DDRange) range ofFile: (id<AQRandomAccessFile>) file
+{
+    UInt64 offset = range.location;
+    while ( offset < DDMaxRange(range) )
+    {
+        @autoreleasepool {
+            UInt64 length = MIN(DDMaxRange(range) - offset, (UInt64)AQHTTPResponseFileChunkSize);
+            NSData * data = [file readDataFromByteRange: DDMakeRange(offset, length)];
+            if ( [data length] == 0 )
+            {
+                NSLog(@"Error reading data!");
+                return ( NO );
+            }
+            
+            if ( [self writeAll: data] == NO )
+                return ( NO );
+            
+            offset += [data length];
+        }
+    }
+    
+    return ( YES );
+}
+
 - (void) _inputStream: (NSInputStream *) stream receivedData: (NSData *) data range: (DDRange) receivedRange
 {
     if ( [_ranges count] == 0 )
@@ -461,6 +594,32 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     if ( [inputData length] == 0 )
         return ( YES );     // socket is OK, but we're going to return early to avoid a zero-byte send causing errors.
     
+    // the socket may already hold plenty of output, from us or from anything else sharing it
+    uint64_t waitStart = AQHTTPTraceTimestamp();
+    if ( [_socketRef waitUntilWritable] == NO )
+        return ( NO );
+    AQHTTPTraceRecordSpan(_trace, "wait for socket", waitStart, AQHTTPTraceTimestamp());
+    
+    // wait our turn, should the server be sharing out its bandwidth
+    AQHTTPBandwidthScheduler * scheduler = _connection.server.bandwidthScheduler;
+    if ( scheduler != nil )
+    {
+        if ( _bandwidthFlow == nil )
+        {
+#if USING_MRR
+            _bandwidthFlow = [[scheduler flowForConnection: _connection] retain];
+#else
+            _bandwidthFlow = [scheduler flowForConnection: _connection];
+#endif
+        }
+        
+        uint64_t scheduleStart = AQHTTPTraceTimestamp();
+        BOOL maySend = [scheduler waitToSend: [inputData length] onFlow: _bandwidthFlow];
+        AQHTTPTraceRecordSpan(_trace, "wait for bandwidth", scheduleStart, AQHTTPTraceTimestamp());
+        if ( maySend == NO )
+            return ( NO );      // the connection closed while we waited
+    }
+    
     __block BOOL done = NO;
     __block BOOL errorOccurred = NO;
     
@@ -470,10 +629,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
 #endif
     
     // this will enqueue the write and will call the completion block once it's completed
+    uint64_t writeStart = AQHTTPTraceTimestamp();
     [_socketRef writeBytes: inputData completion: ^(NSData *unwritten, NSError *error) {
         if ( error != nil )
         {
-            if ( [error.domain isEqualToString: NSPOSIXErrorDomain] && (error.code == EPIPE || error.code == ECONNRESET || error.code == ECANCELED) )
+            if ( [error.domain isEqualToString: NSPOSIXErrorDomain] && (error.code == EPIPE || error.code == ECONNRESET || error.code == ECANCELED || error.code == ENOTCONN) )
             {
                 done = YES;
                 errorOccurred = YES;
@@ -499,6 +659,7 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
             [[NSRunLoop currentRunLoop] runMode: @"AQHTTPRequestWritingDataRunLoopMode" beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.05]];
         }
     }
+    AQHTTPTraceRecordSpan(_trace, "write", writeStart, AQHTTPTraceTimestamp());
     
     if ( errorOccurred )
         return ( NO );      // socket shut down
@@ -506,50 +667,74 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     return ( YES );     // we successfully enqueued the write request
 }
 
-- (NSString *) contentTypeForItemAtPath: (NSString *) path
+- (BOOL) beginChunkedResponse: (CFHTTPMessageRef) response
 {
-    // determine the type
-    CFStringRef uti = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)[path pathExtension], NULL);
-    NSString * contentType = nil;
+    CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Length"), NULL);
     
-    if ( uti != NULL )
+    NSString * requestVersion = CFBridgingRelease(CFHTTPMessageCopyVersion(_request));
+    if ( [requestVersion isEqualToString: (__bridge NSString *)kCFHTTPVersion1_0] )
     {
-        contentType = CFBridgingRelease(UTTypeCopyPreferredTagWithClass(uti, kUTTagClassMIMEType));
-        //TODO : figure out the text encoding, if this is a text file, and include that using "; charset=[encoding]"
-        
-        CFRelease(uti);
+        // no chunked coding in HTTP/1.0: the end of the body is the end of the connection
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), CFSTR("close"));
+        _closeAfterBody = YES;
+    }
+    else if ( [requestVersion isEqualToString: (__bridge NSString *)AQHTTPVersion2_0] == NO )
+    {
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Transfer-Encoding"), CFSTR("chunked"));
+        if ( _connection.draining )
+            CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), CFSTR("close"));
+        _chunkedEncoding = YES;
     }
     
-    if ( contentType == nil )
+    NSData * data = CFBridgingRelease(CFHTTPMessageCopySerializedMessage(response));
+    if ( data == nil )
+        return ( NO );
+    
+    return ( [self writeAll: data] );
+}
+
+- (BOOL) writeChunk: (NSData *) data
+{
+    if ( [data length] == 0 )
+        return ( YES );     // a zero-length chunk would end the body
+    
+    if ( _chunkedEncoding == NO )
+        return ( [self writeAll: data] );
+    
+    // send the size line, data, and trailing CRLF in one go
+    char sizeLine[24];
+    int sizeLength = snprintf(sizeLine, sizeof(sizeLine), "%lx\r\n", (unsigned long)[data length]);
+    
+    NSMutableData * chunk = [[NSMutableData alloc] initWithCapacity: sizeLength + [data length] + 2];
+    [chunk appendBytes: sizeLine length: sizeLength];
+    [chunk appendData: data];
+    [chunk appendBytes: "\r\n" length: 2];
+    
+    BOOL result = [self writeAll: chunk];
+#if USING_MRR
+    [chunk release];
+#endif
+    return ( result );
+}
+
+- (BOOL) finishChunkedResponse
+{
+    if ( _closeAfterBody )
     {
-        NSString * extension = [path pathExtension];
-        if ( [extension isEqualToString: @"svg"] )
-        {
-            contentType = @"image/svg+xml";
-        }
-        else if ( [extension isEqualToString: @"xhtml"] )
-        {
-            contentType = @"application/xhtml+xml";
-        }
-        else if ( [extension isEqualToString: @"html"] )
-        {
-            contentType = @"text/html";
-        }
-        else if ( [extension isEqualToString: @"js"] )
-        {
-            contentType = @"application/javascript";
-        }
-        else if ( [extension isEqualToString: @"css"] )
-        {
-            contentType = @"text/css";
-        }
-        else
-        {
-            contentType = @"application/octet-stream";
-        }
+        [_connection close];
+        return ( YES );
     }
     
-    return ( contentType );
+    if ( _chunkedEncoding == NO )
+        return ( YES );     // HTTP/2 streams end when the operation does
+    
+    // last-chunk, with no trailers
+    return ( [self writeAll: [NSData dataWithBytesNoCopy: (void *)"0\r\n\r\n" length: 5 freeWhenDone: NO]] );
+}
+
+- (NSString *) contentTypeForItemAtPath: (NSString *) path
+{
+    return ( AQHTTPContentTypeForPath(path) );
 }
 
 - (CFHTTPMessageRef) newResponseForItemAtPath: (NSString *) path
@@ -560,6 +745,7 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     NSData * htmlBodyData = nil;
     NSString * contentType = [self contentTypeForItemAtPath: path];
     NSString * myEtag = [self etagForItemAtPath: path];
+    NSDate * modificationDate = [self modificationDateForItemAtPath: path];
     
     if ( status >= 400 )
     {
@@ -587,15 +773,10 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
         CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Content-Type"), CFSTR("text/html; charset=utf-8"));
         CFHTTPMessageSetBody(response, (__bridge CFDataRef)htmlBodyData);
     }
-    else if ( status == 200 && [myEtag length] != 0 )
+    else if ( status == 200 && AQHTTPRequestIsNotModified(_request, myEtag, modificationDate) )
     {
-        // check for a matching Etag in the request
-        NSString * clientEtag = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(_request, CFSTR("If-None-Match")));
-        if ( [clientEtag isEqualToString: myEtag] )
-        {
-            // 304 Not Modified
-            response = CFHTTPMessageCreateResponse(kCFAllocatorDefault, 304, NULL, kCFHTTPVersion1_1);
-        }
+        // 304 Not Modified
+        response = CFHTTPMessageCreateResponse(kCFAllocatorDefault, 304, NULL, kCFHTTPVersion1_1);
     }
     
     if ( response == NULL && _ranges != nil && _isSingleRange == NO )
@@ -626,9 +807,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     
     if ( myEtag != nil )
         CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Etag"), (__bridge CFStringRef)myEtag);
+    if ( modificationDate != nil && htmlBodyData == nil )
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Last-Modified"), (__bridge CFStringRef)[[NSDateFormatter AQHTTPDateFormatter] stringFromDate: modificationDate]);
     
     // if keepalive isn't supported, we'll insist upon a close
-    if ( _connection.supportsPipelinedRequests == NO )
+    if ( _connection.supportsPipelinedRequests == NO || _connection.draining )
     {
         CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Connection"), CFSTR("close"));
     }
@@ -666,6 +849,11 @@ static NSString * const AQHTTPResponseRunLoopMode = @"AQHTTPResponseRunLoopMode"
     return ( nil );
 }
 
+- (NSDate *) modificationDateForItemAtPath: (NSString *) rootRelativePath
+{
+    return ( nil );
+}
+
 - (NSInputStream *) inputStreamForItemAtPath: (NSString *) rootRelativePath
 {
     return ( nil );
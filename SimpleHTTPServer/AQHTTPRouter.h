@@ -0,0 +1,102 @@
+//
+//  AQHTTPRouter.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AQHTTPConnection, AQHTTPResponseOperation;
+
+/// The most parameters (including any wildcard) a single route pattern may contain.
+#define AQHTTPRouterMaxParameters   16
+
+/// The parameter under which a mounted handler receives the remainder of the path.
+extern NSString * const AQHTTPRouteRemainderParameter;
+
+/**
+ A route handler creates the response operation for a matched request.
+ @param connection The connection on which the request arrived. Operations
+ should be created using its `socket` property, as with
+ -[AQHTTPConnection responseOperationForRequest:].
+ @param request The request.
+ @param parameters The values of any parameters in the route's pattern, keyed
+ by name and with percent-escapes removed.
+ @result A response operation, or `nil` to refuse the request.
+ */
+typedef AQHTTPResponseOperation * (^AQHTTPRouteHandler)(AQHTTPConnection * connection, CFHTTPMessageRef request, NSDictionary * parameters);
+
+/**
+ An AQHTTPRouter maps requests to handlers by method and path.
+
+ Install a router on an AQHTTPServer and every connection consults it from
+ -responseOperationForRequest:, so endpoints can be added without subclassing
+ AQHTTPConnection.
+
+ Patterns are made up of `/`-separated segments:
+
+    * Static text, e.g. `/api/users`, which must match exactly.
+    * `:name`, which matches one non-empty path segment and captures it as
+      the parameter `name`, e.g. `/api/users/:id`.
+    * `*name`, which may only appear as the last segment and captures the
+      remainder of the path, however long (possibly empty).
+
+ Patterns are compiled into a compressed radix tree, so looking up a request
+ takes time proportional to the length of its path, regardless of how many
+ routes are registered. The walk down the tree itself allocates no memory;
+ preparing the request's path for it and collecting the captured parameters
+ for the handler do. Where more than one pattern matches, static text is
+ preferred over a parameter, and a parameter over a wildcard.
+
+ A request whose path matches but whose method doesn't receives a
+ `405 Method Not Allowed` response; one which matches nothing at all
+ receives `404 Not Found`. HEAD requests are routed to GET handlers unless
+ they have a handler of their own.
+
+ Routes may be added at any time, and lookups may happen on any thread.
+ */
+@interface AQHTTPRouter : NSObject
+
+/**
+ Returns a handler which serves files from the connection's document root,
+ via -[AQHTTPConnection fileResponseOperationForRequest:]. This is the
+ server's behaviour when it has no router; mount it at `/` to keep that
+ behaviour for any path without a route of its own.
+ */
++ (AQHTTPRouteHandler) fileHandler;
+
+/**
+ Registers a handler for a method and path pattern. Registering the same
+ method and pattern twice replaces the earlier handler.
+ @param method An HTTP method, such as `GET`, or `nil` to match any method.
+ @param pattern A path pattern, beginning with `/`.
+ @param handler The handler which will create operations for matching requests.
+ @exception NSInvalidArgumentException If the pattern is malformed.
+ */
+- (void) addRouteForMethod: (NSString *) method
+                   pattern: (NSString *) pattern
+                   handler: (AQHTTPRouteHandler) handler;
+
+/**
+ Mounts a handler for every request at or below a path prefix, whatever
+ its method. The rest of the path below the prefix (without a leading `/`)
+ is passed in the AQHTTPRouteRemainderParameter parameter.
+ @param handler The handler which will create operations for matching requests.
+ @param prefix A path prefix, such as `/static`, or `/` to mount a handler
+ which receives any request without a more specific route.
+ */
+- (void) mountHandler: (AQHTTPRouteHandler) handler atPrefix: (NSString *) prefix;
+
+/**
+ Routes a request.
+ @param request The request to route.
+ @param connection The connection on which it arrived.
+ @result An operation created by the matching handler, or one which sends an
+ appropriate error response if no route matches or the handler returns `nil`.
+ */
+- (AQHTTPResponseOperation *) responseOperationForRequest: (CFHTTPMessageRef) request
+                                               connection: (AQHTTPConnection *) connection;
+
+@end
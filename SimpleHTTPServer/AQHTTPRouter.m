@@ -0,0 +1,543 @@
+//
+//  AQHTTPRouter.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPRouter.h"
+#import "AQHTTPConnection.h"
+#import "AQHTTPResponseOperation.h"
+#import <pthread.h>
+
+NSString * const AQHTTPRouteRemainderParameter = @"path";
+
+// paths of this length or less are matched without copying them to the heap
+#define AQHTTPRouterPathBufferLength    1024
+
+typedef struct _AQRouteEntry
+{
+    char *                  method;         // NULL matches any method
+    NSUInteger              routeIndex;     // into the router's _routes array
+} _AQRouteEntry;
+
+// One node of the radix tree. Static children are reached by an edge labelled
+// with one or more bytes of the path; no two children's labels share a first byte.
+typedef struct _AQRouteNode
+{
+    char *                  label;
+    size_t                  labelLength;
+    struct _AQRouteNode **  children;       // sorted by the first byte of their labels
+    uint32_t                childCount;
+    struct _AQRouteNode *   parameter;      // matches one non-empty path segment
+    struct _AQRouteNode *   wildcard;       // matches the rest of the path
+    _AQRouteEntry *         entries;
+    uint32_t                entryCount;
+} _AQRouteNode;
+
+typedef struct _AQRouteMatch
+{
+    const _AQRouteEntry *   entry;
+    const _AQRouteNode *    pathMatch;      // a node matching the path, but with no route for the method
+    NSRange                 captures[AQHTTPRouterMaxParameters];
+} _AQRouteMatch;
+
+#pragma mark - Radix Tree
+
+static _AQRouteNode * _AQRouteNodeCreate(const char * label, size_t length)
+{
+    _AQRouteNode * node = calloc(1, sizeof(_AQRouteNode));
+    if ( length != 0 )
+    {
+        node->label = malloc(length);
+        memcpy(node->label, label, length);
+    }
+    node->labelLength = length;
+    return ( node );
+}
+
+static void _AQRouteNodeFree(_AQRouteNode * node)
+{
+    if ( node == NULL )
+        return;
+
+    for ( uint32_t i = 0; i < node->childCount; i++ )
+        _AQRouteNodeFree(node->children[i]);
+    for ( uint32_t i = 0; i < node->entryCount; i++ )
+        free(node->entries[i].method);
+
+    _AQRouteNodeFree(node->parameter);
+    _AQRouteNodeFree(node->wildcard);
+    free(node->children);
+    free(node->entries);
+    free(node->label);
+    free(node);
+}
+
+// binary search on the first byte of each child's label
+static uint32_t _AQRouteNodeChildIndex(const _AQRouteNode * node, uint8_t c, BOOL * found)
+{
+    uint32_t low = 0, high = node->childCount;
+    while ( low < high )
+    {
+        uint32_t mid = (low + high) / 2;
+        uint8_t midByte = (uint8_t)node->children[mid]->label[0];
+        if ( midByte == c )
+        {
+            *found = YES;
+            return ( mid );
+        }
+
+        if ( midByte < c )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *found = NO;
+    return ( low );
+}
+
+static _AQRouteNode * _AQRouteNodeInsertLiteral(_AQRouteNode * node, const char * s, size_t length)
+{
+    while ( length != 0 )
+    {
+        BOOL found = NO;
+        uint32_t index = _AQRouteNodeChildIndex(node, (uint8_t)s[0], &found);
+        if ( found == NO )
+        {
+            _AQRouteNode * child = _AQRouteNodeCreate(s, length);
+            node->children = realloc(node->children, (node->childCount + 1) * sizeof(_AQRouteNode *));
+            memmove(&node->children[index + 1], &node->children[index], (node->childCount - index) * sizeof(_AQRouteNode *));
+            node->children[index] = child;
+            node->childCount++;
+            return ( child );
+        }
+
+        _AQRouteNode * child = node->children[index];
+        size_t common = 0, max = MIN(child->labelLength, length);
+        while ( common < max && child->label[common] == s[common] )
+            common++;
+
+        if ( common < child->labelLength )
+        {
+            // split the edge: the shared prefix becomes a new node, with the original child below it
+            _AQRouteNode * split = _AQRouteNodeCreate(child->label, common);
+            memmove(child->label, child->label + common, child->labelLength - common);
+            child->labelLength -= common;
+
+            split->children = malloc(sizeof(_AQRouteNode *));
+            split->children[0] = child;
+            split->childCount = 1;
+
+            // the split node begins with the same byte, so it takes the original's place
+            node->children[index] = split;
+            child = split;
+        }
+
+        node = child;
+        s += common;
+        length -= common;
+    }
+
+    return ( node );
+}
+
+static const _AQRouteEntry * _AQRouteNodeEntryForMethod(const _AQRouteNode * node, const char * method)
+{
+    const _AQRouteEntry * any = NULL, * get = NULL;
+    for ( uint32_t i = 0; i < node->entryCount; i++ )
+    {
+        const _AQRouteEntry * entry = &node->entries[i];
+        if ( entry->method == NULL )
+            any = entry;
+        else if ( strcmp(entry->method, method) == 0 )
+            return ( entry );
+        else if ( strcmp(entry->method, "GET") == 0 )
+            get = entry;
+    }
+
+    if ( any != NULL )
+        return ( any );
+    if ( get != NULL && strcmp(method, "HEAD") == 0 )
+        return ( get );
+    return ( NULL );
+}
+
+static BOOL _AQRouteNodeMatch(const _AQRouteNode * node, const char * path, size_t offset, size_t length, const char * method, NSUInteger depth, _AQRouteMatch * match)
+{
+    if ( offset == length && node->entryCount != 0 )
+    {
+        match->entry = _AQRouteNodeEntryForMethod(node, method);
+        if ( match->entry != NULL )
+            return ( YES );
+        if ( match->pathMatch == NULL )
+            match->pathMatch = node;
+    }
+
+    if ( offset < length )
+    {
+        // static text first...
+        BOOL found = NO;
+        uint32_t index = _AQRouteNodeChildIndex(node, (uint8_t)path[offset], &found);
+        if ( found )
+        {
+            const _AQRouteNode * child = node->children[index];
+            if ( child->labelLength <= length - offset && memcmp(child->label, path + offset, child->labelLength) == 0 )
+            {
+                if ( _AQRouteNodeMatch(child, path, offset + child->labelLength, length, method, depth, match) )
+                    return ( YES );
+            }
+        }
+
+        // ...then a single segment...
+        if ( node->parameter != NULL && depth < AQHTTPRouterMaxParameters )
+        {
+            size_t end = offset;
+            while ( end < length && path[end] != '/' )
+                end++;
+
+            if ( end > offset )
+            {
+                match->captures[depth] = NSMakeRange(offset, end - offset);
+                if ( _AQRouteNodeMatch(node->parameter, path, end, length, method, depth + 1, match) )
+                    return ( YES );
+            }
+        }
+    }
+
+    // ...and finally the whole of the rest
+    if ( node->wildcard != NULL && node->wildcard->entryCount != 0 && depth < AQHTTPRouterMaxParameters )
+    {
+        match->captures[depth] = NSMakeRange(offset, length - offset);
+        match->entry = _AQRouteNodeEntryForMethod(node->wildcard, method);
+        if ( match->entry != NULL )
+            return ( YES );
+        if ( match->pathMatch == NULL )
+            match->pathMatch = node->wildcard;
+    }
+
+    return ( NO );
+}
+
+#pragma mark - Routes & Error Responses
+
+@interface _AQHTTPRoute : NSObject
+{
+@public
+    AQHTTPRouteHandler  _handler;
+    NSArray *           _parameterNames;
+}
+@end
+
+@implementation _AQHTTPRoute
+#if USING_MRR
+- (void) dealloc
+{
+    [_handler release];
+    [_parameterNames release];
+    [super dealloc];
+}
+#endif
+@end
+
+// sends a fixed error status for requests which couldn't be routed
+@interface _AQHTTPRouteErrorResponseOperation : AQHTTPResponseOperation
+{
+    NSUInteger  _status;
+    NSString *  _allowedMethods;
+}
+- (id) initWithRequest: (CFHTTPMessageRef) request connection: (AQHTTPConnection *) connection status: (NSUInteger) status allowedMethods: (NSString *) allowedMethods;
+@end
+
+@implementation _AQHTTPRouteErrorResponseOperation
+
+- (id) initWithRequest: (CFHTTPMessageRef) request connection: (AQHTTPConnection *) connection status: (NSUInteger) status allowedMethods: (NSString *) allowedMethods
+{
+    self = [super initWithRequest: request socket: connection.socket ranges: nil forConnection: connection];
+    if ( self == nil )
+        return ( nil );
+
+    _status = status;
+    _allowedMethods = [allowedMethods copy];
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_allowedMethods release];
+    [super dealloc];
+}
+#endif
+
+- (NSUInteger) statusCodeForItemAtPath: (NSString *) rootRelativePath
+{
+    return ( _status );
+}
+
+- (CFHTTPMessageRef) newResponseForItemAtPath: (NSString *) path withHTTPStatus: (NSUInteger) status
+{
+    CFHTTPMessageRef response = [super newResponseForItemAtPath: path withHTTPStatus: status];
+    if ( _allowedMethods != nil )
+        CFHTTPMessageSetHeaderFieldValue(response, CFSTR("Allow"), (__bridge CFStringRef)_allowedMethods);
+    return ( response );
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTPRouter
+{
+    _AQRouteNode *      _root;
+    NSMutableArray *    _routes;
+    pthread_rwlock_t    _lock;
+}
+
++ (AQHTTPRouteHandler) fileHandler
+{
+    return ( ^AQHTTPResponseOperation *(AQHTTPConnection * connection, CFHTTPMessageRef request, NSDictionary * parameters) {
+        return ( [connection fileResponseOperationForRequest: request] );
+    } );
+}
+
+- (id) init
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _root = _AQRouteNodeCreate(NULL, 0);
+    _routes = [NSMutableArray new];
+    pthread_rwlock_init(&_lock, NULL);
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    _AQRouteNodeFree(_root);
+    pthread_rwlock_destroy(&_lock);
+#if USING_MRR
+    [_routes release];
+    [super dealloc];
+#endif
+}
+
+- (void) addRouteForMethod: (NSString *) method
+                   pattern: (NSString *) pattern
+                   handler: (AQHTTPRouteHandler) handler
+{
+    NSParameterAssert(handler != nil);
+
+    const char * p = [pattern UTF8String];
+    size_t length = (p == NULL ? 0 : strlen(p));
+    if ( length == 0 || p[0] != '/' )
+        [NSException raise: NSInvalidArgumentException format: @"Route pattern '%@' must begin with '/'", pattern];
+
+    _AQHTTPRoute * route = [_AQHTTPRoute new];
+    route->_handler = [handler copy];
+    NSMutableArray * names = [NSMutableArray new];
+#if USING_MRR
+    [route autorelease];
+    [names autorelease];
+#endif
+
+    pthread_rwlock_wrlock(&_lock);
+    @try
+    {
+        _AQRouteNode * node = _root;
+        size_t i = 0;
+        while ( i < length )
+        {
+            if ( (p[i] == ':' || p[i] == '*') && p[i-1] == '/' )
+            {
+                size_t end = i + 1;
+                while ( end < length && p[end] != '/' )
+                    end++;
+
+                if ( end == i + 1 )
+                    [NSException raise: NSInvalidArgumentException format: @"Route pattern '%@' contains an unnamed parameter", pattern];
+                if ( [names count] == AQHTTPRouterMaxParameters )
+                    [NSException raise: NSInvalidArgumentException format: @"Route pattern '%@' contains more than %d parameters", pattern, AQHTTPRouterMaxParameters];
+
+                if ( p[i] == '*' )
+                {
+                    if ( end != length )
+                        [NSException raise: NSInvalidArgumentException format: @"The wildcard in route pattern '%@' must be its last segment", pattern];
+                    if ( node->wildcard == NULL )
+                        node->wildcard = _AQRouteNodeCreate(NULL, 0);
+                    node = node->wildcard;
+                }
+                else
+                {
+                    if ( node->parameter == NULL )
+                        node->parameter = _AQRouteNodeCreate(NULL, 0);
+                    node = node->parameter;
+                }
+
+                NSString * name = [[NSString alloc] initWithBytes: p + i + 1 length: end - i - 1 encoding: NSUTF8StringEncoding];
+                [names addObject: name];
+#if USING_MRR
+                [name release];
+#endif
+                i = end;
+                continue;
+            }
+
+            // static text runs up to the next parameter
+            size_t end = i + 1;
+            while ( end < length && ((p[end] != ':' && p[end] != '*') || p[end-1] != '/') )
+                end++;
+
+            node = _AQRouteNodeInsertLiteral(node, p + i, end - i);
+            i = end;
+        }
+
+        route->_parameterNames = [names copy];
+        [_routes addObject: route];
+        NSUInteger routeIndex = [_routes count] - 1;
+
+        // the same method & pattern replaces the existing route
+        const char * m = [[method uppercaseString] UTF8String];
+        for ( uint32_t j = 0; j < node->entryCount; j++ )
+        {
+            _AQRouteEntry * entry = &node->entries[j];
+            if ( (m == NULL && entry->method == NULL) || (m != NULL && entry->method != NULL && strcmp(m, entry->method) == 0) )
+            {
+                entry->routeIndex = routeIndex;
+                return;
+            }
+        }
+
+        node->entries = realloc(node->entries, (node->entryCount + 1) * sizeof(_AQRouteEntry));
+        node->entries[node->entryCount].method = (m == NULL ? NULL : strdup(m));
+        node->entries[node->entryCount].routeIndex = routeIndex;
+        node->entryCount++;
+    }
+    @finally
+    {
+        pthread_rwlock_unlock(&_lock);
+    }
+}
+
+- (void) mountHandler: (AQHTTPRouteHandler) handler atPrefix: (NSString *) prefix
+{
+    while ( [prefix hasSuffix: @"/"] )
+        prefix = [prefix substringToIndex: [prefix length] - 1];
+
+    NSString * wildcard = [NSString stringWithFormat: @"%@/*%@", prefix, AQHTTPRouteRemainderParameter];
+    [self addRouteForMethod: nil pattern: wildcard handler: handler];
+
+    // the prefix itself, without a trailing slash
+    if ( [prefix length] != 0 )
+        [self addRouteForMethod: nil pattern: prefix handler: handler];
+}
+
+- (NSString *) _allowedMethodsForNode: (const _AQRouteNode *) node
+{
+    NSMutableArray * methods = [NSMutableArray arrayWithCapacity: node->entryCount + 1];
+    for ( uint32_t i = 0; i < node->entryCount; i++ )
+    {
+        if ( node->entries[i].method == NULL )
+            continue;
+        
+        NSString * method = [NSString stringWithUTF8String: node->entries[i].method];
+        [methods addObject: method];
+        if ( [method isEqualToString: @"GET"] && _AQRouteNodeEntryForMethod(node, "HEAD") == &node->entries[i] )
+            [methods addObject: @"HEAD"];
+    }
+
+    return ( [methods componentsJoinedByString: @", "] );
+}
+
+- (AQHTTPResponseOperation *) responseOperationForRequest: (CFHTTPMessageRef) request
+                                               connection: (AQHTTPConnection *) connection
+{
+    NSURL * url = CFBridgingRelease(CFHTTPMessageCopyRequestURL(request));
+    NSString * method = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
+
+    // match against the path as it was sent, percent-escapes and all
+    CFStringRef pathStr = (url == nil ? NULL : CFURLCopyPath((__bridge CFURLRef)url));
+    if ( pathStr == NULL )
+        pathStr = CFSTR("/");
+
+    char methodBuf[32];
+    char pathBuf[AQHTTPRouterPathBufferLength];
+    char * allocatedPath = NULL;
+
+    const char * path = CFStringGetCStringPtr(pathStr, kCFStringEncodingUTF8);
+    if ( path == NULL )
+    {
+        CFIndex maxLength = CFStringGetMaximumSizeForEncoding(CFStringGetLength(pathStr), kCFStringEncodingUTF8) + 1;
+        char * buf = pathBuf;
+        if ( maxLength > AQHTTPRouterPathBufferLength )
+            buf = allocatedPath = malloc(maxLength);
+        if ( CFStringGetCString(pathStr, buf, maxLength, kCFStringEncodingUTF8) )
+            path = buf;
+        else
+            path = "/";
+    }
+    if ( [method getCString: methodBuf maxLength: sizeof(methodBuf) encoding: NSASCIIStringEncoding] == NO )
+        methodBuf[0] = '\0';
+
+    size_t length = strlen(path);
+    _AQRouteMatch match;
+    match.entry = NULL;
+    match.pathMatch = NULL;
+
+    _AQHTTPRoute * route = nil;
+    NSString * allowedMethods = nil;
+
+    pthread_rwlock_rdlock(&_lock);
+    if ( _AQRouteNodeMatch(_root, path, 0, length, methodBuf, 0, &match) )
+        route = [_routes objectAtIndex: match.entry->routeIndex];
+    else if ( match.pathMatch != NULL )
+        allowedMethods = [self _allowedMethodsForNode: match.pathMatch];
+    pthread_rwlock_unlock(&_lock);
+
+    AQHTTPResponseOperation * op = nil;
+    if ( route != nil )
+    {
+        NSDictionary * parameters = [NSDictionary dictionary];
+        NSUInteger count = [route->_parameterNames count];
+        if ( count != 0 )
+        {
+            NSMutableDictionary * values = [NSMutableDictionary dictionaryWithCapacity: count];
+            for ( NSUInteger i = 0; i < count; i++ )
+            {
+                NSRange r = match.captures[i];
+                CFStringRef raw = CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)path + r.location, r.length, kCFStringEncodingUTF8, false);
+                if ( raw == NULL )
+                    continue;
+
+                NSString * value = CFBridgingRelease(CFURLCreateStringByReplacingPercentEscapes(kCFAllocatorDefault, raw, CFSTR("")));
+                CFRelease(raw);
+                if ( value != nil )
+                    [values setObject: value forKey: [route->_parameterNames objectAtIndex: i]];
+            }
+            parameters = values;
+        }
+
+        op = route->_handler(connection, request, parameters);
+    }
+
+    free(allocatedPath);
+    CFRelease(pathStr);
+
+    if ( op == nil )
+    {
+        NSUInteger status = (allowedMethods != nil ? 405 : 404);
+        op = [[_AQHTTPRouteErrorResponseOperation alloc] initWithRequest: request connection: connection status: status allowedMethods: allowedMethods];
+#if USING_MRR
+        [op autorelease];
+#endif
+    }
+
+    return ( op );
+}
+
+@end
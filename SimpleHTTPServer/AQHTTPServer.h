@@ -8,6 +8,20 @@
 
 #import <Foundation/Foundation.h>
 #import "AQHTTPConnection.h"
+#import "AQHTTPRouter.h"
+#import "AQHTTPBandwidthScheduler.h"
+#import "AQHTTPServerConfiguration.h"
+
+/**
+ Counters describing a server's activity.
+ */
+typedef struct
+{
+    uint64_t    connectionsAccepted;    /// The number of connections accepted since the server was created.
+    uint64_t    requestsReceived;       /// The number of requests handled, counting each HTTP/2 stream as one.
+    uint32_t    openConnections;        /// The number of connections currently open.
+    
+} AQHTTPServerStatistics;
 
 /**
  The AQHTTPServer class implements a small HTTP server instance.
@@ -28,7 +42,8 @@
  @param address A string DNS address or IPv4/IPv6 address. Alternatively,
  the strings "loopback" and "localhost" will be interpreted as the IPv4
  loopback interface, while "loopback6" and "localhost6" will use the
- IPv6 loopback.
+ IPv6 loopback. May be `nil` if the server is to listen only on a
+ Unix-domain socket, set using unixSocketPath.
  @param root The URL of a local folder from which all content will be
  served. May be `nil`, at which point a call to setDocumentRoot: will be required
  to make it usable. Without a document root, the server will run but will reject
@@ -64,20 +79,187 @@
  */
 - (BOOL) reset;
 
+/** @name Graceful Restart */
+
+/**
+ Starts the server using listening sockets passed by another server process,
+ via -handOffListeningSocketsOverSocket:error:, rather than binding its own.
+ 
+ This blocks until the sockets arrive. Once the server is accepting
+ connections on them, it tells the other process, which then stops accepting
+ connections itself. If the sockets were handed off, and include one bound to
+ this server's unixSocketPath, the server takes over the socket file and
+ removes it when it stops.
+ @param unixSocket A connected Unix-domain socket shared with the other process.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result Returns YES if the server is now listening, NO otherwise.
+ */
+- (BOOL) startWithListeningSocketsFromSocket: (int) unixSocket error: (NSError **) error;
+
+/**
+ Passes copies of the server's listening sockets to another process, which
+ should call -startWithListeningSocketsFromSocket:error:. Both processes then
+ accept connections on the same sockets, so this can be used to run several
+ worker processes side by side. The Unix-domain socket file remains this
+ server's to remove.
+ @param unixSocket A connected Unix-domain socket shared with the other process.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result Returns YES if the other process is now using the sockets.
+ */
+- (BOOL) shareListeningSocketsOverSocket: (int) unixSocket error: (NSError **) error;
+
+/**
+ Passes the server's listening sockets to another process, which should call
+ -startWithListeningSocketsFromSocket:error:, and then stops accepting new
+ connections. Since both processes share the same sockets, no connections are
+ refused while the other process takes over.
+ 
+ Existing connections are left running; use
+ -drainConnectionsWithTimeout:completionHandler: to finish them off.
+ @param unixSocket A connected Unix-domain socket shared with the other process.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`. The server remains listening if this
+ method fails, including when the other process does not take up the sockets
+ within ten seconds.
+ @result Returns YES if the other process has taken over the listening sockets.
+ */
+- (BOOL) handOffListeningSocketsOverSocket: (int) unixSocket error: (NSError **) error;
+
+/**
+ Closes all current connections once their in-flight requests are complete.
+ 
+ Idle connections are closed immediately, and busy ones after sending their
+ outstanding responses, which ask the client to close the connection. HTTP/2
+ clients are sent a GOAWAY frame so they open no new streams. Any connections
+ remaining when the timeout expires are closed regardless.
+ @param timeout The longest time to wait for connections to finish.
+ @param completionHandler Called on the main queue once every connection has closed.
+ */
+- (void) drainConnectionsWithTimeout: (NSTimeInterval) timeout completionHandler: (void (^)(void)) completionHandler;
+
 /**
  The server's current document root URL.
  
- This can be called while the server is running; existing connections will keep
- the old document root, while new ones will inherit the new. If set to `nil`,
- the server will reject any new incoming connections.
+ This can be called while the server is running; requests already in progress
+ keep the old document root, while later ones, on new and existing connections
+ alike, use the new. If set to `nil`, the server will reject any new incoming
+ connections.
  */
 @property (nonatomic, copy) NSURL * documentRoot;
 
+/**
+ How long a connection may sit idle before the server closes it. The default
+ is two seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval idleTimeout;
+
+/**
+ The largest request body accepted, in bytes. Zero means there is no limit.
+ The default is 64MB.
+ @see -[AQHTTPConnection maximumRequestBodyLength]
+ */
+@property (nonatomic, assign) unsigned long long maximumRequestBodyLength;
+
+/**
+ A snapshot of the server's current settings. The settings above may be
+ changed from any thread; each change publishes a new snapshot, and reading
+ this property never takes a lock or waits for a change to finish. It is
+ lock-free rather than wait-free, though: a read which races with the
+ reclamation of old snapshots starts over, as many times as it keeps losing.
+ */
+@property (nonatomic, readonly) AQHTTPServerConfiguration * configuration;
+
+/**
+ The certificates used to serve HTTPS, in the form described by
+ -[AQSocket TLSCertificates]. If set, all connections use TLS, offering HTTP/2
+ and HTTP/1.1 via ALPN. This must be set before the server is started.
+ */
+@property (nonatomic, copy) NSArray * TLSCertificates;
+
+/**
+ A router which maps requests to handlers by method and path. When `nil`
+ (the default), connections serve files from the document root.
+ 
+ The router is shared by all connections, and routes may be added to it
+ while the server is running.
+ */
+@property (nonatomic, strong) AQHTTPRouter * router;
+
+/**
+ A scheduler which shares out the server's outgoing bandwidth between its
+ responses, applying any rate limits. When `nil` (the default), responses
+ are sent as fast as each connection allows.
+ */
+@property (nonatomic, strong) AQHTTPBandwidthScheduler * bandwidthScheduler;
+
+/**
+ A cache of recently-requested files. While no router is set, connections
+ answer simple requests for cached files directly, without scheduling a
+ response operation. By default, files of up to 64KB are cached, up to 16MB
+ in total; set to `nil` to disable caching.
+ */
+@property (nonatomic, strong) AQHTTPFileCache * fileCache;
+
+/**
+ A file in which the server keeps a list of its most frequently-requested
+ files, or `nil` (the default) for none. This must be set before the server
+ is started.
+ 
+ When the server starts, the files listed are loaded into the fileCache in
+ the background, a few at a time, so that the first requests after a restart
+ find the cache (and the system's page cache) already warm. Starting isn't
+ delayed: requests arriving before a file is loaded are answered as usual.
+ 
+ While the server runs, the list is rewritten every five minutes with the
+ files which have been requested most often, and once more when it stops.
+ Files outside the document root are ignored.
+ */
+@property (nonatomic, copy) NSURL * warmupManifestURL;
+
+/**
+ The path of a Unix-domain socket on which to listen, or `nil` (the default)
+ to listen only on TCP. It can be combined with a TCP address, and must be set
+ before the server is started.
+ 
+ A reverse proxy on the same host can connect here rather than over loopback
+ TCP. A socket left at this path by a server which has since exited is
+ replaced, but the server won't start if another is still listening on it or
+ if some other kind of file is in the way. The socket is removed again when
+ the server stops, unless it was handed off to another process.
+ 
+ Linux's abstract socket namespace, written with a leading '@', is not
+ available.
+ */
+@property (nonatomic, copy) NSString * unixSocketPath;
+
+/**
+ The permissions given to the socket at unixSocketPath, which govern who may
+ connect to it. The default is 0660.
+ */
+@property (nonatomic, assign) mode_t unixSocketPermissions;
+
 /**
  Returns `YES` if the server is currently running and listening for connections.
  */
 @property (nonatomic, readonly, getter=isListening) BOOL listening;
 
+/**
+ Whether the server accepts connections arriving on its listening sockets.
+ The default is `YES`.
+ 
+ A server which isn't accepting connections keeps its sockets open, so it can
+ still share them with other processes using
+ -shareListeningSocketsOverSocket:error:.
+ */
+@property (nonatomic, assign, getter=isAcceptingConnections) BOOL acceptingConnections;
+
+/**
+ Returns counters describing the server's activity. May be called from any thread.
+ */
+@property (nonatomic, readonly) AQHTTPServerStatistics statistics;
+
 /**
  Provides a custom class to use to manage incoming connections.
  @param connectionClass A class to instantiate to manage new connections
@@ -91,7 +273,8 @@
 
 /**
  Returns a string containing the IP and port of the server. This method prefers IPv6
- if available.
+ if available. A server listening only on a Unix-domain socket returns its path,
+ prefixed with "unix:".
  */
 @property (nonatomic, readonly) NSString * serverAddress;
 
@@ -8,25 +8,286 @@
 
 #import "AQHTTPServer.h"
 #import "AQSocket.h"
+#import "AQHTTPServer_PrivateInternal.h"
 #import "AQHTTPConnection_PrivateInternal.h"
+#import <libkern/OSAtomic.h>
+#import <pthread.h>
 #import <arpa/inet.h>
+#import <sys/uio.h>
+#import <sys/un.h>
+#import <sys/stat.h>
+
+// at most one IPv4, one IPv6 and one Unix-domain socket
+#define AQHTTPMaximumListeningSockets           3
+
+#define AQHTTPServerDefaultUnixSocketPermissions    0660
+
+#define AQHTTPServerDefaultCachedFileSize       (64 * 1024)
+#define AQHTTPServerDefaultFileCacheSize        (16 * 1024 * 1024)
+
+// the warm-up manifest lists this many of the most frequently-requested files, and is rewritten this often
+#define AQHTTPServerWarmupManifestLimit         512
+#define AQHTTPServerWarmupManifestInterval      300.0
+
+// the most files loaded at once while warming up the file cache
+#define AQHTTPServerWarmupConcurrency           4
+
+// how long reclamation of old configuration snapshots first waits for readers to move on, doubling to the maximum
+#define AQHTTPServerInitialReclamationDelay     (10 * NSEC_PER_MSEC)
+#define AQHTTPServerMaximumReclamationDelay     NSEC_PER_SEC
+
+// set in the payload byte when the receiver takes over the listeners, rather than sharing them
+#define AQHTTPDescriptorsTransferOwnership      0x80
+
+// one byte of payload is required to carry the descriptors, and tells the receiver how many to expect
+static BOOL _AQSendDescriptors(int unixSocket, const int * fds, uint8_t count, BOOL transferOwnership)
+{
+    char control[CMSG_SPACE(AQHTTPMaximumListeningSockets * sizeof(int))] = {0};
+    uint8_t payload = count | (transferOwnership ? AQHTTPDescriptorsTransferOwnership : 0);
+    struct iovec iov = { .iov_base = &payload, .iov_len = 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = (socklen_t)CMSG_SPACE(count * sizeof(int))
+    };
+    
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = (socklen_t)CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(unixSocket, &msg, 0);
+        
+    } while ( sent < 0 && errno == EINTR );
+    
+    return ( sent == 1 );
+}
+
+static int _AQReceiveDescriptors(int unixSocket, int * fds, int maxCount, BOOL * outOwnershipTransferred)
+{
+    char control[CMSG_SPACE(AQHTTPMaximumListeningSockets * sizeof(int))] = {0};
+    uint8_t payload = 0;
+    struct iovec iov = { .iov_base = &payload, .iov_len = 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+    
+    ssize_t received;
+    do
+    {
+        received = recvmsg(unixSocket, &msg, 0);
+        
+    } while ( received < 0 && errno == EINTR );
+    
+    if ( received != 1 )
+    {
+        if ( received == 0 )
+            errno = ECONNRESET;
+        return ( -1 );
+    }
+    
+    uint8_t count = payload & ~AQHTTPDescriptorsTransferOwnership;
+    *outOwnershipTransferred = ((payload & AQHTTPDescriptorsTransferOwnership) != 0);
+    
+    int numReceived = 0;
+    for ( struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+    {
+        if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+            continue;
+        
+        const int * p = (const int *)CMSG_DATA(cmsg);
+        int n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for ( int i = 0; i < n; i++ )
+        {
+            if ( numReceived < maxCount )
+                fds[numReceived++] = p[i];
+            else
+                close(p[i]);
+        }
+    }
+    
+    if ( (msg.msg_flags & MSG_CTRUNC) != 0 || numReceived != count )
+    {
+        for ( int i = 0; i < numReceived; i++ )
+            close(fds[i]);
+        errno = EBADMSG;
+        return ( -1 );
+    }
+    
+    return ( numReceived );
+}
+
+// creates a listening Unix-domain socket, clearing away any stale one left at the same path
+static int _AQUnixListeningSocket(NSString * path, mode_t permissions, struct stat * outStatus, NSError ** error)
+{
+    int err = 0;
+    int fd = -1;
+    
+    struct sockaddr_un saddr = {0};
+    const char * fsPath = [path fileSystemRepresentation];
+    saddr.sun_family = AF_UNIX;
+    
+    if ( [path hasPrefix: @"@"] )
+    {
+        // Linux's abstract namespace has no equivalent here
+        err = EAFNOSUPPORT;
+        goto fail;
+    }
+    if ( strlcpy(saddr.sun_path, fsPath, sizeof(saddr.sun_path)) >= sizeof(saddr.sun_path) )
+    {
+        err = ENAMETOOLONG;
+        goto fail;
+    }
+    saddr.sun_len = (uint8_t)SUN_LEN(&saddr);
+    
+    struct stat st;
+    if ( lstat(fsPath, &st) == 0 )
+    {
+        // we'll only replace a socket, and only if nobody is listening on it
+        if ( S_ISSOCK(st.st_mode) == 0 )
+        {
+            err = EEXIST;
+            goto fail;
+        }
+        
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ( probe >= 0 )
+        {
+            int connected = connect(probe, (struct sockaddr *)&saddr, saddr.sun_len);
+            err = (connected == 0 ? EADDRINUSE : errno);
+            close(probe);
+            if ( err != ECONNREFUSED )
+                goto fail;
+            err = 0;
+        }
+        
+        unlink(fsPath);
+    }
+    
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 )
+    {
+        err = errno;
+        goto fail;
+    }
+    
+    int val = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+    
+    // nobody can connect until we listen, so the permissions are in place before anyone tries
+    if ( bind(fd, (struct sockaddr *)&saddr, saddr.sun_len) < 0 ||
+         chmod(fsPath, permissions) < 0 ||
+         lstat(fsPath, outStatus) < 0 )
+    {
+        err = errno;
+        unlink(fsPath);
+        goto fail;
+    }
+    
+    // a reverse proxy tends to open its connections in bursts
+    if ( listen(fd, SOMAXCONN) < 0 )
+    {
+        err = errno;
+        unlink(fsPath);
+        goto fail;
+    }
+    
+    return ( fd );
+    
+fail:
+    if ( fd >= 0 )
+        close(fd);
+    if ( error != NULL )
+        *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: err userInfo: [NSDictionary dictionaryWithObject: path forKey: NSFilePathErrorKey]];
+    return ( -1 );
+}
+
+// reads the paths from a warm-up manifest, keeping only those below the document root
+static NSArray * _AQWarmupManifestPaths(NSURL * manifestURL, NSURL * documentRoot)
+{
+    NSData * data = [NSData dataWithContentsOfURL: manifestURL options: 0 error: NULL];
+    if ( data == nil || documentRoot == nil )
+        return ( nil );
+    
+    id manifest = [NSJSONSerialization JSONObjectWithData: data options: 0 error: NULL];
+    NSArray * files = ([manifest isKindOfClass: [NSDictionary class]] ? [manifest objectForKey: @"files"] : nil);
+    if ( [files isKindOfClass: [NSArray class]] == NO )
+        return ( nil );
+    
+    // the manifest lists absolute paths; the cache is given them relative to the document root, and opens them below it
+    NSString * rootPrefix = [[[documentRoot absoluteURL] path] stringByAppendingString: @"/"];
+    NSMutableArray * paths = [NSMutableArray arrayWithCapacity: [files count]];
+    for ( id file in files )
+    {
+        NSString * path = ([file isKindOfClass: [NSDictionary class]] ? [file objectForKey: AQHTTPHotFilePathKey] : nil);
+        if ( [path isKindOfClass: [NSString class]] && [path hasPrefix: rootPrefix] )
+            [paths addObject: [path substringFromIndex: [rootPrefix length]]];
+    }
+    
+    return ( paths );
+}
 
 @implementation AQHTTPServer
 {
     AQSocket *      _serverSocket4;
     AQSocket *      _serverSocket6;
+    AQSocket *      _serverSocketUnix;
+    
+    NSString *      _unixSocketPath;
+    mode_t          _unixSocketPermissions;
+    
+    // set while the socket file at _unixSocketPath is ours to remove; it's identified by device & inode in case someone replaces it
+    BOOL            _ownsUnixSocketFile;
+    dev_t           _unixSocketDevice;
+    ino_t           _unixSocketInode;
+    
+    // connections are added on the accepting thread and remove themselves from whichever thread they close on
     NSMutableSet *  _connections;
+    pthread_mutex_t _connectionsLock;
     
     BOOL            _isLocalhost;
     NSString *      _address;
-    NSURL *         _root;
     
     Class           _connectionClass;
+    NSArray *       _tlsCertificates;
+    AQHTTPRouter *  _router;
+    AQHTTPBandwidthScheduler *  _bandwidthScheduler;
     
     BOOL            _disconnecting;
+    
+    // set while the server waits for its connections to finish after a handoff
+    dispatch_block_t    _drainCompletion;
+    
+    BOOL            _notAccepting;
+    
+    // updated atomically, from any thread
+    volatile int64_t    _connectionsAccepted;
+    volatile int64_t    _requestsReceived;
+    volatile int32_t    _openConnections;       // mirrors [_connections count], for -statistics
+    
+    // the current AQHTTPServerConfiguration (+1), swapped RCU-style: see -_updateConfiguration:
+    void * volatile     _configuration;
+    volatile int32_t    _configurationEpoch;
+    volatile int32_t    _configurationReaders[2];
+    dispatch_queue_t    _configurationQ;        // serializes updates and reclamation
+    NSMutableArray *    _retiredConfigurations; // [snapshot, epoch in which it was replaced] pairs, on _configurationQ
+    BOOL                _reclamationScheduled;  // on _configurationQ
+    uint64_t            _reclamationDelay;      // on _configurationQ
+    
+    // rewrites the warm-up manifest while the server is listening
+    NSURL *             _warmupManifestURL;
+    dispatch_source_t   _warmupManifestTimer;
 }
 
-@synthesize documentRoot=_root;
+@synthesize TLSCertificates=_tlsCertificates, router=_router, bandwidthScheduler=_bandwidthScheduler, unixSocketPath=_unixSocketPath, unixSocketPermissions=_unixSocketPermissions, warmupManifestURL=_warmupManifestURL;
 
 - (id) initWithAddress: (NSString *) address root: (NSURL *) root
 {
@@ -35,32 +296,53 @@
         return ( nil );
     
     _address = [address copy];
-    _root = [root copy];
     _connections = [NSMutableSet new];
+    pthread_mutex_init(&_connectionsLock, NULL);
+    _unixSocketPermissions = AQHTTPServerDefaultUnixSocketPermissions;
+    
+    AQHTTPFileCache * fileCache = [[AQHTTPFileCache alloc] initWithMaximumFileSize: AQHTTPServerDefaultCachedFileSize totalSize: AQHTTPServerDefaultFileCacheSize];
+    AQHTTPServerConfiguration * configuration = [[AQHTTPServerConfiguration alloc] initWithDocumentRoot: root];
+    _configuration = (void *)CFBridgingRetain([configuration configurationWithFileCache: fileCache]);
+    _configurationQ = dispatch_queue_create("me.alanquatermain.AQHTTPServer.configuration", DISPATCH_QUEUE_SERIAL);
+    _retiredConfigurations = [NSMutableArray new];
+#if USING_MRR
+    [fileCache release];
+    [configuration release];
+#endif
     
     return ( self );
 }
 
-#if USING_MRR
 - (void) dealloc
 {
+    CFRelease((CFTypeRef)_configuration);
+    pthread_mutex_destroy(&_connectionsLock);
+    if ( _warmupManifestTimer != NULL )
+        dispatch_source_cancel(_warmupManifestTimer);
+#if USING_MRR || DISPATCH_USES_ARC == 0
+    dispatch_release(_configurationQ);
+    if ( _warmupManifestTimer != NULL )
+        dispatch_release(_warmupManifestTimer);
+#endif
+#if USING_MRR
+    [_retiredConfigurations release];
     [_address release];
-    [_root release];
     [_connections release];
+    [_tlsCertificates release];
+    [_router release];
+    [_bandwidthScheduler release];
+    [_drainCompletion release];
     [_serverSocket4 release];
     [_serverSocket6 release];
+    [_serverSocketUnix release];
+    [_unixSocketPath release];
+    [_warmupManifestURL release];
     [super dealloc];
-}
 #endif
+}
 
-- (BOOL) start: (NSError **) error
+- (AQSocketEventHandler) _listenerEventHandler
 {
-    if ( _serverSocket4 != nil || _serverSocket6 != nil )
-        return ( NO );
-    
-    _serverSocket4 = [[AQSocket alloc] init];
-    _serverSocket6 = [[AQSocket alloc] init];
-    
     AQHTTPServer * __maybe_weak server = self;
     AQSocketEventHandler handlerBlock = ^(AQSocketEvent event, id info) {
         // ooooh, retain-cycle warnings FTW
@@ -81,7 +363,8 @@
         NSLog(@"New connection incoming; socket=%@", info);
 #endif
         AQSocket *newSocket = info;
-        if ( strongServer->_root == nil )
+        NSURL * documentRoot = strongServer.documentRoot;
+        if ( documentRoot == nil )
         {
 #if DEBUGLOG
             NSLog(@"No document root URL: rejecting on socket %@", newSocket);
@@ -93,9 +376,13 @@
         Class connectionClass = strongServer->_connectionClass;
         if ( connectionClass == nil )
             connectionClass = [AQHTTPConnection class];
-        AQHTTPConnection * newConnection = [[connectionClass alloc] initWithSocket: info documentRoot: strongServer->_root forServer: self];
+        AQHTTPConnection * newConnection = [[connectionClass alloc] initWithSocket: info documentRoot: documentRoot forServer: strongServer];
         newConnection.delegate = strongServer;
+        pthread_mutex_lock(&strongServer->_connectionsLock);
         [strongServer->_connections addObject: newConnection];
+        OSAtomicIncrement32Barrier(&strongServer->_openConnections);
+        pthread_mutex_unlock(&strongServer->_connectionsLock);
+        OSAtomicIncrement64Barrier(&strongServer->_connectionsAccepted);
 #if DEBUGLOG
         NSLog(@"Created new connection %@", newConnection);
 #endif
@@ -104,44 +391,361 @@
 #endif
     };
     
-    _serverSocket4.eventHandler = handlerBlock;
-    _serverSocket6.eventHandler = handlerBlock;
+#if USING_MRR
+    return ( [[handlerBlock copy] autorelease] );
+#else
+    return ( handlerBlock );
+#endif
+}
+
+- (void) _configureListeningSocket: (AQSocket *) socket
+{
+    socket.eventHandler = [self _listenerEventHandler];
+    
+    if ( [_tlsCertificates count] != 0 )
+    {
+        socket.TLSCertificates = _tlsCertificates;
+        socket.TLSApplicationProtocols = [NSArray arrayWithObjects: @"h2", @"http/1.1", nil];
+    }
+}
+
+- (BOOL) _startUnixListener: (NSError **) error
+{
+    struct stat st;
+    int fd = _AQUnixListeningSocket(_unixSocketPath, _unixSocketPermissions, &st, error);
+    if ( fd < 0 )
+        return ( NO );
+    
+    _serverSocketUnix = [[AQSocket alloc] initWithListeningSocket: fd];
+    [self _configureListeningSocket: _serverSocketUnix];
+    
+    _ownsUnixSocketFile = YES;
+    _unixSocketDevice = st.st_dev;
+    _unixSocketInode = st.st_ino;
+    
+    return ( YES );
+}
+
+- (void) _takeOwnershipOfUnixSocketFile: (const struct sockaddr_un *) saddr
+{
+    // only the file this server was configured with, and only if it's still a socket
+    struct stat st;
+    const char * fsPath = [_unixSocketPath fileSystemRepresentation];
+    if ( fsPath == NULL || strncmp(saddr->sun_path, fsPath, sizeof(saddr->sun_path)) != 0 )
+        return;
+    if ( lstat(fsPath, &st) != 0 || S_ISSOCK(st.st_mode) == 0 )
+        return;
     
-    _isLocalhost = ([_address caseInsensitiveCompare: @"loopback"] == NSOrderedSame || [_address caseInsensitiveCompare: @"localhost"] == NSOrderedSame);
+    _ownsUnixSocketFile = YES;
+    _unixSocketDevice = st.st_dev;
+    _unixSocketInode = st.st_ino;
+}
+
+- (void) _removeUnixSocketFile
+{
+    if ( _ownsUnixSocketFile == NO )
+        return;
+    
+    // only if it's still the socket we created
+    struct stat st;
+    const char * fsPath = [_unixSocketPath fileSystemRepresentation];
+    if ( lstat(fsPath, &st) == 0 && st.st_dev == _unixSocketDevice && st.st_ino == _unixSocketInode )
+        unlink(fsPath);
     
-    if ( [_serverSocket4 listenForConnections: _isLocalhost useIPv6: NO error: error] == NO )
+    _ownsUnixSocketFile = NO;
+}
+
+- (BOOL) start: (NSError **) error
+{
+    if ( self.listening )
+        return ( NO );
+    
+    if ( _address == nil && _unixSocketPath == nil )
     {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: EDESTADDRREQ userInfo: nil];
+        return ( NO );
+    }
+    
+    _isLocalhost = (_address != nil && ([_address caseInsensitiveCompare: @"loopback"] == NSOrderedSame || [_address caseInsensitiveCompare: @"localhost"] == NSOrderedSame));
+    
+    if ( _address != nil )
+    {
+        _serverSocket4 = [[AQSocket alloc] init];
+        _serverSocket6 = [[AQSocket alloc] init];
+        
+        [self _configureListeningSocket: _serverSocket4];
+        [self _configureListeningSocket: _serverSocket6];
+        
+        if ( [_serverSocket4 listenForConnections: _isLocalhost useIPv6: NO error: error] == NO )
+        {
+#if USING_MRR
+            [_serverSocket4 release];
+            [_serverSocket6 release];
+#endif
+            _serverSocket4 = nil;
+            _serverSocket6 = nil;
+            return ( NO );
+        }
+        
+        NSError * ipv6Error = nil;
+        if ( [_serverSocket6 listenForConnections: _isLocalhost useIPv6: YES error: &ipv6Error] == NO )
+        {
+            // drop down to IPv4 only
 #if USING_MRR
-        [_serverSocket4 release];
-        [_serverSocket6 release];
+            [_serverSocket6 release];
 #endif
-        _serverSocket4 = nil;
-        _serverSocket6 = nil;
+            _serverSocket6 = nil;
+        }
+    }
+    
+    if ( _unixSocketPath != nil && [self _startUnixListener: error] == NO )
+    {
+        [self stop];
         return ( NO );
     }
     
-    NSError * ipv6Error = nil;
-    if ( [_serverSocket6 listenForConnections: _isLocalhost useIPv6: YES error: &ipv6Error] == NO )
+    if ( _notAccepting )
     {
-        // drop down to IPv4 only
+        [_serverSocket4 suspendReading];
+        [_serverSocket6 suspendReading];
+        [_serverSocketUnix suspendReading];
+    }
+    
+    [self _beginWarmup];
+    return ( YES );
+}
+
+- (BOOL) startWithListeningSocketsFromSocket: (int) unixSocket error: (NSError **) error
+{
+    if ( self.listening )
+        return ( NO );
+    
+    int fds[AQHTTPMaximumListeningSockets];
+    BOOL ownershipTransferred = NO;
+    int count = _AQReceiveDescriptors(unixSocket, fds, AQHTTPMaximumListeningSockets, &ownershipTransferred);
+    if ( count <= 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: (count < 0 ? errno : EBADMSG) userInfo: nil];
+        return ( NO );
+    }
+    
+    for ( int i = 0; i < count; i++ )
+    {
+        struct sockaddr_storage saddr = {0};
+        socklen_t slen = sizeof(saddr);
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        
+        // we only adopt sockets which are actually listening, one of each family
+        if ( getsockname(fds[i], (struct sockaddr *)&saddr, &slen) < 0 ||
+             getsockopt(fds[i], SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || listening == 0 ||
+             (saddr.ss_family == AF_INET && _serverSocket4 != nil) ||
+             (saddr.ss_family == AF_INET6 && _serverSocket6 != nil) ||
+             (saddr.ss_family == AF_UNIX && _serverSocketUnix != nil) ||
+             (saddr.ss_family != AF_INET && saddr.ss_family != AF_INET6 && saddr.ss_family != AF_UNIX) )
+        {
+            NSLog(@"Ignoring unusable socket %d received from the previous server process", fds[i]);
+            close(fds[i]);
+            continue;
+        }
+        
+        AQSocket * socket = [[AQSocket alloc] initWithListeningSocket: fds[i]];
+        [self _configureListeningSocket: socket];
+        if ( saddr.ss_family == AF_INET )
+            _serverSocket4 = socket;
+        else if ( saddr.ss_family == AF_INET6 )
+            _serverSocket6 = socket;
+        else
+            _serverSocketUnix = socket;
+        
+        // a handoff passes the socket file on with the listener; workers sharing it leave it to the supervisor
+        if ( saddr.ss_family == AF_UNIX && ownershipTransferred )
+            [self _takeOwnershipOfUnixSocketFile: (const struct sockaddr_un *)&saddr];
+    }
+    
+    if ( self.listening == NO )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: ENOTSOCK userInfo: nil];
+        return ( NO );
+    }
+    
+    _isLocalhost = (_address != nil && ([_address caseInsensitiveCompare: @"loopback"] == NSOrderedSame || [_address caseInsensitiveCompare: @"localhost"] == NSOrderedSame));
+    
+    if ( _notAccepting )
+    {
+        [_serverSocket4 suspendReading];
+        [_serverSocket6 suspendReading];
+        [_serverSocketUnix suspendReading];
+    }
+    
+    // tell the previous process it can stop accepting
+    uint8_t ack = 1;
+    if ( write(unixSocket, &ack, 1) != 1 )
+        NSLog(@"Unable to acknowledge listening sockets: %d (%s)", errno, strerror(errno));
+    
+    [self _beginWarmup];
+    return ( YES );
+}
+
+- (BOOL) _sendListeningSocketsOverSocket: (int) unixSocket transferringOwnership: (BOOL) transferOwnership error: (NSError **) error
+{
+    int fds[AQHTTPMaximumListeningSockets];
+    uint8_t count = 0;
+    if ( _serverSocket4.nativeHandle != -1 )
+        fds[count++] = _serverSocket4.nativeHandle;
+    if ( _serverSocket6.nativeHandle != -1 )
+        fds[count++] = _serverSocket6.nativeHandle;
+    if ( _serverSocketUnix.nativeHandle != -1 )
+        fds[count++] = _serverSocketUnix.nativeHandle;
+    
+    if ( count == 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: ENOTCONN userInfo: nil];
+        return ( NO );
+    }
+    
+    if ( _AQSendDescriptors(unixSocket, fds, count, transferOwnership) == NO )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+        return ( NO );
+    }
+    
+    return ( YES );
+}
+
+- (BOOL) _shareListeningSocketsOverSocket: (int) unixSocket transferringOwnership: (BOOL) transferOwnership error: (NSError **) error
+{
+    if ( [self _sendListeningSocketsOverSocket: unixSocket transferringOwnership: transferOwnership error: error] == NO )
+        return ( NO );
+    
+    struct timeval timeout = { .tv_sec = AQHTTPHandoffAcknowledgementTimeout, .tv_usec = 0 };
+    setsockopt(unixSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    uint8_t ack = 0;
+    ssize_t numRead;
+    do
+    {
+        numRead = read(unixSocket, &ack, 1);
+        
+    } while ( numRead < 0 && errno == EINTR );
+    
+    if ( numRead != 1 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSPOSIXErrorDomain code: (numRead == 0 ? ECONNRESET : errno) userInfo: nil];
+        return ( NO );
+    }
+    
+    return ( YES );
+}
+
+- (BOOL) shareListeningSocketsOverSocket: (int) unixSocket error: (NSError **) error
+{
+    return ( [self _shareListeningSocketsOverSocket: unixSocket transferringOwnership: NO error: error] );
+}
+
+- (BOOL) handOffListeningSocketsOverSocket: (int) unixSocket error: (NSError **) error
+{
+    // until the new process says it's listening, we keep accepting connections ourselves
+    if ( [self _shareListeningSocketsOverSocket: unixSocket transferringOwnership: YES error: error] == NO )
+        return ( NO );
+    
+    // both processes share the listening sockets, so closing ours leaves the new process accepting alone
+    _disconnecting = YES;
+    [self _shutdownSockets];
 #if USING_MRR
-        [_serverSocket6 release];
+    [_serverSocket4 release];
+    [_serverSocket6 release];
+    [_serverSocketUnix release];
 #endif
-        _serverSocket6 = nil;
-    }
+    _serverSocket4 = nil;
+    _serverSocket6 = nil;
+    _serverSocketUnix = nil;
+    _disconnecting = NO;
+    
+    // the other process owns the socket file now, and will remove it when it stops
+    _ownsUnixSocketFile = NO;
     
     return ( YES );
 }
 
+- (void) _finishDraining
+{
+    if ( _drainCompletion == nil )
+        return;
+    
+    dispatch_block_t completion = _drainCompletion;
+    _drainCompletion = nil;
+    completion();
+#if USING_MRR
+    [completion release];
+#endif
+}
+
+- (void) drainConnectionsWithTimeout: (NSTimeInterval) timeout completionHandler: (void (^)(void)) completionHandler
+{
+#if USING_MRR
+    [_drainCompletion release];
+#endif
+    _drainCompletion = [completionHandler copy];
+    
+    // connections remove themselves as they close, so work from a copy
+    for ( AQHTTPConnection * connection in [self _copyOfConnections] )
+    {
+        [connection _drain];
+    }
+    
+    if ( [self _connectionCount] == 0 )
+    {
+        [self _finishDraining];
+        return;
+    }
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        if ( _drainCompletion == nil )
+            return;
+        
+        NSLog(@"%lu connections still open after %g seconds; closing them", (unsigned long)[self _connectionCount], timeout);
+        [self _clearConnections];
+        [self _finishDraining];
+    });
+}
+
+- (NSArray *) _copyOfConnections
+{
+    pthread_mutex_lock(&_connectionsLock);
+    NSArray * connections = [_connections allObjects];
+    pthread_mutex_unlock(&_connectionsLock);
+    return ( connections );
+}
+
+- (NSUInteger) _connectionCount
+{
+    pthread_mutex_lock(&_connectionsLock);
+    NSUInteger count = [_connections count];
+    pthread_mutex_unlock(&_connectionsLock);
+    return ( count );
+}
+
 - (void) _clearConnections
 {
-    for ( AQHTTPConnection * connection in _connections )
+    // the connections are closed outside the lock, since one may be closing itself (and removing itself) at the same time
+    pthread_mutex_lock(&_connectionsLock);
+    NSArray * connections = [_connections allObjects];
+    OSAtomicAdd32Barrier(-(int32_t)[_connections count], &_openConnections);
+    [_connections removeAllObjects];
+    pthread_mutex_unlock(&_connectionsLock);
+    
+    for ( AQHTTPConnection * connection in connections )
     {
         connection.delegate = nil;      // so we don't get the callback immediately after calling -close
         [connection close];
     }
-    
-    [_connections removeAllObjects];
 }
 
 - (void) _shutdownSockets
@@ -150,19 +754,25 @@
     [_serverSocket4 close];
     _serverSocket6.eventHandler = nil;
     [_serverSocket6 close];
+    _serverSocketUnix.eventHandler = nil;
+    [_serverSocketUnix close];
 }
 
 - (void) stop
 {
     [self _clearConnections];
     [self _shutdownSockets];
+    [self _removeUnixSocketFile];
+    [self _endWarmup];
     
 #if USING_MRR
     [_serverSocket4 release];
     [_serverSocket6 release];
+    [_serverSocketUnix release];
 #endif
     _serverSocket4 = nil;
     _serverSocket6 = nil;
+    _serverSocketUnix = nil;
 }
 
 - (BOOL) reset
@@ -211,12 +821,65 @@
     [handlerBlock release];
 #endif
     
+    // a Unix-domain socket can't simply be bound again: its file has to be replaced
+    if ( _serverSocketUnix != nil )
+    {
+#if USING_MRR
+        [_serverSocketUnix release];
+#endif
+        _serverSocketUnix = nil;
+        [self _removeUnixSocketFile];
+        
+        error = nil;
+        if ( _unixSocketPath == nil || [self _startUnixListener: &error] == NO )
+            NSLog(@"Error resetting Unix-domain listening socket: %@", error);
+    }
+    
+    if ( _notAccepting )
+    {
+        [_serverSocket4 suspendReading];
+        [_serverSocket6 suspendReading];
+        [_serverSocketUnix suspendReading];
+    }
+    
     return ( keptPorts );
 }
 
 - (BOOL) isListening
 {
-    return ( _serverSocket4 != nil || _serverSocket6 != nil );
+    return ( _serverSocket4 != nil || _serverSocket6 != nil || _serverSocketUnix != nil );
+}
+
+- (BOOL) isAcceptingConnections
+{
+    return ( _notAccepting == NO );
+}
+
+- (void) setAcceptingConnections: (BOOL) acceptingConnections
+{
+    _notAccepting = !acceptingConnections;
+    
+    if ( _notAccepting )
+    {
+        [_serverSocket4 suspendReading];
+        [_serverSocket6 suspendReading];
+        [_serverSocketUnix suspendReading];
+    }
+    else
+    {
+        [_serverSocket4 resumeReading];
+        [_serverSocket6 resumeReading];
+        [_serverSocketUnix resumeReading];
+    }
+}
+
+- (AQHTTPServerStatistics) statistics
+{
+    AQHTTPServerStatistics stats = {0};
+    stats.connectionsAccepted = (uint64_t)_connectionsAccepted;
+    stats.requestsReceived = (uint64_t)_requestsReceived;
+    stats.openConnections = (uint32_t)MAX(_openConnections, 0);     // kept alongside the set, so reporting never takes its lock
+    return ( stats );
 }
 
 - (NSString *) serverAddress
@@ -230,9 +893,15 @@
     if ( saddr.ss_len == 0 )
         saddr = _serverSocket4.socketAddress;
     
+    if ( saddr.ss_len == 0 )
+        saddr = _serverSocketUnix.socketAddress;
+    
     if ( saddr.ss_len == 0 )
         return ( nil );
     
+    if ( saddr.ss_family == AF_UNIX )
+        return ( [NSString stringWithFormat: @"unix:%s", ((struct sockaddr_un *)&saddr)->sun_path] );
+    
     char namebuf[INET6_ADDRSTRLEN];
     uint16_t port = 0;
     
@@ -279,32 +948,226 @@
         _connectionClass = connectionClass;
 }
 
+- (AQHTTPServerConfiguration *) configuration
+{
+    // a reader announces itself in the current epoch before looking at the pointer, so the snapshot it finds can't be reclaimed until it has its own reference
+    // if the epoch moved on while it did so, the reclaimer may already have counted that epoch as empty, so it backs out and tries again:
+    // that's lock-free, not wait-free, but the epoch only moves when a snapshot has been replaced, so in practice it's rare to retry at all
+    for ( ;; )
+    {
+        int32_t epoch = _configurationEpoch;
+        OSAtomicIncrement32Barrier(&_configurationReaders[epoch & 1]);
+        if ( epoch == _configurationEpoch )
+        {
+            CFTypeRef configuration = CFRetain((CFTypeRef)_configuration);
+            OSAtomicDecrement32Barrier(&_configurationReaders[epoch & 1]);
+            return ( CFBridgingRelease(configuration) );
+        }
+        
+        OSAtomicDecrement32Barrier(&_configurationReaders[epoch & 1]);
+    }
+}
+
+- (void) _updateConfiguration: (AQHTTPServerConfiguration * (^)(AQHTTPServerConfiguration * current)) update
+{
+    dispatch_sync(_configurationQ, ^{
+        CFTypeRef oldConfiguration = (CFTypeRef)_configuration;
+        AQHTTPServerConfiguration * newConfiguration = update((__bridge AQHTTPServerConfiguration *)oldConfiguration);
+        OSAtomicCompareAndSwapPtrBarrier((void *)oldConfiguration, (void *)CFBridgingRetain(newConfiguration), &_configuration);
+        
+        // only readers counted in this epoch or earlier can have seen the old pointer; it's released once they've all gone
+        id retired = CFBridgingRelease(oldConfiguration);
+        [_retiredConfigurations addObject: @[retired, @(_configurationEpoch)]];
+        
+        if ( _reclamationScheduled == NO )
+        {
+            _reclamationScheduled = YES;
+            dispatch_async(_configurationQ, ^{ [self _reclaimConfigurations]; });
+        }
+    });
+}
+
+- (void) _reclaimConfigurations
+{
+    // runs on _configurationQ, and never waits there: while readers remain it checks back later, less often each time
+    // we only ever move into a new epoch once the one before the current epoch has drained, so when that's
+    // empty every reader which looked at the pointer before the current epoch began has finished with it
+    int32_t epoch = _configurationEpoch;
+    if ( _configurationReaders[(epoch + 1) & 1] != 0 )
+    {
+        _reclamationDelay = (_reclamationDelay == 0 ? AQHTTPServerInitialReclamationDelay : MIN(_reclamationDelay * 2, AQHTTPServerMaximumReclamationDelay));
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, _reclamationDelay), _configurationQ, ^{ [self _reclaimConfigurations]; });
+        return;
+    }
+    _reclamationDelay = 0;
+    
+    // snapshots replaced in earlier epochs are now unreachable; they're at the front of the list
+    NSUInteger count = 0;
+    for ( NSArray * entry in _retiredConfigurations )
+    {
+        if ( [[entry objectAtIndex: 1] intValue] == epoch )
+            break;
+        count++;
+    }
+    [_retiredConfigurations removeObjectsInRange: NSMakeRange(0, count)];
+    
+    if ( [_retiredConfigurations count] == 0 )
+    {
+        _reclamationScheduled = NO;
+        return;
+    }
+    
+    // those replaced in this epoch may still be in use: start a new one, and wait for this one to drain
+    OSAtomicIncrement32Barrier(&_configurationEpoch);
+    dispatch_async(_configurationQ, ^{ [self _reclaimConfigurations]; });
+}
+
+- (NSURL *) documentRoot
+{
+    return ( self.configuration.documentRoot );
+}
+
 - (void) setDocumentRoot: (NSURL *) documentRoot
 {
-#if USING_MRR
-    NSURL * newURL = [documentRoot copy];
-    NSURL * oldURL = _root;
-    _root = newURL;
-    [oldURL release];
-#else
-    _root = [documentRoot copy];
-#endif
+    // connections pick up the new snapshot as their next request arrives
+    [self _updateConfiguration: ^AQHTTPServerConfiguration *(AQHTTPServerConfiguration * current) {
+        return ( [current configurationWithDocumentRoot: documentRoot] );
+    }];
+}
+
+- (AQHTTPFileCache *) fileCache
+{
+    return ( self.configuration.fileCache );
+}
+
+- (void) setFileCache: (AQHTTPFileCache *) fileCache
+{
+    if ( _warmupManifestURL != nil )
+        fileCache.recordsHotFiles = YES;
     
-    // never propagate nil URLs
-    if ( _root == nil )
+    [self _updateConfiguration: ^AQHTTPServerConfiguration *(AQHTTPServerConfiguration * current) {
+        return ( [current configurationWithFileCache: fileCache] );
+    }];
+}
+
+- (NSTimeInterval) idleTimeout
+{
+    return ( self.configuration.idleTimeout );
+}
+
+- (void) setIdleTimeout: (NSTimeInterval) idleTimeout
+{
+    [self _updateConfiguration: ^AQHTTPServerConfiguration *(AQHTTPServerConfiguration * current) {
+        return ( [current configurationWithIdleTimeout: idleTimeout] );
+    }];
+}
+
+- (unsigned long long) maximumRequestBodyLength
+{
+    return ( self.configuration.maximumRequestBodyLength );
+}
+
+- (void) setMaximumRequestBodyLength: (unsigned long long) maximumRequestBodyLength
+{
+    [self _updateConfiguration: ^AQHTTPServerConfiguration *(AQHTTPServerConfiguration * current) {
+        return ( [current configurationWithMaximumRequestBodyLength: maximumRequestBodyLength] );
+    }];
+}
+
+- (void) _beginWarmup
+{
+    if ( _warmupManifestURL == nil || _warmupManifestTimer != NULL )
         return;
     
-    for ( AQHTTPConnection * connection in _connections )
+    AQHTTPServerConfiguration * configuration = self.configuration;
+    AQHTTPFileCache * cache = configuration.fileCache;
+    NSURL * manifestURL = _warmupManifestURL;
+    NSURL * documentRoot = configuration.documentRoot;
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0);
+    
+    // the server is already accepting connections: those for files not yet loaded simply miss the cache
+    if ( cache != nil )
     {
-        connection.documentRoot = _root;
+        cache.recordsHotFiles = YES;
+        
+        dispatch_async(queue, ^{
+            NSArray * paths = _AQWarmupManifestPaths(manifestURL, documentRoot);
+            if ( [paths count] != 0 )
+                [cache prefetchItemsAtPaths: paths configuration: configuration maximumConcurrency: AQHTTPServerWarmupConcurrency];
+        });
     }
+    
+    AQHTTPServer * __maybe_weak server = self;
+    uint64_t interval = (uint64_t)(AQHTTPServerWarmupManifestInterval * NSEC_PER_SEC);
+    _warmupManifestTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+    dispatch_source_set_timer(_warmupManifestTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    dispatch_source_set_event_handler(_warmupManifestTimer, ^{
+        AQHTTPServer * strongServer = server;
+        [strongServer _writeWarmupManifest];
+    });
+    dispatch_resume(_warmupManifestTimer);
+}
+
+- (void) _endWarmup
+{
+    if ( _warmupManifestTimer == NULL )
+        return;
+    
+    dispatch_source_cancel(_warmupManifestTimer);
+#if USING_MRR || DISPATCH_USES_ARC == 0
+    dispatch_release(_warmupManifestTimer);
+#endif
+    _warmupManifestTimer = NULL;
+    
+    // bring the manifest up to date for whoever starts next
+    [self _writeWarmupManifest];
+}
+
+- (void) _writeWarmupManifest
+{
+    AQHTTPFileCache * cache = self.fileCache;
+    NSArray * files = [cache hotFilesWithLimit: AQHTTPServerWarmupManifestLimit];
+    
+    // an idle server, or a supervisor whose workers do the serving, would only erase a useful manifest
+    if ( [files count] == 0 )
+        return;
+    
+    NSError * error = nil;
+    NSData * data = [NSJSONSerialization dataWithJSONObject: [NSDictionary dictionaryWithObject: files forKey: @"files"] options: 0 error: &error];
+    if ( data == nil || [data writeToURL: _warmupManifestURL options: NSDataWritingAtomic error: &error] == NO )
+        NSLog(@"Unable to write warm-up manifest to %@: %@", [_warmupManifestURL path], error);
+    
+    // requests counted from now on outweigh those already in the manifest
+    [cache ageHotFiles];
+}
+
+- (void) _noteRequestReceived
+{
+    OSAtomicIncrement64Barrier(&_requestsReceived);
 }
 
 #pragma mark - AQHTTPConnectionDelegate Protocol
 
 - (void) connectionDidClose: (AQHTTPConnection *) connection
 {
-    [_connections removeObject: connection];
+    pthread_mutex_lock(&_connectionsLock);
+    if ( [_connections containsObject: connection] )
+    {
+        [_connections removeObject: connection];
+        OSAtomicDecrement32Barrier(&_openConnections);
+    }
+    NSUInteger remaining = [_connections count];
+    pthread_mutex_unlock(&_connectionsLock);
+    [_bandwidthScheduler connectionDidClose: connection];
+    
+    if ( _drainCompletion != nil && remaining == 0 )
+    {
+        // connections close on all sorts of threads; the completion handler is always called on the main one
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if ( [self _connectionCount] == 0 )
+                [self _finishDraining];
+        });
+    }
 }
 
 @end
@@ -0,0 +1,93 @@
+//
+//  AQHTTPServerConfiguration.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <sys/stat.h>
+#import "AQHTTPFileCache.h"
+
+/**
+ An immutable snapshot of a server's settings.
+
+ The server publishes a new snapshot whenever one of its settings changes.
+ Connections and response operations take a snapshot as each request
+ begins and use it throughout, so a request never sees a mixture of old and
+ new settings, and changing them never waits for requests in progress.
+
+ The snapshot keeps the document root open, and files are looked up
+ relative to that descriptor: a request which started before the document
+ root was moved or replaced carries on reading from the directory it
+ started with.
+ */
+@interface AQHTTPServerConfiguration : NSObject
+
+/**
+ Initializes a configuration with default settings.
+ @param documentRoot The URL of the folder from which content is served, or `nil`.
+ @result A new configuration.
+ */
+- (id) initWithDocumentRoot: (NSURL *) documentRoot;
+
+/// The URL of the folder from which content is served.
+@property (nonatomic, readonly) NSURL * documentRoot;
+
+/**
+ An open descriptor for the document root, or -1 if it isn't a folder
+ which could be opened. It remains open for as long as the configuration
+ exists.
+ */
+@property (nonatomic, readonly) int documentRootDescriptor;
+
+/// How long a connection may sit idle before it is closed. The default is two seconds.
+@property (nonatomic, readonly) NSTimeInterval idleTimeout;
+
+/// The largest request body accepted, in bytes, or zero for no limit. The default is 64MB.
+@property (nonatomic, readonly) unsigned long long maximumRequestBodyLength;
+
+/// The cache used to answer requests for small files, or `nil`.
+@property (nonatomic, readonly) AQHTTPFileCache * fileCache;
+
+/** @name Deriving New Configurations */
+
+/// Returns a copy of the configuration with a different document root, opening it afresh.
+- (AQHTTPServerConfiguration *) configurationWithDocumentRoot: (NSURL *) documentRoot;
+
+/// Returns a copy of the configuration with a different idle timeout.
+- (AQHTTPServerConfiguration *) configurationWithIdleTimeout: (NSTimeInterval) idleTimeout;
+
+/// Returns a copy of the configuration with a different request body limit.
+- (AQHTTPServerConfiguration *) configurationWithMaximumRequestBodyLength: (unsigned long long) maximumRequestBodyLength;
+
+/// Returns a copy of the configuration with a different file cache.
+- (AQHTTPServerConfiguration *) configurationWithFileCache: (AQHTTPFileCache *) fileCache;
+
+/** @name Looking Up Files */
+
+/**
+ Returns the absolute path of an item below the document root.
+ @param path A request path, relative to the document root.
+ @result An absolute path, or `nil` if the request path refers to a parent
+ of the document root.
+ */
+- (NSString *) absolutePathForItemAtPath: (NSString *) path;
+
+/**
+ Reads the attributes of an item below the document root, using fstatat().
+ @param status On return, the item's attributes.
+ @param path A request path, relative to the document root.
+ @result Returns `YES` if the item exists, `NO` otherwise.
+ */
+- (BOOL) getStatus: (struct stat *) status ofItemAtPath: (NSString *) path;
+
+/**
+ Opens an item below the document root for reading, using openat().
+ @param path A request path, relative to the document root.
+ @result A new file descriptor, which the caller must close, or -1 on failure.
+ */
+- (int) openItemAtPath: (NSString *) path;
+
+@end
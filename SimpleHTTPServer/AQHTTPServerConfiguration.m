@@ -0,0 +1,196 @@
+//
+//  AQHTTPServerConfiguration.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPServerConfiguration.h"
+#import <fcntl.h>
+
+#define AQHTTPDefaultIdleTimeout                2.0
+#define AQHTTPDefaultMaximumRequestBodyLength   (64ull * 1024 * 1024)
+
+// shared by configurations with the same document root; the descriptor is closed when the last one goes away
+@interface _AQDirectoryDescriptor : NSObject
+{
+@public
+    int     _fd;
+}
+- (id) initWithURL: (NSURL *) url;
+@end
+
+@implementation _AQDirectoryDescriptor
+
+- (id) initWithURL: (NSURL *) url
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _fd = -1;
+    if ( [url isFileURL] )
+        _fd = open([[url path] fileSystemRepresentation], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _fd >= 0 )
+        close(_fd);
+#if USING_MRR
+    [super dealloc];
+#endif
+}
+
+@end
+
+// turns a request path into one relative to the document root, refusing any which would climb out of it
+static NSString * _AQRootRelativePath(NSString * path)
+{
+    NSMutableArray * components = [NSMutableArray array];
+    for ( NSString * component in [path componentsSeparatedByString: @"/"] )
+    {
+        if ( [component length] == 0 || [component isEqualToString: @"."] )
+            continue;
+        if ( [component isEqualToString: @".."] )
+            return ( nil );
+        [components addObject: component];
+    }
+
+    if ( [components count] == 0 )
+        return ( @"." );
+
+    return ( [components componentsJoinedByString: @"/"] );
+}
+
+#pragma mark -
+
+@implementation AQHTTPServerConfiguration
+{
+    NSURL *                     _documentRoot;
+    _AQDirectoryDescriptor *    _rootDescriptor;
+    NSTimeInterval              _idleTimeout;
+    unsigned long long          _maximumRequestBodyLength;
+    AQHTTPFileCache *           _fileCache;
+}
+
+@synthesize documentRoot=_documentRoot, idleTimeout=_idleTimeout, maximumRequestBodyLength=_maximumRequestBodyLength, fileCache=_fileCache;
+
+- (id) initWithDocumentRoot: (NSURL *) documentRoot
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+    _documentRoot = [documentRoot copy];
+    _rootDescriptor = [[_AQDirectoryDescriptor alloc] initWithURL: documentRoot];
+    _idleTimeout = AQHTTPDefaultIdleTimeout;
+    _maximumRequestBodyLength = AQHTTPDefaultMaximumRequestBodyLength;
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_documentRoot release];
+    [_rootDescriptor release];
+    [_fileCache release];
+    [super dealloc];
+}
+#endif
+
+- (int) documentRootDescriptor
+{
+    return ( _rootDescriptor->_fd );
+}
+
+// a new configuration sharing everything with this one, ready to have a single value changed
+- (AQHTTPServerConfiguration *) _derivedConfiguration
+{
+    AQHTTPServerConfiguration * result = [[AQHTTPServerConfiguration alloc] init];
+#if USING_MRR
+    result->_documentRoot = [_documentRoot retain];
+    result->_rootDescriptor = [_rootDescriptor retain];
+    result->_fileCache = [_fileCache retain];
+    [result autorelease];
+#else
+    result->_documentRoot = _documentRoot;
+    result->_rootDescriptor = _rootDescriptor;
+    result->_fileCache = _fileCache;
+#endif
+    result->_idleTimeout = _idleTimeout;
+    result->_maximumRequestBodyLength = _maximumRequestBodyLength;
+    return ( result );
+}
+
+- (AQHTTPServerConfiguration *) configurationWithDocumentRoot: (NSURL *) documentRoot
+{
+    AQHTTPServerConfiguration * result = [self _derivedConfiguration];
+    _AQDirectoryDescriptor * descriptor = [[_AQDirectoryDescriptor alloc] initWithURL: documentRoot];
+#if USING_MRR
+    [result->_documentRoot release];
+    [result->_rootDescriptor release];
+#endif
+    result->_documentRoot = [documentRoot copy];
+    result->_rootDescriptor = descriptor;
+    return ( result );
+}
+
+- (AQHTTPServerConfiguration *) configurationWithIdleTimeout: (NSTimeInterval) idleTimeout
+{
+    AQHTTPServerConfiguration * result = [self _derivedConfiguration];
+    result->_idleTimeout = idleTimeout;
+    return ( result );
+}
+
+- (AQHTTPServerConfiguration *) configurationWithMaximumRequestBodyLength: (unsigned long long) maximumRequestBodyLength
+{
+    AQHTTPServerConfiguration * result = [self _derivedConfiguration];
+    result->_maximumRequestBodyLength = maximumRequestBodyLength;
+    return ( result );
+}
+
+- (AQHTTPServerConfiguration *) configurationWithFileCache: (AQHTTPFileCache *) fileCache
+{
+    AQHTTPServerConfiguration * result = [self _derivedConfiguration];
+#if USING_MRR
+    [result->_fileCache release];
+    result->_fileCache = [fileCache retain];
+#else
+    result->_fileCache = fileCache;
+#endif
+    return ( result );
+}
+
+- (NSString *) absolutePathForItemAtPath: (NSString *) path
+{
+    NSString * relativePath = _AQRootRelativePath(path);
+    if ( relativePath == nil || _documentRoot == nil )
+        return ( nil );
+
+    return ( [[[_documentRoot URLByAppendingPathComponent: relativePath] absoluteURL] path] );
+}
+
+- (BOOL) getStatus: (struct stat *) status ofItemAtPath: (NSString *) path
+{
+    NSString * relativePath = _AQRootRelativePath(path);
+    if ( relativePath == nil || _rootDescriptor->_fd < 0 )
+        return ( NO );
+
+    return ( fstatat(_rootDescriptor->_fd, [relativePath fileSystemRepresentation], status, 0) == 0 );
+}
+
+- (int) openItemAtPath: (NSString *) path
+{
+    NSString * relativePath = _AQRootRelativePath(path);
+    if ( relativePath == nil || _rootDescriptor->_fd < 0 )
+        return ( -1 );
+
+    return ( openat(_rootDescriptor->_fd, [relativePath fileSystemRepresentation], O_RDONLY | O_CLOEXEC) );
+}
+
+@end
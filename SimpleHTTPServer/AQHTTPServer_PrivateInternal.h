@@ -0,0 +1,22 @@
+//
+//  AQHTTPServer_PrivateInternal.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPServer.h"
+
+// a process receiving our listening sockets has this long to acknowledge them before we carry on without it
+#define AQHTTPHandoffAcknowledgementTimeout     10
+
+@interface AQHTTPServer ()
+
+// called by connections as each request arrives, on any thread
+- (void) _noteRequestReceived;
+
+// sends the listening sockets without waiting; once listening on them, the receiver writes a single byte back
+- (BOOL) _sendListeningSocketsOverSocket: (int) unixSocket transferringOwnership: (BOOL) transferOwnership error: (NSError **) error;
+
+@end
@@ -0,0 +1,88 @@
+//
+//  AQHTTPTrace.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Per-request phase tracing.
+
+ While tracing is enabled, a sample of requests are each given a trace
+ identifier as they're parsed, and the time spent in each phase of
+ answering them (parsing, waiting in the connection's queue, building the
+ response header, waiting for the socket, writing) is recorded as a span.
+
+ Spans are kept in a fixed-size buffer belonging to the thread which
+ recorded them, so recording never contends with other threads; once a
+ thread's buffer is full its oldest spans are overwritten. The spans
+ collected so far can be exported at any time in the Trace Event format
+ read by chrome://tracing and similar tools.
+
+ Requests which aren't sampled carry a trace identifier of zero, and cost
+ nothing more than a check of that identifier at each phase.
+ */
+
+/// Identifies the traced request to which a span belongs. Zero means "not traced".
+typedef uint64_t AQHTTPTraceID;
+
+/**
+ Returns the current time in the units used by spans, or zero if tracing is
+ disabled. Call this at the start of a phase and pass the result to
+ AQHTTPTraceRecordSpan() at its end.
+ */
+extern uint64_t AQHTTPTraceTimestamp(void);
+
+/**
+ Decides whether a newly-arrived request is to be traced.
+ @result A new trace identifier, or zero if tracing is disabled or the
+ request wasn't sampled.
+ */
+extern AQHTTPTraceID AQHTTPTraceBeginRequest(void);
+
+/**
+ Records a completed phase of a traced request on the calling thread.
+ Does nothing if `trace` or `start` is zero, as they are when tracing was
+ disabled at the start of the phase.
+ @param trace The request's trace identifier.
+ @param name The name of the phase. This must be a string constant: only
+ the pointer is kept.
+ @param start The time the phase began, from AQHTTPTraceTimestamp().
+ @param end The time the phase ended, from AQHTTPTraceTimestamp().
+ */
+extern void AQHTTPTraceRecordSpan(AQHTTPTraceID trace, const char * name, uint64_t start, uint64_t end);
+
+@interface AQHTTPTrace : NSObject
+
+/**
+ Enables tracing for one request in every `interval`, or disables it if
+ `interval` is zero (the default). An interval of one traces every request.
+ Spans already recorded are kept.
+ */
++ (void) setSamplingInterval: (NSUInteger) interval;
+
+/// One request in this many is traced, or none if this is zero.
++ (NSUInteger) samplingInterval;
+
+/**
+ Returns the spans recorded so far as a JSON Trace Event document. Each span
+ is a complete ('X') event on the thread which recorded it, with the request's
+ trace identifier in its arguments. May be called from any thread.
+ */
++ (NSData *) traceEventData;
+
+/**
+ Writes the spans recorded so far to a file, as returned by +traceEventData.
+ @param path The path of the file to write.
+ @param error On failure, describes what went wrong. Can be `NULL`.
+ @result Returns YES if the file was written, NO otherwise.
+ */
++ (BOOL) writeTraceEventsToFile: (NSString *) path error: (NSError **) error;
+
+/// Discards all spans recorded so far.
++ (void) removeAllSpans;
+
+@end
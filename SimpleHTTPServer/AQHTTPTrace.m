@@ -0,0 +1,189 @@
+//
+//  AQHTTPTrace.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPTrace.h"
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
+
+// spans kept per thread; a thread which records more overwrites its oldest
+#define AQHTTPTraceBufferCapacity   4096
+
+typedef struct _AQTraceSpan {
+    const char *    name;
+    AQHTTPTraceID   trace;
+    uint64_t        start;
+    uint64_t        end;
+    uint64_t        thread;
+} _AQTraceSpan;
+
+typedef struct _AQTraceBuffer {
+    struct _AQTraceBuffer * next;       // buffers are never freed, so they can be read after their thread exits
+    volatile int32_t        inUse;      // cleared when the owning thread exits, so another can take the buffer over
+    OSSpinLock              lock;       // only ever contended while the spans are being exported
+    uint64_t                count;      // spans recorded since the buffer was last emptied
+    _AQTraceSpan            spans[AQHTTPTraceBufferCapacity];
+} _AQTraceBuffer;
+
+static volatile uint32_t            _AQTraceSamplingInterval = 0;
+static volatile int64_t             _AQTraceRequestCount = 0;
+static _AQTraceBuffer * volatile    _AQTraceBuffers = NULL;
+
+static pthread_key_t                _AQTraceBufferKey;
+static pthread_once_t               _AQTraceBufferKeyOnce = PTHREAD_ONCE_INIT;
+
+static void _AQTraceThreadExited(void * buffer)
+{
+    OSAtomicCompareAndSwap32Barrier(1, 0, &((_AQTraceBuffer *)buffer)->inUse);
+}
+
+static void _AQTraceCreateBufferKey(void)
+{
+    pthread_key_create(&_AQTraceBufferKey, _AQTraceThreadExited);
+}
+
+static _AQTraceBuffer * _AQTraceBufferForCurrentThread(void)
+{
+    pthread_once(&_AQTraceBufferKeyOnce, _AQTraceCreateBufferKey);
+    _AQTraceBuffer * buffer = pthread_getspecific(_AQTraceBufferKey);
+    if ( buffer != NULL )
+        return ( buffer );
+
+    // reuse the buffer of a thread which has gone away, if there is one
+    for ( buffer = _AQTraceBuffers; buffer != NULL; buffer = buffer->next )
+    {
+        if ( OSAtomicCompareAndSwap32Barrier(0, 1, &buffer->inUse) )
+            break;
+    }
+
+    if ( buffer == NULL )
+    {
+        buffer = calloc(1, sizeof(_AQTraceBuffer));
+        if ( buffer == NULL )
+            return ( NULL );
+
+        buffer->inUse = 1;
+        buffer->lock = OS_SPINLOCK_INIT;
+        do
+        {
+            buffer->next = _AQTraceBuffers;
+        } while ( OSAtomicCompareAndSwapPtrBarrier(buffer->next, buffer, (void * volatile *)&_AQTraceBuffers) == false );
+    }
+
+    pthread_setspecific(_AQTraceBufferKey, buffer);
+    return ( buffer );
+}
+
+uint64_t AQHTTPTraceTimestamp(void)
+{
+    if ( _AQTraceSamplingInterval == 0 )
+        return ( 0 );
+    return ( mach_absolute_time() );
+}
+
+AQHTTPTraceID AQHTTPTraceBeginRequest(void)
+{
+    uint32_t interval = _AQTraceSamplingInterval;
+    if ( interval == 0 )
+        return ( 0 );
+
+    // the request's number doubles as its identifier
+    int64_t request = OSAtomicIncrement64(&_AQTraceRequestCount);
+    if ( request % interval != 0 )
+        return ( 0 );
+
+    return ( (AQHTTPTraceID)request );
+}
+
+void AQHTTPTraceRecordSpan(AQHTTPTraceID trace, const char * name, uint64_t start, uint64_t end)
+{
+    if ( trace == 0 || start == 0 || end < start )
+        return;
+
+    _AQTraceBuffer * buffer = _AQTraceBufferForCurrentThread();
+    if ( buffer == NULL )
+        return;
+
+    uint64_t thread = 0;
+    pthread_threadid_np(NULL, &thread);
+
+    OSSpinLockLock(&buffer->lock);
+    _AQTraceSpan * span = &buffer->spans[buffer->count % AQHTTPTraceBufferCapacity];
+    span->name = name;
+    span->trace = trace;
+    span->start = start;
+    span->end = end;
+    span->thread = thread;
+    buffer->count++;
+    OSSpinLockUnlock(&buffer->lock);
+}
+
+@implementation AQHTTPTrace
+
++ (void) setSamplingInterval: (NSUInteger) interval
+{
+    _AQTraceSamplingInterval = (uint32_t)MIN(interval, (NSUInteger)UINT32_MAX);
+    OSMemoryBarrier();
+}
+
++ (NSUInteger) samplingInterval
+{
+    return ( _AQTraceSamplingInterval );
+}
+
++ (NSData *) traceEventData
+{
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double microsecondsPerTick = ((double)timebase.numer / (double)timebase.denom) / 1000.0;
+
+    int pid = getpid();
+    NSMutableString * json = [NSMutableString stringWithString: @"{\"traceEvents\":["];
+    [json appendFormat: @"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%@\"}}", pid, [[NSProcessInfo processInfo] processName]];
+
+    // copy each buffer out so recording threads are held up only briefly
+    _AQTraceSpan * spans = malloc(sizeof(_AQTraceSpan) * AQHTTPTraceBufferCapacity);
+    for ( _AQTraceBuffer * buffer = _AQTraceBuffers; buffer != NULL; buffer = buffer->next )
+    {
+        OSSpinLockLock(&buffer->lock);
+        NSUInteger count = (NSUInteger)MIN(buffer->count, (uint64_t)AQHTTPTraceBufferCapacity);
+        memcpy(spans, buffer->spans, sizeof(_AQTraceSpan) * count);
+        OSSpinLockUnlock(&buffer->lock);
+
+        @autoreleasepool
+        {
+            for ( NSUInteger i = 0; i < count; i++ )
+            {
+                _AQTraceSpan * span = &spans[i];
+                [json appendFormat: @",{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%llu,\"args\":{\"request\":%llu}}",
+                 span->name, span->start * microsecondsPerTick, (span->end - span->start) * microsecondsPerTick, pid, span->thread, span->trace];
+            }
+        }
+    }
+    free(spans);
+
+    [json appendString: @"]}"];
+    return ( [json dataUsingEncoding: NSUTF8StringEncoding] );
+}
+
++ (BOOL) writeTraceEventsToFile: (NSString *) path error: (NSError **) error
+{
+    return ( [[self traceEventData] writeToFile: path options: NSDataWritingAtomic error: error] );
+}
+
++ (void) removeAllSpans
+{
+    for ( _AQTraceBuffer * buffer = _AQTraceBuffers; buffer != NULL; buffer = buffer->next )
+    {
+        OSSpinLockLock(&buffer->lock);
+        buffer->count = 0;
+        OSSpinLockUnlock(&buffer->lock);
+    }
+}
+
+@end
@@ -0,0 +1,72 @@
+//
+//  AQHTTPWorkerPool.h
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AQHTTPServer.h"
+
+/**
+ An AQHTTPWorkerPool runs a server's connections in a set of worker
+ processes, so that a stalled or crashed worker affects only its own clients.
+
+ The supervising process binds the listening sockets once, using an
+ AQHTTPServer which doesn't accept connections itself, and passes them to
+ each worker when it starts. The workers all accept connections on the same
+ sockets. A worker which exits unexpectedly is replaced, and each worker
+ reports its statistics to the supervisor once a second.
+
+ Workers are new instances of the current executable, launched with the
+ arguments given to the pool followed by `--worker` and a descriptor number,
+ which should be passed to +startWorkerServer:supervisorSocket:supervisorLostHandler:error:.
+ */
+@interface AQHTTPWorkerPool : NSObject
+
+/**
+ Initializes a worker pool.
+ @param server A listening server, whose sockets will be shared with the
+ workers. The pool stops the server from accepting connections itself.
+ @param arguments The command-line arguments for each worker process.
+ @result A new worker pool, which has no workers until -startWorkers: is called.
+ */
+- (id) initWithServer: (AQHTTPServer *) server workerArguments: (NSArray *) arguments;
+
+/**
+ Launches worker processes, keeping that many running until -stopWithCompletionHandler:
+ is called.
+ @param count The number of workers to run.
+ */
+- (void) startWorkers: (NSUInteger) count;
+
+/**
+ Asks each worker to finish its existing connections and exit, by sending it
+ `SIGTERM`. Workers are no longer replaced once this has been called.
+ @param completionHandler Called on the main queue once every worker has exited.
+ */
+- (void) stopWithCompletionHandler: (void (^)(void)) completionHandler;
+
+/**
+ The statistics reported by all the pool's workers, added together. Workers
+ which have exited contribute their final counts.
+ */
+@property (nonatomic, readonly) AQHTTPServerStatistics statistics;
+
+/**
+ Starts a server in a worker process, accepting connections on the listening
+ sockets of its pool's supervisor and reporting statistics to it.
+ @param server The server, which must not already be running.
+ @param supervisorSocket The descriptor given to the worker by its pool.
+ @param handler Called on the main queue should the supervisor exit.
+ @param error Upon failure, this value will point to an object describing
+ the underlying error. Can be `NULL`.
+ @result Returns YES if the server is now accepting connections.
+ */
++ (BOOL) startWorkerServer: (AQHTTPServer *) server
+          supervisorSocket: (int) supervisorSocket
+     supervisorLostHandler: (void (^)(void)) handler
+                     error: (NSError **) error;
+
+@end
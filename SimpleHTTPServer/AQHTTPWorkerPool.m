@@ -0,0 +1,443 @@
+//
+//  AQHTTPWorkerPool.m
+//  SimpleHTTPServer
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQHTTPWorkerPool.h"
+#import "AQHTTPServer_PrivateInternal.h"
+#import <spawn.h>
+#import <crt_externs.h>
+#import <fcntl.h>
+#import <sys/socket.h>
+#import <sys/wait.h>
+
+// a worker which exits sooner than this after launching is replaced only after the same delay, so a crashing worker can't spin
+#define AQHTTPWorkerMinimumLifetime     1.0
+
+#define AQHTTPWorkerReportInterval      (1 * NSEC_PER_SEC)
+
+// when a worker can't be launched at all (say, out of processes or descriptors), we try again after this long, doubling up to the maximum
+#define AQHTTPWorkerInitialLaunchBackoff    0.5
+#define AQHTTPWorkerMaximumLaunchBackoff    30.0
+
+@interface _AQHTTPWorker : NSObject
+{
+@public
+    pid_t                   _pid;
+    int                     _socket;
+    CFAbsoluteTime          _launchTime;
+    dispatch_source_t       _exitSource;
+    dispatch_source_t       _reportSource;
+
+    // the worker writes a byte once it's listening, and is killed if that takes too long
+    BOOL                    _acknowledged;
+    dispatch_source_t       _acknowledgementTimer;
+
+    // reports arrive as AQHTTPServerStatistics structures, possibly a piece at a time
+    AQHTTPServerStatistics  _statistics;
+    uint8_t                 _reportBuffer[sizeof(AQHTTPServerStatistics)];
+    size_t                  _reportLength;
+}
+@end
+
+@implementation _AQHTTPWorker
+
+- (void) dealloc
+{
+    if ( _reportSource != NULL )
+        dispatch_source_cancel(_reportSource);
+    if ( _exitSource != NULL )
+        dispatch_source_cancel(_exitSource);
+    if ( _acknowledgementTimer != NULL )
+        dispatch_source_cancel(_acknowledgementTimer);
+#if USING_MRR || DISPATCH_USES_ARC == 0
+    if ( _reportSource != NULL )
+        dispatch_release(_reportSource);
+    if ( _exitSource != NULL )
+        dispatch_release(_exitSource);
+    if ( _acknowledgementTimer != NULL )
+        dispatch_release(_acknowledgementTimer);
+#endif
+#if USING_MRR
+    [super dealloc];
+#endif
+}
+
+@end
+
+#pragma mark -
+
+@implementation AQHTTPWorkerPool
+{
+    AQHTTPServer *          _server;
+    NSArray *               _arguments;
+    NSMutableArray *        _workers;
+    NSUInteger              _workerCount;
+
+    BOOL                    _stopping;
+    dispatch_block_t        _stopCompletion;
+
+    NSTimeInterval          _launchBackoff;
+    BOOL                    _launchRetryScheduled;
+
+    // the final counts of workers which have exited
+    AQHTTPServerStatistics  _retiredStatistics;
+}
+
+- (id) initWithServer: (AQHTTPServer *) server workerArguments: (NSArray *) arguments
+{
+    self = [super init];
+    if ( self == nil )
+        return ( nil );
+
+#if USING_MRR
+    _server = [server retain];
+#else
+    _server = server;
+#endif
+    _arguments = [arguments copy];
+    _workers = [NSMutableArray new];
+    _launchBackoff = AQHTTPWorkerInitialLaunchBackoff;
+
+    // the workers accept connections; we just keep the sockets open for them
+    _server.acceptingConnections = NO;
+
+    return ( self );
+}
+
+#if USING_MRR
+- (void) dealloc
+{
+    [_server release];
+    [_arguments release];
+    [_workers release];
+    [_stopCompletion release];
+    [super dealloc];
+}
+#endif
+
+- (void) startWorkers: (NSUInteger) count
+{
+    _workerCount = count;
+    while ( [_workers count] < _workerCount )
+    {
+        if ( [self _launchWorker] == NO )
+        {
+            [self _retryLaunchingWorkers];
+            return;
+        }
+    }
+
+    _launchBackoff = AQHTTPWorkerInitialLaunchBackoff;
+}
+
+- (void) _retryLaunchingWorkers
+{
+    if ( _launchRetryScheduled )
+        return;
+
+    NSLog(@"Retrying in %g seconds", _launchBackoff);
+    _launchRetryScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_launchBackoff * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        _launchRetryScheduled = NO;
+        if ( _stopping == NO )
+            [self startWorkers: _workerCount];
+    });
+    _launchBackoff = MIN(_launchBackoff * 2.0, AQHTTPWorkerMaximumLaunchBackoff);
+}
+
+- (void) stopWithCompletionHandler: (void (^)(void)) completionHandler
+{
+    _stopping = YES;
+#if USING_MRR
+    [_stopCompletion release];
+#endif
+    _stopCompletion = [completionHandler copy];
+
+    if ( [_workers count] == 0 )
+    {
+        dispatch_async(dispatch_get_main_queue(), ^{ [self _finishStopping]; });
+        return;
+    }
+
+    for ( _AQHTTPWorker * worker in _workers )
+    {
+        kill(worker->_pid, SIGTERM);
+    }
+}
+
+- (AQHTTPServerStatistics) statistics
+{
+    AQHTTPServerStatistics stats = _retiredStatistics;
+    for ( _AQHTTPWorker * worker in _workers )
+    {
+        stats.connectionsAccepted += worker->_statistics.connectionsAccepted;
+        stats.requestsReceived += worker->_statistics.requestsReceived;
+        stats.openConnections += worker->_statistics.openConnections;
+    }
+
+    return ( stats );
+}
+
+- (void) _finishStopping
+{
+    if ( _stopCompletion == nil )
+        return;
+
+    dispatch_block_t completion = _stopCompletion;
+    _stopCompletion = nil;
+    completion();
+#if USING_MRR
+    [completion release];
+#endif
+}
+
+// returns NO if no worker process could be launched; one which launched but fails to start is replaced when it exits
+- (BOOL) _launchWorker
+{
+    int sockets[2];
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0 )
+    {
+        NSLog(@"Unable to create worker socket: %d (%s)", errno, strerror(errno));
+        return ( NO );
+    }
+
+    int nosigpipe = 1;
+    setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+
+    NSMutableArray * arguments = [_arguments mutableCopy];
+    [arguments addObject: @"--worker"];
+    [arguments addObject: [NSString stringWithFormat: @"%d", sockets[1]]];
+
+    const char * path = [[[NSBundle mainBundle] executablePath] fileSystemRepresentation];
+    char ** argv = calloc([arguments count] + 2, sizeof(char *));
+    argv[0] = (char *)path;
+    [arguments enumerateObjectsUsingBlock: ^(id obj, NSUInteger idx, BOOL *stop) {
+        argv[idx+1] = (char *)[obj UTF8String];
+    }];
+
+    // the worker gets only the standard descriptors and its end of the socket
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addinherit_np(&actions, STDIN_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, STDOUT_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, STDERR_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, sockets[1]);
+
+    pid_t pid = 0;
+    int err = posix_spawn(&pid, path, &actions, &attr, argv, *_NSGetEnviron());
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    free(argv);
+#if USING_MRR
+    [arguments release];
+#endif
+    close(sockets[1]);
+
+    if ( err != 0 )
+    {
+        NSLog(@"Unable to launch worker process: %d (%s)", err, strerror(err));
+        close(sockets[0]);
+        return ( NO );
+    }
+
+    _AQHTTPWorker * worker = [_AQHTTPWorker new];
+    worker->_pid = pid;
+    worker->_socket = sockets[0];
+    worker->_launchTime = CFAbsoluteTimeGetCurrent();
+    [_workers addObject: worker];
+#if USING_MRR
+    [worker release];
+#endif
+
+    AQHTTPWorkerPool * __maybe_weak weakSelf = self;
+    _AQHTTPWorker * __maybe_weak weakWorker = worker;
+
+    worker->_exitSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC, pid, DISPATCH_PROC_EXIT, dispatch_get_main_queue());
+    dispatch_source_set_event_handler(worker->_exitSource, ^{
+        [weakSelf _workerExited: weakWorker];
+    });
+    dispatch_resume(worker->_exitSource);
+
+    // the worker waits for the listening sockets before it does anything else
+    NSError * error = nil;
+    if ( [_server _sendListeningSocketsOverSocket: sockets[0] transferringOwnership: NO error: &error] == NO )
+    {
+        // it'll be replaced once it has gone
+        NSLog(@"Worker %d did not start: %@", pid, error);
+        kill(pid, SIGKILL);
+        return ( YES );
+    }
+
+    int flags = fcntl(sockets[0], F_GETFL, 0);
+    fcntl(sockets[0], F_SETFL, flags | O_NONBLOCK);
+
+    // we don't wait here for the worker to say it's listening: its acknowledgement arrives ahead of its reports
+    worker->_acknowledgementTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    dispatch_source_set_timer(worker->_acknowledgementTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)AQHTTPHandoffAcknowledgementTimeout * NSEC_PER_SEC), DISPATCH_TIME_FOREVER, NSEC_PER_SEC / 10);
+    dispatch_source_set_event_handler(worker->_acknowledgementTimer, ^{
+        _AQHTTPWorker * strongWorker = weakWorker;
+        dispatch_source_cancel(strongWorker->_acknowledgementTimer);
+        if ( strongWorker->_acknowledged == NO )
+        {
+            NSLog(@"Worker %d did not start listening within %d seconds", strongWorker->_pid, AQHTTPHandoffAcknowledgementTimeout);
+            kill(strongWorker->_pid, SIGKILL);
+        }
+    });
+    dispatch_resume(worker->_acknowledgementTimer);
+
+    int fd = sockets[0];
+    worker->_reportSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, dispatch_get_main_queue());
+    dispatch_source_set_event_handler(worker->_reportSource, ^{
+        _AQHTTPWorker * strongWorker = weakWorker;
+        uint8_t ack = 0;
+        ssize_t numRead;
+        if ( strongWorker->_acknowledged == NO )
+        {
+            numRead = read(fd, &ack, 1);
+            if ( numRead == 1 )
+            {
+                strongWorker->_acknowledged = YES;
+                dispatch_source_cancel(strongWorker->_acknowledgementTimer);
+                return;     // any report which followed it fires the source again
+            }
+        }
+        else
+        {
+            size_t wanted = sizeof(strongWorker->_reportBuffer) - strongWorker->_reportLength;
+            numRead = read(fd, strongWorker->_reportBuffer + strongWorker->_reportLength, wanted);
+            if ( numRead > 0 )
+            {
+                strongWorker->_reportLength += numRead;
+                if ( strongWorker->_reportLength == sizeof(strongWorker->_reportBuffer) )
+                {
+                    memcpy(&strongWorker->_statistics, strongWorker->_reportBuffer, sizeof(AQHTTPServerStatistics));
+                    strongWorker->_reportLength = 0;
+                }
+                return;
+            }
+        }
+
+        if ( numRead == 0 || (errno != EAGAIN && errno != EINTR) )
+        {
+            // the worker has gone; its exit source takes care of the rest
+            dispatch_source_cancel(strongWorker->_reportSource);
+        }
+    });
+    dispatch_source_set_cancel_handler(worker->_reportSource, ^{
+        close(fd);
+    });
+    dispatch_resume(worker->_reportSource);
+
+    return ( YES );
+}
+
+- (void) _workerExited: (_AQHTTPWorker *) worker
+{
+    if ( worker == nil )
+        return;
+
+    int status = 0;
+    waitpid(worker->_pid, &status, 0);
+
+    if ( WIFSIGNALED(status) && (_stopping == NO || WTERMSIG(status) != SIGTERM) )
+        NSLog(@"Worker %d was terminated by signal %d", worker->_pid, WTERMSIG(status));
+    else if ( WIFEXITED(status) && WEXITSTATUS(status) != 0 )
+        NSLog(@"Worker %d exited with status %d", worker->_pid, WEXITSTATUS(status));
+
+    // the worker's connections closed with it, but what it did still counts
+    _retiredStatistics.connectionsAccepted += worker->_statistics.connectionsAccepted;
+    _retiredStatistics.requestsReceived += worker->_statistics.requestsReceived;
+
+    // the report source closes the socket if it was ever created
+    if ( worker->_reportSource == NULL )
+        close(worker->_socket);
+
+    CFAbsoluteTime lifetime = CFAbsoluteTimeGetCurrent() - worker->_launchTime;
+    [_workers removeObjectIdenticalTo: worker];
+
+    if ( _stopping )
+    {
+        if ( [_workers count] == 0 )
+            [self _finishStopping];
+        return;
+    }
+
+    if ( lifetime >= AQHTTPWorkerMinimumLifetime )
+    {
+        [self startWorkers: _workerCount];
+        return;
+    }
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(AQHTTPWorkerMinimumLifetime * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        if ( _stopping == NO )
+            [self startWorkers: _workerCount];
+    });
+}
+
+#pragma mark - Worker Side
+
+static dispatch_source_t __workerReportTimer = NULL;
+static dispatch_source_t __workerSupervisorSource = NULL;
+
++ (BOOL) startWorkerServer: (AQHTTPServer *) server
+          supervisorSocket: (int) supervisorSocket
+     supervisorLostHandler: (void (^)(void)) handler
+                     error: (NSError **) error
+{
+    if ( [server startWithListeningSocketsFromSocket: supervisorSocket error: error] == NO )
+        return ( NO );
+
+    int nosigpipe = 1;
+    setsockopt(supervisorSocket, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+
+    // the supervisor reads reports back to back from the stream, so one only partly sent (should its
+    // buffer fill up) has to be finished before the next is started
+    __block AQHTTPServerStatistics report;
+    __block size_t reportSent = sizeof(report);
+    __workerReportTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    dispatch_source_set_timer(__workerReportTimer, dispatch_time(DISPATCH_TIME_NOW, AQHTTPWorkerReportInterval), AQHTTPWorkerReportInterval, AQHTTPWorkerReportInterval / 10);
+    dispatch_source_set_event_handler(__workerReportTimer, ^{
+        if ( reportSent == sizeof(report) )
+        {
+            report = server.statistics;
+            reportSent = 0;
+        }
+
+        ssize_t numSent = send(supervisorSocket, (const uint8_t *)&report + reportSent, sizeof(report) - reportSent, MSG_DONTWAIT);
+        if ( numSent > 0 )
+            reportSent += numSent;
+        else if ( numSent < 0 && errno != EAGAIN && errno != EINTR )
+            dispatch_source_cancel(__workerReportTimer);
+    });
+    dispatch_resume(__workerReportTimer);
+
+    // the supervisor never sends us anything, so the socket only becomes readable when it closes
+    void (^handlerCopy)(void) = [handler copy];
+    __workerSupervisorSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, supervisorSocket, 0, dispatch_get_main_queue());
+    dispatch_source_set_event_handler(__workerSupervisorSource, ^{
+        dispatch_source_cancel(__workerSupervisorSource);
+        dispatch_source_cancel(__workerReportTimer);
+        if ( handlerCopy != nil )
+            handlerCopy();
+    });
+    dispatch_source_set_cancel_handler(__workerSupervisorSource, ^{
+        close(supervisorSocket);
+    });
+    dispatch_resume(__workerSupervisorSource);
+#if USING_MRR
+    [handlerCopy release];
+#endif
+
+    return ( YES );
+}
+
+@end
@@ -94,12 +94,71 @@ typedef void (^AQSocketEventHandler)(AQSocketEvent event, id info);
  */
 - (id) init;
 
+/**
+ Initializes a socket which accepts connections on an existing listening
+ socket, such as one inherited from another process. The new instance takes
+ ownership of the descriptor, and will close it when the socket is closed.
+ @param nativeSocket A socket which is already bound and listening.
+ @result A new AQSocket instance with a status of `AQSocketListening`.
+ */
+- (id) initWithListeningSocket: (CFSocketNativeHandle) nativeSocket;
+
 /** @name Properties */
 
 /// The event handler for this socket. Must be set non-zero before the socket can
 /// be connected or otherwise used. See AQSocketEventHandler for more discussion.
 @property (nonatomic, copy) AQSocketEventHandler eventHandler;
 
+/** @name TLS */
+
+/**
+ The certificates used to secure connections accepted by a listening socket.
+ 
+ When set on a listening socket, every connection it subsequently accepts runs
+ the server side of a TLS session. The handshake happens in the background:
+ the accepted socket's event handler only ever sees decrypted data, and writes
+ made before the handshake completes are sent once it does. This has no effect
+ on sockets created using the connect methods.
+ 
+ The array is in the form expected by SSLSetCertificate(): a SecIdentityRef
+ followed by any intermediate SecCertificateRefs. Requires OS X 10.8 or later.
+ @see TLSCertificatesWithPKCS12Data:passphrase:error:
+ */
+@property (nonatomic, copy) NSArray * TLSCertificates;
+
+/**
+ The ALPN protocol names offered by connections accepted by a listening socket,
+ in order of preference, e.g. `@"h2"` and `@"http/1.1"`. Ignored where the
+ system doesn't support ALPN.
+ */
+@property (nonatomic, copy) NSArray * TLSApplicationProtocols;
+
+/**
+ Returns `YES` if data sent and received by this socket is encrypted using TLS.
+ */
+@property (nonatomic, readonly, getter=isSecure) BOOL secure;
+
+/**
+ For a secure connected socket, the ALPN protocol agreed with the peer during
+ the TLS handshake. Returns `nil` if no protocol was agreed, or the handshake
+ has not yet completed.
+ */
+@property (nonatomic, readonly) NSString * negotiatedApplicationProtocol;
+
+/**
+ Loads a server identity and its certificate chain from a PKCS#12 archive,
+ in a form suitable for the TLSCertificates property.
+ @param data The contents of a PKCS#12 (.p12) file.
+ @param passphrase The passphrase protecting the archive.
+ @param error If this method returns `nil`, then on return this value contains
+ an NSError object detailing the error.
+ @result An array containing a SecIdentityRef followed by any other certificates
+ in its chain, or `nil` on failure.
+ */
++ (NSArray *) TLSCertificatesWithPKCS12Data: (NSData *) data
+                                 passphrase: (NSString *) passphrase
+                                      error: (NSError **) error;
+
 /** @name Connections */
 
 /**
@@ -118,7 +177,7 @@ typedef void (^AQSocketEventHandler)(AQSocketEvent event, id info);
 
 /**
  Binds a listening (server-side) socket to the supplied socket address. This is a synchronous
- operation.
+ operation. The address may be an IPv4, IPv6 or Unix-domain (`AF_UNIX`) address.
  @param saddr A socket address structure containing a local address to which to bind.
  @param error If this method returns `NO`, then on return this value contains an
  NSError object detailing the error.
@@ -207,6 +266,12 @@ typedef void (^AQSocketEventHandler)(AQSocketEvent event, id info);
  */
 @property (nonatomic, readonly) uint16_t port;
 
+/**
+ Returns the socket's file descriptor while it is listening or connected, and
+ `-1` otherwise. The descriptor remains owned by the receiver.
+ */
+@property (nonatomic, readonly) CFSocketNativeHandle nativeHandle;
+
 /** @name Data Transmission */
 
 /** 
@@ -222,12 +287,100 @@ typedef void (^AQSocketEventHandler)(AQSocketEvent event, id info);
  the eventHandler callback block property, only by the `completionHandler` passed
  to this method.
  
+ The data is not copied, so a mutable data object must not be modified until
+ the completion handler has been called. Writes are not limited in size or
+ number, so callers which produce a lot of output should observe the
+ socket's water marks; see -notifyWhenWritable:.
+ 
  @param bytes The data to write on the socket.
  @param completionHandler A callback method to invoke upon write completion or error.
+ If the socket is not connected, this is called with an `ENOTCONN` error.
  
  @exception NSInternalInconsistencyException If the socket is not connected, or is a server-side listening socket.
  */
 - (void) writeBytes: (NSData *) bytes
          completion: (void (^)(NSData * unwritten, NSError * error)) completionHandler;
 
+/** @name Write Flow Control */
+
+/**
+ The number of bytes passed to -writeBytes:completion: which have not yet
+ been written to the socket.
+ */
+@property (nonatomic, readonly) NSUInteger queuedWriteByteCount;
+
+/**
+ Once this many bytes are queued for writing, the socket stops being
+ writable until its queue drains to the writeLowWaterMark. Defaults to 256KB.
+ */
+@property (nonatomic, assign) NSUInteger writeHighWaterMark;
+
+/**
+ The number of queued bytes at or below which a socket that reached its
+ writeHighWaterMark becomes writable again. Defaults to 64KB.
+ */
+@property (nonatomic, assign) NSUInteger writeLowWaterMark;
+
+/**
+ If no queued write completes within this many seconds, the client is
+ assumed to have stopped reading, and the connection is shut down. Any
+ pending writes then fail, and the event handler receives
+ `AQSocketEventDisconnected`. Defaults to 60 seconds; zero disables the
+ check.
+ */
+@property (nonatomic, assign) NSTimeInterval writeStallTimeout;
+
+/**
+ Returns `NO` from the time the socket's queued output reaches its
+ writeHighWaterMark until it drains to its writeLowWaterMark.
+ */
+@property (nonatomic, readonly, getter=isWritable) BOOL writable;
+
+/**
+ Calls a handler once the socket is ready for more output.
+ 
+ Anything producing output faster than the peer can receive it should wait
+ for this between writes, so its output is held by the peer and the kernel
+ rather than in memory.
+ @param handler Called with `YES` once the socket is writable, which may be
+ before this method returns, or with `NO` if the socket is closed first.
+ Unless it is called before this method returns, the handler runs on an
+ arbitrary queue.
+ */
+- (void) notifyWhenWritable: (void (^)(BOOL writable)) handler;
+
+/**
+ Blocks the calling thread until the socket is ready for more output, as
+ signalled by -notifyWhenWritable:. Must not be called on a queue the
+ socket's own writes complete on.
+ @result Returns `YES` once the socket is writable, or `NO` if the socket is
+ closed first.
+ */
+- (BOOL) waitUntilWritable;
+
+/** @name Flow Control */
+
+/**
+ Stops reading from a connected socket. No further AQSocketEventDataAvailable
+ events will be delivered until -resumeReading is called, and once the
+ system's receive buffer fills the peer will be unable to send any more.
+ 
+ This allows a consumer which can't keep up with its input to push back on
+ the sender, rather than buffering everything in memory.
+ 
+ On a connected socket calls nest: each must be balanced by a call to
+ -resumeReading, and reading resumes only once all of them have been, so
+ several consumers can each hold the input back independently.
+ 
+ On a listening socket, this stops accepting new connections, which wait in
+ the socket's backlog (or are accepted by another process sharing the socket).
+ Calls there do not nest.
+ */
+- (void) suspendReading;
+
+/**
+ Resumes reading from a socket previously passed to -suspendReading.
+ */
+- (void) resumeReading;
+
 @end
@@ -37,11 +37,14 @@
 #import "AQSocketReader.h"
 #import "AQSocketReader+PrivateInternal.h"
 #import "AQSocketIOChannel.h"
+#import "AQSocketTLSIOChannel.h"
 #import <libkern/OSAtomic.h>
 #import <sys/socket.h>
 #import <netinet/in.h>
 #import <arpa/inet.h>
 #import <netdb.h>
+#import <sys/un.h>
+#import <fcntl.h>
 #import <syslog.h>
 
 // See -connectToAddress:port:error: for discussion.
@@ -72,6 +75,11 @@ static NSString * __EventTrackingRunLoopMode()
 
 #define LISTEN_WITH_CFSOCKET 0
 
+// Output queued beyond the high water mark makes a socket unwritable until it drains to the low water mark.
+#define AQSocketDefaultWriteHighWaterMark   (256 * 1024)
+#define AQSocketDefaultWriteLowWaterMark    (64 * 1024)
+#define AQSocketDefaultWriteStallTimeout    60.0
+
 @interface AQSocket (CFSocketConnectionCallback)
 - (void) connectedSuccessfully;
 - (void) connectionFailedWithError: (SInt32) err;
@@ -254,13 +262,59 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     CFSocketRef             _socketRef;
     dispatch_source_t       _listenSource;
     CFSocketNativeHandle    _rawSocket;
+    BOOL                    _listenSuspended;
     CFRunLoopSourceRef      _socketRunloopSource;
     dispatch_semaphore_t    _sync;
     AQSocketIOChannel *     _socketIO;
     AQSocketReader *        _socketReader;
+    NSArray *               _tlsCertificates;
+    NSArray *               _tlsProtocols;
+    
+    // output accounting, guarded by _writeQ
+    dispatch_queue_t        _writeQ;
+    NSUInteger              _queuedWriteBytes;
+    NSUInteger              _writeHighWaterMark;
+    NSUInteger              _writeLowWaterMark;
+    NSTimeInterval          _writeStallTimeout;
+    NSTimeInterval          _lastWriteProgress;
+    BOOL                    _writeBlocked;
+    BOOL                    _writeStallCheckPending;
+    NSMutableArray *        _writableHandlers;
 }
 
-@synthesize eventHandler, status=_status;
+@synthesize eventHandler, status=_status, TLSCertificates=_tlsCertificates, TLSApplicationProtocols=_tlsProtocols;
+@synthesize writeHighWaterMark=_writeHighWaterMark, writeLowWaterMark=_writeLowWaterMark, writeStallTimeout=_writeStallTimeout;
+
++ (NSArray *) TLSCertificatesWithPKCS12Data: (NSData *) data
+                                 passphrase: (NSString *) passphrase
+                                      error: (NSError **) error
+{
+    NSDictionary * options = [NSDictionary dictionaryWithObject: (passphrase != nil ? passphrase : @"") forKey: (__bridge id)kSecImportExportPassphrase];
+    CFArrayRef items = NULL;
+    OSStatus err = SecPKCS12Import((__bridge CFDataRef)data, (__bridge CFDictionaryRef)options, &items);
+    if ( err != noErr || items == NULL || CFArrayGetCount(items) == 0 )
+    {
+        if ( error != NULL )
+            *error = [NSError errorWithDomain: NSOSStatusErrorDomain code: (err != noErr ? err : errSecItemNotFound) userInfo: nil];
+        if ( items != NULL )
+            CFRelease(items);
+        return ( nil );
+    }
+    
+    // we use the first identity in the archive
+    NSDictionary * item = (__bridge NSDictionary *)CFArrayGetValueAtIndex(items, 0);
+    id identity = [item objectForKey: (__bridge id)kSecImportItemIdentity];
+    NSArray * chain = [item objectForKey: (__bridge id)kSecImportItemCertChain];
+    
+    NSMutableArray * result = [NSMutableArray arrayWithObject: identity];
+    
+    // the chain begins with the identity's own certificate, which mustn't be repeated
+    if ( [chain count] > 1 )
+        [result addObjectsFromArray: [chain subarrayWithRange: NSMakeRange(1, [chain count] - 1)]];
+    
+    CFRelease(items);
+    return ( result );
+}
 
 - (id) initWithSocketType: (int) type
 {
@@ -277,6 +331,12 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     // gets created with zero resources available. Will be signalled when socket becomes available for use.
     _sync = dispatch_semaphore_create(0);
     
+    _writeQ = dispatch_queue_create("me.alanquatermain.AQSocket.write", DISPATCH_QUEUE_SERIAL);
+    _writeHighWaterMark = AQSocketDefaultWriteHighWaterMark;
+    _writeLowWaterMark = AQSocketDefaultWriteLowWaterMark;
+    _writeStallTimeout = AQSocketDefaultWriteStallTimeout;
+    _writableHandlers = [NSMutableArray new];
+    
     return ( self );
 }
 
@@ -286,6 +346,11 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
 }
 
 - (id) initWithConnectedSocket: (CFSocketNativeHandle) nativeSocket
+{
+    return ( [self initWithConnectedSocket: nativeSocket TLSCertificates: nil applicationProtocols: nil] );
+}
+
+- (id) initWithConnectedSocket: (CFSocketNativeHandle) nativeSocket TLSCertificates: (NSArray *) certificates applicationProtocols: (NSArray *) protocols
 {
     int socktype = SOCK_STREAM;
     socklen_t len = 0;
@@ -302,6 +367,8 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     //CFSocketContext ctx = { 0, (__bridge void *)self, NULL, NULL, CFCopyDescription };
     //_socketRef = CFSocketCreateWithNative(kCFAllocatorDefault, nativeSocket, 0, NULL, &ctx);
     _rawSocket = nativeSocket;
+    _tlsCertificates = [certificates copy];
+    _tlsProtocols = [protocols copy];
     [self connectedSuccessfully];       // setup the io channel for data notifications etc.
     
     return ( self );
@@ -333,7 +400,12 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     }
     
     if ( _listenSource != NULL )
+    {
+        // a suspended source would never run its cancel handler
+        if ( _listenSuspended )
+            dispatch_resume(_listenSource);
         dispatch_source_cancel(_listenSource);
+    }
     
 #if USING_MRR || DISPATCH_USES_ARC == 0
     if ( _sync != NULL )
@@ -346,13 +418,87 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
         dispatch_release(_listenSource);
         _listenSource = NULL;
     }
+    if ( _writeQ != NULL )
+    {
+        dispatch_release(_writeQ);
+        _writeQ = NULL;
+    }
 #endif
 #if USING_MRR
+    [_writableHandlers release];
     [_socketReader release];
+    [_tlsCertificates release];
+    [_tlsProtocols release];
     [super dealloc];
 #endif
 }
 
+- (id) initWithListeningSocket: (CFSocketNativeHandle) nativeSocket
+{
+    int socktype = SOCK_STREAM;
+    socklen_t len = sizeof(socktype);
+    
+    getsockopt(nativeSocket, SOL_SOCKET, SO_TYPE, &socktype, &len);
+    self = [self initWithSocketType: socktype];
+    if ( self == nil )
+        return ( nil );
+    
+    _rawSocket = nativeSocket;
+    [self _acceptConnectionsOnNativeSocket: nativeSocket];
+    _status = AQSocketListening;
+    
+    return ( self );
+}
+
+- (void) _acceptConnectionsOnNativeSocket: (CFSocketNativeHandle) nativeSocket
+{
+    // the socket may be shared with other processes, any of which might accept a connection before we do
+    int flags = fcntl(nativeSocket, F_GETFL, 0);
+    fcntl(nativeSocket, F_SETFL, flags | O_NONBLOCK);
+    
+    _listenSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, nativeSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+    dispatch_debug(_listenSource, "listen source creation");
+    
+    AQSocket * __maybe_weak weakSelf = self;
+    dispatch_source_set_event_handler(_listenSource, ^{
+        AQSocket * strongSelf = weakSelf;
+        int clientSock = accept(nativeSocket, NULL, NULL);
+        if ( clientSock < 0 )
+        {
+            // someone else got there first, or the client gave up waiting
+            if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED )
+                return;
+            
+            NSError * err = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
+            NSLog(@"%@ failed to accept new connection: %@", strongSelf, err);
+            return;
+        }
+        
+        // accepted sockets inherit O_NONBLOCK from the listener, but the I/O channels expect blocking sockets
+        int clientFlags = fcntl(clientSock, F_GETFL, 0);
+        fcntl(clientSock, F_SETFL, clientFlags & ~O_NONBLOCK);
+        
+        [strongSelf acceptNewConnection: clientSock];
+    });
+    
+    // The descriptor may only be closed once the source is done with it. Listening sockets have no other
+    // use for the sync semaphore, so -close waits on it to be sure the descriptor can't be reused under us.
+    dispatch_semaphore_t cancelled = _sync;
+#if DISPATCH_USES_ARC == 0
+    dispatch_retain(cancelled);
+#endif
+    dispatch_source_set_cancel_handler(_listenSource, ^{
+        close(nativeSocket);
+        dispatch_semaphore_signal(cancelled);
+#if DISPATCH_USES_ARC == 0
+        dispatch_release(cancelled);
+#endif
+    });
+    
+    dispatch_resume(_listenSource);
+    dispatch_debug(_listenSource, "listen source resumption");
+}
+
 - (BOOL) listenOnAddress: (struct sockaddr *) saddr
                    error: (NSError **) error
 {
@@ -367,7 +513,9 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
         .copyDescription = CFCopyDescription
     };
     
-    _socketRef = CFSocketCreate(kCFAllocatorDefault, saddr->sa_family, _socketType, _socketProtocol, kCFSocketAcceptCallBack, _CFSocketAcceptCallBack, &ctx);
+    // Unix-domain sockets take no protocol
+    int protocol = (saddr->sa_family == AF_UNIX ? 0 : _socketProtocol);
+    _socketRef = CFSocketCreate(kCFAllocatorDefault, saddr->sa_family, _socketType, protocol, kCFSocketAcceptCallBack, _CFSocketAcceptCallBack, &ctx);
     if ( _socketRef == NULL )
     {
         // We failed to create the socket, so build an error (if appropriate)
@@ -411,7 +559,8 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     if ( sockErr != kCFSocketSuccess )
         return ( NO );
 #else
-    _rawSocket = socket(saddr->sa_family, _socketType, _socketProtocol);
+    // Unix-domain sockets take no protocol
+    _rawSocket = socket(saddr->sa_family, _socketType, (saddr->sa_family == AF_UNIX ? 0 : _socketProtocol));
     if ( _rawSocket < 0 )
     {
         NSError * err = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
@@ -446,40 +595,27 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     }
     
     listen(_rawSocket, 16);
-    _listenSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, _rawSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
-    dispatch_debug(_listenSource, "listen source creation");
-    
-    AQSocket * __maybe_weak weakSelf = self;
-    dispatch_source_set_event_handler(_listenSource, ^{
-        AQSocket * strongSelf = weakSelf;
-        int lfd = (int)dispatch_source_get_handle(_listenSource);
-        int clientSock = accept(lfd, NULL, NULL);
-        if ( clientSock < 0 )
-        {
-            NSError * err = [NSError errorWithDomain: NSPOSIXErrorDomain code: errno userInfo: nil];
-            NSLog(@"%@ failed to accept new connection: %@", strongSelf, err);
-            return;
-        }
-        
-        [strongSelf acceptNewConnection: clientSock];
-    });
-    
-    dispatch_resume(_listenSource);
-    dispatch_debug(_listenSource, "listen source resumption");
+    [self _acceptConnectionsOnNativeSocket: _rawSocket];
 #endif
     
+#if DEBUGLOG
     // Find out what port we were assigned.
     struct sockaddr_storage myAddr = {0};
     socklen_t slen = sizeof(struct sockaddr_storage);
     getsockname(_rawSocket, (struct sockaddr *)&myAddr, &slen);
     
-    char addrStr[INET6_ADDRSTRLEN];
-    struct sockaddr_in *pIn4 = (struct sockaddr_in *)&myAddr;
-    struct sockaddr_in6 *pIn6 = (struct sockaddr_in6 *)&myAddr;
-    inet_ntop(myAddr.ss_family, (myAddr.ss_family == AF_INET ? (void *)&pIn4->sin_addr : (void *)&pIn6->sin6_addr), addrStr, INET6_ADDRSTRLEN);
-    
-#if DEBUGLOG
-    NSLog(@"Listening on %s:%hu", addrStr, (in_port_t)(myAddr.ss_family == AF_INET ? ntohs(pIn4->sin_port) : ntohs(pIn6->sin6_port)));
+    if ( myAddr.ss_family == AF_UNIX )
+    {
+        NSLog(@"Listening on %s", ((struct sockaddr_un *)&myAddr)->sun_path);
+    }
+    else
+    {
+        char addrStr[INET6_ADDRSTRLEN];
+        struct sockaddr_in *pIn4 = (struct sockaddr_in *)&myAddr;
+        struct sockaddr_in6 *pIn6 = (struct sockaddr_in6 *)&myAddr;
+        inet_ntop(myAddr.ss_family, (myAddr.ss_family == AF_INET ? (void *)&pIn4->sin_addr : (void *)&pIn6->sin6_addr), addrStr, INET6_ADDRSTRLEN);
+        NSLog(@"Listening on %s:%hu", addrStr, (in_port_t)(myAddr.ss_family == AF_INET ? ntohs(pIn4->sin_port) : ntohs(pIn6->sin6_port)));
+    }
 #endif
     
     // Record the change in status.
@@ -723,6 +859,23 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
 
 - (void) close
 {
+    if ( _status == AQSocketListening && _listenSource != NULL )
+    {
+        // listening sockets have no I/O channel: cancelling the source closes the descriptor
+        if ( _listenSuspended )
+            dispatch_resume(_listenSource);
+        _listenSuspended = NO;
+        dispatch_source_cancel(_listenSource);
+        dispatch_semaphore_wait(_sync, DISPATCH_TIME_FOREVER);
+#if USING_MRR || DISPATCH_USES_ARC == 0
+        dispatch_release(_listenSource);
+#endif
+        _listenSource = NULL;
+        _rawSocket = -1;
+        _status = AQSocketUnconnected;
+        return;
+    }
+    
     if ( _socketIO == nil )
         return;
     
@@ -752,6 +905,7 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     
     if ( _rawSocket != -1 )
         close(_rawSocket);
+    _rawSocket = -1;
     
     // We set 'disconnected' state if we close because of a connection reset or broken pipe, etc.
     // If that isn't set, then this is considered a voluntary disconnect, so we mark the socket
@@ -759,6 +913,9 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     if ( _status != AQSocketDisconnected )
         _status = AQSocketUnconnected;
     
+    // nothing waiting for output space is going to get it now
+    [self _notifyWritableHandlers: NO];
+    
     // NB: we do NOT release the socket resource because it's gone now; it'll be released (if recreated) later.
 }
 
@@ -799,29 +956,257 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     return ( port );
 }
 
+- (CFSocketNativeHandle) nativeHandle
+{
+    if ( _status != AQSocketListening && _status != AQSocketConnected )
+        return ( -1 );
+    
+    return ( _rawSocket );
+}
+
+- (void) _failWrite: (NSData *) bytes completion: (void (^)(NSData *, NSError *)) completionHandler
+{
+    if ( completionHandler == nil )
+        return;
+    
+    // the caller may be waiting on the completion handler, so it runs asynchronously like any other
+    void (^completionCopy)(NSData *, NSError *) = [completionHandler copy];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        completionCopy(bytes, [NSError errorWithDomain: NSPOSIXErrorDomain code: ENOTCONN userInfo: nil]);
+    });
+#if USING_MRR
+    [completionCopy release];
+#endif
+}
+
 - (void) writeBytes: (NSData *) bytes
          completion: (void (^)(NSData *, NSError *)) completionHandler
 {
     NSParameterAssert([bytes length] != 0);
     if ( _status != AQSocketConnected )
+    {
+        [self _failWrite: bytes completion: completionHandler];
         return;
+    }
     
     // claim the socket resource
     if ( dispatch_semaphore_wait(_sync, dispatch_time(DISPATCH_TIME_NOW, 1 * NSEC_PER_SEC)) != 0 )
-        return;     // timed out, which means we've got no socket any more
+    {
+        // timed out, which means we've got no socket any more
+        [self _failWrite: bytes completion: completionHandler];
+        return;
+    }
     
     if ( _socketIO == nil )
     {
         [NSException raise: NSInternalInconsistencyException format: @"-[%@ %@]: socket is not connected.", NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
     }
     
+    NSUInteger length = [bytes length];
+    dispatch_sync(_writeQ, ^{
+        if ( _queuedWriteBytes == 0 )
+            _lastWriteProgress = [NSDate timeIntervalSinceReferenceDate];
+        _queuedWriteBytes += length;
+        if ( _queuedWriteBytes >= _writeHighWaterMark )
+            _writeBlocked = YES;
+        [self _scheduleWriteStallCheckAfter: _writeStallTimeout];
+    });
+    
     // Pass the write along to our IO channel, along with the completion/unsent handler.
-    [_socketIO writeData: bytes withCompletion: completionHandler];
+    // The bytes are accounted for before the caller hears about them, so it sees an up-to-date queue.
+    void (^completionCopy)(NSData *, NSError *) = [completionHandler copy];
+    [_socketIO writeData: bytes withCompletion: ^(NSData *unwritten, NSError *error) {
+        [self _completedWriteOfLength: length];
+        if ( completionCopy != nil )
+            completionCopy(unwritten, error);
+    }];
+#if USING_MRR
+    [completionCopy release];
+#endif
     
     // reopen the resource for others
     dispatch_semaphore_signal(_sync);
 }
 
+- (void) _completedWriteOfLength: (NSUInteger) length
+{
+    __block BOOL nowWritable = NO;
+    dispatch_sync(_writeQ, ^{
+        _queuedWriteBytes -= length;
+        _lastWriteProgress = [NSDate timeIntervalSinceReferenceDate];
+        if ( _writeBlocked && _queuedWriteBytes <= _writeLowWaterMark )
+        {
+            _writeBlocked = NO;
+            nowWritable = YES;
+        }
+    });
+    
+    if ( nowWritable )
+        [self _notifyWritableHandlers: YES];
+}
+
+- (void) _notifyWritableHandlers: (BOOL) writable
+{
+    __block NSArray * handlers = nil;
+    dispatch_sync(_writeQ, ^{
+        if ( [_writableHandlers count] == 0 )
+            return;
+        handlers = [_writableHandlers copy];
+        [_writableHandlers removeAllObjects];
+    });
+    
+    // the handlers may well write more, so they're called outside the queue
+    for ( void (^handler)(BOOL) in handlers )
+    {
+        handler(writable);
+    }
+#if USING_MRR
+    [handlers release];
+#endif
+}
+
+// must be called on _writeQ
+- (void) _scheduleWriteStallCheckAfter: (NSTimeInterval) delay
+{
+    if ( _writeStallCheckPending || _writeStallTimeout <= 0.0 )
+        return;
+    
+    _writeStallCheckPending = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _writeQ, ^{
+        _writeStallCheckPending = NO;
+        if ( _queuedWriteBytes == 0 )
+            return;
+        
+        NSTimeInterval stalled = [NSDate timeIntervalSinceReferenceDate] - _lastWriteProgress;
+        if ( stalled < _writeStallTimeout )
+        {
+            [self _scheduleWriteStallCheckAfter: _writeStallTimeout - stalled];
+            return;
+        }
+        
+#if DEBUGLOG
+        NSLog(@"Socket %@ has made no progress on %lu queued bytes in %.0f seconds; shutting it down.", self, (unsigned long)_queuedWriteBytes, stalled);
+#endif
+        // This wakes any write waiting for buffer space, which then fails. The reader sees the end
+        // of its input, and the socket is closed in the usual way.
+        if ( _status == AQSocketConnected && _rawSocket != -1 )
+            shutdown(_rawSocket, SHUT_RDWR);
+    });
+}
+
+- (NSUInteger) queuedWriteByteCount
+{
+    __block NSUInteger count = 0;
+    dispatch_sync(_writeQ, ^{
+        count = _queuedWriteBytes;
+    });
+    return ( count );
+}
+
+- (BOOL) isWritable
+{
+    __block BOOL writable = NO;
+    dispatch_sync(_writeQ, ^{
+        writable = (_writeBlocked == NO);
+    });
+    return ( writable );
+}
+
+- (void) notifyWhenWritable: (void (^)(BOOL)) handler
+{
+    __block BOOL wait = NO;
+    dispatch_sync(_writeQ, ^{
+        if ( _writeBlocked == NO || _status != AQSocketConnected )
+            return;
+        
+        void (^handlerCopy)(BOOL) = [handler copy];
+        [_writableHandlers addObject: handlerCopy];
+#if USING_MRR
+        [handlerCopy release];
+#endif
+        wait = YES;
+    });
+    
+    if ( wait == NO )
+        handler(_status == AQSocketConnected);
+}
+
+- (BOOL) waitUntilWritable
+{
+    if ( self.writable )
+        return ( YES );
+    
+    __block BOOL writable = NO;
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [self notifyWhenWritable: ^(BOOL isWritable) {
+        writable = isWritable;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(sem);
+#endif
+    
+    return ( writable );
+}
+
+- (void) suspendReading
+{
+    if ( _status == AQSocketListening )
+    {
+        if ( _listenSuspended == NO && _listenSource != NULL )
+        {
+            dispatch_suspend(_listenSource);
+            _listenSuspended = YES;
+        }
+        return;
+    }
+    
+    if ( _status != AQSocketConnected )
+        return;
+    
+    // claim the socket resource, so the channel can't be closed underneath us
+    if ( dispatch_semaphore_wait(_sync, dispatch_time(DISPATCH_TIME_NOW, 1 * NSEC_PER_SEC)) != 0 )
+        return;
+    
+    [_socketIO suspendReading];
+    dispatch_semaphore_signal(_sync);
+}
+
+- (void) resumeReading
+{
+    if ( _status == AQSocketListening )
+    {
+        if ( _listenSuspended )
+        {
+            dispatch_resume(_listenSource);
+            _listenSuspended = NO;
+        }
+        return;
+    }
+    
+    if ( _status != AQSocketConnected )
+        return;
+    
+    if ( dispatch_semaphore_wait(_sync, dispatch_time(DISPATCH_TIME_NOW, 1 * NSEC_PER_SEC)) != 0 )
+        return;
+    
+    [_socketIO resumeReading];
+    dispatch_semaphore_signal(_sync);
+}
+
+- (BOOL) isSecure
+{
+    return ( [_socketIO isKindOfClass: [AQSocketTLSIOChannel class]] );
+}
+
+- (NSString *) negotiatedApplicationProtocol
+{
+    if ( [_socketIO isKindOfClass: [AQSocketTLSIOChannel class]] == NO )
+        return ( nil );
+    return ( ((AQSocketTLSIOChannel *)_socketIO).negotiatedApplicationProtocol );
+}
+
 - (void) setEventHandler: (AQSocketEventHandler) anEventHandler
 {
 #if USING_MRR
@@ -866,6 +1251,12 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     BOOL gotMine = (getsockname(_rawSocket, (struct sockaddr *)&sockname, &socknamelen) == 0);
     BOOL gotPeer = (getpeername(_rawSocket, (struct sockaddr *)&peername, &peernamelen) == 0);
     
+    if ( gotMine && sockname.ss_family == AF_UNIX )
+    {
+        // Unix-domain peers are usually unnamed, and neither end has a port
+        return ( [NSString stringWithFormat: @"%@: {status=%@, path=%s}", [super description], [__statusStrings objectAtIndex: _status], ((struct sockaddr_un *)&sockname)->sun_path] );
+    }
+    
     char socknamestr[INET6_ADDRSTRLEN];
     char peernamestr[INET6_ADDRSTRLEN];
     
@@ -969,14 +1360,33 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
     // First, the IO channel. We will have its cleanup handler release the
     // CFSocketRef for us; in other words, the IO channel now owns the
     // CFSocketRef.
-    _socketIO = [[AQSocketIOChannel alloc] initWithNativeSocket: _rawSocket cleanupHandler: ^{
+    void (^cleanupHandler)(void) = ^{
         // all done with the socket reference, make it noticeably go away.
         if ( _socketRef != NULL )
         {
             CFRelease(_socketRef);
             _socketRef = NULL;
         }
-    }];
+    };
+    
+    // Connections accepted by a secure listener get a channel which handles the TLS session.
+    if ( [_tlsCertificates count] != 0 )
+    {
+        _socketIO = [[AQSocketTLSIOChannel alloc] initWithNativeSocket: _rawSocket certificates: _tlsCertificates applicationProtocols: _tlsProtocols cleanupHandler: cleanupHandler];
+        if ( _socketIO == nil )
+        {
+            // we can't talk to the client without TLS, so drop the connection
+            NSLog(@"Unable to create TLS session for socket %@", self);
+            _status = AQSocketDisconnected;
+            close(_rawSocket);
+            _rawSocket = -1;
+            return;
+        }
+    }
+    else
+    {
+        _socketIO = [[AQSocketIOChannel alloc] initWithNativeSocket: _rawSocket cleanupHandler: cleanupHandler];
+    }
     
     // Next the socket reader object. This will keep track of all the data blobs
     // returned via dispatch_io_read(), providing peek support to the upper
@@ -1067,7 +1477,8 @@ static CFRunLoopRef AQSocketCFHandlerRunLoop(void)
 
 - (void) acceptNewConnection: (CFSocketNativeHandle) clientSock
 {
-    AQSocket * child = [[AQSocket alloc] initWithConnectedSocket: clientSock];
+    // children of a secure listener are themselves secure
+    AQSocket * child = [[AQSocket alloc] initWithConnectedSocket: clientSock TLSCertificates: _tlsCertificates applicationProtocols: _tlsProtocols];
     if ( child == nil )
         return;
     
@@ -19,6 +19,8 @@
 - (id) initWithNativeSocket: (CFSocketNativeHandle) nativeSocket cleanupHandler: (void (^)(void)) cleanupHandler;
 - (void) writeData: (NSData *) data withCompletion: (void (^)(NSData * unsentData, NSError *error)) completion;
 @property (nonatomic, copy) void (^readHandler)(NSData *data, NSError *error);
+- (void) suspendReading;
+- (void) resumeReading;
 - (void) close;
 @end
 
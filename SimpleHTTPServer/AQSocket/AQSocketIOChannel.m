@@ -12,6 +12,7 @@
 #import <sys/ioctl.h>
 #import <fcntl.h>
 #import <libkern/OSAtomic.h>
+#import <pthread.h>
 
 @implementation _AQDispatchData
 
@@ -63,6 +64,8 @@
 @interface AQSocketDispatchSourceIOChannel : AQSocketIOChannel
 {
     dispatch_source_t _readerSource;
+    pthread_mutex_t _readLock;          // guards the reader source and its suspend count
+    NSUInteger _readSuspendCount;
 }
 @end
 
@@ -139,6 +142,16 @@
     [NSException raise: @"SubclassMustImplementException" format: @"Subclass of %@ is expected to implement %@", NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
 }
 
+- (void) suspendReading
+{
+    [NSException raise: @"SubclassMustImplementException" format: @"Subclass of %@ is expected to implement %@", NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
+}
+
+- (void) resumeReading
+{
+    [NSException raise: @"SubclassMustImplementException" format: @"Subclass of %@ is expected to implement %@", NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
+}
+
 @end
 
 @implementation AQSocketDispatchIOChannel
@@ -236,18 +249,17 @@
         return;
     }
     
-    // This copy call ensures we have an immutable data object. If we were
-    // passed an immutable NSData, the copy is actually only a retain.
-    // We convert it to a CFDataRef in order to get manual reference counting
-    // semantics in order to keep the data object alive until the dispatch_data_t
-    // in which we're using it is itself released. This is necessary because when using
-    // ARC we can't call -release, so there would be no reference to the ObjC object
-    // within the cleanup block, thus nothing keeping it retained...
-    CFDataRef staticData = CFDataCreateCopy(kCFAllocatorDefault, (__bridge CFDataRef)data);
-    
-    dispatch_data_t ddata = dispatch_data_create(CFDataGetBytePtr(staticData), CFDataGetLength(staticData), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        // When the dispatch data object is deallocated, release our CFData ref.
-        CFRelease(staticData);
+    // The bytes are used in place: callers don't modify data they've passed to us until they've been
+    // told it was written, so copying it would only double the memory held by a large write.
+    // We take a CF reference in order to get manual reference counting semantics, keeping the data
+    // object alive until the dispatch_data_t in which we're using it is itself released. This is
+    // necessary because when using ARC we can't call -release, so there would be no reference to
+    // the ObjC object within the cleanup block, thus nothing keeping it retained...
+    CFTypeRef retainedData = CFBridgingRetain(data);
+    
+    dispatch_data_t ddata = dispatch_data_create([data bytes], [data length], dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        // When the dispatch data object is deallocated, release our reference.
+        CFRelease(retainedData);
     });
     
 #if DEBUGLOG
@@ -317,6 +329,8 @@
     _readerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, _nativeSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
     // leave it suspended until we get a read handler installed
     
+    pthread_mutex_init(&_readLock, NULL);
+    
     return ( self );
 }
 
@@ -324,21 +338,50 @@
 {
     if ( _readerSource != NULL )
     {
+        if ( _readSuspendCount != 0 )
+            dispatch_resume(_readerSource);     // a suspended source can't be released
         dispatch_source_cancel(_readerSource);
 #if DISPATCH_USES_ARC == 0
         dispatch_release(_readerSource);
 #endif
         _readerSource = NULL;
     }
+    pthread_mutex_destroy(&_readLock);
 #if USING_MRR
     [super dealloc];
 #endif
 }
 
+// Suspensions are counted, since several parties (request bodies, the connection, its cache) may each
+// want reading paused for their own reasons: reading resumes only once all of them have released it.
+// This is called from the request queue, the reader source's handler and -close alike, so it's guarded
+// by a lock rather than run on _q, which may be blocked in a write or on a request body's lock.
+- (void) suspendReading
+{
+    pthread_mutex_lock(&_readLock);
+    if ( _readerSource != NULL && _readSuspendCount++ == 0 )
+        dispatch_suspend(_readerSource);
+    pthread_mutex_unlock(&_readLock);
+}
+
+- (void) resumeReading
+{
+    pthread_mutex_lock(&_readLock);
+    if ( _readerSource != NULL && _readSuspendCount != 0 && --_readSuspendCount == 0 )
+        dispatch_resume(_readerSource);
+    pthread_mutex_unlock(&_readLock);
+}
+
 - (void) close
 {
+    pthread_mutex_lock(&_readLock);
     if ( _readerSource != NULL )
     {
+        // the cancel handler won't run while the source is suspended, whoever suspended it
+        if ( _readSuspendCount != 0 )
+            dispatch_resume(_readerSource);
+        _readSuspendCount = 0;
+        
         // this runs the cleanup handler, if any
         dispatch_source_cancel(_readerSource);
 #if DISPATCH_USES_ARC == 0
@@ -346,6 +389,7 @@
 #endif
         _readerSource = NULL;
     }
+    pthread_mutex_unlock(&_readLock);
 }
 
 @end
@@ -452,7 +496,7 @@
         
         while (totalSent < [data length])
         {
-            ssize_t numSent = send(_nativeSocket, p, len, 0);
+            ssize_t numSent = send(_nativeSocket, p + totalSent, len, 0);
             int err = errno;
             if ( numSent < 0 && err != EAGAIN )
             {
@@ -622,7 +666,7 @@
     
     while (totalSent < [data length])
     {
-        ssize_t numSent = send(_nativeSocket, p, len, 0);
+        ssize_t numSent = send(_nativeSocket, p + totalSent, len, 0);
         int err = errno;
         if ( numSent < 0 && err != EAGAIN )
         {
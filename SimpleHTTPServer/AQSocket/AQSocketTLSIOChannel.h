@@ -0,0 +1,41 @@
+//
+//  AQSocketTLSIOChannel.h
+//  AQSocket
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQSocketIOChannel.h"
+#import <Security/Security.h>
+#import <pthread.h>
+
+// An IO channel which runs the server side of a TLS session over its socket using
+// SecureTransport. The read handler only ever sees decrypted application data, and
+// writes are encrypted before they hit the wire. Any writes made before the handshake
+// completes are held back and sent, in order, once it does. Writes never block the
+// channel's queue: output the socket has no room for waits for it to drain.
+@interface AQSocketTLSIOChannel : AQSocketIOChannel
+{
+    SSLContextRef       _ssl;
+    dispatch_source_t   _readerSource;
+    NSMutableArray *    _pendingWrites;
+    NSArray *           _applicationProtocols;
+    NSString *          _negotiatedProtocol;
+    BOOL                _handshakeComplete;
+    BOOL                _failed;
+    pthread_mutex_t     _readLock;          // guards the reader source and its suspend count
+    NSUInteger          _readSuspendCount;
+}
+
+// certificates is in the form expected by SSLSetCertificate(): a SecIdentityRef followed by any intermediate SecCertificateRefs.
+// protocols is a list of ALPN protocol names in order of preference, and may be nil.
+- (id) initWithNativeSocket: (CFSocketNativeHandle) nativeSocket
+               certificates: (NSArray *) certificates
+       applicationProtocols: (NSArray *) protocols
+             cleanupHandler: (void (^)(void)) cleanupHandler;
+
+// the ALPN protocol agreed with the client, or nil if none was (or the handshake hasn't completed)
+@property (nonatomic, readonly) NSString * negotiatedApplicationProtocol;
+
+@end
@@ -0,0 +1,555 @@
+//
+//  AQSocketTLSIOChannel.m
+//  AQSocket
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#import "AQSocketTLSIOChannel.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+
+static char _AQSocketTLSQueueKey;
+
+// what SecureTransport's I/O functions are given as their connection
+typedef struct _AQSocketTLSConnection {
+    int     fd;
+    BOOL    writeBlocked;       // set when the socket's send buffer filled up, so we know to wait for room
+} _AQSocketTLSConnection;
+
+// SecureTransport calls these to move ciphertext on & off the socket. Neither ever blocks:
+// we report errSSLWouldBlock and pick up again when the reader or writer source fires.
+static OSStatus _AQSocketTLSRead(SSLConnectionRef connection, void * data, size_t * dataLength)
+{
+    int fd = ((const _AQSocketTLSConnection *)connection)->fd;
+    size_t requested = *dataLength;
+    size_t total = 0;
+    OSStatus result = noErr;
+
+    while ( total < requested )
+    {
+        ssize_t nread = recv(fd, (uint8_t *)data + total, requested - total, MSG_DONTWAIT);
+        if ( nread > 0 )
+        {
+            total += nread;
+            continue;
+        }
+
+        if ( nread == 0 )
+            result = errSSLClosedGraceful;
+        else if ( errno == EINTR )
+            continue;
+        else if ( errno == EAGAIN )
+            result = errSSLWouldBlock;
+        else
+            result = errSSLClosedAbort;
+        break;
+    }
+
+    *dataLength = total;
+    return ( result );
+}
+
+static OSStatus _AQSocketTLSWrite(SSLConnectionRef connection, const void * data, size_t * dataLength)
+{
+    _AQSocketTLSConnection * conn = (_AQSocketTLSConnection *)connection;
+    const uint8_t * p = data;
+    size_t len = *dataLength;
+    size_t total = 0;
+    OSStatus result = noErr;
+
+    while ( total < len )
+    {
+        ssize_t numSent = send(conn->fd, p + total, len - total, MSG_DONTWAIT);
+        if ( numSent >= 0 )
+        {
+            total += numSent;
+            continue;
+        }
+
+        if ( errno == EINTR )
+            continue;
+
+        if ( errno == EAGAIN )
+        {
+            // SecureTransport keeps the rest, and sends it when we call it again
+            conn->writeBlocked = YES;
+            result = errSSLWouldBlock;
+        }
+        else
+        {
+            result = errSSLClosedAbort;
+        }
+        break;
+    }
+
+    *dataLength = total;
+    return ( result );
+}
+
+@interface _AQSocketTLSPendingWrite : NSObject
+{
+@public
+    NSData * _data;
+    void (^_completion)(NSData *, NSError *);
+}
+@end
+
+@implementation _AQSocketTLSPendingWrite
+#if USING_MRR
+- (void) dealloc
+{
+    [_data release];
+    [_completion release];
+    [super dealloc];
+}
+#endif
+@end
+
+@implementation AQSocketTLSIOChannel
+{
+    _AQSocketTLSConnection  _connection;
+    
+    // fires on _q while the socket has room for output we're holding; suspended otherwise
+    dispatch_source_t       _writerSource;
+    BOOL                    _writingSuspended;
+    
+    // how much of the first pending write SecureTransport has taken
+    NSUInteger              _writeOffset;
+}
+
+@synthesize negotiatedApplicationProtocol=_negotiatedProtocol;
+
+- (id) initWithNativeSocket: (CFSocketNativeHandle) nativeSocket
+               certificates: (NSArray *) certificates
+       applicationProtocols: (NSArray *) protocols
+             cleanupHandler: (void (^)(void)) cleanupHandler
+{
+    NSParameterAssert([certificates count] != 0);
+
+    self = [super initWithNativeSocket: nativeSocket cleanupHandler: cleanupHandler];
+    if ( self == nil )
+        return ( nil );
+
+    // SSLCreateContext() is new in 10.8
+    if ( SSLCreateContext == NULL )
+    {
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    _ssl = SSLCreateContext(kCFAllocatorDefault, kSSLServerSide, kSSLStreamType);
+    if ( _ssl == NULL )
+    {
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    _connection.fd = _nativeSocket;
+    SSLSetIOFuncs(_ssl, _AQSocketTLSRead, _AQSocketTLSWrite);
+    SSLSetConnection(_ssl, (SSLConnectionRef)&_connection);
+
+    OSStatus err = SSLSetCertificate(_ssl, (__bridge CFArrayRef)certificates);
+    if ( err != noErr )
+    {
+        NSLog(@"Failed to set TLS certificate: %d", (int)err);
+#if USING_MRR
+        [self release];
+#endif
+        return ( nil );
+    }
+
+    // TLS 1.0 and 1.1 are deprecated (RFC 8996)
+    SSLSetProtocolVersionMin(_ssl, kTLSProtocol12);
+
+    // Keying the session cache by the client's address (not its port, which is new for every connection)
+    // lets a returning client resume its previous session with an abbreviated handshake. The key only picks
+    // the cache entry: resuming still takes the session ID the client was given, so clients sharing an
+    // address behind NAT can replace one another's entries but never resume one another's sessions.
+    struct sockaddr_storage peer = {0};
+    socklen_t slen = sizeof(peer);
+    if ( getpeername(_nativeSocket, (struct sockaddr *)&peer, &slen) == 0 )
+    {
+        const void * addr = NULL;
+        size_t addrLen = 0;
+        if ( peer.ss_family == AF_INET )
+        {
+            addr = &((struct sockaddr_in *)&peer)->sin_addr;
+            addrLen = sizeof(struct in_addr);
+        }
+        else if ( peer.ss_family == AF_INET6 )
+        {
+            addr = &((struct sockaddr_in6 *)&peer)->sin6_addr;
+            addrLen = sizeof(struct in6_addr);
+        }
+
+        if ( addr != NULL )
+            SSLSetPeerID(_ssl, addr, addrLen);
+    }
+
+    // ALPN is new in 10.13.4; without it, clients will simply fall back to HTTP/1.1
+    if ( [protocols count] != 0 && SSLSetALPNProtocols != NULL )
+    {
+        SSLSetALPNProtocols(_ssl, (__bridge CFArrayRef)protocols);
+        _applicationProtocols = [protocols copy];
+    }
+
+    _pendingWrites = [NSMutableArray new];
+
+    dispatch_queue_set_specific(_q, &_AQSocketTLSQueueKey, (__bridge void *)self, NULL);
+
+    _readerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, _nativeSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+    // leave it suspended until we get a read handler installed
+    pthread_mutex_init(&_readLock, NULL);
+
+    // writes wait for room on this, rather than blocking _q (and with it, reads) until the client catches up
+    _writerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, _nativeSocket, 0, _q);
+    _writingSuspended = YES;
+    dispatch_source_set_event_handler(_writerSource, ^{
+        if ( _handshakeComplete )
+            [self _serviceWrites];
+        else
+            [self _readAvailableData];      // the handshake was waiting to send
+    });
+
+    return ( self );
+}
+
+- (void) dealloc
+{
+    if ( _readerSource != NULL )
+    {
+        if ( _readSuspendCount != 0 )
+            dispatch_resume(_readerSource);     // a suspended source can't be released
+        dispatch_source_cancel(_readerSource);
+#if DISPATCH_USES_ARC == 0
+        dispatch_release(_readerSource);
+#endif
+        _readerSource = NULL;
+    }
+    pthread_mutex_destroy(&_readLock);
+    [self _cancelWriterSource];
+    if ( _ssl != NULL )
+        CFRelease(_ssl);
+#if USING_MRR
+    [_pendingWrites release];
+    [_applicationProtocols release];
+    [_negotiatedProtocol release];
+    [super dealloc];
+#endif
+}
+
+- (void) _performOnQueue: (dispatch_block_t) block
+{
+    // -close is frequently called from within our own read handler
+    if ( dispatch_get_specific(&_AQSocketTLSQueueKey) == (__bridge void *)self )
+        block();
+    else
+        dispatch_sync(_q, block);
+}
+
+- (void) _cancelWriterSource
+{
+    if ( _writerSource == NULL )
+        return;
+
+    if ( _writingSuspended )
+        dispatch_resume(_writerSource);     // a suspended source can't be cancelled or released
+    dispatch_source_cancel(_writerSource);
+#if DISPATCH_USES_ARC == 0
+    dispatch_release(_writerSource);
+#endif
+    _writerSource = NULL;
+}
+
+- (void) close
+{
+    [self _performOnQueue: ^{
+        if ( _handshakeComplete && _failed == NO )
+            SSLClose(_ssl);     // sends close_notify, if there's room for it
+        _failed = YES;
+
+        for ( _AQSocketTLSPendingWrite * write in _pendingWrites )
+        {
+            if ( write->_completion != nil )
+                write->_completion(write->_data, [NSError errorWithDomain: NSPOSIXErrorDomain code: ENOTCONN userInfo: nil]);
+        }
+        [_pendingWrites removeAllObjects];
+        _writeOffset = 0;
+
+        [self _cancelWriterSource];
+    }];
+
+    pthread_mutex_lock(&_readLock);
+    if ( _readerSource != NULL )
+    {
+        // the cancel handler won't run while the source is suspended, whoever suspended it
+        if ( _readSuspendCount != 0 )
+            dispatch_resume(_readerSource);
+        _readSuspendCount = 0;
+
+        // this runs the cleanup handler, if any
+        dispatch_source_cancel(_readerSource);
+#if DISPATCH_USES_ARC == 0
+        dispatch_release(_readerSource);
+#endif
+        _readerSource = NULL;
+    }
+    pthread_mutex_unlock(&_readLock);
+}
+
+// Counted as in AQSocketDispatchSourceIOChannel, and locked rather than run on _q for the same reasons:
+// the request body resumes reading with its own lock held, and a read on _q may be waiting for that lock.
+- (void) suspendReading
+{
+    // SSLRead() drains its own buffers each time the source fires, so nothing decrypted is left behind
+    pthread_mutex_lock(&_readLock);
+    if ( _readerSource != NULL && _readSuspendCount++ == 0 )
+        dispatch_suspend(_readerSource);
+    pthread_mutex_unlock(&_readLock);
+}
+
+- (void) resumeReading
+{
+    pthread_mutex_lock(&_readLock);
+    if ( _readerSource != NULL && _readSuspendCount != 0 && --_readSuspendCount == 0 )
+        dispatch_resume(_readerSource);
+    pthread_mutex_unlock(&_readLock);
+}
+
+- (void) _handshakeCompleted
+{
+    _handshakeComplete = YES;
+
+    if ( _applicationProtocols != nil && SSLCopyALPNProtocols != NULL )
+    {
+        // pick our most-preferred protocol from those the client offered
+        CFArrayRef offered = NULL;
+        if ( SSLCopyALPNProtocols(_ssl, &offered) == noErr && offered != NULL )
+        {
+            for ( NSString * protocol in _applicationProtocols )
+            {
+                if ( [(__bridge NSArray *)offered containsObject: protocol] )
+                {
+                    _negotiatedProtocol = [protocol copy];
+                    break;
+                }
+            }
+            CFRelease(offered);
+        }
+    }
+
+#if DEBUGLOG
+    SSLProtocol version = kSSLProtocolUnknown;
+    SSLGetNegotiatedProtocolVersion(_ssl, &version);
+    NSLog(@"TLS handshake complete on channel %@: version=%d, ALPN=%@", self, (int)version, _negotiatedProtocol);
+#endif
+
+    // now anything written during the handshake can go out
+    [self _serviceWrites];
+}
+
+- (void) _readAvailableData
+{
+    if ( _failed )
+        return;
+
+    NSError * error = nil;
+    if ( _handshakeComplete == NO )
+    {
+        _connection.writeBlocked = NO;
+        OSStatus status = SSLHandshake(_ssl);
+        if ( status == errSSLWouldBlock )
+        {
+            // more to come from the client, or our side of the handshake is waiting for room to send
+            [self _updateWriterSource];
+            return;
+        }
+
+        if ( status != noErr )
+        {
+#if DEBUGLOG
+            NSLog(@"TLS handshake failed on channel %@: %d", self, (int)status);
+#endif
+            _failed = YES;
+            error = [NSError errorWithDomain: NSOSStatusErrorDomain code: status userInfo: nil];
+            _readHandler(nil, error);
+            return;
+        }
+
+        [self _handshakeCompleted];
+    }
+
+    NSMutableData * data = [NSMutableData new];
+    BOOL closed = NO;
+
+#define READ_BUFLEN 1024*8
+    uint8_t buf[READ_BUFLEN];
+    for ( ;; )
+    {
+        size_t processed = 0;
+        OSStatus status = SSLRead(_ssl, buf, READ_BUFLEN, &processed);
+        if ( processed != 0 )
+            [data appendBytes: buf length: processed];
+
+        if ( status == noErr )
+            continue;
+
+        if ( status == errSSLClosedGraceful || status == errSSLClosedNoNotify )
+            closed = YES;
+        else if ( status != errSSLWouldBlock )
+            error = [NSError errorWithDomain: NSOSStatusErrorDomain code: status userInfo: nil];
+        break;
+    }
+
+    // a readable socket may have carried nothing but TLS records of its own
+    if ( [data length] != 0 )
+        _readHandler(data, nil);
+
+    if ( error != nil )
+    {
+        _failed = YES;
+        _readHandler(nil, error);
+    }
+    else if ( closed )
+    {
+        // zero-length data signals the end of the stream
+        _failed = YES;
+        _readHandler([NSData data], nil);
+    }
+
+#if USING_MRR
+    [data release];
+#endif
+}
+
+- (void) setReadHandler: (void (^)(NSData *, NSError *)) readHandler
+{
+    // Always suspend the reader source before swapping out an existing handler.
+    // This also has the effect of mirroring the dispatch_resume() call after installing the event/cancel handlers.
+    if ( _readHandler != nil )
+        dispatch_suspend(_readerSource);
+
+    [super setReadHandler: readHandler];
+    if ( _readHandler == nil )
+        return;
+
+    if ( _readerSource == NULL )
+        return;
+
+    dispatch_source_set_cancel_handler(_readerSource, ^{
+        if ( _cleanupHandler != nil )
+            _cleanupHandler();
+    });
+
+    dispatch_source_set_event_handler(_readerSource, ^{
+        dispatch_sync(_q, ^{
+            [self _readAvailableData];
+        });
+    });
+
+    dispatch_resume(_readerSource);
+}
+
+// must be called on _q: resumes the writer source while SecureTransport has output waiting for room, and suspends it otherwise
+- (void) _updateWriterSource
+{
+    if ( _writerSource == NULL )
+        return;
+
+    if ( _connection.writeBlocked && _writingSuspended )
+    {
+        _writingSuspended = NO;
+        dispatch_resume(_writerSource);
+    }
+    else if ( _connection.writeBlocked == NO && _writingSuspended == NO )
+    {
+        _writingSuspended = YES;
+        dispatch_suspend(_writerSource);
+    }
+}
+
+// must be called on _q: sends as much of the pending writes as the socket will take
+- (void) _serviceWrites
+{
+    _connection.writeBlocked = NO;
+
+    while ( [_pendingWrites count] != 0 )
+    {
+        _AQSocketTLSPendingWrite * write = [_pendingWrites objectAtIndex: 0];
+        NSData * data = write->_data;
+        NSError * error = nil;
+        NSData * unwritten = nil;
+
+        if ( _failed )
+        {
+            error = [NSError errorWithDomain: NSPOSIXErrorDomain code: ENOTCONN userInfo: nil];
+            unwritten = data;
+        }
+        else
+        {
+            // once all the data has been taken, this just flushes whatever SecureTransport still holds
+            size_t processed = 0;
+            OSStatus status = SSLWrite(_ssl, (const uint8_t *)[data bytes] + _writeOffset, [data length] - _writeOffset, &processed);
+            _writeOffset += processed;
+            if ( status == errSSLWouldBlock )
+                break;
+
+            if ( status != noErr )
+            {
+                error = [NSError errorWithDomain: NSOSStatusErrorDomain code: status userInfo: nil];
+                unwritten = [data subdataWithRange: NSMakeRange(_writeOffset, [data length] - _writeOffset)];
+            }
+        }
+
+        void (^completion)(NSData *, NSError *) = write->_completion;
+        if ( completion != nil )
+        {
+            dispatch_async(_q, ^{
+                completion(unwritten, error);
+            });
+        }
+
+        [_pendingWrites removeObjectAtIndex: 0];
+        _writeOffset = 0;
+    }
+
+    [self _updateWriterSource];
+}
+
+- (void) writeData: (NSData *) data withCompletion: (void (^)(NSData *, NSError *)) completion
+{
+    // Ensure the completion block is on the heap, not the stack.
+    void (^completionCopy)(NSData *, NSError *) = [completion copy];
+
+    dispatch_async(_q, ^{
+        _AQSocketTLSPendingWrite * write = [_AQSocketTLSPendingWrite new];
+#if USING_MRR
+        write->_data = [data retain];
+        write->_completion = [completionCopy retain];
+#else
+        write->_data = data;
+        write->_completion = completionCopy;
+#endif
+        [_pendingWrites addObject: write];
+#if USING_MRR
+        [write release];
+#endif
+
+        // anything written during the handshake waits for it to finish; otherwise it goes behind what's already waiting
+        if ( _handshakeComplete || _failed )
+            [self _serviceWrites];
+    });
+
+#if USING_MRR
+    // This has been captured by the block now, so we can release it.
+    [completionCopy release];
+#endif
+}
+
+@end
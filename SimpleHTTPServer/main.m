@@ -10,20 +10,44 @@
 #import <getopt.h>
 #import <sysexits.h>
 #import <asl.h>
+#import <spawn.h>
+#import <crt_externs.h>
+#import <sys/wait.h>
+#import <sys/socket.h>
 
 #import "AQHTTPServer.h"
+#import "AQHTTPWorkerPool.h"
+#import "AQHTTPBundleConnection.h"
+#import "AQHTTPTrace.h"
+#import "AQSocket.h"
 
 static const char *gVersionNumber = "1.0";
 
+// how long the old process of a graceful restart keeps serving its existing connections
+static const NSTimeInterval kDefaultDrainTimeout = 30.0;
+
 aslclient gASLClient = NULL;
 
-static const char *		_shortCommandLineArgs = "hvda:r:";
+static const char *		_shortCommandLineArgs = "hvda:u:m:r:b:c:p:t:w:i:W:l:L:T:M:";
 static struct option	_longCommandLineArgs[] = {
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'v' },
 	{ "debug", no_argument, NULL, 'd' },
     { "address", required_argument, NULL, 'a' },
+    { "unix-socket", required_argument, NULL, 'u' },
+    { "unix-socket-mode", required_argument, NULL, 'm' },
     { "webroot", required_argument, NULL, 'r' },
+    { "bundle", required_argument, NULL, 'b' },
+    { "certificate", required_argument, NULL, 'c' },
+    { "passphrase", required_argument, NULL, 'p' },
+    { "drain-timeout", required_argument, NULL, 't' },
+    { "workers", required_argument, NULL, 'w' },
+    { "inherit-listeners", required_argument, NULL, 'i' },
+    { "worker", required_argument, NULL, 'W' },
+    { "rate-limit", required_argument, NULL, 'l' },
+    { "connection-rate-limit", required_argument, NULL, 'L' },
+    { "trace", required_argument, NULL, 'T' },
+    { "warmup-manifest", required_argument, NULL, 'M' },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -38,7 +62,40 @@ static void usage(FILE *fp)
                            @"\n"
                            @"Arguments:\n"
                            @"  -a, --address      The address on which to listen. Can be IPv4, IPv6, or a name.\n"
+                           @"  -u, --unix-socket  The path of a Unix-domain socket on which to listen, alone or\n"
+                           @"                     alongside --address.\n"
+                           @"  -m, --unix-socket-mode\n"
+                           @"                     The permissions of the --unix-socket, in octal. The default is 0660.\n"
                            @"  -r, --webroot      The path of a folder from which to serve content.\n"
+                           @"  -b, --bundle       The path of a content bundle from which to serve content.\n"
+                           @"                     Use this in place of --webroot.\n"
+                           @"  -c, --certificate  The path of a PKCS#12 file containing a certificate and private key.\n"
+                           @"                     If provided, the server will use HTTPS.\n"
+                           @"  -p, --passphrase   The passphrase for the --certificate file.\n"
+                           @"  -t, --drain-timeout\n"
+                           @"                     The number of seconds for which existing connections are kept\n"
+                           @"                     open during a graceful restart. The default is 30.\n"
+                           @"  -w, --workers      The number of worker processes which serve connections. By default\n"
+                           @"                     connections are served by the main process.\n"
+                           @"  -l, --rate-limit   The most bytes per second to send across all connections, shared\n"
+                           @"                     fairly between responses with small ones first. Accepts a K, M or\n"
+                           @"                     G suffix. With --workers, each worker gets an equal part.\n"
+                           @"  -L, --connection-rate-limit\n"
+                           @"                     The most bytes per second to send on any one connection.\n"
+                           @"  -T, --trace        Trace the phases of one request in every N. Send SIGUSR1 to write\n"
+                           @"                     the traces so far to a file in the temporary folder, in the Trace\n"
+                           @"                     Event format used by chrome://tracing.\n"
+                           @"  -M, --warmup-manifest\n"
+                           @"                     The path of a file in which to record the most frequently-requested\n"
+                           @"                     files. At startup, the files it lists are loaded in the background.\n"
+                           @"\n"
+                           @"Send SIGUSR2 to restart gracefully: a new instance of the server is started\n"
+                           @"(using the executable currently at the same path) and takes over the listening\n"
+                           @"sockets, while this one finishes its existing connections and exits.\n"
+                           @"Send SIGHUP to reopen the --webroot folder, so that a path which is a symbolic link\n"
+                           @"may be pointed at new content; requests already in progress finish with the old.\n"
+                           @"With --workers, send it to the workers.\n"
+                           @"Send SIGINFO to log the server's statistics.\n"
                            @"\n", [[NSProcessInfo processInfo] processName]];
     fprintf(fp, "%s", [usageStr UTF8String]);
 #if USING_MRR
@@ -47,12 +104,111 @@ static void usage(FILE *fp)
     fflush(fp);
 }
 
+// parses a byte count with an optional K, M or G suffix
+static BOOL _ParseByteCount(const char * str, NSUInteger * outCount)
+{
+    if ( str == NULL )
+        return ( NO );
+    
+    char * end = NULL;
+    double value = strtod(str, &end);
+    if ( end == str || value < 0.0 )
+        return ( NO );
+    
+    switch ( *end )
+    {
+        case 'G': case 'g':
+            value *= 1024.0;
+        case 'M': case 'm':
+            value *= 1024.0;
+        case 'K': case 'k':
+            value *= 1024.0;
+            end++;
+            break;
+        default:
+            break;
+    }
+    
+    if ( *end != '\0' )
+        return ( NO );
+    
+    *outCount = (NSUInteger)value;
+    return ( YES );
+}
+
 static void version(FILE *fp)
 {
     fprintf(fp, "%s: version %s\n", [[[NSProcessInfo processInfo] processName] UTF8String], gVersionNumber);
     fflush(fp);
 }
 
+// Starts a new instance of the server which will take over our listening sockets, and hands them over.
+static BOOL _RestartGracefully(AQHTTPServer * server, NSArray * arguments)
+{
+    int sockets[2];
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0 )
+    {
+        NSLog(@"Unable to create handoff socket: %d (%s)", errno, strerror(errno));
+        return ( NO );
+    }
+    
+    NSMutableArray * childArgs = [arguments mutableCopy];
+    [childArgs addObject: @"--inherit-listeners"];
+    [childArgs addObject: [NSString stringWithFormat: @"%d", sockets[1]]];
+    
+    const char * path = [[[NSBundle mainBundle] executablePath] fileSystemRepresentation];
+    char ** argv = calloc([childArgs count] + 2, sizeof(char *));
+    argv[0] = (char *)path;
+    [childArgs enumerateObjectsUsingBlock: ^(id obj, NSUInteger idx, BOOL *stop) {
+        argv[idx+1] = (char *)[obj UTF8String];
+    }];
+    
+    // the new process gets only the standard descriptors and its end of the handoff socket
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT);
+    
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addinherit_np(&actions, STDIN_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, STDOUT_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, STDERR_FILENO);
+    posix_spawn_file_actions_addinherit_np(&actions, sockets[1]);
+    
+    pid_t child = 0;
+    int err = posix_spawn(&child, path, &actions, &attr, argv, *_NSGetEnviron());
+    
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    free(argv);
+#if USING_MRR
+    [childArgs release];
+#endif
+    close(sockets[1]);
+    
+    if ( err != 0 )
+    {
+        NSLog(@"Unable to start new server process: %d (%s)", err, strerror(err));
+        close(sockets[0]);
+        return ( NO );
+    }
+    
+    NSError * error = nil;
+    BOOL handedOff = [server handOffListeningSocketsOverSocket: sockets[0] error: &error];
+    close(sockets[0]);
+    
+    if ( handedOff == NO )
+    {
+        NSLog(@"New server process %d did not take over: %@", child, error);
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+        return ( NO );
+    }
+    
+    NSLog(@"Handed over to new server process %d; finishing existing connections", child);
+    return ( YES );
+}
+
 int main(int argc, char * const argv[])
 {
     gASLClient = asl_open("me.alanquatermain.SimpleHTTPServer", "SimpleHTTPServer", ASL_OPT_NO_DELAY);
@@ -61,7 +217,21 @@ int main(int argc, char * const argv[])
     {
         int ch = 0;
         NSString * address = nil;
+        NSString * unixSocketPath = nil;
+        mode_t unixSocketMode = 0660;
         NSString * root = nil;
+        BOOL rootIsBundle = NO;
+        NSString * certificatePath = nil;
+        NSString * passphrase = nil;
+        NSTimeInterval drainTimeout = kDefaultDrainTimeout;
+        int handoffSocket = -1;
+        int workerSocket = -1;
+        NSUInteger workerCount = 0;
+        NSUInteger rateLimit = 0;
+        NSUInteger connectionRateLimit = 0;
+        NSUInteger traceInterval = 0;
+        NSString * warmupManifestPath = nil;
+        BOOL debug = NO;
         
         @try
         {
@@ -86,6 +256,7 @@ int main(int argc, char * const argv[])
                             opts |= ASL_OPT_STDERR;
                         gASLClient = asl_open("me.alanquatermain.SimpleHTTPServer", "SimpleHTTPServer", opts);
                         asl_set_filter(gASLClient, ASL_FILTER_MASK_UPTO(ASL_LEVEL_DEBUG));
+                        debug = YES;
                         break;
                         
                     case 'a':
@@ -98,6 +269,30 @@ int main(int argc, char * const argv[])
                         address = [NSString stringWithUTF8String: optarg];
                         break;
                         
+                    case 'u':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        unixSocketPath = [NSString stringWithUTF8String: optarg];
+                        break;
+                        
+                    case 'm':
+                    {
+                        char * end = NULL;
+                        unsigned long mode = (optarg != NULL ? strtoul(optarg, &end, 8) : 0);
+                        if ( optarg == NULL || end == optarg || *end != '\0' || mode > 0777 )
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        unixSocketMode = (mode_t)mode;
+                        break;
+                    }
+                        
                     case 'r':
                         if (optarg == NULL)
                         {
@@ -106,6 +301,114 @@ int main(int argc, char * const argv[])
                         }
                         
                         root = [NSString stringWithUTF8String: optarg];
+                        rootIsBundle = NO;
+                        break;
+                        
+                    case 'b':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        root = [NSString stringWithUTF8String: optarg];
+                        rootIsBundle = YES;
+                        break;
+                        
+                    case 'c':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        certificatePath = [NSString stringWithUTF8String: optarg];
+                        break;
+                        
+                    case 'p':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        passphrase = [NSString stringWithUTF8String: optarg];
+                        break;
+                        
+                    case 't':
+                        if (optarg == NULL || atof(optarg) < 0.0)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        drainTimeout = atof(optarg);
+                        break;
+                        
+                    case 'i':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        handoffSocket = atoi(optarg);
+                        break;
+                        
+                    case 'w':
+                        if (optarg == NULL || atoi(optarg) < 0)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        workerCount = (NSUInteger)atoi(optarg);
+                        break;
+                        
+                    case 'W':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        workerSocket = atoi(optarg);
+                        break;
+                        
+                    case 'l':
+                        if ( _ParseByteCount(optarg, &rateLimit) == NO )
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        break;
+                        
+                    case 'L':
+                        if ( _ParseByteCount(optarg, &connectionRateLimit) == NO )
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        break;
+                        
+                    case 'T':
+                        if (optarg == NULL || atoi(optarg) < 0)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        traceInterval = (NSUInteger)atoi(optarg);
+                        break;
+                        
+                    case 'M':
+                        if (optarg == NULL)
+                        {
+                            usage(stderr);
+                            exit(EX_USAGE);
+                        }
+                        
+                        warmupManifestPath = [NSString stringWithUTF8String: optarg];
                         break;
                         
                     default:
@@ -121,19 +424,199 @@ int main(int argc, char * const argv[])
             exit(EX_OSERR);
         }
         
-        if ( address == nil || root == nil )
+        if ( (address == nil && unixSocketPath == nil) || root == nil )
         {
-            fprintf(stderr, "You must specify an address and a root path.\n");
+            fprintf(stderr, "You must specify an address or a Unix socket, and a root path.\n");
             usage(stderr);
             exit(EX_USAGE);
         }
         
         AQHTTPServer * server = [[AQHTTPServer alloc] initWithAddress: address root: [NSURL fileURLWithPath: root]];
+        if ( rootIsBundle )
+            [server setConnectionClass: [AQHTTPBundleConnection class]];
+        if ( unixSocketPath != nil )
+        {
+            server.unixSocketPath = unixSocketPath;
+            server.unixSocketPermissions = unixSocketMode;
+        }
+        
+        // a supervisor serves nothing itself, so only its workers keep the manifest
+        if ( warmupManifestPath != nil && (workerCount == 0 || workerSocket != -1) )
+            server.warmupManifestURL = [NSURL fileURLWithPath: warmupManifestPath];
+        
+        if ( rateLimit != 0 || connectionRateLimit != 0 )
+        {
+            AQHTTPBandwidthScheduler * scheduler = [[AQHTTPBandwidthScheduler alloc] initWithRate: rateLimit connectionRate: connectionRateLimit];
+            server.bandwidthScheduler = scheduler;
+#if USING_MRR
+            [scheduler release];
+#endif
+        }
+        
         NSError * error = nil;
-        if ( [server start: &error] == NO )
+        if ( certificatePath != nil )
         {
-            NSLog(@"Error starting server: %@", error);
-            exit(EX_OSERR);
+            NSData * p12 = [NSData dataWithContentsOfFile: certificatePath options: 0 error: &error];
+            NSArray * certificates = (p12 != nil ? [AQSocket TLSCertificatesWithPKCS12Data: p12 passphrase: passphrase error: &error] : nil);
+            if ( certificates == nil )
+            {
+                fprintf(stderr, "Unable to load certificate from %s: %s\n", [certificatePath UTF8String], [[error description] UTF8String]);
+                exit(EX_NOINPUT);
+            }
+            
+            server.TLSCertificates = certificates;
+        }
+        
+        // the arguments for a worker, or for our replacement should we be asked to restart
+        NSMutableArray * arguments = [NSMutableArray arrayWithObjects: (rootIsBundle ? @"--bundle" : @"--webroot"), root, nil];
+        if ( address != nil )
+            [arguments addObjectsFromArray: [NSArray arrayWithObjects: @"--address", address, nil]];
+        if ( unixSocketPath != nil )
+        {
+            [arguments addObjectsFromArray: [NSArray arrayWithObjects: @"--unix-socket", unixSocketPath, nil]];
+            [arguments addObject: [NSString stringWithFormat: @"--unix-socket-mode=%o", (unsigned int)unixSocketMode]];
+        }
+        if ( certificatePath != nil )
+            [arguments addObjectsFromArray: [NSArray arrayWithObjects: @"--certificate", certificatePath, nil]];
+        if ( passphrase != nil )
+            [arguments addObjectsFromArray: [NSArray arrayWithObjects: @"--passphrase", passphrase, nil]];
+        if ( debug )
+            [arguments addObject: @"--debug"];
+        [arguments addObject: [NSString stringWithFormat: @"--drain-timeout=%g", drainTimeout]];
+        if ( connectionRateLimit != 0 )
+            [arguments addObject: [NSString stringWithFormat: @"--connection-rate-limit=%lu", (unsigned long)connectionRateLimit]];
+        if ( traceInterval != 0 )
+            [arguments addObject: [NSString stringWithFormat: @"--trace=%lu", (unsigned long)traceInterval]];
+        if ( warmupManifestPath != nil )
+            [arguments addObjectsFromArray: [NSArray arrayWithObjects: @"--warmup-manifest", warmupManifestPath, nil]];
+        
+        [AQHTTPTrace setSamplingInterval: traceInterval];
+        dispatch_source_t traceSrc = NULL;
+        if ( traceInterval != 0 )
+        {
+            // each process, worker or not, writes out its own traces
+            signal(SIGUSR1, SIG_IGN);
+            traceSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGUSR1, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+            dispatch_source_set_event_handler(traceSrc, ^{
+                NSString * tracePath = [NSTemporaryDirectory() stringByAppendingPathComponent: [NSString stringWithFormat: @"SimpleHTTPServer-%d-trace.json", getpid()]];
+                NSError * traceError = nil;
+                if ( [AQHTTPTrace writeTraceEventsToFile: tracePath error: &traceError] )
+                    NSLog(@"Wrote request traces to %@", tracePath);
+                else
+                    NSLog(@"Unable to write request traces to %@: %@", tracePath, traceError);
+            });
+            dispatch_resume(traceSrc);
+        }
+        
+        dispatch_source_t reloadSrc = NULL;
+        if ( rootIsBundle == NO )
+        {
+            // reopening the folder picks up whatever is at its path now; connections switch to it as their next request arrives
+            signal(SIGHUP, SIG_IGN);
+            reloadSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGHUP, 0, dispatch_get_main_queue());
+            dispatch_source_set_event_handler(reloadSrc, ^{
+                server.documentRoot = [NSURL fileURLWithPath: root];
+                NSLog(@"Reopened the document root at %@", root);
+            });
+            dispatch_resume(reloadSrc);
+        }
+        
+        if ( workerSocket != -1 )
+        {
+            // we're one of a supervisor's workers: we serve connections on its sockets until told to stop
+            __block BOOL stopping = NO;
+            dispatch_block_t stopWorker = ^{
+                if ( stopping )
+                    return;
+                
+                stopping = YES;
+                [server drainConnectionsWithTimeout: drainTimeout completionHandler: ^{
+                    CFRunLoopStop(CFRunLoopGetMain());
+                }];
+            };
+            
+            if ( [AQHTTPWorkerPool startWorkerServer: server supervisorSocket: workerSocket supervisorLostHandler: stopWorker error: &error] == NO )
+            {
+                NSLog(@"Error starting worker: %@", error);
+                exit(EX_OSERR);
+            }
+            
+            signal(SIGTERM, SIG_IGN);
+            dispatch_source_t termSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGTERM, 0, dispatch_get_main_queue());
+            dispatch_source_set_event_handler(termSrc, stopWorker);
+            dispatch_resume(termSrc);
+        }
+        else
+        {
+            if ( handoffSocket != -1 )
+            {
+                // we're replacing a running server, which is waiting to pass us its listening sockets
+                BOOL started = [server startWithListeningSocketsFromSocket: handoffSocket error: &error];
+                close(handoffSocket);
+                if ( started == NO )
+                {
+                    NSLog(@"Error taking over listening sockets: %@", error);
+                    exit(EX_OSERR);
+                }
+            }
+            else if ( [server start: &error] == NO )
+            {
+                NSLog(@"Error starting server: %@", error);
+                exit(EX_OSERR);
+            }
+            
+            AQHTTPWorkerPool * pool = nil;
+            NSMutableArray * restartArguments = [NSMutableArray arrayWithArray: arguments];
+            if ( rateLimit != 0 )
+                [restartArguments addObject: [NSString stringWithFormat: @"--rate-limit=%lu", (unsigned long)rateLimit]];
+            if ( workerCount != 0 )
+            {
+                // the workers share our overall rate limit between them
+                NSMutableArray * workerArguments = [NSMutableArray arrayWithArray: arguments];
+                if ( rateLimit != 0 )
+                    [workerArguments addObject: [NSString stringWithFormat: @"--rate-limit=%lu", (unsigned long)MAX(rateLimit / workerCount, 1ul)]];
+                
+                pool = [[AQHTTPWorkerPool alloc] initWithServer: server workerArguments: workerArguments];
+                [pool startWorkers: workerCount];
+                [restartArguments addObject: [NSString stringWithFormat: @"--workers=%lu", (unsigned long)workerCount]];
+                
+                signal(SIGTERM, SIG_IGN);
+                dispatch_source_t termSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGTERM, 0, dispatch_get_main_queue());
+                dispatch_source_set_event_handler(termSrc, ^{
+                    [pool stopWithCompletionHandler: ^{
+                        CFRunLoopStop(CFRunLoopGetMain());
+                    }];
+                });
+                dispatch_resume(termSrc);
+            }
+            
+            signal(SIGINFO, SIG_IGN);
+            dispatch_source_t infoSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGINFO, 0, dispatch_get_main_queue());
+            dispatch_source_set_event_handler(infoSrc, ^{
+                AQHTTPServerStatistics stats = (pool != nil ? pool.statistics : server.statistics);
+                NSLog(@"%llu connections accepted, %llu requests handled, %u connections open", stats.connectionsAccepted, stats.requestsReceived, stats.openConnections);
+            });
+            dispatch_resume(infoSrc);
+            
+            __block BOOL restarting = NO;
+            signal(SIGUSR2, SIG_IGN);
+            dispatch_source_t restartSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGUSR2, 0, dispatch_get_main_queue());
+            dispatch_source_set_event_handler(restartSrc, ^{
+                if ( restarting )
+                    return;
+                
+                restarting = _RestartGracefully(server, restartArguments);
+                if ( restarting == NO )
+                    return;
+                
+                // our replacement starts its own workers; ours finish their connections and exit
+                void (^finished)(void) = ^{ CFRunLoopStop(CFRunLoopGetMain()); };
+                if ( pool != nil )
+                    [pool stopWithCompletionHandler: finished];
+                else
+                    [server drainConnectionsWithTimeout: drainTimeout completionHandler: finished];
+            });
+            dispatch_resume(restartSrc);
         }
         
         dispatch_source_t src = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGINT, 0, dispatch_get_main_queue());
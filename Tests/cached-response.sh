@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# Fetches a small file repeatedly, and checks that once the first request has
+# loaded it into the file cache, GET, HEAD, and conditional requests for it
+# are answered from the cache (the traces of those requests show no response
+# operation) with the same content and headers an operation sends; and that
+# a file changed on disk is served afresh rather than from the stale entry.
+#
+# Tunables: REQUESTS.
+
+source "$(dirname "$0")/common.sh"
+require curl cmp python3 lsof
+
+REQUESTS=${REQUESTS:-10}
+
+make_file "$WORK_DIR/root/small.txt" 4096
+
+# every request is traced, so the Nth request the server sees has trace identifier N
+start_server --address localhost --webroot "$WORK_DIR/root" --trace 1
+URL="http://127.0.0.1:$SERVER_PORT/small.txt"
+CURL=(curl -sS --fail -H 'Connection: close')
+
+# the first request misses, and the cache loads the file in the background
+"${CURL[@]}" -D "$WORK_DIR/headers.1" -o "$WORK_DIR/fetched" "$URL" || fail "unable to fetch small.txt"
+cmp -s "$WORK_DIR/fetched" "$WORK_DIR/root/small.txt" || fail "small.txt arrived corrupted"
+sleep 1
+
+for i in $(seq 2 "$REQUESTS"); do
+    "${CURL[@]}" -D "$WORK_DIR/headers.$i" -o "$WORK_DIR/fetched" "$URL" || fail "unable to fetch small.txt from the cache"
+    cmp -s "$WORK_DIR/fetched" "$WORK_DIR/root/small.txt" || fail "small.txt arrived corrupted from the cache"
+done
+
+# header_value FILE NAME: prints the value of a header saved by curl -D
+header_value()
+{
+    grep -i "^$2:" "$1" | head -n 1 | cut -d: -f2- | sed 's/^ *//' | tr -d '\r'
+}
+
+for name in Content-Type Content-Length Etag Last-Modified; do
+    [ "$(header_value "$WORK_DIR/headers.$REQUESTS" $name)" = "$(header_value "$WORK_DIR/headers.1" $name)" ] || fail "the cached response's $name differs from the operation's"
+done
+
+etag=$(header_value "$WORK_DIR/headers.1" Etag)
+[ -n "$etag" ] || fail "small.txt was sent without an entity tag"
+
+"${CURL[@]}" -I -o "$WORK_DIR/headers.head" "$URL" || fail "unable to fetch the headers of small.txt from the cache"
+[ "$(header_value "$WORK_DIR/headers.head" Content-Length)" = 4096 ] || fail "the cached HEAD response has the wrong Content-Length"
+
+status=$(curl -s -o "$WORK_DIR/fetched" -w '%{http_code}' -H 'Connection: close' -H "If-None-Match: $etag" "$URL")
+[ "$status" = 304 ] || fail "a conditional request for the cached file was answered with $status"
+[ ! -s "$WORK_DIR/fetched" ] || fail "the cached 304 response carried a body"
+
+# a changed file doesn't match its cache entry, so it's served afresh
+make_file "$WORK_DIR/root/small.txt" 2048
+"${CURL[@]}" -o "$WORK_DIR/fetched" "$URL" || fail "unable to fetch small.txt after it changed"
+cmp -s "$WORK_DIR/fetched" "$WORK_DIR/root/small.txt" || fail "small.txt was served from a stale cache entry after it changed"
+
+write_traces
+trace_spans "$TRACE_FILE" >"$WORK_DIR/spans" || fail "the traces are not a valid Trace Event document"
+
+# served_by_operation REQUEST: succeeds if a response operation answered the request
+served_by_operation()
+{
+    grep -qx "$1 response" "$WORK_DIR/spans"
+}
+
+served_by_operation 1 || fail "the first request was not answered by an operation"
+for i in $(seq 2 $((REQUESTS + 2))); do
+    grep -qx "$i write" "$WORK_DIR/spans" || fail "request $i was not traced"
+    ! served_by_operation "$i" || fail "request $i was not answered from the cache"
+done
+served_by_operation $((REQUESTS + 3)) || fail "the request after small.txt changed was answered from the cache"
+
+echo "PASS"
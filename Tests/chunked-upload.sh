@@ -0,0 +1,107 @@
+#!/bin/bash
+#
+# Uploads chunked request bodies which the client holds back part-way, and
+# checks that the server keeps serving other clients meanwhile, decodes the
+# chunks (with extensions and trailers) well enough to find the pipelined
+# request which follows the body, and doesn't ask for a body which the
+# response doesn't need when the client waits with `Expect: 100-continue`.
+#
+# Tunables: HOLD (seconds for which the rest of the body is held back; keep it
+# below the server's two-second idle timeout).
+
+source "$(dirname "$0")/common.sh"
+require curl python3 lsof
+
+HOLD=${HOLD:-1.5}
+
+make_file "$WORK_DIR/root/small.txt" 512
+printf 'upload target\n' >"$WORK_DIR/root/upload.txt"
+
+start_server --address localhost --webroot "$WORK_DIR/root"
+
+# client.py PORT MODE: speaks HTTP/1.1 on a raw socket; MODE is 'pipelined' or 'expect'
+cat >"$WORK_DIR/client.py" <<'EOF'
+import socket, sys, time
+
+port, mode, held, hold, expected = int(sys.argv[1]), sys.argv[2], sys.argv[3], float(sys.argv[4]), sys.argv[5]
+sock = socket.create_connection(("127.0.0.1", port))
+sock.settimeout(10)
+
+def read_response(buf):
+    # returns (status, body, rest of buf), reading more as needed; None at the end of the stream
+    while b"\r\n\r\n" not in buf:
+        data = sock.recv(65536)
+        if not data:
+            return None
+        buf += data
+    head, buf = buf.split(b"\r\n\r\n", 1)
+    lines = head.decode("latin-1").split("\r\n")
+    status = int(lines[0].split()[1])
+    headers = dict((k.strip().lower(), v.strip()) for k, v in (l.split(":", 1) for l in lines[1:]))
+    length = int(headers.get("content-length", "0"))
+    while len(buf) < length:
+        data = sock.recv(65536)
+        if not data:
+            break
+        buf += data
+    return status, buf[:length], buf[length:]
+
+expect = "Expect: 100-continue\r\n" if mode == "expect" else ""
+sock.sendall(("POST /upload.txt HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n%s\r\n" % expect).encode())
+if mode == "pipelined":
+    sock.sendall(b"5;name=value\r\nhello\r\n")
+open(held, "w").close()
+
+if mode == "expect":
+    # the response needs nothing from the body, so none is asked for, and the connection is closed after it
+    response = read_response(b"")
+    if response is None:
+        sys.exit("no response while the body was held back")
+    status, body, rest = response
+    if status == 100:
+        sys.exit("the server asked for a body it doesn't read")
+    if status != 200:
+        sys.exit("the upload was answered with %d" % status)
+    if rest or sock.recv(65536):
+        sys.exit("the connection stayed open after a response which left the body unsent")
+    sys.exit(0)
+
+time.sleep(hold)
+sock.sendall(b"400\r\n" + b"x" * 1024 + b"\r\n0\r\nX-Checksum: none\r\n\r\n")
+sock.sendall(b"GET /small.txt HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+
+buf = b""
+statuses = []
+bodies = []
+while True:
+    response = read_response(buf)
+    if response is None:
+        break
+    status, body, buf = response
+    statuses.append(status)
+    bodies.append(body)
+
+if statuses != [200, 200]:
+    sys.exit("expected two 200 responses, got %r" % statuses)
+if bodies[1] != open(expected, "rb").read():
+    sys.exit("the request after the chunked body was answered with the wrong content")
+EOF
+
+python3 "$WORK_DIR/client.py" "$SERVER_PORT" pipelined "$WORK_DIR/held" "$HOLD" "$WORK_DIR/root/small.txt" &
+client=$!
+
+for i in $(seq 50); do
+    [ -e "$WORK_DIR/held" ] && break
+    sleep 0.1
+done
+[ -e "$WORK_DIR/held" ] || fail "the client did not start its upload"
+
+# the upload in progress shouldn't hold anyone else up
+curl -sS --fail --max-time 1 -o /dev/null "http://127.0.0.1:$SERVER_PORT/small.txt" || fail "another client was not served while an upload was held back"
+
+wait "$client" || fail "the pipelined request after a held-back chunked body was not answered correctly"
+
+rm -f "$WORK_DIR/held"
+python3 "$WORK_DIR/client.py" "$SERVER_PORT" expect "$WORK_DIR/held" 0 "$WORK_DIR/root/small.txt" || fail "an upload waiting for 100 Continue was not answered correctly"
+
+echo "PASS"
@@ -0,0 +1,132 @@
+# Helpers shared by the scripts in Tests and Benchmarks. Source this file from
+# a bash script; it runs the SimpleHTTPServer executable named by $SERVER,
+# which defaults to the one `xcodebuild -configuration Release` leaves in
+# build/Release. Scratch files go in $WORK_DIR, which is removed on exit along
+# with any server the script started.
+
+set -euo pipefail
+
+ROOT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)
+SERVER=${SERVER:-"$ROOT_DIR/build/Release/SimpleHTTPServer"}
+WORK_DIR=$(mktemp -d "${TMPDIR:-/tmp}/SimpleHTTPServer-test.XXXXXX")
+SERVER_PID=
+SERVER_PORT=
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# exit status 77 marks a skipped test, as with automake
+skip()
+{
+    echo "SKIP: $*" >&2
+    exit 77
+}
+
+require()
+{
+    local tool
+    for tool in "$@"; do
+        command -v "$tool" >/dev/null 2>&1 || skip "$tool is not installed"
+    done
+}
+
+# listening_port PID: prints the IPv4 port on which the process is listening, if any
+listening_port()
+{
+    lsof -nP -a -p "$1" -i4TCP -sTCP:LISTEN -Fn 2>/dev/null | sed -n 's/^n.*:\([0-9][0-9]*\)$/\1/p' | head -n 1
+}
+
+# wait_for_listener PID: waits for the process to listen, and sets SERVER_PORT
+wait_for_listener()
+{
+    local i
+    for i in $(seq 100); do
+        kill -0 "$1" 2>/dev/null || fail "server exited early: $(cat "$WORK_DIR/server.log")"
+        SERVER_PORT=$(listening_port "$1")
+        if [ -n "$SERVER_PORT" ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "server did not start listening"
+}
+
+# start_server ARGS...: starts the server in the background, and waits until
+# it's listening; its output goes to $WORK_DIR/server.log
+start_server()
+{
+    [ -x "$SERVER" ] || fail "no server executable at $SERVER; build it, or set SERVER"
+    "$SERVER" "$@" >>"$WORK_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    wait_for_listener "$SERVER_PID"
+}
+
+stop_server()
+{
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+
+# make_file PATH BYTES: creates a file of the given size
+make_file()
+{
+    mkdir -p "$(dirname "$1")"
+    head -c "$2" /dev/zero >"$1"
+}
+
+# percentile P: prints the Pth percentile of the numbers on standard input
+percentile()
+{
+    sort -n | awk -v p="$1" '{ v[NR] = $1 } END { if ( NR == 0 ) exit 1; i = int((NR * p + 99) / 100); if ( i < 1 ) i = 1; print v[i] }'
+}
+
+# write_traces: has the server, started with --trace, write out its request
+# traces, and sets TRACE_FILE to the copy of them kept in $WORK_DIR
+write_traces()
+{
+    local before i path
+    before=$(grep -c 'Wrote request traces to ' "$WORK_DIR/server.log" || true)
+    kill -USR1 "$SERVER_PID"
+    for i in $(seq 50); do
+        if [ "$(grep -c 'Wrote request traces to ' "$WORK_DIR/server.log" || true)" -gt "$before" ]; then
+            path=$(grep 'Wrote request traces to ' "$WORK_DIR/server.log" | tail -n 1 | sed 's/.*Wrote request traces to //')
+            TRACE_FILE="$WORK_DIR/trace-$before.json"
+            mv "$path" "$TRACE_FILE" || fail "no traces at $path"
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "the server did not write its traces: $(tail -n 5 "$WORK_DIR/server.log")"
+}
+
+# trace_spans FILE: checks that FILE is a well-formed Trace Event document, and
+# prints each span in it as "REQUEST NAME"
+trace_spans()
+{
+    python3 - "$1" <<'EOF'
+import json, sys
+
+events = json.load(open(sys.argv[1]))["traceEvents"]
+if not any(e["ph"] == "M" and e["name"] == "process_name" for e in events):
+    sys.exit("the traces don't name their process")
+for e in events:
+    if e["ph"] != "X":
+        continue
+    if not isinstance(e["ts"], (int, float)) or not isinstance(e["dur"], (int, float)) or e["dur"] < 0:
+        sys.exit("malformed span: %r" % e)
+    print("%d %s" % (e["args"]["request"], e["name"]))
+EOF
+}
+
+cleanup()
+{
+    stop_server
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
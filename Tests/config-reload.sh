@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Serves a --webroot which is a symbolic link, points it at new content and
+# sends SIGHUP, and checks that a download already in progress finishes
+# intact from the old content; that a keep-alive connection opened before the
+# reload is answered from the new content on its next request; and that new
+# connections see only the new content.
+#
+# Tunables: RATE (curl's --limit-rate for the download in progress).
+
+source "$(dirname "$0")/common.sh"
+require curl cmp python3 lsof
+
+RATE=${RATE:-2M}
+
+mkdir -p "$WORK_DIR/release1" "$WORK_DIR/release2"
+printf 'release one\n' >"$WORK_DIR/release1/index.html"
+printf 'the second release\n' >"$WORK_DIR/release2/index.html"
+head -c $((8 * 1024 * 1024)) /dev/urandom >"$WORK_DIR/release1/large.bin"
+ln -s release1 "$WORK_DIR/site"
+
+start_server --address localhost --webroot "$WORK_DIR/site"
+BASE="http://127.0.0.1:$SERVER_PORT"
+
+# client.py PORT PID SITE LOG: fetches index.html on a keep-alive connection
+# either side of repointing SITE and sending PID a SIGHUP
+cat >"$WORK_DIR/client.py" <<'EOF'
+import os, signal, socket, sys, time
+
+port, pid, site, log = int(sys.argv[1]), int(sys.argv[2]), sys.argv[3], sys.argv[4]
+sock = socket.create_connection(("127.0.0.1", port))
+sock.settimeout(10)
+buf = b""
+
+def get(path):
+    # returns (status, body) of a request on the keep-alive connection
+    global buf
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" % path).encode())
+    while b"\r\n\r\n" not in buf:
+        data = sock.recv(65536)
+        if not data:
+            sys.exit("the connection was closed before a response to %s" % path)
+        buf += data
+    head, buf = buf.split(b"\r\n\r\n", 1)
+    lines = head.decode("latin-1").split("\r\n")
+    headers = dict((k.strip().lower(), v.strip()) for k, v in (l.split(":", 1) for l in lines[1:]))
+    length = int(headers.get("content-length", "0"))
+    while len(buf) < length:
+        data = sock.recv(65536)
+        if not data:
+            sys.exit("the connection was closed part-way through a response to %s" % path)
+        buf += data
+    body, buf = buf[:length], buf[length:]
+    return int(lines[0].split()[1]), body
+
+status, body = get("/index.html")
+if (status, body) != (200, b"release one\n"):
+    sys.exit("before the reload, index.html was answered with %d %r" % (status, body))
+
+# swap the link atomically, as a deployment would
+os.symlink("release2", site + ".new")
+os.rename(site + ".new", site)
+
+reloads = open(log).read().count("Reopened the document root")
+os.kill(pid, signal.SIGHUP)
+deadline = time.time() + 1
+while open(log).read().count("Reopened the document root") == reloads:
+    if time.time() > deadline:
+        sys.exit("the server did not reopen its document root")
+    time.sleep(0.05)
+
+# well within the idle timeout, so this is still the same connection
+status, body = get("/index.html")
+if (status, body) != (200, b"the second release\n"):
+    sys.exit("after the reload, the open connection was answered with %d %r" % (status, body))
+EOF
+
+curl -sS --fail --limit-rate "$RATE" -o "$WORK_DIR/large.bin" "$BASE/large.bin" &
+download=$!
+
+for i in $(seq 50); do
+    [ -s "$WORK_DIR/large.bin" ] && break
+    sleep 0.1
+done
+[ -s "$WORK_DIR/large.bin" ] || fail "the download did not start"
+
+python3 "$WORK_DIR/client.py" "$SERVER_PORT" "$SERVER_PID" "$WORK_DIR/site" "$WORK_DIR/server.log" || fail "the open connection did not switch to the new content"
+
+kill -0 "$download" 2>/dev/null || fail "the download finished before the reload; lower RATE"
+
+curl -sS --fail -o "$WORK_DIR/index.html" "$BASE/index.html" || fail "unable to fetch index.html after the reload"
+cmp -s "$WORK_DIR/index.html" "$WORK_DIR/release2/index.html" || fail "a new connection was answered from the old content"
+
+status=$(curl -s -o /dev/null -w '%{http_code}' "$BASE/large.bin")
+[ "$status" = 404 ] || fail "a file only in the old content was answered with $status after the reload"
+
+wait "$download" || fail "the download in progress failed across the reload"
+cmp -s "$WORK_DIR/large.bin" "$WORK_DIR/release1/large.bin" || fail "the download in progress arrived corrupted across the reload"
+
+echo "PASS"
@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Packs a folder into a content bundle with SimpleHTTPBundleBuilder, serves
+# it with --bundle, and checks that its items arrive intact over HTTP/2 (both
+# by upgrade and by prior knowledge) and HTTP/1.1, that a client accepting
+# gzip is sent the stored compressed variant of a textual item, and that
+# ranges and missing items are answered as they would be from a folder.
+
+source "$(dirname "$0")/common.sh"
+require curl cmp gzip lsof
+
+BUILDER=${BUILDER:-"$ROOT_DIR/build/Release/SimpleHTTPBundleBuilder"}
+[ -x "$BUILDER" ] || fail "no bundle builder at $BUILDER; build it, or set BUILDER"
+
+mkdir -p "$WORK_DIR/root/css"
+for i in $(seq 200); do
+    echo "body { margin: ${i}px; }"
+done >"$WORK_DIR/root/css/site.css"
+head -c $((1024 * 1024 + 123)) /dev/urandom >"$WORK_DIR/root/image.bin"
+
+"$BUILDER" -o "$WORK_DIR/site.bundle" "$WORK_DIR/root" >/dev/null || fail "unable to build the bundle"
+
+start_server --address localhost --bundle "$WORK_DIR/site.bundle"
+BASE="http://127.0.0.1:$SERVER_PORT"
+
+for file in css/site.css image.bin; do
+    for protocol in --http2 --http2-prior-knowledge --http1.1; do
+        version=$(curl -sS --fail -o "$WORK_DIR/fetched" -w '%{http_version}' "$protocol" "$BASE/$file") || fail "unable to fetch $file with $protocol"
+        cmp -s "$WORK_DIR/fetched" "$WORK_DIR/root/$file" || fail "$file arrived corrupted with $protocol"
+        if [ "$protocol" = --http1.1 ]; then
+            [ "$version" = 1.1 ] || fail "$file was fetched with HTTP/$version where HTTP/1.1 was asked for"
+        else
+            [ "$version" = 2 ] || fail "$file was fetched with HTTP/$version where $protocol was asked for"
+        fi
+    done
+done
+
+# curl decodes what it asked to be compressed, so the headers show whether it was
+curl -sS --fail --http2 --compressed -D "$WORK_DIR/headers" -o "$WORK_DIR/fetched" "$BASE/css/site.css" || fail "unable to fetch the compressed variant"
+grep -qi '^content-encoding: *gzip' "$WORK_DIR/headers" || fail "the compressed variant was not sent to a client accepting gzip"
+cmp -s "$WORK_DIR/fetched" "$WORK_DIR/root/css/site.css" || fail "the compressed variant did not decompress to the original"
+
+curl -sS --fail --http2 -r 1000-1999 -o "$WORK_DIR/fetched" "$BASE/image.bin" || fail "unable to fetch a range"
+cmp -s "$WORK_DIR/fetched" <(tail -c +1001 "$WORK_DIR/root/image.bin" | head -c 1000) || fail "the range arrived corrupted"
+
+status=$(curl -s -o /dev/null -w '%{http_code}' --http2 "$BASE/missing.txt")
+[ "$status" = 404 ] || fail "a missing item was answered with $status"
+
+echo "PASS"
@@ -0,0 +1,95 @@
+#!/bin/bash
+#
+# Runs the server with --workers, and checks that every worker listens on the
+# shared socket and requests are served; that a worker which is killed is
+# replaced while the others carry on serving; and that the supervisor's
+# statistics add up what its workers, past and present, have handled.
+#
+# Tunables: WORKERS, REQUESTS.
+
+source "$(dirname "$0")/common.sh"
+require curl lsof pgrep
+
+WORKERS=${WORKERS:-3}
+REQUESTS=${REQUESTS:-50}
+
+make_file "$WORK_DIR/root/index.html" 2048
+
+start_server --address localhost --webroot "$WORK_DIR/root" --workers "$WORKERS"
+URL="http://127.0.0.1:$SERVER_PORT/index.html"
+
+worker_pids()
+{
+    pgrep -P "$SERVER_PID" 2>/dev/null || true
+}
+
+# a worker outlives a supervisor killed outright, so they're stopped explicitly should we fail
+trap 'kill $(worker_pids) 2>/dev/null; cleanup' EXIT
+
+# wait_for_workers: waits until all the workers are running and listening
+wait_for_workers()
+{
+    local i listening
+    for i in $(seq 100); do
+        listening=0
+        for pid in $(worker_pids); do
+            [ -n "$(listening_port "$pid")" ] && listening=$((listening + 1))
+        done
+        [ "$listening" -eq "$WORKERS" ] && return 0
+        sleep 0.1
+    done
+    fail "$listening of $WORKERS workers are listening"
+}
+
+# requests N: makes N requests, each on a new connection, and fails unless they all succeed
+requests()
+{
+    curl -s -o /dev/null -w '%{http_code}\n' -H 'Connection: close' "$URL?[1-$1]" >"$WORK_DIR/requests.out" || true
+    [ "$(grep -c '^200$' "$WORK_DIR/requests.out" || true)" -eq "$1" ] || fail "requests failed: $(sort "$WORK_DIR/requests.out" | uniq -c | tr '\n' ' ')"
+}
+
+# requests_handled: has the supervisor log its statistics, and sets HANDLED to the number of requests
+requests_handled()
+{
+    local before i
+    before=$(grep -c 'requests handled' "$WORK_DIR/server.log" || true)
+    kill -INFO "$SERVER_PID"
+    for i in $(seq 50); do
+        if [ "$(grep -c 'requests handled' "$WORK_DIR/server.log" || true)" -gt "$before" ]; then
+            HANDLED=$(grep 'requests handled' "$WORK_DIR/server.log" | tail -n 1 | sed 's/.* \([0-9][0-9]*\) requests handled.*/\1/')
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "the supervisor did not log its statistics"
+}
+
+wait_for_workers
+requests "$REQUESTS"
+
+victim=$(worker_pids | head -n 1)
+kill -KILL "$victim"
+
+# the survivors keep serving while the supervisor replaces the one we killed
+requests "$REQUESTS"
+
+for i in $(seq 100); do
+    pids=$(worker_pids)
+    if [ "$(echo "$pids" | grep -c .)" -eq "$WORKERS" ] && ! echo "$pids" | grep -qx "$victim"; then
+        break
+    fi
+    [ "$i" -lt 100 ] || fail "worker $victim was not replaced"
+    sleep 0.1
+done
+wait_for_workers
+grep -q "Worker $victim was terminated by signal 9" "$WORK_DIR/server.log" || fail "the supervisor did not notice worker $victim being killed"
+
+requests "$REQUESTS"
+
+# workers report every second; those requests served by the killed worker before its last report still count
+sleep 2
+requests_handled
+echo "$HANDLED requests handled across $WORKERS workers and one replacement"
+[ "$HANDLED" -ge "$REQUESTS" ] || fail "the supervisor counted only $HANDLED requests"
+
+echo "PASS"
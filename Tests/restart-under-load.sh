@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+# Restarts the server gracefully several times while clients keep requesting
+# from it, and checks that not a single request fails: each new process must
+# take over the listening socket without refusing connections, and each old
+# one must finish the requests it has already accepted, including a slow
+# download which spans the restarts, before exiting.
+#
+# Tunables: DURATION (seconds of load), CLIENTS, RESTARTS.
+
+source "$(dirname "$0")/common.sh"
+require curl cmp lsof
+
+DURATION=${DURATION:-12}
+CLIENTS=${CLIENTS:-8}
+RESTARTS=${RESTARTS:-3}
+
+make_file "$WORK_DIR/root/index.html" 2048
+head -c $((4 * 1024 * 1024)) /dev/urandom >"$WORK_DIR/root/large.bin"
+
+start_server --address localhost --webroot "$WORK_DIR/root" --drain-timeout 30
+URL="http://127.0.0.1:$SERVER_PORT"
+
+# the processes listening on the port; there are two while one hands off to the next
+listener_pids()
+{
+    lsof -t -nP -i4TCP:"$SERVER_PORT" -sTCP:LISTEN 2>/dev/null || true
+}
+
+# replacements aren't our children, so they have to be found through the port
+trap 'kill $(listener_pids) 2>/dev/null; cleanup' EXIT
+
+# each client makes a fresh connection for every few requests, so connections are always being opened
+load()
+{
+    local end=$((SECONDS + DURATION))
+    while [ $SECONDS -lt $end ]; do
+        curl -s -o /dev/null -o /dev/null -o /dev/null -w '%{http_code}\n' "$URL/index.html" "$URL/index.html" "$URL/index.html" || true
+    done >"$1"
+}
+
+loaders=()
+for i in $(seq "$CLIENTS"); do
+    load "$WORK_DIR/load.$i" &
+    loaders+=($!)
+done
+
+curl -s --fail --limit-rate 256K -o "$WORK_DIR/large.bin" "$URL/large.bin" &
+download=$!
+
+old_pids=()
+for i in $(seq "$RESTARTS"); do
+    sleep $((DURATION / (RESTARTS + 1)))
+    pid=$(listener_pids)
+    old_pids+=("$pid")
+    kill -USR2 "$pid"
+
+    for attempt in $(seq 100); do
+        pids=$(listener_pids)
+        if [ -n "$pids" ] && [ "$pids" != "$pid" ] && [ "$(echo "$pids" | wc -l)" -eq 1 ]; then
+            break
+        fi
+        [ "$attempt" -lt 100 ] || fail "restart $i: no new process took over from $pid"
+        sleep 0.1
+    done
+done
+
+wait "${loaders[@]}"
+wait "$download" || fail "the download in progress across the restarts failed"
+cmp -s "$WORK_DIR/large.bin" "$WORK_DIR/root/large.bin" || fail "the download in progress across the restarts was corrupted"
+
+total=$(cat "$WORK_DIR"/load.* | wc -l | tr -d " ")
+failed=$(cat "$WORK_DIR"/load.* | grep -vc '^200$' || true)
+echo "$total requests, $failed failed, across $RESTARTS restarts"
+[ "$total" -gt 0 ] || fail "no requests were made"
+[ "$failed" -eq 0 ] || fail "$failed requests failed: $(cat "$WORK_DIR"/load.* | grep -v '^200$' | sort | uniq -c | tr '\n' ' ')"
+
+# with nothing left to drain, the old processes should be gone (or at least be zombies awaiting us)
+running()
+{
+    local state
+    state=$(ps -o stat= -p "$1" 2>/dev/null | tr -d " " || true)
+    [ -n "$state" ] && [ "${state#Z}" = "$state" ]
+}
+
+for pid in "${old_pids[@]}"; do
+    for attempt in $(seq 50); do
+        running "$pid" || break
+        [ "$attempt" -lt 50 ] || fail "process $pid is still running after handing off"
+        sleep 0.1
+    done
+done
+
+echo "PASS"
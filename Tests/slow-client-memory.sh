@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# Has several clients download a file slowly, while sampling the server's
+# resident memory. Since responses wait for each socket's queued output to
+# drain below its low water mark, the files stay on disk rather than piling
+# up in memory: peak RSS should grow by about as little for a large file as
+# for a small one, and by far less than the clients are downloading.
+#
+# Tunables: CLIENTS, RATE (each client's download rate), SECONDS_PER_SIZE.
+
+source "$(dirname "$0")/common.sh"
+require curl lsof
+
+CLIENTS=${CLIENTS:-8}
+RATE=${RATE:-64K}
+SECONDS_PER_SIZE=${SECONDS_PER_SIZE:-10}
+SMALL_MB=32
+LARGE_MB=512
+# allowance for buffers, queues and the allocator's slack
+TOLERANCE_KB=$((16 * 1024))
+
+make_file "$WORK_DIR/root/small.bin" $((SMALL_MB * 1024 * 1024))
+make_file "$WORK_DIR/root/large.bin" $((LARGE_MB * 1024 * 1024))
+
+rss_kb()
+{
+    ps -o rss= -p "$1" | tr -d ' '
+}
+
+# peak_growth FILE: sets GROWTH to how far the server's RSS rises above its idle level while the file is downloaded slowly
+peak_growth()
+{
+    start_server --address localhost --webroot "$WORK_DIR/root"
+    local url="http://127.0.0.1:$SERVER_PORT/$1"
+
+    # one request first, so the growth measured is that of the downloads and not of the server's first use
+    curl -s --fail -o /dev/null -r 0-0 "$url" || fail "unable to fetch $1"
+    sleep 1
+    local baseline peak rss
+    baseline=$(rss_kb "$SERVER_PID")
+    peak=$baseline
+
+    local clients=()
+    for i in $(seq "$CLIENTS"); do
+        curl -s -o /dev/null --limit-rate "$RATE" --max-time "$SECONDS_PER_SIZE" "$url" &
+        clients+=($!)
+    done
+
+    local end=$((SECONDS + SECONDS_PER_SIZE))
+    while [ $SECONDS -lt $end ]; do
+        rss=$(rss_kb "$SERVER_PID")
+        [ "$rss" -gt "$peak" ] && peak=$rss
+        sleep 0.2
+    done
+
+    wait "${clients[@]}" || true
+    stop_server
+    GROWTH=$((peak - baseline))
+}
+
+peak_growth small.bin
+small=$GROWTH
+peak_growth large.bin
+large=$GROWTH
+echo "peak RSS growth with $CLIENTS slow clients: ${small}KB for ${SMALL_MB}MB, ${large}KB for ${LARGE_MB}MB"
+
+[ "$large" -le $((small + TOLERANCE_KB)) ] || fail "peak RSS grew with the file size"
+[ "$large" -le $((TOLERANCE_KB * 2)) ] || fail "peak RSS grew by ${large}KB serving slow clients"
+
+echo "PASS"
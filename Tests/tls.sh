@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Serves HTTPS with a freshly generated self-signed certificate, and checks
+# that clients which trust it can fetch files intact over TLS 1.2 or later,
+# that ALPN selects HTTP/2 or HTTP/1.1 as the client asks, that a returning
+# client resumes its session, and that TLS 1.1 and plain HTTP are refused.
+# The large file is sent in many records, so it exercises writes which would
+# block.
+
+source "$(dirname "$0")/common.sh"
+require openssl curl cmp lsof
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout "$WORK_DIR/key.pem" -out "$WORK_DIR/cert.pem" 2>/dev/null
+# SecPKCS12Import only understands the older PKCS#12 encryption algorithms
+openssl pkcs12 -export -inkey "$WORK_DIR/key.pem" -in "$WORK_DIR/cert.pem" \
+    -certpbe PBE-SHA1-3DES -keypbe PBE-SHA1-3DES -macalg sha1 \
+    -passout pass:secret -out "$WORK_DIR/identity.p12"
+
+make_file "$WORK_DIR/root/small.txt" 512
+head -c $((8 * 1024 * 1024)) /dev/urandom >"$WORK_DIR/root/large.bin"
+
+start_server --address localhost --webroot "$WORK_DIR/root" --certificate "$WORK_DIR/identity.p12" --passphrase secret
+BASE="https://127.0.0.1:$SERVER_PORT"
+CURL=(curl -sS --fail --cacert "$WORK_DIR/cert.pem")
+
+for file in small.txt large.bin; do
+    "${CURL[@]}" --tlsv1.2 -o "$WORK_DIR/$file" "$BASE/$file" || fail "unable to fetch $file over TLS"
+    cmp -s "$WORK_DIR/$file" "$WORK_DIR/root/$file" || fail "$file arrived corrupted"
+done
+
+version=$("${CURL[@]}" -o /dev/null -w '%{http_version}' --http2 "$BASE/small.txt")
+[ "$version" = 2 ] || fail "ALPN negotiated HTTP/$version where HTTP/2 was offered"
+version=$("${CURL[@]}" -o /dev/null -w '%{http_version}' --http1.1 "$BASE/small.txt")
+[ "$version" = 1.1 ] || fail "ALPN negotiated HTTP/$version where only HTTP/1.1 was offered"
+
+# a TLS 1.2 session saved from one connection should be resumed by the next
+openssl s_client -connect "127.0.0.1:$SERVER_PORT" -tls1_2 -CAfile "$WORK_DIR/cert.pem" \
+    -sess_out "$WORK_DIR/session.pem" </dev/null >"$WORK_DIR/s_client.out" 2>&1 || fail "unable to connect with openssl s_client"
+openssl s_client -connect "127.0.0.1:$SERVER_PORT" -tls1_2 -CAfile "$WORK_DIR/cert.pem" \
+    -sess_in "$WORK_DIR/session.pem" </dev/null >"$WORK_DIR/s_client.out" 2>&1 || fail "unable to reconnect with openssl s_client"
+grep -q "^Reused" "$WORK_DIR/s_client.out" || fail "the TLS session was not resumed: $(grep -E '^(New|Reused)' "$WORK_DIR/s_client.out")"
+
+if "${CURL[@]}" -o /dev/null --tlsv1.1 --tls-max 1.1 "$BASE/small.txt" 2>/dev/null; then
+    fail "a TLS 1.1 connection was accepted"
+fi
+if curl -sS --fail -o /dev/null --max-time 5 "http://127.0.0.1:$SERVER_PORT/small.txt" 2>/dev/null; then
+    fail "a plain HTTP request was answered on the TLS listener"
+fi
+
+echo "PASS"
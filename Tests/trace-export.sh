@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# Runs the server with --trace, and checks that SIGUSR1 has it write a Trace
+# Event document which parses as JSON; that exactly one request in every N is
+# traced; that each traced request has a span for every phase it went
+# through; and that spans already written are kept for the next export.
+#
+# Tunables: INTERVAL, REQUESTS (a multiple of INTERVAL).
+
+source "$(dirname "$0")/common.sh"
+require curl python3 lsof
+
+INTERVAL=${INTERVAL:-5}
+REQUESTS=${REQUESTS:-20}
+
+# too large for the file cache, so every request goes through a response operation
+make_file "$WORK_DIR/root/large.bin" $((256 * 1024))
+
+start_server --address localhost --webroot "$WORK_DIR/root" --trace "$INTERVAL"
+URL="http://127.0.0.1:$SERVER_PORT/large.bin"
+
+# requests N: makes N requests, each on a new connection so that each read carries one request
+requests()
+{
+    curl -s -o /dev/null -w '%{http_code}\n' -H 'Connection: close' "$URL?[1-$1]" >"$WORK_DIR/requests.out" || true
+    [ "$(grep -c '^200$' "$WORK_DIR/requests.out" || true)" -eq "$1" ] || fail "requests failed: $(sort "$WORK_DIR/requests.out" | uniq -c | tr '\n' ' ')"
+}
+
+# check_traced FIRST LAST: fails unless exactly the sampled requests up to LAST are traced, and those from FIRST on have a span for every phase
+check_traced()
+{
+    local expected traced request phase
+    expected=$(seq "$INTERVAL" "$INTERVAL" "$2" | tr '\n' ' ')
+    traced=$(cut -d' ' -f1 "$WORK_DIR/spans" | sort -nu | tr '\n' ' ')
+    [ "$traced" = "$expected" ] || fail "expected requests $expected to be traced, not $traced"
+    for request in $(seq "$1" "$INTERVAL" "$2"); do
+        for phase in read parse dispatch queue response 'build response' write; do
+            grep -qx "$request $phase" "$WORK_DIR/spans" || fail "request $request has no '$phase' span"
+        done
+    done
+}
+
+requests "$REQUESTS"
+write_traces
+trace_spans "$TRACE_FILE" >"$WORK_DIR/spans" || fail "the traces are not a valid Trace Event document"
+check_traced "$INTERVAL" "$REQUESTS"
+
+requests "$INTERVAL"
+write_traces
+trace_spans "$TRACE_FILE" >"$WORK_DIR/spans" || fail "the second export is not a valid Trace Event document"
+check_traced $((REQUESTS + INTERVAL)) $((REQUESTS + INTERVAL))
+
+echo "PASS"
@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+# Runs the server with --warmup-manifest and a worker, fetches some files,
+# and checks that stopping the server leaves a manifest listing them, most
+# requested first. Then starts the server again from that manifest, and
+# checks that a file it lists is answered from the file cache on its very
+# first request (the traces show no response operation), while a file it
+# doesn't list is not.
+#
+# Tunables: REQUESTS (for the hottest file; the next gets half as many).
+
+source "$(dirname "$0")/common.sh"
+require curl python3 lsof pgrep
+
+REQUESTS=${REQUESTS:-8}
+
+make_file "$WORK_DIR/root/hot.txt" 4096
+make_file "$WORK_DIR/root/warm.txt" 2048
+make_file "$WORK_DIR/root/cold.txt" 1024
+MANIFEST="$WORK_DIR/manifest.json"
+
+# only workers keep a manifest, and they write it as they stop
+start_server --address localhost --webroot "$WORK_DIR/root" --workers 1 --warmup-manifest "$MANIFEST"
+BASE="http://127.0.0.1:$SERVER_PORT"
+
+# a worker outlives a supervisor killed outright, so it's stopped explicitly should we fail
+trap '[ -z "$SERVER_PID" ] || kill $(pgrep -P "$SERVER_PID") 2>/dev/null; cleanup' EXIT
+
+# fetch FILE N: fetches the file N times, each on a new connection
+fetch()
+{
+    curl -s -o /dev/null -w '%{http_code}\n' -H 'Connection: close' "$BASE/$1?[1-$2]" >"$WORK_DIR/fetch.out" || true
+    [ "$(grep -c '^200$' "$WORK_DIR/fetch.out" || true)" -eq "$2" ] || fail "unable to fetch $1: $(sort "$WORK_DIR/fetch.out" | uniq -c | tr '\n' ' ')"
+}
+
+fetch hot.txt "$REQUESTS"
+fetch warm.txt $((REQUESTS / 2))
+
+stop_server
+[ -s "$MANIFEST" ] || fail "no warm-up manifest was written as the server stopped"
+
+python3 - "$MANIFEST" <<'EOF' || fail "the warm-up manifest does not list the files fetched, most requested first"
+import json, os, sys
+
+files = json.load(open(sys.argv[1]))["files"]
+paths = [f["path"] for f in files]
+names = [os.path.basename(p) for p in paths]
+if names[:2] != ["hot.txt", "warm.txt"] or "cold.txt" in names:
+    sys.exit("the manifest lists %r" % names)
+if not all(os.path.isabs(p) for p in paths):
+    sys.exit("the manifest lists relative paths: %r" % paths)
+EOF
+
+# every request is traced, so the Nth request the server sees has trace identifier N
+start_server --address localhost --webroot "$WORK_DIR/root" --warmup-manifest "$MANIFEST" --trace 1
+BASE="http://127.0.0.1:$SERVER_PORT"
+
+# the manifest's files are loaded in the background once the server is listening
+sleep 1
+fetch hot.txt 1
+fetch cold.txt 1
+
+write_traces
+trace_spans "$TRACE_FILE" >"$WORK_DIR/spans" || fail "the traces are not a valid Trace Event document"
+grep -qx '1 write' "$WORK_DIR/spans" || fail "the first request was not traced"
+! grep -qx '1 response' "$WORK_DIR/spans" || fail "a file listed in the warm-up manifest was not loaded before its first request"
+grep -qx '2 response' "$WORK_DIR/spans" || fail "a file missing from the warm-up manifest was answered from the cache on its first request"
+
+echo "PASS"